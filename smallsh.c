@@ -7,11 +7,15 @@
  * 					status - print the termination status of the last
  *							 foreground process
  *					exit - exits the terminal
+ *				It also supports shell variables, indexed arrays and
+ *				associative arrays (declare, unset, name=value).
  *				Besides these built in commands, the terminal will execute any
  *				other commands provided to it.
  ****************************************************************************/
+#define _GNU_SOURCE
 #include <signal.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -19,12 +23,600 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <linux/ioprio.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/random.h>
+#include <sys/timerfd.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 /*****************************************************************************
  * Typedefs/structs
  ****************************************************************************/
 typedef enum { false = 0, true = !false } bool;
 
+// strings up to this length are stored inline instead of on the heap
+#define SSO_CAPACITY 23
+
+/* indexed arrays are dense vectors, so a stray a[99999999999]=x would ask
+ * for terabytes; subscripts must be below this */
+#define MAX_ARRAY_SIZE (1L << 24)
+
+/* state of a ShellStr - STR_UNSET must stay 0 so zeroed memory is unset.
+ * STR_SLAB strings point into a buffer owned by the array holding them */
+typedef enum { STR_UNSET = 0, STR_INLINE, STR_HEAP, STR_SLAB } StrKind;
+
+// string with small-string optimization, used for variable values
+typedef struct
+{
+	unsigned int len;
+	unsigned char kind;
+	union
+	{
+		char inl[SSO_CAPACITY + 1];
+		char *ptr;
+	} data;
+} ShellStr;
+
+// indexed array - a contiguous vector, unset indices are STR_UNSET holes
+typedef struct
+{
+	ShellStr *elems;
+	size_t count; // one past the highest index in use
+	size_t cap;
+	size_t numSet;
+	char **slabs; // bulk loaded element storage, see mapfile
+	size_t numSlabs;
+} IndexedArray;
+
+// associative array entry
+typedef struct
+{
+	ShellStr key;
+	ShellStr value;
+} AssocSlot;
+
+/* associative array - open addressing hash map with one metadata byte per
+ * slot (empty, deleted, or a 7 bit tag of the key's hash) probed a group
+ * of 8 bytes at a time */
+typedef struct
+{
+	unsigned char *ctrl;
+	AssocSlot *slots;
+	size_t cap;
+	size_t size;
+	size_t growthLeft;
+} AssocArray;
+
+typedef enum { VAR_SCALAR, VAR_INDEXED, VAR_ASSOC } VarKind;
+
+typedef struct
+{
+	char *name;
+	VarKind kind;
+	ShellStr scalar;
+	IndexedArray indexed;
+	AssocArray assoc;
+} ShellVar;
+
+// builtins that run inside the shell process
+typedef int (*BuiltinFn)(char **args, int argCount);
+
+typedef struct
+{
+	const char *name;
+	BuiltinFn fn;
+} Builtin;
+
+// receives a block of whole lines, see readLineBlocks
+typedef void (*LineBlockFn)(void *ctx, const char *data, size_t len);
+
+/* called each time the wait and sleep builtins wake, to reap what they are
+ * waiting on; returns true once the wait is over */
+typedef bool (*WaitStepFn)(void *ctx);
+
+/* buffered reader for one seekable fd. The fd's offset is always left
+ * just past the data handed out; the buffer holds what follows it so the
+ * next read on the same unchanged file and offset needs no syscall to
+ * fetch data */
+typedef struct
+{
+	bool valid;
+	dev_t dev;
+	ino_t ino;
+	off_t size; // size and mtime when buf was filled, to notice writes
+	struct timespec mtime;
+	off_t pos; // file offset of buf[start]
+	char *buf;
+	size_t start;
+	size_t end;
+} FdReader;
+
+/* one piece of a compiled printf format: literal text, or a conversion
+ * with a ready made C format spec taking width and precision as * args */
+typedef struct
+{
+	char conv; // conversion character, 0 for literal text
+	char spec[16];
+	size_t textStart; // literal text, offset into the format's literals
+	size_t textLen;
+	bool widthArg; // width and precision come from the arguments
+	bool precArg;
+	int width; // fixed values, 0 and -1 when not given
+	int prec;
+} PrintfDirective;
+
+// a printf format compiled once and cached by the format string's hash
+typedef struct
+{
+	char *format;
+	char *literals;
+	PrintfDirective *dirs;
+	int numDirs;
+	bool usesArgs;
+} PrintfFormat;
+
+/* a stat or lstat result, plus access(2) checks on the same path, kept
+ * while consecutive test commands run so each file is stat'd once */
+typedef struct
+{
+	char *path;
+	bool follow; // stat rather than lstat
+	int err; // errno if the call failed, else 0
+	struct stat info;
+	int accessChecked; // R_OK/W_OK/X_OK bits already checked
+	int accessOk; // ...and the ones that passed
+} StatCacheEntry;
+
+/* a command execvp could not find, remembered with a stamp of $PATH and
+ * its directories' mtimes, which change as soon as the command could
+ * have been installed */
+typedef struct
+{
+	char *name;
+	uint64_t pathStamp;
+} MissingCommand;
+
+/* a $PATH directory, held open O_PATH so commands in it are found and
+ * exec'd relative to the fd rather than by walking its full path. fd is -1
+ * for relative entries, which follow the current directory, and for
+ * directories that don't exist (yet) */
+typedef struct
+{
+	char *path;
+	int fd;
+} PathDir;
+
+/* where a command was last found, reused while the file is still there and
+ * executable, and $PATH hasn't changed */
+typedef struct
+{
+	char *name;
+	int dirIndex;
+} CommandLocation;
+
+// what to exec: file relative to dirFd, and the full path for messages
+typedef struct
+{
+	int dirFd;
+	const char *file;
+	char path[PATH_MAX];
+} ExecTarget;
+
+/* how a background job is de-prioritized while the user is waiting on the
+ * shell: batch is SCHED_BATCH with the lowest best effort I/O priority,
+ * idle is SCHED_IDLE with idle I/O, nice is nice +10 with the lowest best
+ * effort I/O, and none leaves the job alone */
+typedef enum { POLICY_BATCH, POLICY_IDLE, POLICY_NICE, POLICY_NONE } JobPolicy;
+
+/* a background job, with what it was admitted with: the make jobserver
+ * token and host-wide slot it holds, returned when it is reaped. While it
+ * is demoted, its scheduling before that is kept to restore */
+typedef struct
+{
+	pid_t pid;
+	int token;
+	int slot; // -1 if none
+	JobPolicy policy;
+	bool stopped; // by the shell, under memory pressure
+	bool demoted;
+	int savedSched;
+	int savedNice;
+	int savedIoprio;
+} Job;
+
+// the most host-wide job slots, and shells waiting for one
+#define MAX_JOB_SLOTS 256
+
+/* one host-wide job slot. shell is the shell holding it (0 if free) and
+ * job the job in it (0 while it is being started); each is stored with its
+ * process start time so a reused pid isn't mistaken for it */
+typedef struct
+{
+	_Atomic pid_t shell;
+	_Atomic pid_t job;
+	_Atomic uint64_t shellStart;
+	_Atomic uint64_t jobStart;
+} JobSlot;
+
+/* the shared memory segment every opted in shell on the host maps. released
+ * is a futex that is bumped each time a slot is freed, for the shells listed
+ * in waiting to sleep on */
+typedef struct
+{
+	_Atomic uint32_t magic;
+	_Atomic uint32_t limit;
+	_Atomic uint32_t released;
+	_Atomic pid_t waiting[MAX_JOB_SLOTS];
+	JobSlot slots[MAX_JOB_SLOTS];
+} SlotTable;
+
+// a compiled [[ =~ ]] regex, cached by pattern
+typedef struct
+{
+	char *pattern;
+	regex_t regex;
+} RegexCacheEntry;
+
+// parse state for a test, [ or [[ expression
+typedef struct
+{
+	char **args;
+	int pos;
+	int end;
+	bool isDouble; // [[ ]] rather than test or [
+	bool error;
+} TestParser;
+
+/* the shell's stdin/stdout before an in-shell redirect, so commands run
+ * inside it (whose fds are reset to savedStdin/savedStdout) stay inside */
+typedef struct
+{
+	int prevSavedStdin; // -1 if stdin was not redirected
+	int prevSavedStdout;
+} RedirectFrame;
+
+// growable byte buffer used while expanding words
+typedef struct
+{
+	char *buf;
+	size_t len;
+	size_t cap;
+} StrBuf;
+
+// the fields a single word expands to
+typedef struct
+{
+	char **fields;
+	int count;
+	int cap;
+} FieldList;
+
+// one element of a compiled glob pattern
+typedef enum { GLOB_LITERAL, GLOB_ANY, GLOB_STAR, GLOB_CLASS } GlobTokenKind;
+
+typedef struct
+{
+	GlobTokenKind kind;
+	size_t start; // literal bytes, offset into the pattern's literals
+	size_t len;
+	unsigned char set[32]; // bracket class membership, one bit per byte
+} GlobToken;
+
+/* a glob pattern compiled once and cached, so matching works on length
+ * delimited substrings without copying them */
+typedef struct
+{
+	char *text;
+	char *literals;
+	GlobToken *tokens;
+	int numTokens;
+	size_t minLen; // bytes consumed by everything but the stars
+	bool hasStar;
+} GlobPattern;
+
+/* a parsed ${name<op>...} string operator. kind is one of # % / ^ , for
+ * stripping, substitution and case, ':' for substrings, or '-' '+' '='
+ * for the :- :+ := defaults */
+typedef struct
+{
+	char kind;
+	bool longest; // ## %% // ^^ ,,
+	char anchor; // '#' or '%' for /# and /%
+	GlobPattern *pat;
+	char *word; // replacement or default word, expanded
+	long offset;
+	long length;
+	bool hasLength;
+} StrOp;
+
+/* psort options: the key runs from field keyStart to the end of field
+ * keyEnd (1 based, 0 for the end of the line). Fields are separated by sep,
+ * or if it is 0 start at a run of blanks, which is part of the field */
+typedef struct
+{
+	int keyStart;
+	int keyEnd;
+	char sep;
+	bool numeric;
+	bool reverse;
+	bool unique;
+} SortOptions;
+
+/* a line being sorted. prefix holds the key's first 8 bytes, or its value
+ * for -n, encoded so that unsigned order is the sort order - most
+ * comparisons and the radix sort look no further */
+typedef struct
+{
+	uint64_t prefix;
+	const char *line;
+	uint32_t len; // without the newline
+	uint32_t keyStart;
+	uint32_t keyLen;
+} SortRecord;
+
+/* a sorted sequence psort merges: a slice of records in memory, or a run
+ * spilled to a temporary file and read back a line at a time. cur is the
+ * record at its head */
+typedef struct
+{
+	SortRecord cur;
+	bool done;
+	SortRecord *recs;
+	size_t pos;
+	size_t end;
+	FILE *file;
+	char *lineBuf;
+	size_t lineCap;
+} SortSource;
+
+// the records one psort thread sorts, and scratch space the same size
+typedef struct
+{
+	SortRecord *recs;
+	SortRecord *tmp;
+	size_t count;
+	const SortOptions *opts;
+} SortTask;
+
+// a distinct key counted by countby, interned in its table's slabs
+typedef struct
+{
+	const char *key;
+	size_t len;
+	uint64_t hash;
+	uint64_t count;
+} CountSlot;
+
+/* countby's keys and their counts - probed like an AssocArray, but nothing
+ * is ever deleted, so there are no tombstones. Keys are copied into large
+ * slabs that are freed all at once */
+typedef struct
+{
+	unsigned char *ctrl;
+	CountSlot *slots;
+	size_t cap;
+	size_t size;
+	char **slabs;
+	size_t numSlabs;
+	char *slabPos; // free space in the last slab
+	size_t slabLeft;
+} CountTable;
+
+// the lines one countby thread counts into a table of its own
+typedef struct
+{
+	CountTable table;
+	const char *data;
+	size_t len;
+	int field;
+	char delim;
+} CountTask;
+
+/* one step of a jget path: an object member, or an array element if key
+ * is NULL. key points into the path's text, still JSON escaped */
+typedef struct
+{
+	const char *key;
+	size_t keyLen;
+	long index;
+} JsonStep;
+
+typedef struct
+{
+	JsonStep *steps;
+	int numSteps;
+} JsonPath;
+
+/* the paths jget pulls out of each line, scratch space for unescaping, and
+ * where the lines come from, to report the ones that are not JSON */
+typedef struct
+{
+	JsonPath *paths;
+	int numPaths;
+	StrBuf scratch;
+	const char *command,
+			   *source;
+	long lineNum;
+	bool invalid;
+} JsonQuery;
+
+/* a cols -w filter: the field in column (0 based) compared with op
+ * against value, as numbers for the -eq style ops */
+typedef struct
+{
+	const char *columnName;
+	int column;
+	const char *op;
+	const char *value;
+	double number;
+} ColsFilter;
+
+/* the fields of one CSV record, as they appear in it (quotes and all), and
+ * whether the last one is a quoted field the input ended inside */
+typedef struct
+{
+	const char **starts;
+	size_t *lens;
+	int count;
+	int cap;
+	bool unterminated;
+} ColsFields;
+
+/* what cols does with each record: the columns to print (0 based, all
+ * of them if numColumns is 0) and the filters a record must pass */
+typedef struct
+{
+	char delim;
+	int *columns;
+	int numColumns;
+	ColsFilter *filters;
+	int numFilters;
+} ColsQuery;
+
+// a chunk of records one cols thread processes, and what it prints
+typedef struct
+{
+	const ColsQuery *query;
+	const char *data;
+	size_t len;
+	StrBuf out;
+	bool unterminated;
+} ColsTask;
+
+// computes a checksum of a whole input into digest
+typedef void (*HashFn)(const unsigned char *data, size_t len, unsigned char *digest);
+
+// a checksum the hash builtins compute, and the builtin named after it
+typedef struct
+{
+	const char *name;
+	const char *command;
+	HashFn fn;
+	size_t digestLen;
+} HashAlgo;
+
+// one input hashed by the hash builtins, and its result
+typedef struct
+{
+	const char *path; // "-" for stdin
+	const HashAlgo *algo;
+	unsigned char digest[32];
+	int err; // errno if it could not be read
+} HashJob;
+
+// the inputs a pool of hash threads works through, taking the next in turn
+typedef struct
+{
+	HashJob *jobs;
+	int numJobs;
+	_Atomic int next;
+} HashPool;
+
+/* a >z or <z redirect: a thread in the shell gzipping between one end of a
+ * pipe and the file, while the command has the other end */
+typedef struct CodecStream
+{
+	pthread_t thread;
+	bool compress; // >z, the command writes and the file gets gzip
+	int fileFd,
+		pipeFd, // the thread's end of the pipe, closed when it finishes
+		cmdFd; // the command's end, until it has been handed over
+	char *path;
+	pid_t job; // the background job it belongs to, if any
+	int err; // errno, or EBADMSG if a <z file is not gzip
+	_Atomic int done;
+	struct CodecStream *next; // the next stream of a background job
+} CodecStream;
+
+// one block of a >z stream, deflated on a thread of its own
+typedef struct
+{
+	const unsigned char *in,
+						*dict; // the 32K before it, so the split costs little ratio
+	size_t inLen,
+		   dictLen;
+	unsigned char *out;
+	size_t outLen,
+		   outCap;
+	unsigned long crc;
+	bool ok;
+} CodecBlock;
+
+struct TeeRing;
+
+// a destination of the tee builtin
+typedef struct
+{
+	int fd;
+	const char *name;
+	bool copy, // can't be spliced to, so it is written from the ring
+		 threaded, // has a thread of its own working through the ring
+		 failed;
+	pthread_t thread;
+	uint64_t tail; // chunks of the ring it has written
+	struct TeeRing *ring;
+} TeeSink;
+
+/* chunks of input kept for the sinks tee can't splice to. A slot is only
+ * refilled once the slowest of them has written it, so the input is held
+ * back to the pace of the slowest sink */
+typedef struct TeeRing
+{
+	unsigned char *buf;
+	size_t slotSize,
+		   *lens;
+	uint64_t head; // chunks put in so far
+	bool done;
+	TeeSink *sinks;
+	int numSinks;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} TeeRing;
+
+// where a generator builtin writes, and how much it may
+typedef struct
+{
+	int fd;
+	bool isPipe; // constant blocks can be vmspliced rather than copied
+	unsigned long long limit, // --size, 0 for none
+					   written;
+	int err;
+	struct sigaction prevInt;
+} GenOutput;
+
+// the jobs a wait builtin is waiting for
+typedef struct
+{
+	pid_t *pids;
+	int *codes; // exit codes, -1 while still running
+	int numPids,
+		remaining,
+		last; // the one that finished last
+	bool any; // -n, where one is enough
+} WaitTargets;
+
 /*****************************************************************************
  * Constants
  ****************************************************************************/
@@ -34,28 +626,587 @@ const int CMD_NAME = 0;
 const int STDIN_NUM = 0;
 const int STDOUT_NUM = 1;
 
+// associative array control bytes, probed GROUP_WIDTH at a time
+#define GROUP_WIDTH 8
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+// number of compiled glob patterns kept, direct mapped by hash
+#define GLOB_CACHE_SIZE 32
+
+/* characters escaped in the quoted parts of glob and [[ =~ ]] patterns, so
+ * that they match literally */
+#define GLOB_SPECIAL "*?[\\"
+#define REGEX_SPECIAL "\\^$.[|()*+?{"
+
+// fds below this get a cached FdReader, and the size of each read
+#define FD_READER_COUNT 16
+#define FD_READER_BUFSIZE 65536
+
+// number of compiled printf formats kept, direct mapped by hash
+#define PRINTF_CACHE_SIZE 16
+
+// number of stat results and compiled regexes kept for test and [[
+#define STAT_CACHE_SIZE 16
+#define REGEX_CACHE_SIZE 16
+
+/* the shell's own long lived fds are moved to this number or above, out of
+ * the way of the low numbers scripts redirect */
+#define SHELL_FD_MIN 10
+
+// most background jobs tracked at once
+#define MAX_JOBS 100
+
+// Job.token values that are not bytes read from the jobserver
+#define JOB_TOKEN_NONE -1
+#define JOB_TOKEN_IMPLICIT -2 // the shell's own slot, which it lends to one job
+
+/* host-wide job slots: the segment name (suffixed with the uid), and how
+ * long a waiter sleeps before checking for slots held by processes that
+ * died without freeing them */
+#define SLOT_SHM_NAME "/smallsh-slots"
+#define SLOT_TABLE_MAGIC 0x534c4f54
+#define SLOT_SWEEP_MS 250
+
+/* adaptive job concurrency (-A): the PSI resources watched, the stall per
+ * window that fires a trigger, the average below which the limit may grow
+ * again, and the shortest time between two changes to the limit */
+#define PSI_RESOURCES 3
+#define PSI_TRIGGER "some 200000 2000000"
+#define PSI_LOW_AVG10 5.0
+#define ADAPT_INTERVAL 2.0
+
+/* memory pressure job suspension: the PSI memory trigger that stops the
+ * newest job, and the avg10 below which stopped jobs are resumed, one per
+ * interval, oldest first */
+#define MEM_TRIGGER "some 300000 2000000"
+#define MEM_RESUME_AVG10 1.0
+#define MEM_RESUME_INTERVAL 2.0
+
+/* how long background jobs stay demoted after the prompt is shown, while the
+ * user is likely typing; an idle prompt past this restores them */
+#define PROMPT_ACTIVE_TIME 10.0
+
+// number of command locations kept, direct mapped by hash
+#define COMMAND_CACHE_SIZE 32
+
+// number of commands known not to be in $PATH, direct mapped by hash
+#define MISSING_CACHE_SIZE 16
+
+/* psort: memory for a run before it is spilled to a temporary file (-S),
+ * the size of each read, the most sorting threads and the fewest records
+ * worth starting one for, the bucket size below which the radix sort
+ * switches to insertion sort, and the most runs merged at once */
+#define PSORT_DEFAULT_MEMORY (256 << 20)
+#define PSORT_READ_SIZE (1 << 20)
+#define PSORT_MAX_THREADS 16
+#define PSORT_MIN_PER_THREAD 16384
+#define PSORT_INSERTION_MAX 32
+#define PSORT_MAX_RUNS 64
+
+/* countby: size of each slab of interned keys, and how much of a mapped
+ * file is worth a thread of its own, up to the most threads */
+#define COUNT_SLAB_SIZE (1 << 20)
+#define COUNT_MIN_PER_THREAD (4 << 20)
+#define COUNT_MAX_THREADS 16
+
+/* cols: how much of a mapped file is worth a thread of its own, up to the
+ * most threads */
+#define COLS_MIN_PER_THREAD (4 << 20)
+#define COLS_MAX_THREADS 16
+
+// most threads the hash builtins hash files on
+#define HASH_MAX_THREADS 16
+
+// XXH3 multipliers
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+/* >z: input is deflated in blocks of this size, a batch at a time on up to
+ * the most threads, each primed with the window before it */
+#define CODEC_BLOCK_SIZE (128 << 10)
+#define CODEC_MAX_THREADS 8
+#define CODEC_LEVEL 6
+#define CODEC_DICT_SIZE 32768
+
+/* tee: the size asked for its private pipes, which sets the chunk size, and
+ * how many chunks the ring holds for sinks that can't be spliced to */
+#define TEE_PIPE_SIZE (1 << 20)
+#define TEE_RING_SLOTS 8
+
+/* generator builtins: the size of the blocks they write, and the longest
+ * line randlines makes */
+#define GEN_BLOCK_SIZE (1 << 20)
+#define GEN_LINE_MAX 80
+
 /*****************************************************************************
  * Prototypes
  ****************************************************************************/
 void printAndFlush(char *line);
 char* termPrompt();
 char* getUserCmd();
-void changeDirectory(char *filepath);
-void parseUserCmd(char *userline, char **args, int *argCount, char **input, char **output, bool *backgroundFlag);
-void terminatePidGroup(int bgProcs[], int numBgProcs);
+void runScript(const char *path);
+ssize_t readScriptLine(FILE *script, char **line, size_t *size);
+void runCommandLine(char *line, bool lastLine);
+bool isBlankRest(const char *text);
+char* findListSeparator(char *line, char *separator);
+void runSimpleCommand(char *cmdText, bool mayExec);
+void waitForeground(pid_t pid);
+void trackBackground(pid_t pid, Job *admitted);
+Job admitJob();
+void openTrace();
+void trace(const char *format, ...);
+double monotonicNow();
+void initAdaptive(int ceiling);
+double pressureAvg10(int resource);
+bool checkPressure(int timeoutMs);
+void adaptConcurrency(bool pressured);
+void waitForAdaptiveRoom();
+void retireJob(Job *job);
+void demoteJob(Job *job);
+void restoreJob(Job *job);
+void setJobsDemoted(bool demote);
+Job* findJob(pid_t pid);
+int bgpolicyBuiltin(char **args, int argCount);
+bool jobTableFull();
+void reapJobs();
+void finishJob(int idx, pid_t reaped, int status);
+void abandonJobs();
+void openMemoryTrigger();
+int countStoppedJobs();
+void handleMemoryPressure(bool triggered);
+void waitForChild(pid_t pid, int *status);
+void waitForInput();
+int jobsBuiltin(char **args, int argCount);
+char* findGroupEnd(char *text);
+bool mutatesShellState(const char *body);
+bool printfSetsVar(const char *p);
+void runGroup(char *text, bool mayExec);
+int exitCode(int exitMethod);
+int changeDirectory(char *filepath);
+bool parseUserCmd(char *userline, char **args, int *argCount, char **input, char **output, bool *compressed, bool *backgroundFlag);
+void terminateJobs(int code);
+int signalJob(const Job *job, int sig);
+int reopenNonblocking(int fd, int flags);
+void joinJobserver();
+void createJobserver(int limit);
+int acquireJobToken();
+void releaseJobToken(int token);
+uint64_t processStartTime(pid_t pid);
+bool isProcessAlive(pid_t pid, uint64_t start);
+void openSlotTable(const char *limitText);
+void freeJobSlot(JobSlot *slot);
+int addSlotWaiter();
+int sweepJobSlots();
+int acquireJobSlot();
+void setJobSlotJob(int slot, pid_t pid);
+void releaseJobSlot(int slot, pid_t pid);
+int slotsBuiltin(char **args, int argCount);
 void reportExitStatus(int exitMethod);
 int openInputFD(char *filepath);
-void execute(char **args);
+void execute(char **args, const ExecTarget *target, int errFd);
+int execFailureCode(int err);
+void reportExecError(const char *name, int err);
+pid_t spawnCommand(char **args, const ExecTarget *target, char *newStdin, char *newStdout, bool bgFlag);
+void loadPathDirs();
+bool setExecTarget(ExecTarget *target, int dirIndex, const char *name);
+int findCommand(const char *name, ExecTarget *target);
+uint64_t pathStamp();
+bool isKnownMissing(const char *name);
+void rememberMissing(const char *name, uint64_t stamp);
 void redirectStdin(int FDNum);
 void redirectStdout(int FDNum);
 int openInpFile(char *inpfile);
 int openOutFile(char *outfile);
 void redirectStdIO(char *newStdin, char *newStdout, bool bgFlag);
 void catchSIGTSTP(int signo);
+void strSet(ShellStr *str, const char *src, size_t len);
+const char* strGet(const ShellStr *str);
+void strFree(ShellStr *str);
+bool indexedReserve(IndexedArray *arr, size_t size);
+bool indexedSet(IndexedArray *arr, size_t idx, const char *val, size_t len);
+ShellStr* indexedGet(IndexedArray *arr, size_t idx);
+void indexedUnset(IndexedArray *arr, size_t idx);
+void indexedClear(IndexedArray *arr);
+uint64_t hashBytes(const char *data, size_t len);
+uint64_t groupLoad(const unsigned char *ctrl);
+uint64_t groupMatchTag(uint64_t group, unsigned char tag);
+uint64_t groupMatchEmpty(uint64_t group);
+uint64_t groupMatchFree(uint64_t group);
+size_t assocFindFree(AssocArray *map, uint64_t hash);
+void assocRehash(AssocArray *map, size_t minSize);
+ShellStr* assocFind(AssocArray *map, const char *key, size_t keyLen);
+void assocSet(AssocArray *map, const char *key, size_t keyLen, const char *val, size_t valLen);
+void assocErase(AssocArray *map, const char *key, size_t keyLen);
+void assocClear(AssocArray *map);
+ShellVar* findVar(const char *name, size_t nameLen);
+ShellVar* getOrCreateVar(const char *name, size_t nameLen);
+void resetVar(ShellVar *var, VarKind kind);
+const char* scalarValue(ShellVar *var);
+size_t nameLength(const char *str);
+bool isAssignment(const char *word);
+int setElement(ShellVar *var, const char *sub, size_t subLen, const char *val);
+int assignList(ShellVar *var, char **words, int numWords);
+void printVar(ShellVar *var);
+void printQuoted(const char *value);
+int assignVariables(char **args, int argCount);
+int declareBuiltin(char **args, int argCount);
+int unsetBuiltin(char **args, int argCount);
+void sbAppend(StrBuf *sb, const char *src, size_t len);
+void sbAppendChar(StrBuf *sb, char c);
+void fieldsPush(FieldList *fl, StrBuf *sb);
+void fieldsFree(FieldList *fl);
+char* nextRawWord(char **cursor);
+void expandWord(const char *word, FieldList *out, bool keepEmpty);
+char* expandToString(const char *word);
+const char* expandDollar(const char *p, StrBuf *cur, FieldList *out, bool *started);
+void expandBraced(const char *expr, size_t len, StrBuf *cur, FieldList *out, bool *started);
+void emitValue(const char *val, size_t len, StrOp *op, bool *first, bool join, StrBuf *cur, FieldList *out);
+const char* globParseClass(const char *p, unsigned char *set);
+GlobPattern* globCompile(const char *text);
+GlobPattern* globLookup(const char *text);
+bool globMatch(GlobPattern *pat, const char *str, size_t len);
+bool globMatchAt(GlobPattern *pat, const char *str, size_t len, size_t start, size_t *matchLen);
+void patternEscape(StrBuf *dst, const char *text, size_t len, const char *special);
+char* expandPatternText(const char *text, const char *special);
+GlobPattern* expandPattern(const char *text);
+bool parseStrOp(char *text, StrOp *op);
+void applyStrOp(StrOp *op, const char *val, size_t len, StrBuf *dst);
+void freeStrOp(StrOp *op);
+ShellStr* lookupElement(ShellVar *var, const char *sub);
+bool addArg(char **args, int *idx, const char *src);
+const Builtin* findBuiltin(const char *name);
+int runBuiltin(const Builtin *builtin, char **args, int argCount, char *newStdin, char *newStdout);
+void runBuiltinJob(const Builtin *builtin, char **args, int argCount, char **newStdin, char **newStdout, bool *compressed);
+void exitShell(int code);
+bool pushRedirects(char *newStdin, char *newStdout, RedirectFrame *frame);
+void popRedirects(RedirectFrame *frame);
+int readRecord(int fd, char delim, StrBuf *out);
+int readSeekable(int fd, char delim, StrBuf *out);
+int readPipe(int fd, char delim, StrBuf *out);
+bool isIfs(const char *ifs, const char *text, const bool *quoted, size_t idx, bool spaceOnly);
+int readBuiltin(char **args, int argCount);
+int mapfileBuiltin(char **args, int argCount);
+bool parseCount(const char *text, long *value);
+size_t processEscapes(const char *src, char *dst, bool isArg, bool *stop);
+PrintfFormat* printfCompile(const char *format);
+PrintfFormat* printfLookup(const char *format);
+bool parseNumArg(const char *arg, long long *out);
+int printfBuiltin(char **args, int argCount);
+int cachedStat(const char *path, bool follow, struct stat *info);
+bool cachedAccess(const char *path, int mode);
+void clearStatCache();
+regex_t* regexLookup(const char *pattern);
+bool isTestCommand(const char *name);
+bool isUnaryTestOp(const char *op);
+bool isBinaryTestOp(const char *op, bool isDouble);
+bool testUnary(TestParser *tp, const char *op, const char *arg);
+bool testBinary(TestParser *tp, const char *left, const char *op, const char *right);
+bool testOr(TestParser *tp);
+bool testAnd(TestParser *tp);
+bool testNot(TestParser *tp);
+bool testPrimary(TestParser *tp);
+int testBuiltin(char **args, int argCount);
+int saveFd(int fd);
+void markFdsCloexec();
+void shareJobserverFds();
+const char* fdPurpose(int fd);
+int fdsBuiltin(char **args, int argCount);
+size_t sortSkipField(const SortOptions *opts, const char *line, size_t len, size_t pos);
+void sortMakeRecord(const SortOptions *opts, SortRecord *rec);
+double sortParseNumber(const char *text, size_t len);
+int sortCompareKeys(const SortRecord *a, const SortRecord *b, const SortOptions *opts);
+int sortCompare(const SortRecord *a, const SortRecord *b, const SortOptions *opts);
+int sortQsortCompare(const void *a, const void *b, void *opts);
+void sortRadix(SortRecord *recs, SortRecord *tmp, size_t count, int shift, const SortOptions *opts);
+void* sortChunk(void *arg);
+bool sortSourceNext(SortSource *src, const SortOptions *opts);
+bool sortBeats(const SortSource *sources, int a, int b, const SortOptions *opts);
+void sortAdjust(int *tree, int count, const SortSource *sources, int leaf, const SortOptions *opts);
+void sortMerge(SortSource *sources, int count, FILE *out, const SortOptions *opts);
+bool sortEmitRun(SortRecord *recs, size_t count, FILE *out, const SortOptions *opts);
+FILE* sortTempFile();
+bool sortBlock(char *data, size_t len, SortRecord **recs, size_t *recCap, FILE *out, const SortOptions *opts);
+bool sortSpill(FILE **runs, int *numRuns, char *data, size_t len, SortRecord **recs, size_t *recCap, const SortOptions *opts);
+FILE* sortMergeRuns(FILE **runs, int numRuns, FILE *out, const SortOptions *opts);
+bool sortOptionValue(char letter, const char *value, SortOptions *opts, size_t *memory);
+int psortBuiltin(char **args, int argCount);
+int readLineBlocks(int fd, LineBlockFn fn, void *ctx);
+void countGrow(CountTable *table);
+void countAdd(CountTable *table, const char *key, size_t len, uint64_t hash, uint64_t count);
+const char* countKey(const char *line, size_t len, int field, char delim, size_t *keyLen);
+void countLines(CountTable *table, const char *data, size_t len, int field, char delim);
+void* countChunk(void *arg);
+void countBlock(void *ctx, const char *data, size_t len);
+void countFree(CountTable *table);
+int countCompare(const void *a, const void *b);
+int countbyBuiltin(char **args, int argCount);
+const char* scanBytes(const char *pos, const char *end, const char *set);
+const char* jsonSkipSpace(const char *pos, const char *end);
+const char* jsonSkipString(const char *pos, const char *end);
+const char* jsonSkipValue(const char *pos, const char *end);
+void jsonDecodeString(const char *pos, const char *end, StrBuf *out);
+bool jsonKeyMatches(const char *pos, const char *end, const JsonStep *step, StrBuf *scratch);
+const char* jsonFollow(const char *pos, const char *end, const JsonPath *path, StrBuf *scratch);
+bool jsonParsePath(const char *text, JsonPath *path);
+void jgetBlock(void *ctx, const char *data, size_t len);
+bool jsonScalarValid(const char *pos, const char *end);
+bool jsonLineValid(const char *pos, const char *end);
+void printTsvField(const char *text, size_t len);
+int jgetBuiltin(char **args, int argCount);
+const char* colsRecord(const char *pos, const char *end, bool final, char delim, ColsFields *fields);
+void colsUnquote(const char *field, size_t len, StrBuf *out);
+int colsFind(const char *name, const ColsFields *header, StrBuf *scratch);
+bool colsPasses(const ColsQuery *query, const ColsFields *fields, StrBuf *scratch);
+void colsOutput(const ColsQuery *query, const ColsFields *fields, const char *record, StrBuf *out);
+bool colsIsOp(const char *op);
+size_t colsProcess(const ColsQuery *query, const char *data, size_t len, bool final, StrBuf *out, bool *unterminated);
+void* colsChunk(void *arg);
+const char* colsRecordStart(const char *from, const char *target, const char *end);
+bool colsSetup(ColsQuery *query, const char *list, const ColsFields *header);
+int colsBuiltin(char **args, int argCount);
+void hashSelectKernels();
+uint32_t crc32cSoft(uint32_t crc, const unsigned char *data, size_t len);
+void crc32cDigest(const unsigned char *data, size_t len, unsigned char *digest);
+void sha256BlocksSoft(uint32_t *state, const unsigned char *data, size_t blocks);
+void sha256Digest(const unsigned char *data, size_t len, unsigned char *digest);
+uint64_t xxh3Mul128Fold(uint64_t a, uint64_t b);
+uint64_t xxh3Avalanche(uint64_t hash);
+uint64_t xxh3Mix16(const unsigned char *data, const unsigned char *secret);
+void xxh3StripesSoft(uint64_t *acc, const unsigned char *data, size_t stripes, const unsigned char *secret);
+void xxh3ScrambleSoft(uint64_t *acc, const unsigned char *secret);
+void xxh3Digest(const unsigned char *data, size_t len, unsigned char *digest);
+void hashRunJob(HashJob *job);
+void* hashWorker(void *arg);
+void hashJobs(HashJob *jobs, int numJobs);
+const HashAlgo* hashAlgoFor(const char *name);
+int hashCheck(const HashAlgo *algo, const char *listPath, const char *command);
+int hashBuiltin(char **args, int argCount);
+#ifdef __x86_64__
+uint32_t crc32cHw(uint32_t crc, const unsigned char *data, size_t len);
+void sha256BlocksNi(uint32_t *state, const unsigned char *data, size_t blocks);
+void xxh3StripesAvx2(uint64_t *acc, const unsigned char *data, size_t stripes, const unsigned char *secret);
+void xxh3ScrambleAvx2(uint64_t *acc, const unsigned char *secret);
+#endif
+bool startCodecs(char **input, char **output, const bool *compressed, CodecStream **codecs);
+bool finishCodecs(CodecStream **codecs, pid_t job);
+void dropCodecs(CodecStream **codecs);
+bool joinCodec(CodecStream *stream);
+void reapCodecs(bool wait);
+void joinJobCodecs(pid_t job);
+int writeAll(int fd, const void *data, size_t len);
+size_t readFull(int fd, void *buf, size_t len, int *err);
+int teeBuiltin(char **args, int argCount);
+ssize_t teeFill(int pipeFd, size_t len, char *scratch);
+void teeSplice(int from, TeeSink *sink, size_t len, const char *command);
+void teeDrain(int fd, size_t len);
+void teePublish(TeeRing *ring, int from, size_t len, const char *command);
+uint64_t teeSlowest(TeeRing *ring);
+void* teeConsumer(void *arg);
+bool parseSize(const char *value, int defaultUnit, unsigned long long *size);
+void catchBuiltinSIGINT(int signo);
+void catchInterrupts(struct sigaction *prev);
+void genStart(GenOutput *out, unsigned long long limit);
+bool genEmit(GenOutput *out, const char *data, size_t len, bool constant);
+int genFinish(GenOutput *out, const char *command);
+bool genOptions(char **args, int argCount, int *next, unsigned long long *limit, uint64_t *seed);
+uint64_t genNext(uint64_t *state);
+int seqBuiltin(char **args, int argCount);
+int yesBuiltin(char **args, int argCount);
+int randBuiltin(char **args, int argCount);
+bool waitEvents(int timerFd, const pid_t *pids, int numPids, WaitStepFn step, void *ctx);
+bool jobIdPid(const char *command, const char *id, pid_t *pid);
+int signalNumber(const char *name);
+int killBuiltin(char **args, int argCount);
+bool waitStep(void *ctx);
+int waitBuiltin(char **args, int argCount);
+bool sleepStep(void *ctx);
+int sleepBuiltin(char **args, int argCount);
+#ifdef HAVE_ZLIB
+void* codecThread(void *arg);
+void* deflateBlock(void *arg);
+int gzipStream(CodecStream *stream);
+int gunzipStream(CodecStream *stream);
+#endif
 
 // Global variable for signal handling
 volatile static bool foregroundOnly = 0;
-volatile static int fgPidForSignal = -5;
+volatile static int fgPidForSignal = -5,
+					fgExitFromSignal = -5; // the fg status, if the SIGTSTP handler reaped it
+/* set by SIGINT while a builtin that can block for long runs, since the
+ * shell otherwise ignores it */
+volatile static sig_atomic_t builtinInterrupted = 0;
+static struct sigaction default_action = {{ 0 }},
+						ignore_action = {{ 0 }};
+
+// shell state shared by main() and the command runners
+static char **cmdargs = NULL; // MAX_LINE_ARGS preallocated argument buffers
+static int childExitMethod = -5, // status of the last command
+		   savedStdin = -1, // original stdin/stdout, restored after redirects
+		   savedStdout = -1;
+
+// background jobs, oldest first, and the process they belong to
+static Job jobs[MAX_JOBS];
+static int numJobs = 0;
+static pid_t jobsOwner = 0;
+
+/* the make jobserver: tokens are read from jobserverRead, a private non
+ * blocking fd, and written back to jobserverWrite. jobserverFds are the
+ * fds named in MAKEFLAGS, left open across exec for make and the like */
+static int jobserverRead = -1,
+		   jobserverWrite = -1,
+		   jobserverFds[2] = { -1, -1 };
+static bool implicitTokenUsed = false;
+
+// the host-wide job slots, if SMALLSH_SLOTS opted in
+static SlotTable *slotTable = NULL;
+
+/* adaptive job concurrency: the current limit on running background jobs,
+ * its ceiling, when it last changed, and PSI trigger fds (-1 where PSI is
+ * not available, in which case the load average is used) */
+static bool adaptiveJobs = false;
+static int adaptiveLimit = 0,
+		   adaptiveCeiling = 0,
+		   psiFds[PSI_RESOURCES] = { -1, -1, -1 };
+static const char *psiNames[PSI_RESOURCES] = { "cpu", "memory", "io" };
+static double lastAdapt = 0;
+
+// SMALLSH_TRACE log of scheduling decisions
+static FILE *traceFile = NULL;
+
+/* background jobs are demoted while a foreground command or the prompt is
+ * active, using each job's policy; new jobs get the default policy */
+static const char *policyNames[] = { "batch", "idle", "nice", "none" };
+static JobPolicy defaultJobPolicy = POLICY_BATCH;
+static bool jobsDemoted = false,
+			interactive = false;
+
+// PSI memory trigger for suspending jobs, armed with the first job, and when
+// a job was last stopped or resumed
+static int memTriggerFd = -1;
+static bool memTriggerTried = false;
+static double lastMemChange = 0;
+
+// shell variables, kept as pointers so lookups stay valid across growth
+static ShellVar **shellVars = NULL;
+static int shellVarCount = 0,
+		   shellVarCap = 0;
+
+static GlobPattern *globCache[GLOB_CACHE_SIZE];
+
+static FdReader fdReaders[FD_READER_COUNT];
+
+static PrintfFormat *printfCache[PRINTF_CACHE_SIZE];
+
+static StatCacheEntry statCache[STAT_CACHE_SIZE];
+static int statCacheCount = 0,
+		   statCacheNext = 0; // next entry to evict once full
+
+static RegexCacheEntry regexCache[REGEX_CACHE_SIZE];
+
+static MissingCommand missingCache[MISSING_CACHE_SIZE];
+
+// $PATH split into open directories, and the $PATH value they came from
+static PathDir *pathDirs = NULL;
+static int numPathDirs = 0;
+static char *pathDirsFor = NULL;
+
+static CommandLocation commandCache[COMMAND_CACHE_SIZE];
+
+// private pipe used to peek at pipe input with tee(2), created on demand
+static int peekPipe[2] = { -1, -1 };
+
+// the script being run, if any
+static int scriptFd = -1;
+
+/* checksum kernels: the portable ones until hashSelectKernels picks ones
+ * using instructions the CPU has */
+static uint32_t (*crc32cUpdate)(uint32_t crc, const unsigned char *data, size_t len) = crc32cSoft;
+static void (*sha256Blocks)(uint32_t *state, const unsigned char *data, size_t blocks) = sha256BlocksSoft;
+static void (*xxh3Stripes)(uint64_t *acc, const unsigned char *data, size_t stripes, const unsigned char *secret) = xxh3StripesSoft;
+static void (*xxh3Scramble)(uint64_t *acc, const unsigned char *secret) = xxh3ScrambleSoft;
+static uint32_t crc32cTable[256];
+
+// codec threads of >z and <z background jobs, joined once they finish
+static CodecStream *bgCodecs = NULL;
+
+static const HashAlgo hashAlgos[] =
+{
+	{ "crc32c", "crc32c", crc32cDigest, 4 },
+	{ "xxh3", "xxh3sum", xxh3Digest, 8 },
+	{ "sha256", "sha256sum", sha256Digest, 32 },
+};
+
+static const uint32_t sha256K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// XXH3's default secret
+static const unsigned char xxh3Secret[192] =
+{
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// builtins looked up by name, after the ones main() handles itself
+static const Builtin builtins[] =
+{
+	{ "declare", declareBuiltin },
+	{ "unset", unsetBuiltin },
+	{ "read", readBuiltin },
+	{ "mapfile", mapfileBuiltin },
+	{ "readarray", mapfileBuiltin },
+	{ "printf", printfBuiltin },
+	{ "test", testBuiltin },
+	{ "[", testBuiltin },
+	{ "[[", testBuiltin },
+	{ "fds", fdsBuiltin },
+	{ "slots", slotsBuiltin },
+	{ "bgpolicy", bgpolicyBuiltin },
+	{ "jobs", jobsBuiltin },
+	{ "psort", psortBuiltin },
+	{ "countby", countbyBuiltin },
+	{ "jget", jgetBuiltin },
+	{ "cols", colsBuiltin },
+	{ "hash", hashBuiltin },
+	{ "crc32c", hashBuiltin },
+	{ "xxh3sum", hashBuiltin },
+	{ "sha256sum", hashBuiltin },
+	{ "tee", teeBuiltin },
+	{ "seq", seqBuiltin },
+	{ "yes", yesBuiltin },
+	{ "randbytes", randBuiltin },
+	{ "randlines", randBuiltin },
+	{ "kill", killBuiltin },
+	{ "wait", waitBuiltin },
+	{ "sleep", sleepBuiltin },
+};
 
 /*****************************************************************************
  * Main
@@ -66,9 +1217,7 @@ int main(int argc, char**argv)
 	 * Signal Handlers
 	 ************************/
 	// set up SIGINT handlers 
-	struct sigaction default_action = {{ 0 }}, 
-					 SIGTSTP_action = {{ 0 }}, 
-					 ignore_action = {{ 0 }};
+	struct sigaction SIGTSTP_action = {{ 0 }};
 
 	default_action.sa_handler = SIG_DFL;
 	ignore_action.sa_handler = SIG_IGN;
@@ -81,187 +1230,114 @@ int main(int argc, char**argv)
 	// actually ignore SIGINT
 	sigaction(SIGTSTP, &SIGTSTP_action, NULL);
 	sigaction(SIGINT, &ignore_action, NULL);
+	/* builtins write from the shell itself, so a reader that goes away must
+	 * end the command with EPIPE rather than kill the shell */
+	sigaction(SIGPIPE, &ignore_action, NULL);
 
 	/*************************
 	 * Control variables
 	 ************************/
-	// variables for parsing user input
-	char *inputfile = NULL, // redirect stdin to this file
-		 *outputfile = NULL, // redirect stdout to this file
-		 *userCmd = NULL; // string to capture entire user command line
-
-	int cmdArgCount = 0,	
-		childExitMethod = -5,
-		savedStdin = dup(STDIN_NUM), // save original stdin
-		savedStdout = dup(STDOUT_NUM), // save original stdout
-		backgroundPids[100], // array to store background pids in
-		backgroundPidCount = 0,
-		bgChildExitMethod = -5,
-		actualBgPid = 0;
-
-	char *cmdargs[MAX_LINE_ARGS]; // hold an array of args, first one is also the command
+	char *userCmd = NULL; // string to capture entire user command line
+	int argi = 1, // next command line argument
+		jobLimit = 0; // -j N
+
+	savedStdin = saveFd(STDIN_NUM); // save original stdin
+	savedStdout = saveFd(STDOUT_NUM); // save original stdout
+
+	// hold an array of args, first one is also the command
+	cmdargs = malloc(MAX_LINE_ARGS * sizeof(char *));
 	int idx = 0;
 	for (idx = 0; idx < MAX_LINE_ARGS; idx++)
 	{
 		cmdargs[idx] = malloc(MAX_LINE_LENGTH);
 		memset(cmdargs[idx], '\0', MAX_LINE_LENGTH);
 	}
-		
-	pid_t forkPid = -5;
-	bool background = 0; // flag for background processes - 1=foreground, 0=background
 
 	/*************************
-	 * Terminal prompt loop
+	 * Options
 	 ************************/
-	while (1)
+	// -j N or -jN: be a make jobserver for N concurrent jobs
+	// -A: adapt the number of background jobs to PSI pressure
+	while (argi < argc && (!strncmp(argv[argi], "-j", 2) || !strcmp(argv[argi], "-A")))
 	{
-		/***************************
-		 * Handle background zombies
-		 **************************/
-		// check background pid tracker for reaping
-		for (idx = 0; idx < backgroundPidCount; idx++)
+		if (!strcmp(argv[argi], "-A"))
+		{
+			adaptiveJobs = true;
+			argi++;
+			continue;
+		}
+		const char *count = argv[argi][2] ? argv[argi] + 2 : (argi + 1 < argc ? argv[++argi] : "");
+		jobLimit = atoi(count);
+		if (jobLimit < 1)
 		{
-			actualBgPid = waitpid(backgroundPids[idx], &bgChildExitMethod, WNOHANG);
+			fprintf(stderr, "smallsh: -j: expected a job count\n");
+			exit(2);
+		}
+		argi++;
+	}
 
-			// if background pid has been reaped, report it.
-			if (actualBgPid)
-			{
-				printf("%d has been reaped.\n", actualBgPid);
-				fflush(stdout);
+	openTrace();
+	if (adaptiveJobs)
+	{
+		initAdaptive(jobLimit);
+	}
+
+	// background jobs share a make jobserver: our own, or one we run under
+	jobsOwner = getpid();
+	if (jobLimit)
+	{
+		createJobserver(jobLimit);
+	}
+	else
+	{
+		joinJobserver();
+	}
+	atexit(abandonJobs);
 
-				reportExitStatus(bgChildExitMethod);
+	// SMALLSH_SLOTS=N caps background jobs across every shell on the host
+	if (getenv("SMALLSH_SLOTS"))
+	{
+		openSlotTable(getenv("SMALLSH_SLOTS"));
+	}
 
-				// slide background pids forward if one has been removed
-				int j = 0;
-				for (j = idx; j < backgroundPidCount; j++)
-				{
-					backgroundPids[j] = backgroundPids[j + 1];
-				}
-				// update count
-				backgroundPidCount--;
-			}
-		}
+	/*************************
+	 * Non-interactive modes
+	 ************************/
+	// smallsh -c "command line"
+	if (argc - argi > 1 && !strcmp(argv[argi], "-c"))
+	{
+		runCommandLine(argv[argi + 1], true);
+		exit(exitCode(childExitMethod));
+	}
+	// smallsh script
+	if (argc - argi > 0)
+	{
+		runScript(argv[argi]);
+		exit(exitCode(childExitMethod));
+	}
 
+	/*************************
+	 * Terminal prompt loop
+	 ************************/
+	interactive = true;
+	while (1)
+	{
 		/***************************
-		 * User input
+		 * Handle background zombies
 		 **************************/
-		// get command from user and parse it for execution
-		userCmd = termPrompt();
-		parseUserCmd(userCmd, cmdargs, &cmdArgCount, &inputfile, &outputfile, &background);
+		reapJobs();
+		setJobsDemoted(true);
 
 		/***************************
-		 * Result decision path
+		 * User input
 		 **************************/
-		// blank line - must be checked first to avoid the other checks segfaulting
-		if (cmdargs[CMD_NAME] == NULL)
-		{
-			// do nothing, let variables parsing variables reset at end of loop
-		}
-		// comment line
-		else if (cmdargs[CMD_NAME][0] == '#')
-		{
-			// do nothing, let variables parsing variables reset at end of loop
-		}
-		// change director command
-		else if (!strcmp(cmdargs[CMD_NAME], "cd"))
-		{
-			changeDirectory(cmdargs[1]);
-		}
-		// exit command
-		else if (!strcmp(cmdargs[CMD_NAME], "exit"))
-		{
-			terminatePidGroup(backgroundPids, backgroundPidCount);
-		}
-		// status command
-		else if (!strcmp(cmdargs[CMD_NAME], "status"))
-		{
-			reportExitStatus(childExitMethod);	
-		}
-		// try to exec the command
-		else
-		{
-			// fork new process and test for success
-			forkPid = fork();
-			// this block is in the parent
-			switch (forkPid)
-			{
-				// check for failure
-				case -1: { perror("Fork failure, get a spoon.\n"); exit(-2); break; }
-				// child code block
-				case 0:
-				{
-					// redirect stdin/stdout before exec
-					redirectStdIO(inputfile, outputfile, background);
-
-					// restore SIGINT for foreground processes before exec
-					if (!background)
-					{
-						sigaction(SIGINT, &default_action, NULL);
-					}	
-
-					// ignore SIGTSTP in all child processes
-					sigaction(SIGTSTP, &ignore_action, NULL);
-
-					execute(cmdargs);
-					exit(0);
-					break;
-				}
-				default: 
-				{
-					/* set global equal to forkpid so signal handler waits
-					 * for foreground process */
-
-					if (!background || foregroundOnly)
-					{
-						fgPidForSignal = forkPid;
-						forkPid = waitpid(forkPid, &childExitMethod, 0);
-						fgPidForSignal = -5;
-						if (WIFSIGNALED(childExitMethod))
-						{
-							reportExitStatus(childExitMethod);
-						}
-					}
-					// add background pid to array for tracking
-					else
-					{
-						backgroundPids[backgroundPidCount] = forkPid;
-						backgroundPidCount++;
-						printf("PID of new background process: %d\n", forkPid);
-						fflush(stdout);
-					}
-
-					// reset stdin/stdout to terminal
-					redirectStdin(savedStdin);
-					redirectStdout(savedStdout);
-				}
-			}
-		}
+		// get command from user and run it
+		userCmd = termPrompt();
+		runCommandLine(userCmd, false);
 
-		/* reset parsing variables for next command. check that they exist
-		 * first in the case of a comment line or blank line. */
-		if (userCmd)
-		{
-			free(userCmd);
-			userCmd = NULL;
-		}
-		
-		if (inputfile)
-		{
-			free(inputfile);
-			inputfile = NULL;
-		}
-		
-		if (outputfile)
-		{
-			free(outputfile);
-			outputfile = NULL;
-		}
-				
-		/* since we set one of the array elements to NULL, we need to re-allocate
-		 * that element */
-		cmdargs[cmdArgCount] = malloc(MAX_LINE_LENGTH);
-		cmdArgCount = 0;
-		background = 0;
+		// reset for next command
+		free(userCmd);
+		userCmd = NULL;
 	} // end while loop
 
 	// deallocate memory
@@ -270,367 +1346,11731 @@ int main(int argc, char**argv)
 	{
 		free(cmdargs[idx]);
 	}
+	free(cmdargs);
 
 	return 0;
 }
 
 /*****************************************************************************
- * Description: Displays CLI prompt and waits for user input.
- * Parameters: None
- * Returns: A string of the command the user input
+ * Description: Runs the lines of a script file. Each line is read ahead
+ * 				of running the previous one, so the final command is known
+ * 				and can replace the shell instead of being forked.
+ * Parameters: path = the script file
+ * Returns: None
  ****************************************************************************/
-char* termPrompt()
+void runScript(const char *path)
 {
-	printAndFlush(":");
-	return getUserCmd();
-}
+	FILE *script = fopen(path, "re");
+	char *line = NULL,
+		 *nextLine = NULL;
+	size_t lineSize = 0,
+		   nextSize = 0;
+	ssize_t nextLen = 0;
 
-/*****************************************************************************
- * Description: Waits for user to provide input to stdin. Source: Class reading
+	if (!script)
+	{
+		perror(path);
+		exit(127);
+	}
+	scriptFd = fileno(script);
+
+	nextLen = readScriptLine(script, &nextLine, &nextSize);
+	while (nextLen != -1)
+	{
+		// swap the read ahead line in as the current one
+		char *tmp = line;
+		size_t tmpSize = lineSize;
+		line = nextLine;
+		lineSize = nextSize;
+		nextLine = tmp;
+		nextSize = tmpSize;
+		line[strcspn(line, "\n")] = '\0';
+
+		nextLen = readScriptLine(script, &nextLine, &nextSize);
+		runCommandLine(line, nextLen == -1);
+	}
+
+	free(line);
+	free(nextLine);
+	fclose(script);
+	scriptFd = -1;
+}
+
+/*****************************************************************************
+ * Description: Reads the next script line that has something to run
+ * Parameters: script = the script file
+ * 			   line/size = getline's buffer
+ * Returns: The line length, -1 at end of file
+ ****************************************************************************/
+ssize_t readScriptLine(FILE *script, char **line, size_t *size)
+{
+	ssize_t len = 0;
+	while ((len = getline(line, size, script)) != -1 && isBlankRest(*line));
+	return len;
+}
+
+/*****************************************************************************
+ * Description: Checks if the rest of a command line has nothing to run
+ * Parameters: text = the rest of the line
+ * Returns: true if it is only whitespace, separators or a comment
+ ****************************************************************************/
+bool isBlankRest(const char *text)
+{
+	for (; *text && *text != '#'; text++)
+	{
+		if (!isspace((unsigned char)*text) && *text != ';')
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Runs a command line: commands separated by ;, && and ||.
+ * 				A command after && only runs if the previous one succeeded,
+ * 				and after || only if it failed.
+ * Parameters: line = the command line, modified in place
+ * 			   lastLine = true if the shell exits after this line, so its
+ * 			   			  final command may be exec'd in place
+ * Returns: None
+ ****************************************************************************/
+void runCommandLine(char *line, bool lastLine)
+{
+	char *cursor = line;
+	char connector = ';'; // how the current command joins the previous one
+
+	while (cursor)
+	{
+		char next = ';';
+		char *end = findListSeparator(cursor, &next);
+		if (end)
+		{
+			*end = '\0';
+		}
+
+		int lastCode = exitCode(childExitMethod);
+		if (connector == ';' || (connector == '&' && lastCode == 0) || (connector == '|' && lastCode != 0))
+		{
+			bool isLast = !end || isBlankRest(end + (next == ';' ? 1 : 2));
+			char *start = cursor + strspn(cursor, " \t");
+			if (*start == '(' || (*start == '{' && (isspace((unsigned char)start[1]) || !start[1])))
+			{
+				runGroup(start, lastLine && isLast);
+			}
+			else
+			{
+				runSimpleCommand(cursor, lastLine && isLast);
+			}
+		}
+
+		connector = next;
+		cursor = end ? end + (next == ';' ? 1 : 2) : NULL;
+	}
+}
+
+/*****************************************************************************
+ * Description: Finds the next ;, && or || in a command line, skipping
+ * 				quotes, ${...}, [[ ... ]] and ( ) { } groups, and ending at a
+ * 				# comment.
+ * Parameters: line = the command line
+ * 			   separator = set to ';', '&' (for &&) or '|' (for ||)
+ * Returns: A pointer to the separator, or NULL if there is none
+ ****************************************************************************/
+char* findListSeparator(char *line, char *separator)
+{
+	char *p = line;
+	char quote = '\0';
+	int braces = 0,
+		groups = 0; // open ( and { groups, whose lists are split later
+	bool inTest = false,
+		 wordStart = true;
+
+	for (; *p; p++)
+	{
+		bool atWordStart = wordStart;
+		wordStart = (*p == ' ' || *p == '\t' || *p == ';');
+
+		if (quote)
+		{
+			if (*p == '\\' && quote == '"' && p[1]) { p++; }
+			else if (*p == quote) { quote = '\0'; }
+			continue;
+		}
+		if (*p == '\\' && p[1]) { p++; continue; }
+		if (*p == '\'' || *p == '"') { quote = *p; continue; }
+		if (*p == '$' && p[1] == '{') { braces++; p++; continue; }
+		if (*p == '}' && braces > 0) { braces--; continue; }
+		if (braces == 0 && *p == '(') { groups++; continue; }
+		if (braces == 0 && *p == ')' && groups > 0) { groups--; continue; }
+		if (braces > 0 || !atWordStart)
+		{
+			if (*p == ';' && braces == 0 && groups == 0 && !inTest) { *separator = ';'; return p; }
+			if ((*p == '&' || *p == '|') && p[1] == *p && braces == 0 && groups == 0 && !inTest) { *separator = *p; return p; }
+			continue;
+		}
+
+		// the checks below only apply at the start of a word
+		if (*p == '#')
+		{
+			*p = '\0';
+			return NULL;
+		}
+		if (!strncmp(p, "[[", 2) && (p[2] == ' ' || p[2] == '\0')) { inTest = true; }
+		else if (!strncmp(p, "]]", 2) && (p[2] == ' ' || p[2] == ';' || p[2] == '\0')) { inTest = false; }
+		else if (*p == '{' && (isspace((unsigned char)p[1]) || !p[1])) { groups++; }
+		else if (*p == '}' && groups > 0) { groups--; }
+		if (!inTest && groups == 0 && *p == ';') { *separator = ';'; return p; }
+		if (!inTest && groups == 0 && (*p == '&' || *p == '|') && p[1] == *p) { *separator = *p; return p; }
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Parses and runs a single command, either a builtin in the
+ * 				shell or a program in a child process.
+ * Parameters: cmdText = the command, modified in place
+ * 			   mayExec = true if nothing runs after this command, in which
+ * 			   			 case a foreground program replaces the shell
+ * 			   			 rather than being forked, as long as there are
+ * 			   			 no background jobs left to wait on
+ * Returns: None
+ ****************************************************************************/
+void runSimpleCommand(char *cmdText, bool mayExec)
+{
+	// variables for parsing user input
+	char *inputfile = NULL, // redirect stdin to this file
+		 *outputfile = NULL; // redirect stdout to this file
+	int cmdArgCount = 0;
+	pid_t forkPid = -5;
+	ExecTarget target;
+	int execErr = 0;
+	bool background = 0; // flag for background processes - 1=foreground, 0=background
+	bool compressed[2] = { false, false }; // <z and >z
+	CodecStream *codecs[2] = { NULL, NULL };
+
+	if (!parseUserCmd(cmdText, cmdargs, &cmdArgCount, &inputfile, &outputfile, compressed, &background))
+	{
+		childExitMethod = W_EXITCODE(1, 0);
+	}
+
+	// cached test results only stay valid while nothing but tests runs
+	if (!cmdargs[CMD_NAME] || !isTestCommand(cmdargs[CMD_NAME]) || outputfile)
+	{
+		clearStatCache();
+	}
+
+	/***************************
+	 * Result decision path
+	 **************************/
+	// blank line - must be checked first to avoid the other checks segfaulting
+	if (cmdargs[CMD_NAME] == NULL)
+	{
+		// do nothing, let variables parsing variables reset at end
+	}
+	// comment line
+	else if (cmdargs[CMD_NAME][0] == '#')
+	{
+		// do nothing, let variables parsing variables reset at end
+	}
+	// change director command
+	else if (!strcmp(cmdargs[CMD_NAME], "cd"))
+	{
+		childExitMethod = W_EXITCODE(changeDirectory(cmdargs[1]) ? 1 : 0, 0);
+	}
+	// exit command
+	else if (!strcmp(cmdargs[CMD_NAME], "exit"))
+	{
+		// exit takes an optional exit code, and like bash exits 2 on a bad one
+		char *end = NULL;
+		long code = cmdargs[1] ? strtol(cmdargs[1], &end, 10) : 0;
+		if (cmdargs[1] && (end == cmdargs[1] || *end))
+		{
+			fprintf(stderr, "smallsh: exit: %s: numeric argument required\n", cmdargs[1]);
+			code = 2;
+		}
+		terminateJobs(code);
+	}
+	// status command
+	else if (!strcmp(cmdargs[CMD_NAME], "status"))
+	{
+		reportExitStatus(childExitMethod);	
+	}
+	// variable assignment, name=value, name=(list) or name[sub]=value
+	else if (isAssignment(cmdargs[CMD_NAME]))
+	{
+		childExitMethod = W_EXITCODE(assignVariables(cmdargs, cmdArgCount), 0);
+	}
+	// a backgrounded builtin runs in a child, as a job like any other
+	else if (findBuiltin(cmdargs[CMD_NAME]) && background && !foregroundOnly)
+	{
+		runBuiltinJob(findBuiltin(cmdargs[CMD_NAME]), cmdargs, cmdArgCount, &inputfile, &outputfile, compressed);
+	}
+	// other builtins, run in the shell with their redirects applied
+	else if (findBuiltin(cmdargs[CMD_NAME]))
+	{
+		int result = 1;
+		if (startCodecs(&inputfile, &outputfile, compressed, codecs))
+		{
+			result = runBuiltin(findBuiltin(cmdargs[CMD_NAME]), cmdargs, cmdArgCount, inputfile, outputfile);
+			// a file that could not be gzipped or gunzipped fails the command
+			if (!finishCodecs(codecs, 0) && !result)
+			{
+				result = 1;
+			}
+		}
+		childExitMethod = W_EXITCODE(result, 0);
+	}
+	// find the command before forking, so a missing one costs no fork
+	else if ((execErr = findCommand(cmdargs[CMD_NAME], &target)) != 0)
+	{
+		reportExecError(cmdargs[CMD_NAME], execErr);
+		childExitMethod = W_EXITCODE(execFailureCode(execErr), 0);
+	}
+	/* last command with nothing left to do - exec it in place of the shell,
+	 * unless the shell has to stay to run a <z or >z codec */
+	else if (mayExec && !background && numJobs == 0 && !compressed[0] && !compressed[1])
+	{
+		redirectStdIO(inputfile, outputfile, false);
+		sigaction(SIGINT, &default_action, NULL);
+		sigaction(SIGTSTP, &ignore_action, NULL);
+		sigaction(SIGPIPE, &default_action, NULL);
+		fflush(stdout);
+		markFdsCloexec();
+		execute(cmdargs, &target, -1);
+	}
+	// no room to track another background job
+	else if (background && !foregroundOnly && jobTableFull())
+	{
+		childExitMethod = W_EXITCODE(1, 0);
+	}
+	// try to exec the command
+	else
+	{
+		background = background && !foregroundOnly;
+		// background jobs wait to be admitted before they start
+		Job job = { .token = JOB_TOKEN_NONE, .slot = -1, .policy = POLICY_NONE };
+		if (background)
+		{
+			job = admitJob();
+		}
+
+		if (!startCodecs(&inputfile, &outputfile, compressed, codecs))
+		{
+			retireJob(&job);
+			childExitMethod = W_EXITCODE(1, 0);
+		}
+		else
+		{
+			forkPid = spawnCommand(cmdargs, &target, inputfile, outputfile, background);
+			// -1 means exec failed, and the status is already set
+			if (forkPid == -1)
+			{
+				retireJob(&job);
+			}
+			else if (!background)
+			{
+				waitForeground(forkPid);
+			}
+			// add background pid to array for tracking
+			else
+			{
+				trackBackground(forkPid, &job);
+			}
+			// a background job's codecs are joined when reapJobs sees them finish
+			if (!finishCodecs(codecs, background && forkPid != -1 ? forkPid : 0) && !background && !exitCode(childExitMethod))
+			{
+				childExitMethod = W_EXITCODE(1, 0);
+			}
+		}
+
+		// reset stdin/stdout to terminal
+		redirectStdin(savedStdin);
+		redirectStdout(savedStdout);
+	}
+
+	/* reset parsing variables for next command. check that they exist
+	 * first in the case of a comment line or blank line. */
+	if (inputfile)
+	{
+		free(inputfile);
+		inputfile = NULL;
+	}
+	
+	if (outputfile)
+	{
+		free(outputfile);
+		outputfile = NULL;
+	}
+			
+	/* since we set one of the array elements to NULL, we need to re-allocate
+	 * that element */
+	cmdargs[cmdArgCount] = malloc(MAX_LINE_LENGTH);
+}
+
+/*****************************************************************************
+ * Description: Waits for a foreground child and records its status. The
+ * 				SIGTSTP handler also waits on it, through fgPidForSignal.
+ * 				Background jobs are demoted while it runs.
+ * Parameters: pid = the child
+ * Returns: None
+ ****************************************************************************/
+void waitForeground(pid_t pid)
+{
+	// background jobs yield to the command the user is waiting on
+	setJobsDemoted(true);
+
+	/* set global equal to pid so signal handler waits
+	 * for foreground process */
+	fgExitFromSignal = -5;
+	fgPidForSignal = pid;
+	waitForChild(pid, &childExitMethod);
+	fgPidForSignal = -5;
+
+	// ...and to the prompt, which restores them once it goes idle
+	if (!interactive)
+	{
+		setJobsDemoted(false);
+	}
+	if (WIFSIGNALED(childExitMethod))
+	{
+		reportExitStatus(childExitMethod);
+	}
+}
+
+/*****************************************************************************
+ * Description: Adds a background child to the job table and reports it.
+ * 				Each job is its own process group, so signals reach the
+ * 				processes it starts.
+ * Parameters: pid = the child
+ * 			   admitted = what admitJob gave it
+ * Returns: None
+ ****************************************************************************/
+void trackBackground(pid_t pid, Job *admitted)
+{
+	// the child does this too, so the group exists whichever runs first
+	setpgid(pid, pid);
+	admitted->pid = pid;
+	setJobSlotJob(admitted->slot, pid);
+	jobs[numJobs++] = *admitted;
+	if (jobsDemoted)
+	{
+		demoteJob(&jobs[numJobs - 1]);
+	}
+	printf("PID of new background process: %d\n", pid);
+	fflush(stdout);
+	childExitMethod = W_EXITCODE(0, 0);
+}
+
+/*****************************************************************************
+ * Description: Waits until a background job may start: it needs room under
+ * 				the adaptive limit, a make jobserver token and a host-wide
+ * 				slot, where those are in use
  * Parameters: None
- * Returns: A string of user input
+ * Returns: The job, without a pid yet
+ ****************************************************************************/
+Job admitJob()
+{
+	Job job = { .token = JOB_TOKEN_NONE, .slot = -1, .policy = defaultJobPolicy };
+
+	openMemoryTrigger();
+	// a memory trigger that fired while nothing was waiting on it
+	if (memTriggerFd != -1 && numJobs > 0)
+	{
+		struct pollfd pfd = { memTriggerFd, POLLPRI, 0 };
+		handleMemoryPressure(poll(&pfd, 1, 0) > 0);
+	}
+	waitForAdaptiveRoom();
+	job.token = acquireJobToken();
+	job.slot = acquireJobSlot();
+	return job;
+}
+
+/*****************************************************************************
+ * Description: Gives back what a job was admitted with
+ * Parameters: job = the job, which keeps its pid
+ * Returns: None
+ ****************************************************************************/
+void retireJob(Job *job)
+{
+	releaseJobToken(job->token);
+	releaseJobSlot(job->slot, job->pid);
+	job->token = JOB_TOKEN_NONE;
+	job->slot = -1;
+}
+
+/*****************************************************************************
+ * Description: Opens the trace log named by SMALLSH_TRACE, if set
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void openTrace()
+{
+	const char *path = getenv("SMALLSH_TRACE");
+
+	if (path && *path && !(traceFile = fopen(path, "ae")))
+	{
+		perror("smallsh: SMALLSH_TRACE");
+	}
+}
+
+/*****************************************************************************
+ * Description: Writes a line to the trace log, stamped with the time and
+ * 				the shell's pid
+ * Parameters: format/... = printf style
+ * Returns: None
+ ****************************************************************************/
+void trace(const char *format, ...)
+{
+	struct timespec now;
+	struct tm local;
+	char stamp[32];
+	va_list ap;
+
+	if (!traceFile)
+	{
+		return;
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	localtime_r(&now.tv_sec, &local);
+	strftime(stamp, sizeof(stamp), "%H:%M:%S", &local);
+
+	fprintf(traceFile, "%s.%03ld smallsh[%d] ", stamp, now.tv_nsec / 1000000, (int)getpid());
+	va_start(ap, format);
+	vfprintf(traceFile, format, ap);
+	va_end(ap);
+	fputc('\n', traceFile);
+	fflush(traceFile);
+}
+
+/*****************************************************************************
+ * Description: Gets the time from a clock that never jumps
+ * Parameters: None
+ * Returns: Seconds since an arbitrary start
+ ****************************************************************************/
+double monotonicNow()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*****************************************************************************
+ * Description: Starts adaptive concurrency: arms a PSI trigger on each of
+ * 				/proc/pressure/{cpu,memory,io} and starts the limit at the
+ * 				number of CPUs.
+ * Parameters: ceiling = the most jobs to ever allow (-j N), or 0 for four
+ * 						 per CPU
+ * Returns: None
+ ****************************************************************************/
+void initAdaptive(int ceiling)
+{
+	int cpus = sysconf(_SC_NPROCESSORS_ONLN),
+		i = 0;
+
+	cpus = cpus > 0 ? cpus : 1;
+	adaptiveCeiling = ceiling ? ceiling : 4 * cpus;
+	adaptiveCeiling = adaptiveCeiling < MAX_JOBS ? adaptiveCeiling : MAX_JOBS;
+	adaptiveLimit = cpus < adaptiveCeiling ? cpus : adaptiveCeiling;
+	lastAdapt = monotonicNow();
+
+	for (i = 0; i < PSI_RESOURCES; i++)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/pressure/%s", psiNames[i]);
+		psiFds[i] = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (psiFds[i] != -1 && write(psiFds[i], PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) == -1)
+		{
+			close(psiFds[i]);
+			psiFds[i] = -1;
+		}
+	}
+	trace("adaptive: limit %d, ceiling %d, %s", adaptiveLimit, adaptiveCeiling,
+		  psiFds[0] != -1 ? "PSI triggers " PSI_TRIGGER : "no PSI, using load average");
+}
+
+/*****************************************************************************
+ * Description: Reads a resource's recent pressure
+ * Parameters: resource = index into psiNames
+ * Returns: The "some" avg10 percentage, or 0 if unavailable
+ ****************************************************************************/
+double pressureAvg10(int resource)
+{
+	char path[64],
+		 buf[256];
+	double avg = 0;
+	int fd = -1;
+	ssize_t len = 0;
+
+	snprintf(path, sizeof(path), "/proc/pressure/%s", psiNames[resource]);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		return 0;
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	buf[len > 0 ? len : 0] = '\0';
+	sscanf(buf, "some avg10=%lf", &avg);
+	return avg;
+}
+
+/*****************************************************************************
+ * Description: Checks for pressure, waiting up to timeoutMs for it. A PSI
+ * 				trigger fd polls POLLPRI when its stall threshold is crossed
+ * 				within its window; without PSI, pressure is a 1 minute load
+ * 				average above the number of CPUs.
+ * Parameters: timeoutMs = how long to wait, 0 to just check
+ * Returns: true if there is pressure
+ ****************************************************************************/
+bool checkPressure(int timeoutMs)
+{
+	struct pollfd pfds[PSI_RESOURCES];
+	int numFds = 0,
+		i = 0;
+
+	for (i = 0; i < PSI_RESOURCES; i++)
+	{
+		if (psiFds[i] != -1)
+		{
+			pfds[numFds].fd = psiFds[i];
+			pfds[numFds].events = POLLPRI;
+			pfds[numFds].revents = 0;
+			numFds++;
+		}
+	}
+
+	if (!numFds)
+	{
+		double load = 0;
+		if (timeoutMs)
+		{
+			usleep(timeoutMs * 1000);
+		}
+		return getloadavg(&load, 1) == 1 && load > sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if (poll(pfds, numFds, timeoutMs) <= 0)
+	{
+		return false;
+	}
+	for (i = 0; i < numFds; i++)
+	{
+		if (pfds[i].revents & POLLPRI)
+		{
+			int j = 0;
+			for (j = 0; j < PSI_RESOURCES && psiFds[j] != pfds[i].fd; j++) { }
+			trace("adaptive: %s pressure trigger fired, avg10 %.2f", psiNames[j], pressureAvg10(j));
+		}
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Adjusts the adaptive limit: halved under pressure, and
+ * 				raised by one once pressure has stayed low for an interval
+ * Parameters: pressured = whether there is pressure now
+ * Returns: None
+ ****************************************************************************/
+void adaptConcurrency(bool pressured)
+{
+	double now = monotonicNow();
+	int old = adaptiveLimit,
+		i = 0;
+
+	if (now - lastAdapt < (pressured ? ADAPT_INTERVAL / 2 : ADAPT_INTERVAL))
+	{
+		return;
+	}
+
+	if (pressured)
+	{
+		adaptiveLimit = adaptiveLimit > 1 ? adaptiveLimit / 2 : 1;
+	}
+	else
+	{
+		double load = 0;
+		// rising pressure that hasn't crossed a trigger yet still holds the limit
+		for (i = 0; i < PSI_RESOURCES; i++)
+		{
+			if (psiFds[i] != -1 && pressureAvg10(i) >= PSI_LOW_AVG10)
+			{
+				return;
+			}
+		}
+		if (psiFds[0] == -1 && getloadavg(&load, 1) == 1 && load > 0.7 * sysconf(_SC_NPROCESSORS_ONLN))
+		{
+			return;
+		}
+		adaptiveLimit = adaptiveLimit < adaptiveCeiling ? adaptiveLimit + 1 : adaptiveCeiling;
+	}
+
+	lastAdapt = now;
+	if (adaptiveLimit != old)
+	{
+		trace("adaptive: %s, limit %d -> %d (%d jobs running)", pressured ? "pressure" : "pressure low",
+			  old, adaptiveLimit, numJobs);
+	}
+}
+
+/*****************************************************************************
+ * Description: With -A, holds a new background job until fewer than the
+ * 				adaptive limit are running, reaping jobs and adjusting the
+ * 				limit while it waits
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void waitForAdaptiveRoom()
+{
+	bool held = false;
+
+	if (!adaptiveJobs)
+	{
+		return;
+	}
+
+	adaptConcurrency(checkPressure(0));
+	while (true)
+	{
+		reapJobs();
+		if (numJobs < adaptiveLimit)
+		{
+			break;
+		}
+		if (!held)
+		{
+			trace("adaptive: holding job, %d running, limit %d", numJobs, adaptiveLimit);
+			held = true;
+		}
+		adaptConcurrency(checkPressure(100));
+	}
+	if (held)
+	{
+		trace("adaptive: releasing job, %d running, limit %d", numJobs, adaptiveLimit);
+	}
+}
+
+/*****************************************************************************
+ * Description: Lowers a background job's CPU and I/O priority according to
+ * 				its policy, saving what it had. Only the job's own process is
+ * 				changed; processes it starts while demoted inherit the lower
+ * 				priority.
+ * Parameters: job = the job
+ * Returns: None
+ ****************************************************************************/
+void demoteJob(Job *job)
+{
+	struct sched_param param = { 0 };
+	int ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7);
+
+	if (job->demoted || job->policy == POLICY_NONE)
+	{
+		return;
+	}
+
+	errno = 0;
+	job->savedNice = getpriority(PRIO_PROCESS, job->pid);
+	job->savedSched = sched_getscheduler(job->pid);
+	job->savedIoprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, job->pid);
+	if (job->savedSched == -1 || errno)
+	{
+		return;
+	}
+
+	switch (job->policy)
+	{
+		case POLICY_BATCH: { sched_setscheduler(job->pid, SCHED_BATCH, &param); break; }
+		case POLICY_IDLE:
+		{
+			sched_setscheduler(job->pid, SCHED_IDLE, &param);
+			ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+			break;
+		}
+		case POLICY_NICE:
+		{
+			setpriority(PRIO_PROCESS, job->pid, job->savedNice + 10 < 19 ? job->savedNice + 10 : 19);
+			break;
+		}
+		default: { break; }
+	}
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, job->pid, ioprio);
+	job->demoted = true;
+	trace("priority: demoted job %d (%s)", (int)job->pid, policyNames[job->policy]);
+}
+
+/*****************************************************************************
+ * Description: Gives a demoted job back the priority it had. Without
+ * 				CAP_SYS_NICE a nice increase can't be undone, which is why
+ * 				the default policy is batch.
+ * Parameters: job = the job
+ * Returns: None
+ ****************************************************************************/
+void restoreJob(Job *job)
+{
+	struct sched_param param = { 0 };
+
+	if (!job->demoted)
+	{
+		return;
+	}
+	sched_setscheduler(job->pid, job->savedSched, &param);
+	setpriority(PRIO_PROCESS, job->pid, job->savedNice);
+	if (job->savedIoprio != -1)
+	{
+		syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, job->pid, job->savedIoprio);
+	}
+	job->demoted = false;
+	trace("priority: restored job %d", (int)job->pid);
+}
+
+/*****************************************************************************
+ * Description: Demotes or restores every background job
+ * Parameters: demote = true to demote
+ * Returns: None
+ ****************************************************************************/
+void setJobsDemoted(bool demote)
+{
+	int i = 0;
+
+	if (demote == jobsDemoted)
+	{
+		return;
+	}
+	jobsDemoted = demote;
+	for (i = 0; i < numJobs; i++)
+	{
+		if (demote)
+		{
+			demoteJob(&jobs[i]);
+		}
+		else
+		{
+			restoreJob(&jobs[i]);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Looks up a background job by pid
+ * Parameters: pid = the job's pid
+ * Returns: The job, or NULL if it isn't one
+ ****************************************************************************/
+Job* findJob(pid_t pid)
+{
+	int i = 0;
+	for (i = 0; i < numJobs; i++)
+	{
+		if (jobs[i].pid == pid)
+		{
+			return &jobs[i];
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: bgpolicy [policy [pid...]] - with no arguments, shows the
+ * 				default policy and each job's. With a policy, sets the
+ * 				default for new jobs, or the policy of the jobs given.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if a pid is not a job, or 2 for an unknown policy
+ ****************************************************************************/
+int bgpolicyBuiltin(char **args, int argCount)
+{
+	int policy = 0,
+		result = 0,
+		i = 0;
+
+	if (argCount == 1)
+	{
+		printf("default %s, jobs %s\n", policyNames[defaultJobPolicy], jobsDemoted ? "demoted" : "not demoted");
+		for (i = 0; i < numJobs; i++)
+		{
+			printf("%d %s%s\n", (int)jobs[i].pid, policyNames[jobs[i].policy], jobs[i].demoted ? " (demoted)" : "");
+		}
+		return 0;
+	}
+
+	for (policy = 0; policy <= POLICY_NONE && strcmp(args[1], policyNames[policy]); policy++) { }
+	if (policy > POLICY_NONE)
+	{
+		fprintf(stderr, "smallsh: %s: %s: expected batch, idle, nice or none\n", args[0], args[1]);
+		return 2;
+	}
+
+	if (argCount == 2)
+	{
+		defaultJobPolicy = policy;
+		return 0;
+	}
+	for (i = 2; i < argCount; i++)
+	{
+		Job *job = findJob(atoi(args[i]));
+		if (!job)
+		{
+			fprintf(stderr, "smallsh: %s: %s: no such job\n", args[0], args[i]);
+			result = 1;
+			continue;
+		}
+		// re-demote under the new policy
+		bool wasDemoted = job->demoted;
+		restoreJob(job);
+		job->policy = policy;
+		if (wasDemoted || jobsDemoted)
+		{
+			demoteJob(job);
+		}
+	}
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Checks for room in the job table before a background job is
+ * 				started, reaping finished jobs first
+ * Parameters: None
+ * Returns: true (after printing an error) if there is no room
+ ****************************************************************************/
+bool jobTableFull()
+{
+	reapJobs();
+	if (numJobs < MAX_JOBS)
+	{
+		return false;
+	}
+	fprintf(stderr, "smallsh: too many background jobs\n");
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Reaps and reports finished background jobs, returning their
+ * 				jobserver tokens and joining the <z and >z codecs that are done
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void reapJobs()
+{
+	int bgChildExitMethod = -5,
+		idx = 0;
+
+	while (idx < numJobs)
+	{
+		pid_t actualBgPid = waitpid(jobs[idx].pid, &bgChildExitMethod, WNOHANG);
+
+		// still running
+		if (actualBgPid == 0)
+		{
+			idx++;
+			continue;
+		}
+		finishJob(idx, actualBgPid, bgChildExitMethod);
+	}
+	reapCodecs(false);
+}
+
+/*****************************************************************************
+ * Description: Reports a background job that waitpid has returned for and
+ * 				takes it out of the job table, returning its jobserver token
+ * Parameters: idx = the job's index
+ * 			   reaped = what waitpid returned, -1 if it failed
+ * 			   status = the wait status, if it was reaped
+ * Returns: None
+ ****************************************************************************/
+void finishJob(int idx, pid_t reaped, int status)
+{
+	// if background pid has been reaped, report it.
+	if (reaped > 0)
+	{
+		printf("%d has been reaped.\n", reaped);
+		fflush(stdout);
+		reportExitStatus(status);
+	}
+	retireJob(&jobs[idx]);
+
+	// slide later jobs forward, keeping them oldest first
+	memmove(&jobs[idx], &jobs[idx + 1], (numJobs - idx - 1) * sizeof(Job));
+	numJobs--;
+}
+
+/*****************************************************************************
+ * Description: Leaves background jobs to finish on their own when the shell
+ * 				exits: resumes any it stopped, and returns their tokens so
+ * 				make doesn't lose them, then waits for any of their <z and
+ * 				>z codecs. Registered with atexit, and does nothing in
+ * 				forked children.
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void abandonJobs()
+{
+	int idx = 0;
+
+	if (getpid() != jobsOwner)
+	{
+		return;
+	}
+	for (idx = 0; idx < numJobs; idx++)
+	{
+		if (jobs[idx].stopped)
+		{
+			signalJob(&jobs[idx], SIGCONT);
+		}
+		releaseJobToken(jobs[idx].token);
+		jobs[idx].token = JOB_TOKEN_NONE;
+	}
+	// a >z file is only complete once its codec has written the trailer
+	reapCodecs(true);
+}
+
+/*****************************************************************************
+ * Description: Arms a PSI trigger on /proc/pressure/memory, used to stop
+ * 				background jobs before the box starts swapping. It is armed
+ * 				when the first job is admitted, so shells that never start
+ * 				one, like most smallsh -c, don't pay for it.
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void openMemoryTrigger()
+{
+	if (memTriggerTried)
+	{
+		return;
+	}
+	memTriggerTried = true;
+	memTriggerFd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (memTriggerFd != -1 && write(memTriggerFd, MEM_TRIGGER, strlen(MEM_TRIGGER) + 1) == -1)
+	{
+		close(memTriggerFd);
+		memTriggerFd = -1;
+	}
+}
+
+/*****************************************************************************
+ * Description: Counts the jobs stopped for memory pressure
+ * Parameters: None
+ * Returns: The count
+ ****************************************************************************/
+int countStoppedJobs()
+{
+	int count = 0,
+		i = 0;
+	for (i = 0; i < numJobs; i++)
+	{
+		count += jobs[i].stopped;
+	}
+	return count;
+}
+
+/*****************************************************************************
+ * Description: Stops the newest running background job when the memory
+ * 				trigger fires. Otherwise, once memory pressure has stayed
+ * 				low for an interval, resumes the oldest stopped job.
+ * Parameters: triggered = whether the memory trigger fired
+ * Returns: None
+ ****************************************************************************/
+void handleMemoryPressure(bool triggered)
+{
+	double now = monotonicNow();
+	int i = 0;
+
+	if (triggered)
+	{
+		for (i = numJobs - 1; i >= 0 && jobs[i].stopped; i--) { }
+		if (i >= 0 && signalJob(&jobs[i], SIGSTOP) == 0)
+		{
+			jobs[i].stopped = true;
+			lastMemChange = now;
+			trace("memory: pressure trigger fired, avg10 %.2f, stopped job %d (%d stopped)",
+				  pressureAvg10(1), (int)jobs[i].pid, countStoppedJobs());
+		}
+		return;
+	}
+
+	if (now - lastMemChange < MEM_RESUME_INTERVAL || pressureAvg10(1) >= MEM_RESUME_AVG10)
+	{
+		return;
+	}
+	for (i = 0; i < numJobs && !jobs[i].stopped; i++) { }
+	if (i < numJobs)
+	{
+		signalJob(&jobs[i], SIGCONT);
+		jobs[i].stopped = false;
+		lastMemChange = now;
+		trace("memory: pressure low, resumed job %d (%d stopped)", (int)jobs[i].pid, countStoppedJobs());
+	}
+}
+
+/*****************************************************************************
+ * Description: Waits for a child to exit. While there are background jobs
+ * 				to manage, it polls the child's pidfd together with the
+ * 				memory trigger, so jobs are stopped and resumed during a
+ * 				long foreground command.
+ * Parameters: pid = the child
+ * 			   status = receives its wait status
+ * Returns: None
+ ****************************************************************************/
+void waitForChild(pid_t pid, int *status)
+{
+	int pidfd = -1;
+
+	if (memTriggerFd != -1 && numJobs > 0)
+	{
+		pidfd = syscall(SYS_pidfd_open, pid, 0);
+	}
+	while (pidfd != -1)
+	{
+		struct pollfd pfds[2] = { { pidfd, POLLIN, 0 }, { memTriggerFd, POLLPRI, 0 } };
+		int ready = poll(pfds, 2, countStoppedJobs() ? MEM_RESUME_INTERVAL * 1000 : -1);
+
+		if ((ready == -1 && errno != EINTR) || pfds[0].revents)
+		{
+			break;
+		}
+		handleMemoryPressure(ready > 0 && (pfds[1].revents & POLLPRI));
+	}
+	if (pidfd != -1)
+	{
+		close(pidfd);
+	}
+
+	while (waitpid(pid, status, 0) == -1)
+	{
+		// the SIGTSTP handler may have reaped it first
+		if (errno != EINTR)
+		{
+			if (fgExitFromSignal != -5)
+			{
+				*status = fgExitFromSignal;
+			}
+			break;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: At the prompt, waits for a line from a terminal while
+ * 				watching the memory trigger for background jobs. Jobs stay
+ * 				demoted while the prompt is fresh and are restored once it
+ * 				has sat idle for PROMPT_ACTIVE_TIME. Terminals hand over a
+ * 				line per read, so nothing can be left waiting in stdin's
+ * 				buffer.
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void waitForInput()
+{
+	double shown = monotonicNow();
+
+	// without a terminal there is no one typing at the prompt
+	if (!isatty(STDIN_NUM))
+	{
+		setJobsDemoted(false);
+		return;
+	}
+	while (numJobs > 0)
+	{
+		struct pollfd pfds[2] = { { STDIN_NUM, POLLIN, 0 }, { memTriggerFd, POLLPRI, 0 } };
+		double idle = monotonicNow() - shown;
+		int timeout = -1;
+
+		if (jobsDemoted && idle >= PROMPT_ACTIVE_TIME)
+		{
+			setJobsDemoted(false);
+		}
+		if (jobsDemoted)
+		{
+			timeout = (PROMPT_ACTIVE_TIME - idle) * 1000 + 1;
+		}
+		if (memTriggerFd != -1 && countStoppedJobs() && (timeout == -1 || timeout > MEM_RESUME_INTERVAL * 1000))
+		{
+			timeout = MEM_RESUME_INTERVAL * 1000;
+		}
+
+		int ready = poll(pfds, 2, timeout);
+		if ((ready == -1 && errno != EINTR) || pfds[0].revents)
+		{
+			break;
+		}
+		if (memTriggerFd != -1)
+		{
+			handleMemoryPressure(ready > 0 && (pfds[1].revents & POLLPRI));
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: jobs - lists the background jobs: pid, whether running or
+ * 				stopped for memory pressure, the priority policy, and the
+ * 				jobserver token and host-wide slot held
+ * Parameters: args/argCount = the command words
+ * Returns: 0
+ ****************************************************************************/
+int jobsBuiltin(char **args, int argCount)
+{
+	int i = 0;
+
+	(void)args;
+	(void)argCount;
+	reapJobs();
+	for (i = 0; i < numJobs; i++)
+	{
+		Job *job = &jobs[i];
+		printf("[%d] %d %s, %s%s", i + 1, (int)job->pid, job->stopped ? "Stopped (memory pressure)" : "Running",
+			   policyNames[job->policy], job->demoted ? " (demoted)" : "");
+		if (job->token != JOB_TOKEN_NONE)
+		{
+			printf(", jobserver token");
+		}
+		if (job->slot != -1)
+		{
+			printf(", slot %d", job->slot);
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ * Description: Finds the end of a ( list ) or { list; } group, skipping
+ * 				quotes, ${...} and nested groups.
+ * Parameters: text = the group, starting at its ( or {
+ * Returns: A pointer to the matching ) or }, or NULL if there is none
+ ****************************************************************************/
+char* findGroupEnd(char *text)
+{
+	char open = text[0],
+		 quote = '\0';
+	int depth = 0,
+		braces = 0;
+	char *p = text;
+
+	for (; *p; p++)
+	{
+		bool atWordStart = (p == text || p[-1] == ' ' || p[-1] == '\t' || p[-1] == ';');
+		if (quote)
+		{
+			if (*p == '\\' && quote == '"' && p[1]) { p++; }
+			else if (*p == quote) { quote = '\0'; }
+		}
+		else if (*p == '\\' && p[1]) { p++; }
+		else if (*p == '\'' || *p == '"') { quote = *p; }
+		else if (*p == '$' && p[1] == '{') { braces++; p++; }
+		else if (*p == '}' && braces > 0) { braces--; }
+		else if (open == '(' && *p == '(') { depth++; }
+		else if (open == '(' && *p == ')' && --depth == 0) { return p; }
+		// braces only group as words of their own
+		else if (open == '{' && *p == '{' && atWordStart && (isspace((unsigned char)p[1]) || !p[1])) { depth++; }
+		else if (open == '{' && *p == '}' && atWordStart && --depth == 0) { return p; }
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Decides whether a subshell body could change the shell's
+ * 				own state - the directory, variables, background jobs or the
+ * 				shell's existence - in which case it must run in a child.
+ * 				This errs on the side of forking: any command word that is
+ * 				such a builtin, an assignment, or not known until expanded
+ * 				counts, as do := and =~ anywhere.
+ * Parameters: body = the text between the parentheses
+ * Returns: true if the body must be run in a forked child
+ ****************************************************************************/
+bool mutatesShellState(const char *body)
+{
+	static const char *mutators[] = { "cd", "exit", "declare", "unset", "read", "mapfile",
+									  "readarray", "wait", "sleep", "kill", "bgpolicy", "jobs", NULL };
+	const char *p = body;
+	bool commandStart = true;
+
+	if (strstr(body, ":=") || strstr(body, "=~"))
+	{
+		return true;
+	}
+
+	while (*p)
+	{
+		if (isspace((unsigned char)*p))
+		{
+			p++;
+			continue;
+		}
+		if (strchr(";&|(){}", *p))
+		{
+			// a single & starts a background job
+			if (*p == '&' && p[1] != '&' && (p == body || p[-1] != '&'))
+			{
+				return true;
+			}
+			commandStart = true;
+			p++;
+			continue;
+		}
+
+		size_t len = strcspn(p, " \t;&|(){}");
+		if (commandStart)
+		{
+			char *word = strndup(p, len);
+			bool mutates = isAssignment(word) || strchr(word, '$') || strchr(word, '`') ||
+						   (!strcmp(word, "printf") && printfSetsVar(p + len));
+			int i = 0;
+			for (i = 0; mutators[i] && !mutates; i++)
+			{
+				mutates = !strcmp(word, mutators[i]);
+			}
+			free(word);
+			if (mutates)
+			{
+				return true;
+			}
+		}
+		commandStart = false;
+		p += len;
+	}
+	return false;
+}
+
+/*****************************************************************************
+ * Description: Runs a ( list ) subshell or { list; } group, followed by
+ * 				optional < > redirects and &. Groups always run in the
+ * 				shell. Subshells are forked only if they are backgrounded
+ * 				or could change shell state; otherwise they run in the shell
+ * 				too, with the redirects applied around them, since the result
+ * 				is the same without the cost of a fork.
+ * Parameters: text = the group, starting at its ( or {
+ * 			   mayExec = true if nothing runs after the group
+ * Returns: None
+ ****************************************************************************/
+void runGroup(char *text, bool mayExec)
+{
+	bool subshell = text[0] == '(',
+		 background = false,
+		 compressed[2] = { false, false };
+	CodecStream *codecs[2] = { NULL, NULL };
+	char *close = findGroupEnd(text),
+		 *inputfile = NULL,
+		 *outputfile = NULL;
+
+	if (!close)
+	{
+		fprintf(stderr, "smallsh: syntax error: missing `%s'\n", subshell ? ")" : "}");
+		childExitMethod = W_EXITCODE(2, 0);
+		return;
+	}
+	*close = '\0';
+	char *body = text + 1,
+		 *cursor = close + 1,
+		 *piece = NULL;
+
+	// what follows the group can only be redirects and &
+	while ((piece = nextRawWord(&cursor)))
+	{
+		char **target = NULL;
+		if (piece[0] == '<' || piece[0] == '>')
+		{
+			// <z and >z go through a gzip codec
+			if (!piece[1] || !strcmp(piece + 1, "z"))
+			{
+				target = piece[0] == '<' ? &inputfile : &outputfile;
+				compressed[piece[0] == '>'] = piece[1] == 'z';
+			}
+		}
+		if (!strcmp(piece, "&"))
+		{
+			background = true;
+		}
+		else if (target && (piece = nextRawWord(&cursor)))
+		{
+			free(*target);
+			*target = expandToString(piece);
+		}
+		else
+		{
+			fprintf(stderr, "smallsh: syntax error near `%s'\n", piece ? piece : "newline");
+			childExitMethod = W_EXITCODE(2, 0);
+			free(inputfile);
+			free(outputfile);
+			return;
+		}
+	}
+	background = background && !foregroundOnly;
+	if (background && jobTableFull())
+	{
+		childExitMethod = W_EXITCODE(1, 0);
+		free(inputfile);
+		free(outputfile);
+		return;
+	}
+
+	if (!subshell || (!background && !mutatesShellState(body)))
+	{
+		RedirectFrame frame;
+		if (startCodecs(&inputfile, &outputfile, compressed, codecs) && pushRedirects(inputfile, outputfile, &frame))
+		{
+			/* the redirects are already on fds 0/1, so a last command can exec,
+			 * unless the shell is running a codec for them */
+			runCommandLine(body, mayExec && !codecs[0] && !codecs[1]);
+			popRedirects(&frame);
+		}
+		else
+		{
+			childExitMethod = W_EXITCODE(1, 0);
+		}
+		if (!finishCodecs(codecs, 0) && !exitCode(childExitMethod))
+		{
+			childExitMethod = W_EXITCODE(1, 0);
+		}
+	}
+	else if (!startCodecs(&inputfile, &outputfile, compressed, codecs))
+	{
+		childExitMethod = W_EXITCODE(1, 0);
+	}
+	else
+	{
+		Job job = { .token = JOB_TOKEN_NONE, .slot = -1, .policy = POLICY_NONE };
+		if (background)
+		{
+			job = admitJob();
+		}
+		fflush(stdout);
+		pid_t forkPid = fork();
+		switch (forkPid)
+		{
+			case -1: { perror("Fork failure, get a spoon.\n"); exit(-2); break; }
+			case 0:
+			{
+				redirectStdIO(inputfile, outputfile, background);
+				dropCodecs(codecs);
+				if (!background)
+				{
+					sigaction(SIGINT, &default_action, NULL);
+				}
+				else
+				{
+					setpgid(0, 0);
+				}
+				sigaction(SIGTSTP, &ignore_action, NULL);
+
+				// the subshell's own commands return to its redirected fds
+				savedStdin = saveFd(STDIN_NUM);
+				savedStdout = saveFd(STDOUT_NUM);
+				// the parent's jobs are not the subshell's to wait on or kill
+				numJobs = 0;
+				jobsOwner = getpid();
+
+				runCommandLine(body, true);
+				exitShell(exitCode(childExitMethod));
+			}
+			default:
+			{
+				if (background)
+				{
+					trackBackground(forkPid, &job);
+				}
+				else
+				{
+					waitForeground(forkPid);
+				}
+				if (!finishCodecs(codecs, background ? forkPid : 0) && !background && !exitCode(childExitMethod))
+				{
+					childExitMethod = W_EXITCODE(1, 0);
+				}
+			}
+		}
+	}
+	free(inputfile);
+	free(outputfile);
+}
+
+/*****************************************************************************
+ * Description: Converts a wait status to a shell exit code
+ * Parameters: exitMethod = the status from waitpid, or -5 if no command has
+ * 							run yet
+ * Returns: The exit code, 128 + the signal number if it was signaled
+ ****************************************************************************/
+int exitCode(int exitMethod)
+{
+	if (exitMethod == -5)
+	{
+		return 0;
+	}
+	if (WIFEXITED(exitMethod))
+	{
+		return WEXITSTATUS(exitMethod);
+	}
+	if (WIFSIGNALED(exitMethod))
+	{
+		return 128 + WTERMSIG(exitMethod);
+	}
+	return 1;
+}
+
+/*****************************************************************************
+ * Description: Displays CLI prompt and waits for user input.
+ * Parameters: None
+ * Returns: A string of the command the user input
+ ****************************************************************************/
+char* termPrompt()
+{
+	printAndFlush(":");
+	waitForInput();
+	return getUserCmd();
+}
+
+/*****************************************************************************
+ * Description: Waits for user to provide input to stdin. Source: Class reading
+ * Parameters: None
+ * Returns: A string of user input
+ ****************************************************************************/
+char* getUserCmd()
+{
+	char *lineEntered = NULL;
+	size_t bufferSize = 0;
+	int numCharsEntered = 0;
+
+	while (true)
+	{
+		// get line from user
+		numCharsEntered = getline(&lineEntered, &bufferSize, stdin);
+		if (numCharsEntered == -1)
+			clearerr(stdin);
+		else
+			break;  // loop control - exits when we have input
+	}
+	// get rid of newline at end
+	lineEntered[numCharsEntered - 1] = '\0';
+	return lineEntered;
+}
+
+/*****************************************************************************
+ * Description: Prints a line and flushes afterward
+ * Parameters: line = the line to print
+ * Returns: None
+ ****************************************************************************/
+void printAndFlush(char *line)
+{
+	printf("%s", line);
+	fflush(stdout);
+}
+
+/*****************************************************************************
+ * Description: Splits a command line into words and expands each one. Words
+ * 				may be quoted with '' or "" and may contain $ expansions,
+ * 				which can produce several arguments (e.g. ${arr[@]}).
+ * Parameters: userline = the line to parse, modified in place
+ * 			   args = preallocated argument buffers, NULL terminated on return
+ * 			   argCount = set to the number of arguments found
+ * 			   input/output = set to the redirect filenames, if any
+ * 			   compressed = [0] and [1] set if input/output were given with
+ * 			   				<z or >z rather than < or >
+ * 			   backgroundFlag = set if the line ends in &
+ * Returns: false (after printing why) if an argument is too long or there
+ * 			are too many, in which case there are no arguments
+ ****************************************************************************/
+bool parseUserCmd(char *userline, char **args, int *argCount, char **input, char **output, bool *compressed, bool *backgroundFlag)
+{
+	char *cursor = userline;
+	char *piece = nextRawWord(&cursor);
+	int idx = 0;
+	bool fits = true;
+
+	while (piece && fits)
+	{
+		if (idx == 0 && piece[0] == '#') // comment, ignore the rest of the line
+		{
+			addArg(args, &idx, "#");
+			break;
+		}
+		else if (idx > 1 && !strcmp(args[0], "[[") && strcmp(piece, "]]") &&
+				 (!strcmp(args[idx - 1], "==") || !strcmp(args[idx - 1], "=") ||
+				  !strcmp(args[idx - 1], "!=") || !strcmp(args[idx - 1], "=~")))
+		{
+			// a [[ ]] pattern: its quoted parts are escaped to match literally
+			char *pattern = expandPatternText(piece, args[idx - 1][1] == '~' ? REGEX_SPECIAL : GLOB_SPECIAL);
+			fits = addArg(args, &idx, pattern);
+			free(pattern);
+		}
+		else if (idx > 0 && !strcmp(args[0], "[[") && strcmp(piece, "]]"))
+		{
+			// inside [[ ]] < and > compare strings and empty words are kept
+			FieldList expanded = { 0 };
+			expandWord(piece, &expanded, true);
+
+			int i = 0;
+			for (i = 0; i < expanded.count && fits; i++)
+			{
+				fits = addArg(args, &idx, expanded.fields[i]);
+			}
+			fieldsFree(&expanded);
+		}
+		else if (isAssignment(piece) && piece[strcspn(piece, "=") + 1] != '(' &&
+				 (idx == 0 || !strcmp(args[0], "declare") || isAssignment(args[idx - 1])))
+		{
+			// an assignment value is one word, array elements joined by spaces
+			char *value = expandToString(piece);
+			fits = addArg(args, &idx, value);
+			free(value);
+		}
+		else if (!strcmp(piece, "<") || !strcmp(piece, "<z")) // there is an input redirect
+		{
+			compressed[0] = piece[1] == 'z';
+			piece = nextRawWord(&cursor);
+			if (piece)
+			{
+				free(*input);
+				*input = expandToString(piece);
+			}
+		}
+		else if (!strcmp(piece, ">") || !strcmp(piece, ">z")) // there is an output redirect
+		{
+			compressed[1] = piece[1] == 'z';
+			piece = nextRawWord(&cursor);
+			if (piece)
+			{
+				free(*output);
+				*output = expandToString(piece);
+			}
+		}
+		else if (!strcmp(piece, "&")) // this piece is our background flag
+		{
+			*backgroundFlag = true;
+		}
+		else // this piece is an argument, possibly expanding to several
+		{
+			FieldList expanded = { 0 };
+			expandWord(piece, &expanded, false);
+
+			int i = 0;
+			for (i = 0; i < expanded.count && fits; i++)
+			{
+				fits = addArg(args, &idx, expanded.fields[i]);
+			}
+			fieldsFree(&expanded);
+		}
+	
+		// advance the token
+		if (piece)
+		{
+			piece = nextRawWord(&cursor);
+		}
+	}
+	// a command cut short is not run at all
+	idx = fits ? idx : 0;
+	*argCount = idx;
+	/* free and set the next available slot to NULL so we can pass the 
+	 * arg array to execvp */
+	free(args[idx]);
+	args[idx] = NULL;
+	return fits;
+}
+
+/*****************************************************************************
+ * Description: Copies an argument into the next of the fixed size argument
+ * 				buffers.
+ * Parameters: args = the MAX_LINE_ARGS buffers of MAX_LINE_LENGTH bytes
+ * 			   idx = the next buffer, advanced past it
+ * 			   src = the string to copy
+ * Returns: false (after printing why) if the argument is too long or there
+ * 			is no buffer left for it
+ ****************************************************************************/
+bool addArg(char **args, int *idx, const char *src)
+{
+	if (strlen(src) >= (size_t)MAX_LINE_LENGTH)
+	{
+		fprintf(stderr, "smallsh: %.20s...: argument too long (over %d bytes)\n", src, MAX_LINE_LENGTH - 1);
+		return false;
+	}
+	if (*idx >= MAX_LINE_ARGS - 1)
+	{
+		fprintf(stderr, "smallsh: %s: too many arguments (over %d)\n", args[0], MAX_LINE_ARGS - 1);
+		return false;
+	}
+	strcpy(args[(*idx)++], src);
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Changes the CWD to the directory specified by filepath.
+ * Parameters: filepath = the location of the directory to switch to
+ * Returns: 0 on success, -1 on failure
+ ****************************************************************************/
+int changeDirectory(char *filepath)
+{
+	int failure = 0;
+	// check for empty argument
+	if (!filepath)
+	{
+		failure = chdir(getenv("HOME"));
+	}			
+	// relative filepath
+	else
+	{
+		failure = chdir(filepath);
+	}
+
+	if (failure)
+	{
+		printf("Error with chdir: %d\n", failure);
+		fflush(stdout);
+	}
+	return failure;
+}
+
+/*****************************************************************************
+ * Description: Terminates the parent process and all background jobs
+ * Parameters: code = the shell's exit code
+ * Returns: None
+ ****************************************************************************/
+void terminateJobs(int code)
+{
+	int exitMethod = -5;
+
+	int i = 0;
+	for (i = 0; i < numJobs; i++)
+	{
+		signalJob(&jobs[i], SIGTERM);
+		// a stopped job only gets the SIGTERM once it is continued
+		if (jobs[i].stopped)
+		{
+			signalJob(&jobs[i], SIGCONT);
+		}
+		waitpid(jobs[i].pid, &exitMethod, 0);
+		retireJob(&jobs[i]);
+	}
+	numJobs = 0;
+
+	// exit may be running in a subshell's child
+	exitShell(code);
+}
+
+/*****************************************************************************
+ * Description: Opens a private, non blocking, close on exec file description
+ * 				for a pipe or fifo fd, through /proc/self/fd. Setting
+ * 				O_NONBLOCK on the fd itself would change it for every process
+ * 				sharing the jobserver.
+ * Parameters: fd = the fd to reopen
+ * 			   flags = O_RDONLY or O_WRONLY
+ * Returns: The new fd, or -1 on failure
+ ****************************************************************************/
+int reopenNonblocking(int fd, int flags)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	return open(path, flags | O_NONBLOCK | O_CLOEXEC);
+}
+
+/*****************************************************************************
+ * Description: Joins the GNU make jobserver named in MAKEFLAGS, if any: the
+ * 				fifo:PATH style of make 4.4, or an inherited R,W pipe. The
+ * 				last --jobserver-auth (or older --jobserver-fds) wins.
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void joinJobserver()
+{
+	const char *flags = getenv("MAKEFLAGS"),
+			   *auth = NULL,
+			   *p = flags;
+	int readFd = -1,
+		writeFd = -1;
+
+	while (p && *p)
+	{
+		const char *found = NULL;
+		if (!strncmp(p, "--jobserver-auth=", 17)) { found = p + 17; }
+		else if (!strncmp(p, "--jobserver-fds=", 16)) { found = p + 16; }
+		if (found && (p == flags || p[-1] == ' '))
+		{
+			auth = found;
+		}
+		p++;
+	}
+	if (!auth)
+	{
+		return;
+	}
+
+	if (!strncmp(auth, "fifo:", 5))
+	{
+		char *path = strndup(auth + 5, strcspn(auth + 5, " "));
+		jobserverRead = jobserverWrite = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		free(path);
+		return;
+	}
+
+	// make only leaves the pipe open for commands it knows are recursive
+	if (sscanf(auth, "%d,%d", &readFd, &writeFd) != 2 || readFd < 0 || writeFd < 0 ||
+		fcntl(readFd, F_GETFD) == -1 || fcntl(writeFd, F_GETFD) == -1)
+	{
+		return;
+	}
+	jobserverFds[0] = readFd;
+	jobserverFds[1] = writeFd;
+	jobserverWrite = writeFd;
+	jobserverRead = reopenNonblocking(readFd, O_RDONLY);
+	if (jobserverRead == -1)
+	{
+		// no /proc - poll and read the shared fd, which may briefly block
+		jobserverRead = readFd;
+	}
+}
+
+/*****************************************************************************
+ * Description: Makes the shell a jobserver for limit concurrent jobs, for
+ * 				its own background jobs and any make (or other client) run
+ * 				under it. Like make, the shell keeps one implicit token and
+ * 				puts the other limit - 1 in a pipe named in MAKEFLAGS.
+ * Parameters: limit = the number of jobs, at least 1
+ * Returns: None
+ ****************************************************************************/
+void createJobserver(int limit)
+{
+	int fds[2],
+		i = 0;
+	char *flags = NULL;
+	const char *oldFlags = getenv("MAKEFLAGS");
+
+	if (pipe(fds) == -1)
+	{
+		perror("smallsh: jobserver");
+		return;
+	}
+	// out of the way of low fds, and not close on exec, so clients inherit them
+	jobserverFds[0] = fcntl(fds[0], F_DUPFD, SHELL_FD_MIN);
+	jobserverFds[1] = fcntl(fds[1], F_DUPFD, SHELL_FD_MIN);
+	close(fds[0]);
+	close(fds[1]);
+
+	for (i = 0; i < limit - 1; i++)
+	{
+		while (write(jobserverFds[1], "+", 1) == -1 && errno == EINTR) { }
+	}
+
+	if (asprintf(&flags, "%s%s-j%d --jobserver-auth=%d,%d", oldFlags ? oldFlags : "", oldFlags ? " " : "",
+				 limit, jobserverFds[0], jobserverFds[1]) != -1)
+	{
+		setenv("MAKEFLAGS", flags, 1);
+		free(flags);
+	}
+
+	jobserverWrite = jobserverFds[1];
+	jobserverRead = reopenNonblocking(jobserverFds[0], O_RDONLY);
+	if (jobserverRead == -1)
+	{
+		jobserverRead = jobserverFds[0];
+	}
+}
+
+/*****************************************************************************
+ * Description: Gets a jobserver token for a background job, waiting until
+ * 				one is free. The shell's implicit token goes first. While
+ * 				waiting, finished jobs are reaped so their tokens come back.
+ * Parameters: None
+ * Returns: The token, JOB_TOKEN_IMPLICIT, or JOB_TOKEN_NONE if there is no
+ * 			jobserver (or it has gone away)
+ ****************************************************************************/
+int acquireJobToken()
+{
+	unsigned char token = 0;
+
+	if (jobserverRead == -1)
+	{
+		return JOB_TOKEN_NONE;
+	}
+	if (!implicitTokenUsed)
+	{
+		implicitTokenUsed = true;
+		return JOB_TOKEN_IMPLICIT;
+	}
+
+	while (true)
+	{
+		ssize_t got = read(jobserverRead, &token, 1);
+		if (got == 1)
+		{
+			return token;
+		}
+		if (got == 0 || (errno != EAGAIN && errno != EINTR))
+		{
+			return JOB_TOKEN_NONE;
+		}
+
+		// a reaped job may free a token (or the implicit one)
+		reapJobs();
+		if (!implicitTokenUsed)
+		{
+			implicitTokenUsed = true;
+			return JOB_TOKEN_IMPLICIT;
+		}
+		struct pollfd pfd = { jobserverRead, POLLIN, 0 };
+		poll(&pfd, 1, 100);
+	}
+}
+
+/*****************************************************************************
+ * Description: Returns a background job's jobserver token
+ * Parameters: token = from acquireJobToken
+ * Returns: None
+ ****************************************************************************/
+void releaseJobToken(int token)
+{
+	unsigned char byte = token;
+
+	if (token == JOB_TOKEN_IMPLICIT)
+	{
+		implicitTokenUsed = false;
+	}
+	else if (token >= 0)
+	{
+		while (write(jobserverWrite, &byte, 1) == -1 && errno == EINTR) { }
+	}
+}
+
+/*****************************************************************************
+ * Description: Reads a process's start time, which together with its pid
+ * 				identifies it even if the pid is later reused
+ * Parameters: pid = the process
+ * Returns: The start time in clock ticks since boot, or 0 if unknown
+ ****************************************************************************/
+uint64_t processStartTime(pid_t pid)
+{
+	char path[64],
+		 buf[1024];
+	unsigned long long start = 0;
+	int fd = -1,
+		field = 0;
+	ssize_t len = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		return 0;
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+	{
+		return 0;
+	}
+	buf[len] = '\0';
+
+	// the command name may hold spaces and parens, so count from the last )
+	char *p = strrchr(buf, ')');
+	for (field = 2; p && field < 22; field++)
+	{
+		p = strchr(p + 1, ' ');
+	}
+	if (p)
+	{
+		sscanf(p + 1, "%llu", &start);
+	}
+	return start;
+}
+
+/*****************************************************************************
+ * Description: Checks that a process is still running and is the same one.
+ * 				pidfd_open fails with ESRCH once a process is reaped, and the
+ * 				pidfd polls readable as soon as it exits, so a zombie that
+ * 				its parent (or init) hasn't reaped yet counts as dead.
+ * Parameters: pid = the process
+ * 			   start = its start time, or 0 to skip that check
+ * Returns: true if it is running (or can't be proven dead)
+ ****************************************************************************/
+bool isProcessAlive(pid_t pid, uint64_t start)
+{
+	int pidfd = syscall(SYS_pidfd_open, pid, 0);
+
+	if (pidfd == -1)
+	{
+		return errno != ESRCH;
+	}
+	struct pollfd pfd = { pidfd, POLLIN, 0 };
+	bool alive = poll(&pfd, 1, 0) == 0 && (!start || processStartTime(pid) == start);
+	close(pidfd);
+	return alive;
+}
+
+/*****************************************************************************
+ * Description: Maps the host-wide job slot table, creating it if this is the
+ * 				first shell to opt in. The limit is set by whichever shell
+ * 				creates the table.
+ * Parameters: limitText = SMALLSH_SLOTS, the number of slots
+ * Returns: None
+ ****************************************************************************/
+void openSlotTable(const char *limitText)
+{
+	char name[64];
+	size_t size = sizeof(SlotTable);
+	int limit = atoi(limitText),
+		fd = -1,
+		tries = 0;
+	bool created = true;
+
+	if (limit < 1 || limit > MAX_JOB_SLOTS)
+	{
+		fprintf(stderr, "smallsh: SMALLSH_SLOTS: expected 1 to %d slots\n", MAX_JOB_SLOTS);
+		return;
+	}
+
+	snprintf(name, sizeof(name), "%s.%d", SLOT_SHM_NAME, (int)getuid());
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd == -1 && errno == EEXIST)
+	{
+		created = false;
+		fd = shm_open(name, O_RDWR | O_CLOEXEC, 0600);
+	}
+	if (fd == -1 || (created && ftruncate(fd, size) == -1))
+	{
+		perror("smallsh: job slots");
+		if (fd != -1) { close(fd); }
+		return;
+	}
+
+	SlotTable *table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (table == MAP_FAILED)
+	{
+		perror("smallsh: job slots");
+		return;
+	}
+
+	if (created)
+	{
+		atomic_store(&table->limit, limit);
+		atomic_store(&table->magic, SLOT_TABLE_MAGIC);
+	}
+	else
+	{
+		// the creator may still be setting it up
+		while (atomic_load(&table->magic) != SLOT_TABLE_MAGIC && tries++ < 100)
+		{
+			usleep(1000);
+		}
+		if (atomic_load(&table->magic) != SLOT_TABLE_MAGIC)
+		{
+			fprintf(stderr, "smallsh: job slots: %s is not a slot table\n", name);
+			munmap(table, size);
+			return;
+		}
+	}
+	slotTable = table;
+}
+
+/*****************************************************************************
+ * Description: Frees a slot and wakes the shells waiting for one
+ * Parameters: slot = the slot
+ * Returns: None
+ ****************************************************************************/
+void freeJobSlot(JobSlot *slot)
+{
+	atomic_store(&slot->job, 0);
+	atomic_store(&slot->shell, 0);
+	atomic_fetch_add(&slotTable->released, 1);
+	syscall(SYS_futex, &slotTable->released, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*****************************************************************************
+ * Description: Lists this shell as waiting for a slot, for slots to show.
+ * 				Entries left by shells that died waiting are taken over.
+ * Parameters: None
+ * Returns: The entry index, or -1 if the list is full
+ ****************************************************************************/
+int addSlotWaiter()
+{
+	pid_t self = getpid();
+	int i = 0;
+
+	for (i = 0; i < MAX_JOB_SLOTS; i++)
+	{
+		pid_t old = atomic_load(&slotTable->waiting[i]);
+		if ((!old || !isProcessAlive(old, 0)) &&
+			atomic_compare_exchange_strong(&slotTable->waiting[i], &old, self))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*****************************************************************************
+ * Description: Frees slots whose job has exited, or whose shell died before
+ * 				starting the job, without the slot being given back - the
+ * 				shell was killed, or exited leaving the job to finish.
+ * Parameters: None
+ * Returns: The number of slots freed
+ ****************************************************************************/
+int sweepJobSlots()
+{
+	int freed = 0,
+		i = 0;
+
+	for (i = 0; i < MAX_JOB_SLOTS; i++)
+	{
+		JobSlot *slot = &slotTable->slots[i];
+		pid_t shell = atomic_load(&slot->shell),
+			  job = atomic_load(&slot->job);
+
+		if (!shell)
+		{
+			continue;
+		}
+		bool alive = job ? isProcessAlive(job, atomic_load(&slot->jobStart))
+						 : isProcessAlive(shell, atomic_load(&slot->shellStart));
+		// recheck the owner, so a slot freed and retaken meanwhile is left alone
+		if (!alive && atomic_load(&slot->shell) == shell && atomic_load(&slot->job) == job)
+		{
+			freeJobSlot(slot);
+			freed++;
+		}
+	}
+	return freed;
+}
+
+/*****************************************************************************
+ * Description: Takes a host-wide slot for a background job, sleeping on the
+ * 				table's futex while all are in use. Every SLOT_SWEEP_MS it
+ * 				also reaps this shell's own jobs and frees dead holders.
+ * Parameters: None
+ * Returns: The slot index, or -1 if slots are not in use
+ ****************************************************************************/
+int acquireJobSlot()
+{
+	pid_t self = getpid();
+	uint64_t selfStart = 0;
+	int waiter = -1;
+
+	if (!slotTable)
+	{
+		return -1;
+	}
+
+	while (true)
+	{
+		uint32_t seen = atomic_load(&slotTable->released),
+				 limit = atomic_load(&slotTable->limit);
+		int i = 0;
+
+		for (i = 0; i < (int)limit && i < MAX_JOB_SLOTS; i++)
+		{
+			JobSlot *slot = &slotTable->slots[i];
+			pid_t expected = 0;
+			if (atomic_compare_exchange_strong(&slot->shell, &expected, self))
+			{
+				selfStart = selfStart ? selfStart : processStartTime(self);
+				atomic_store(&slot->shellStart, selfStart);
+				atomic_store(&slot->job, 0);
+				if (waiter != -1)
+				{
+					atomic_store(&slotTable->waiting[waiter], 0);
+				}
+				return i;
+			}
+		}
+
+		if (sweepJobSlots())
+		{
+			continue;
+		}
+		reapJobs();
+
+		// sleep until a slot is freed, unless one was freed since we looked
+		struct timespec timeout = { 0, SLOT_SWEEP_MS * 1000000L };
+		if (waiter == -1)
+		{
+			waiter = addSlotWaiter();
+		}
+		syscall(SYS_futex, &slotTable->released, FUTEX_WAIT, seen, &timeout, NULL, 0);
+	}
+}
+
+/*****************************************************************************
+ * Description: Records the job started in a slot
+ * Parameters: slot = the slot index, or -1
+ * 			   pid = the job
+ * Returns: None
+ ****************************************************************************/
+void setJobSlotJob(int slot, pid_t pid)
+{
+	if (slot == -1)
+	{
+		return;
+	}
+	atomic_store(&slotTable->slots[slot].jobStart, processStartTime(pid));
+	atomic_store(&slotTable->slots[slot].job, pid);
+}
+
+/*****************************************************************************
+ * Description: Gives back a job's slot, unless it has already been swept
+ * 				up (the job exited before being reaped) and taken again
+ * Parameters: slot = the slot index, or -1
+ * 			   pid = the job, or 0 if it never started
+ * Returns: None
+ ****************************************************************************/
+void releaseJobSlot(int slot, pid_t pid)
+{
+	if (slot == -1)
+	{
+		return;
+	}
+	JobSlot *held = &slotTable->slots[slot];
+	if (atomic_load(&held->shell) == getpid() && atomic_load(&held->job) == pid)
+	{
+		freeJobSlot(held);
+	}
+}
+
+/*****************************************************************************
+ * Description: slots - shows the host-wide job slots: the limit, how many
+ * 				are used, how many shells are waiting, and who holds each
+ * Parameters: args/argCount = the command words
+ * Returns: 0, or 1 if slots are not in use
+ ****************************************************************************/
+int slotsBuiltin(char **args, int argCount)
+{
+	int used = 0,
+		waiting = 0,
+		i = 0;
+
+	(void)argCount;
+	if (!slotTable)
+	{
+		fprintf(stderr, "smallsh: %s: not enabled, set SMALLSH_SLOTS to the number of slots\n", args[0]);
+		return 1;
+	}
+
+	// don't show slots or waiters left by processes that are gone
+	sweepJobSlots();
+	for (i = 0; i < MAX_JOB_SLOTS; i++)
+	{
+		pid_t waiter = atomic_load(&slotTable->waiting[i]);
+		used += atomic_load(&slotTable->slots[i].shell) != 0;
+		waiting += waiter && isProcessAlive(waiter, 0);
+	}
+	printf("%d of %u slots used, %d waiting\n", used, atomic_load(&slotTable->limit), waiting);
+
+	for (i = 0; i < MAX_JOB_SLOTS; i++)
+	{
+		JobSlot *slot = &slotTable->slots[i];
+		pid_t shell = atomic_load(&slot->shell),
+			  job = atomic_load(&slot->job);
+		if (shell && job)
+		{
+			printf("%3d shell %d%s, job %d\n", i, (int)shell, shell == getpid() ? " (this shell)" : "", (int)job);
+		}
+		else if (shell)
+		{
+			printf("%3d shell %d%s, starting a job\n", i, (int)shell, shell == getpid() ? " (this shell)" : "");
+		}
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ * Description: Prints exit status to CLI. If exited normally, prints the 
+ * 				exit status code. If signaled, prints the signal code
+ * Parameters: the int status code to interpret
+ * Returns: None
+ ****************************************************************************/
+void reportExitStatus(int exitMethod)
+{
+	if (WIFEXITED(exitMethod))
+	{
+		int exitStatus = WEXITSTATUS(exitMethod);
+		printf("Exit Status: %d\n", exitStatus);
+		fflush(stdout);
+	}
+	else if (WIFSIGNALED(exitMethod))
+	{
+		int termSignal = WTERMSIG(exitMethod);
+		if (termSignal != 123)
+		{
+			printf("Terminating Signal: %d\n", termSignal);
+			fflush(stdout);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Executes a command found by findCommand, relative to its
+ * 				open $PATH directory. A file that is not a binary and has no
+ * 				#! line is run by /bin/sh, as execvp does. If exec fails, the error goes to errFd or is printed,
+ * 				and the child exits 126 or 127.
+ * 				Source: Class Lecture
+ * Parameters: args = an array of arguments/the command to execute
+ * 			   target = the command's file
+ * 			   errFd = the exec error pipe, or -1
+ * Returns: None
+ ****************************************************************************/
+void execute(char **args, const ExecTarget *target, int errFd)
+{
+	execveat(target->dirFd, target->file, args, environ, 0);
+
+	int err = errno;
+	/* a #! script can't be run relative to a close on exec dirfd, since its
+	 * interpreter would be given a /dev/fd path that is gone by then */
+	if (err == ENOENT && target->dirFd != AT_FDCWD)
+	{
+		execv(target->path, args);
+		err = errno;
+	}
+	if (err == ENOEXEC)
+	{
+		int argCount = 0;
+		while (args[argCount])
+		{
+			argCount++;
+		}
+		char **shArgs = malloc((argCount + 2) * sizeof(char *));
+		shArgs[0] = "sh";
+		shArgs[1] = (char *)target->path;
+		memcpy(shArgs + 2, args + 1, argCount * sizeof(char *));
+		execv("/bin/sh", shArgs);
+		free(shArgs);
+	}
+
+	if (errFd != -1)
+	{
+		// the parent reports it, knowing it came from exec and not the command
+		while (write(errFd, &err, sizeof(err)) == -1 && errno == EINTR) { }
+	}
+	else
+	{
+		reportExecError(target->path, err);
+	}
+	_exit(execFailureCode(err));
+}
+
+/*****************************************************************************
+ * Description: Gives the POSIX exit status for a command that could not be
+ * 				executed: 127 if it was not found, 126 if it was found but
+ * 				could not be run.
+ * Parameters: err = the errno from exec
+ * Returns: 126 or 127
+ ****************************************************************************/
+int execFailureCode(int err)
+{
+	return (err == ENOENT || err == ENOTDIR) ? 127 : 126;
+}
+
+/*****************************************************************************
+ * Description: Prints why a command could not be executed
+ * Parameters: name = the command name
+ * 			   err = the errno from exec
+ * Returns: None
+ ****************************************************************************/
+void reportExecError(const char *name, int err)
+{
+	if (err == ENOENT && !strchr(name, '/'))
+	{
+		fprintf(stderr, "smallsh: %s: command not found\n", name);
+	}
+	else
+	{
+		fprintf(stderr, "smallsh: %s: %s\n", name, strerror(err));
+	}
+}
+
+/*****************************************************************************
+ * Description: Forks and execs a command with its redirects. A close on exec
+ * 				pipe carries exec's errno back: it reads as EOF once exec
+ * 				succeeds, so the parent knows straight away whether the
+ * 				command started, and a failure is never mistaken for the
+ * 				command itself exiting with an error.
+ * Parameters: args = the command words
+ * 			   target = the command's file, from findCommand
+ * 			   newStdin/newStdout = the redirect filenames, may be NULL
+ * 			   bgFlag = true if the command runs in the background
+ * Returns: The child's pid, or -1 if exec failed, with childExitMethod set
+ * 			to 126 or 127 and the child reaped
+ ****************************************************************************/
+pid_t spawnCommand(char **args, const ExecTarget *target, char *newStdin, char *newStdout, bool bgFlag)
+{
+	int errPipe[2] = { -1, -1 },
+		err = 0;
+	ssize_t got = 0;
+
+	if (pipe2(errPipe, O_CLOEXEC) == -1)
+	{
+		// still runnable, the child just reports its own exec error
+		errPipe[0] = errPipe[1] = -1;
+	}
+
+	fflush(stdout);
+	pid_t forkPid = fork();
+	switch (forkPid)
+	{
+		// check for failure
+		case -1: { perror("Fork failure, get a spoon.\n"); exit(-2); break; }
+		// child code block
+		case 0:
+		{
+			if (errPipe[0] != -1)
+			{
+				close(errPipe[0]);
+			}
+
+			// redirect stdin/stdout before exec
+			redirectStdIO(newStdin, newStdout, bgFlag);
+			if (bgFlag)
+			{
+				setpgid(0, 0);
+			}
+
+			// restore SIGINT for foreground processes before exec
+			if (!bgFlag)
+			{
+				sigaction(SIGINT, &default_action, NULL);
+			}
+
+			// ignore SIGTSTP in all child processes, and give back SIGPIPE
+			sigaction(SIGTSTP, &ignore_action, NULL);
+			sigaction(SIGPIPE, &default_action, NULL);
+
+			markFdsCloexec();
+			execute(args, target, errPipe[1]);
+			break;
+		}
+	}
+
+	if (errPipe[0] == -1)
+	{
+		return forkPid;
+	}
+	close(errPipe[1]);
+	while ((got = read(errPipe[0], &err, sizeof(err))) == -1 && errno == EINTR) { }
+	close(errPipe[0]);
+	if (got != sizeof(err))
+	{
+		return forkPid;
+	}
+
+	waitpid(forkPid, NULL, 0);
+	reportExecError(target->path, err);
+	childExitMethod = W_EXITCODE(execFailureCode(err), 0);
+	return -1;
+}
+
+/*****************************************************************************
+ * Description: Opens the directories in $PATH, if $PATH has changed since
+ * 				they were last opened. Changing $PATH also forgets where
+ * 				commands were found.
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void loadPathDirs()
+{
+	// execvp's search path when $PATH is unset
+	const char *path = getenv("PATH") ? getenv("PATH") : "/bin:/usr/bin";
+	int i = 0;
+
+	if (pathDirsFor && !strcmp(path, pathDirsFor))
+	{
+		return;
+	}
+
+	for (i = 0; i < numPathDirs; i++)
+	{
+		if (pathDirs[i].fd != -1)
+		{
+			close(pathDirs[i].fd);
+		}
+		free(pathDirs[i].path);
+	}
+	for (i = 0; i < COMMAND_CACHE_SIZE; i++)
+	{
+		free(commandCache[i].name);
+		commandCache[i].name = NULL;
+	}
+	free(pathDirsFor);
+	pathDirsFor = strdup(path);
+	numPathDirs = 0;
+	pathDirs = realloc(pathDirs, (strlen(path) + 1) * sizeof(PathDir));
+
+	while (true)
+	{
+		size_t len = strcspn(path, ":");
+		PathDir *dir = &pathDirs[numPathDirs++];
+
+		// an empty entry means the current directory
+		dir->path = len ? strndup(path, len) : strdup(".");
+		dir->fd = -1;
+		if (dir->path[0] == '/')
+		{
+			dir->fd = open(dir->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		}
+
+		path += len;
+		if (*path != ':')
+		{
+			break;
+		}
+		path++;
+	}
+}
+
+/*****************************************************************************
+ * Description: Points an exec target at a command in a $PATH directory
+ * Parameters: target = filled in
+ * 			   dirIndex = the index into pathDirs
+ * 			   name = the command name
+ * Returns: false if the path is too long
+ ****************************************************************************/
+bool setExecTarget(ExecTarget *target, int dirIndex, const char *name)
+{
+	PathDir *dir = &pathDirs[dirIndex];
+	int dirLen = strlen(dir->path);
+
+	if (snprintf(target->path, sizeof(target->path), "%s/%s", dir->path, name) >= (int)sizeof(target->path))
+	{
+		return false;
+	}
+	// relative directories are looked up from the current directory each time
+	target->dirFd = dir->fd != -1 ? dir->fd : AT_FDCWD;
+	target->file = dir->fd != -1 ? target->path + dirLen + 1 : target->path;
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Finds a command the way execvp would, but relative to the
+ * 				open $PATH directories, and remembers where it was found.
+ * 				Like bash's hash table, a remembered location is used for
+ * 				as long as the file there is executable.
+ * Parameters: name = the command name
+ * 			   target = filled in with where to exec it
+ * Returns: 0 if found, else ENOENT or the error from the first directory
+ * 			that had the command but could not run it (usually EACCES)
+ ****************************************************************************/
+int findCommand(const char *name, ExecTarget *target)
+{
+	int err = ENOENT,
+		i = 0;
+
+	// paths are exec'd as they are
+	if (strchr(name, '/'))
+	{
+		if (strlen(name) >= sizeof(target->path))
+		{
+			return ENAMETOOLONG;
+		}
+		strcpy(target->path, name);
+		target->dirFd = AT_FDCWD;
+		target->file = target->path;
+		return 0;
+	}
+
+	loadPathDirs();
+	if (!*name || isKnownMissing(name))
+	{
+		return ENOENT;
+	}
+
+	CommandLocation *loc = &commandCache[hashBytes(name, strlen(name)) % COMMAND_CACHE_SIZE];
+	if (loc->name && !strcmp(loc->name, name) && setExecTarget(target, loc->dirIndex, name) &&
+		faccessat(target->dirFd, target->file, X_OK, AT_EACCESS) == 0)
+	{
+		return 0;
+	}
+
+	// stamp before searching, which also opens directories made since, so
+	// a directory that appears during the search changes the stamp
+	uint64_t stamp = pathStamp();
+	for (i = 0; i < numPathDirs; i++)
+	{
+		struct stat info;
+		if (pathDirs[i].path[0] == '/' && pathDirs[i].fd == -1)
+		{
+			continue;
+		}
+		if (!setExecTarget(target, i, name) || fstatat(target->dirFd, target->file, &info, 0) == -1)
+		{
+			continue;
+		}
+		if (S_ISREG(info.st_mode) && faccessat(target->dirFd, target->file, X_OK, AT_EACCESS) == 0)
+		{
+			free(loc->name);
+			loc->name = strdup(name);
+			loc->dirIndex = i;
+			return 0;
+		}
+		// like execvp, keep looking but report this if nothing else is found
+		err = EACCES;
+	}
+
+	if (err == ENOENT)
+	{
+		rememberMissing(name, stamp);
+	}
+	return err;
+}
+
+/*****************************************************************************
+ * Description: Stamps the current $PATH: its value plus the inode and mtime
+ * 				of each of its directories, any of which changes when a
+ * 				command could have appeared in it. The open directory fds
+ * 				are fstat'd rather than their paths walked again. A
+ * 				directory that didn't exist before, or was removed since it
+ * 				was opened, is opened again in pathDirs so findCommand
+ * 				searches what was stamped.
+ * Parameters: None
+ * Returns: The stamp
+ ****************************************************************************/
+uint64_t pathStamp()
+{
+	uint64_t stamp = 0;
+	int i = 0;
+
+	loadPathDirs();
+	stamp = hashBytes(pathDirsFor, strlen(pathDirsFor));
+
+	for (i = 0; i < numPathDirs; i++)
+	{
+		PathDir *dir = &pathDirs[i];
+		struct stat info;
+		uint64_t fields[3] = { 0, 0, 0 };
+		int result = -1;
+
+		if (dir->fd != -1)
+		{
+			result = fstat(dir->fd, &info);
+			// a removed directory may have been made again at its path
+			if (result == 0 && info.st_nlink == 0)
+			{
+				close(dir->fd);
+				dir->fd = -1;
+				result = -1;
+			}
+		}
+		if (dir->path[0] == '/' && dir->fd == -1)
+		{
+			dir->fd = open(dir->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+			if (dir->fd != -1)
+			{
+				result = fstat(dir->fd, &info);
+			}
+		}
+		else if (dir->path[0] != '/')
+		{
+			result = stat(dir->path, &info);
+		}
+
+		if (result == 0)
+		{
+			fields[0] = info.st_ino;
+			fields[1] = info.st_mtim.tv_sec;
+			fields[2] = info.st_mtim.tv_nsec;
+		}
+		stamp = stamp * 31 + hashBytes((const char *)fields, sizeof(fields));
+	}
+	return stamp;
+}
+
+/*****************************************************************************
+ * Description: Checks whether a command is known to be missing from $PATH,
+ * 				so a script repeating a typo doesn't fork to find out again.
+ * 				Names with a / are not searched for and never cached.
+ * Parameters: name = the command name
+ * Returns: true if the command was not found and $PATH has not changed since
+ ****************************************************************************/
+bool isKnownMissing(const char *name)
+{
+	if (strchr(name, '/'))
+	{
+		return false;
+	}
+
+	MissingCommand *entry = &missingCache[hashBytes(name, strlen(name)) % MISSING_CACHE_SIZE];
+	if (!entry->name || strcmp(entry->name, name))
+	{
+		return false;
+	}
+	if (entry->pathStamp != pathStamp())
+	{
+		free(entry->name);
+		entry->name = NULL;
+		return false;
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Remembers that a command was not found in $PATH
+ * Parameters: name = the command name
+ * 			   stamp = the pathStamp taken before the search
+ * Returns: None
+ ****************************************************************************/
+void rememberMissing(const char *name, uint64_t stamp)
+{
+	if (strchr(name, '/'))
+	{
+		return;
+	}
+
+	MissingCommand *entry = &missingCache[hashBytes(name, strlen(name)) % MISSING_CACHE_SIZE];
+	free(entry->name);
+	entry->name = strdup(name);
+	entry->pathStamp = stamp;
+}
+
+/*****************************************************************************
+ * Description: Opens a file to have stdin redirected to it. Opens as read-only
+ * 				Source: Class Lecture
+ * Parameters: inpfile = the filename to be opened
+ * Returns: int representing the open file descriptor
+ ****************************************************************************/
+int openInpFile(char *inpfile)
+{
+	// create file descriptor to redirect stdin
+	int inputFD = open(inpfile, O_RDONLY | O_CLOEXEC);
+	if (inputFD == -1) { perror("Input file could not be opened"); exit(1); }
+
+	return inputFD;
+}
+
+/*****************************************************************************
+ * Description: Redirects stdin to a provided file descriptor number. Exits
+ * 				if redirection fails.
+ * 				Source: Class Lecture
+ * Parameters: FDNum = the file descriptor to be redirected to
+ * Returns: None
+ ****************************************************************************/
+void redirectStdin(int FDNum)
+{
+	int inResult = 0;
+	// redirect stdin
+	inResult = dup2(FDNum, STDIN_NUM);
+	if (inResult == -1) { perror("Input redirection failed.\n"); exit(1); }
+}
+
+/*****************************************************************************
+ * Description: Opens a file to have stdout redirected to it. Opens for writing,
+ * 				for truncating, and creating. Exits if file open fails
+ * 				Source: Class Lecture
+ * Parameters: outfile = the filename to be opened
+ * Returns: int representing the open file descriptor
+ ****************************************************************************/
+int openOutFile(char *outfile)
+{
+	// create file descriptor to redirect stdin
+	int outputFD = open(outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (outputFD == -1) { perror("Output file could not be opened"); exit(1); }
+
+	return outputFD;
+}
+
+/*****************************************************************************
+ * Description: Redirects stdout to a provided file descriptor number. Exits
+ * 				if redirection fails.
+ * 				Source: Class Lecture
+ * Parameters: FDNum = the file descriptor to be redirected to
+ * Returns: None
+ ****************************************************************************/
+void redirectStdout(int FDNum)
+{
+	// redirect stdout
+	int outResult = 0;
+		
+	// redirect stdout
+	outResult = dup2(FDNum, STDOUT_NUM);
+	if (outResult == -1) { perror("Output redirection failed.\n"); exit(1); }
+}
+
+/*****************************************************************************
+ * Description: Toggle global variable
+ *
+ * Parameters: signo = the parameter for passing which signal caused the 
+ * 					   handler to start
+ * Returns: None
+ ****************************************************************************/
+void catchSIGTSTP(int signo)
+{
+	int exitMeth = -5;
+	//if (fgPidForSignal != -5)
+	{
+		if (waitpid(fgPidForSignal, &exitMeth, 0) > 0)
+		{
+			fgExitFromSignal = exitMeth;
+		}
+	}
+	if (!foregroundOnly)
+	{
+		foregroundOnly = true;
+		char *msg = "\nEntering foreground only mode. (& is now ignored)\n:";
+		if (fgPidForSignal != -5)
+		{
+			write(STDOUT_FILENO, msg, 51);
+		}
+		else
+		{
+			write(STDOUT_FILENO, msg, 52);
+		}
+						
+	}
+	else
+	{
+		foregroundOnly = false;
+		char *msg = "\nExiting foreground only mode.\n:";
+		if (fgPidForSignal != -5)
+		{
+			write(STDOUT_FILENO, msg, 31);
+		}
+		else
+		{
+			write(STDOUT_FILENO, msg, 32);
+		}
+	}
+
+}
+
+/*****************************************************************************
+ * Description: Handles redirection of stdin and stdout based on the status of
+ * 				'newStdin', 'newStdout', and bgFlag. Redirects stdin and stdout
+ * 				to 'newStdin' and 'newStdout', respectively. If the process is
+ * 				a background process, redirects to dev/null if 'newStdin' and
+ * 				'newStdout' are NULL. 
+ * Parameters: newStdin = the filename of the file to redirect stdin to
+ * 			   newStdout = the filename of the file to redirect stdout to
+ * 			   bgFlag = a boolean flag - 1 = backgroung process 0 = foreground
+ * Returns: None
+ ****************************************************************************/
+void redirectStdIO(char *newStdin, char *newStdout, bool bgFlag)
+{
+	// redirect stdin
+	if (newStdin != NULL)
+	{
+		// create file descriptor to redirect stdin
+		int inputFD = openInpFile(newStdin);
+		// redirect stdin
+		redirectStdin(inputFD);
+		close(inputFD);
+	}
+	else if (bgFlag)
+	{
+		// redirect to dev null
+		int devNull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		redirectStdin(devNull);
+		close(devNull);
+	}
+
+	// redirect stdout
+	if (newStdout != NULL)
+	{
+		// create file descriptor to redirect stdin
+		int outputFD = openOutFile(newStdout);
+		// redirect stdout
+		redirectStdout(outputFD);
+		close(outputFD);
+	}
+	else if (bgFlag)
+	{
+		// redirect to dev null
+		int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		redirectStdout(devNull);
+		close(devNull);
+	}
+}
+
+/*****************************************************************************
+ * Description: Stores a copy of 'len' bytes of 'src' in a shell string.
+ * 				Strings of up to SSO_CAPACITY bytes are kept inline.
+ * Parameters: str = the shell string to overwrite
+ * 			   src = the bytes to store, need not be NUL terminated
+ * 			   len = the number of bytes to store
+ * Returns: None
+ ****************************************************************************/
+void strSet(ShellStr *str, const char *src, size_t len)
+{
+	char *heap = NULL;
+	if (len > SSO_CAPACITY)
+	{
+		// copy before freeing in case src points into the old value
+		heap = malloc(len + 1);
+		memcpy(heap, src, len);
+		heap[len] = '\0';
+		strFree(str);
+		str->data.ptr = heap;
+		str->kind = STR_HEAP;
+	}
+	else
+	{
+		char tmp[SSO_CAPACITY + 1];
+		memcpy(tmp, src, len);
+		strFree(str);
+		memcpy(str->data.inl, tmp, len);
+		str->data.inl[len] = '\0';
+		str->kind = STR_INLINE;
+	}
+	str->len = len;
+}
+
+/*****************************************************************************
+ * Description: Gets the contents of a shell string
+ * Parameters: str = the shell string
+ * Returns: A NUL terminated string, "" if the string is unset
+ ****************************************************************************/
+const char* strGet(const ShellStr *str)
+{
+	switch (str->kind)
+	{
+		case STR_INLINE: return str->data.inl;
+		case STR_HEAP:
+		case STR_SLAB: return str->data.ptr;
+		default: return "";
+	}
+}
+
+/*****************************************************************************
+ * Description: Frees a shell string's storage and marks it unset
+ * Parameters: str = the shell string
+ * Returns: None
+ ****************************************************************************/
+void strFree(ShellStr *str)
+{
+	if (str->kind == STR_HEAP)
+	{
+		free(str->data.ptr);
+	}
+	str->kind = STR_UNSET;
+	str->len = 0;
+}
+
+/*****************************************************************************
+ * Description: Makes room for at least 'size' elements in an indexed array,
+ * 				growing the vector geometrically.
+ * Parameters: arr = the array
+ * 			   size = the number of elements needed
+ * Returns: false, with the array unchanged, if size is over MAX_ARRAY_SIZE
+ * 			or there is no memory for it
+ ****************************************************************************/
+bool indexedReserve(IndexedArray *arr, size_t size)
+{
+	if (size <= arr->cap)
+	{
+		return true;
+	}
+	if (size > MAX_ARRAY_SIZE)
+	{
+		return false;
+	}
+
+	size_t newCap = arr->cap ? arr->cap * 2 : 8;
+	while (newCap < size)
+	{
+		newCap *= 2;
+	}
+	ShellStr *elems = realloc(arr->elems, newCap * sizeof(ShellStr));
+	if (!elems)
+	{
+		return false;
+	}
+	arr->elems = elems;
+	memset(arr->elems + arr->cap, 0, (newCap - arr->cap) * sizeof(ShellStr));
+	arr->cap = newCap;
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Sets element 'idx' of an indexed array, growing the vector
+ * 				when needed.
+ * Parameters: arr = the array
+ * 			   idx = the index to set
+ * 			   val/len = the value to store
+ * Returns: false if the vector could not grow to idx (see indexedReserve)
+ ****************************************************************************/
+bool indexedSet(IndexedArray *arr, size_t idx, const char *val, size_t len)
+{
+	if (!indexedReserve(arr, idx + 1))
+	{
+		return false;
+	}
+	if (arr->elems[idx].kind == STR_UNSET)
+	{
+		arr->numSet++;
+	}
+	strSet(&arr->elems[idx], val, len);
+
+	if (idx >= arr->count)
+	{
+		arr->count = idx + 1;
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Looks up element 'idx' of an indexed array
+ * Parameters: arr = the array
+ * 			   idx = the index to get
+ * Returns: The element, or NULL if it is not set
+ ****************************************************************************/
+ShellStr* indexedGet(IndexedArray *arr, size_t idx)
+{
+	if (idx >= arr->count || arr->elems[idx].kind == STR_UNSET)
+	{
+		return NULL;
+	}
+	return &arr->elems[idx];
+}
+
+/*****************************************************************************
+ * Description: Unsets element 'idx' of an indexed array
+ * Parameters: arr = the array
+ * 			   idx = the index to unset
+ * Returns: None
+ ****************************************************************************/
+void indexedUnset(IndexedArray *arr, size_t idx)
+{
+	if (!indexedGet(arr, idx))
+	{
+		return;
+	}
+	strFree(&arr->elems[idx]);
+	arr->numSet--;
+
+	// shrink the logical end past any trailing holes
+	while (arr->count > 0 && arr->elems[arr->count - 1].kind == STR_UNSET)
+	{
+		arr->count--;
+	}
+}
+
+/*****************************************************************************
+ * Description: Frees every element of an indexed array and its vector
+ * Parameters: arr = the array
+ * Returns: None
+ ****************************************************************************/
+void indexedClear(IndexedArray *arr)
+{
+	size_t i = 0;
+	for (i = 0; i < arr->count; i++)
+	{
+		strFree(&arr->elems[i]);
+	}
+	for (i = 0; i < arr->numSlabs; i++)
+	{
+		free(arr->slabs[i]);
+	}
+	free(arr->slabs);
+	free(arr->elems);
+	memset(arr, 0, sizeof(IndexedArray));
+}
+
+/*****************************************************************************
+ * Description: Hashes a byte string. FNV-1a followed by a 64 bit finalizer
+ * 				so the low 7 bits used as control byte tags are well mixed.
+ * Parameters: data/len = the bytes to hash
+ * Returns: The 64 bit hash
+ ****************************************************************************/
+uint64_t hashBytes(const char *data, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i = 0;
+	for (i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/* Control byte group helpers. A group is GROUP_WIDTH control bytes loaded
+ * into one 64 bit word; each helper returns a word with the high bit set
+ * in every byte that matches. Group bytes are little endian. */
+static const uint64_t GROUP_LSBS = 0x0101010101010101ULL;
+static const uint64_t GROUP_MSBS = 0x8080808080808080ULL;
+
+uint64_t groupLoad(const unsigned char *ctrl)
+{
+	uint64_t group;
+	memcpy(&group, ctrl, sizeof(group));
+	return group;
+}
+
+uint64_t groupMatchTag(uint64_t group, unsigned char tag)
+{
+	// may report false positives, which the key comparison filters out
+	uint64_t x = group ^ (GROUP_LSBS * tag);
+	return (x - GROUP_LSBS) & ~x & GROUP_MSBS;
+}
+
+uint64_t groupMatchEmpty(uint64_t group)
+{
+	// CTRL_EMPTY is the only control byte with bit 7 set and bit 1 clear
+	return group & ~(group << 6) & GROUP_MSBS;
+}
+
+uint64_t groupMatchFree(uint64_t group)
+{
+	// CTRL_EMPTY and CTRL_DELETED both have bit 7 set and bit 0 clear
+	return group & ~(group << 7) & GROUP_MSBS;
+}
+
+/*****************************************************************************
+ * Description: Looks up a key in an associative array. Probes whole groups
+ * 				of slots, comparing the 7 bit hash tag in each control byte
+ * 				before touching the slot itself.
+ * Parameters: map = the associative array
+ * 			   key/keyLen = the key to look up
+ * Returns: The value for the key, or NULL if it is not present
+ ****************************************************************************/
+ShellStr* assocFind(AssocArray *map, const char *key, size_t keyLen)
+{
+	if (map->cap == 0)
+	{
+		return NULL;
+	}
+
+	uint64_t hash = hashBytes(key, keyLen);
+	unsigned char tag = hash & 0x7F;
+	size_t groupMask = map->cap / GROUP_WIDTH - 1,
+		   group = (hash >> 7) & groupMask,
+		   step = 0;
+
+	// triangular probing over a power of two visits every group
+	for (step = 0; step <= groupMask; step++)
+	{
+		uint64_t ctrl = groupLoad(map->ctrl + group * GROUP_WIDTH);
+		uint64_t matches = groupMatchTag(ctrl, tag);
+		while (matches)
+		{
+			size_t idx = group * GROUP_WIDTH + (__builtin_ctzll(matches) >> 3);
+			AssocSlot *slot = &map->slots[idx];
+			if (slot->key.len == keyLen && !memcmp(strGet(&slot->key), key, keyLen))
+			{
+				return &slot->value;
+			}
+			matches &= matches - 1;
+		}
+		if (groupMatchEmpty(ctrl))
+		{
+			return NULL;
+		}
+		group = (group + step + 1) & groupMask;
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Finds the first empty or deleted slot for a hash
+ * Parameters: map = the associative array, must have free slots
+ * 			   hash = the hash of the key to insert
+ * Returns: The index of the slot
+ ****************************************************************************/
+size_t assocFindFree(AssocArray *map, uint64_t hash)
+{
+	size_t groupMask = map->cap / GROUP_WIDTH - 1,
+		   group = (hash >> 7) & groupMask,
+		   step = 0;
+
+	while (true)
+	{
+		uint64_t free = groupMatchFree(groupLoad(map->ctrl + group * GROUP_WIDTH));
+		if (free)
+		{
+			return group * GROUP_WIDTH + (__builtin_ctzll(free) >> 3);
+		}
+		step++;
+		group = (group + step) & groupMask;
+	}
+}
+
+/*****************************************************************************
+ * Description: Rebuilds an associative array's table, large enough for at
+ * 				least 'minSize' entries. Also clears out deleted slots.
+ * Parameters: map = the associative array
+ * 			   minSize = the number of entries the table must hold
+ * Returns: None
+ ****************************************************************************/
+void assocRehash(AssocArray *map, size_t minSize)
+{
+	size_t newCap = GROUP_WIDTH;
+	while (newCap * 7 / 8 < minSize)
+	{
+		newCap *= 2;
+	}
+
+	unsigned char *oldCtrl = map->ctrl;
+	AssocSlot *oldSlots = map->slots;
+	size_t oldCap = map->cap,
+		   i = 0;
+
+	map->ctrl = malloc(newCap);
+	memset(map->ctrl, CTRL_EMPTY, newCap);
+	map->slots = malloc(newCap * sizeof(AssocSlot));
+	map->cap = newCap;
+
+	// slots hold no self references, so they can be moved bytewise
+	for (i = 0; i < oldCap; i++)
+	{
+		if (!(oldCtrl[i] & 0x80))
+		{
+			AssocSlot *slot = &oldSlots[i];
+			uint64_t hash = hashBytes(strGet(&slot->key), slot->key.len);
+			size_t idx = assocFindFree(map, hash);
+			map->ctrl[idx] = hash & 0x7F;
+			map->slots[idx] = *slot;
+		}
+	}
+	map->growthLeft = newCap * 7 / 8 - map->size;
+
+	free(oldCtrl);
+	free(oldSlots);
+}
+
+/*****************************************************************************
+ * Description: Sets a key in an associative array, inserting it if needed.
+ * Parameters: map = the associative array
+ * 			   key/keyLen = the key
+ * 			   val/valLen = the value to store
+ * Returns: None
+ ****************************************************************************/
+void assocSet(AssocArray *map, const char *key, size_t keyLen, const char *val, size_t valLen)
+{
+	ShellStr *existing = assocFind(map, key, keyLen);
+	if (existing)
+	{
+		strSet(existing, val, valLen);
+		return;
+	}
+
+	uint64_t hash = hashBytes(key, keyLen);
+	size_t idx = 0;
+	if (map->cap == 0 || map->growthLeft == 0)
+	{
+		/* out of never-used slots: grow, or just drop tombstones if most
+		 * of the used slots are deleted ones */
+		assocRehash(map, map->size * 2 > map->cap * 7 / 8 ? map->size * 2 + 1 : map->size + 1);
+	}
+	idx = assocFindFree(map, hash);
+	if (map->ctrl[idx] == CTRL_EMPTY)
+	{
+		map->growthLeft--;
+	}
+	map->ctrl[idx] = hash & 0x7F;
+	memset(&map->slots[idx], 0, sizeof(AssocSlot));
+	strSet(&map->slots[idx].key, key, keyLen);
+	strSet(&map->slots[idx].value, val, valLen);
+	map->size++;
+}
+
+/*****************************************************************************
+ * Description: Removes a key from an associative array, if present.
+ * Parameters: map = the associative array
+ * 			   key/keyLen = the key
+ * Returns: None
+ ****************************************************************************/
+void assocErase(AssocArray *map, const char *key, size_t keyLen)
+{
+	ShellStr *value = assocFind(map, key, keyLen);
+	if (!value)
+	{
+		return;
+	}
+
+	AssocSlot *slot = (AssocSlot *)((char *)value - offsetof(AssocSlot, value));
+	size_t idx = slot - map->slots;
+	strFree(&slot->key);
+	strFree(&slot->value);
+
+	/* a group that still has an empty byte ends every probe that reaches
+	 * it, so the slot can go straight back to empty */
+	size_t groupStart = idx / GROUP_WIDTH * GROUP_WIDTH;
+	if (groupMatchEmpty(groupLoad(map->ctrl + groupStart)))
+	{
+		map->ctrl[idx] = CTRL_EMPTY;
+		map->growthLeft++;
+	}
+	else
+	{
+		map->ctrl[idx] = CTRL_DELETED;
+	}
+	map->size--;
+}
+
+/*****************************************************************************
+ * Description: Frees every entry of an associative array and its table
+ * Parameters: map = the associative array
+ * Returns: None
+ ****************************************************************************/
+void assocClear(AssocArray *map)
+{
+	size_t i = 0;
+	for (i = 0; i < map->cap; i++)
+	{
+		if (!(map->ctrl[i] & 0x80))
+		{
+			strFree(&map->slots[i].key);
+			strFree(&map->slots[i].value);
+		}
+	}
+	free(map->ctrl);
+	free(map->slots);
+	memset(map, 0, sizeof(AssocArray));
+}
+
+/*****************************************************************************
+ * Description: Finds a shell variable by name
+ * Parameters: name/nameLen = the variable name, need not be NUL terminated
+ * Returns: The variable, or NULL if it does not exist
+ ****************************************************************************/
+ShellVar* findVar(const char *name, size_t nameLen)
+{
+	int i = 0;
+	for (i = 0; i < shellVarCount; i++)
+	{
+		if (!strncmp(shellVars[i]->name, name, nameLen) && shellVars[i]->name[nameLen] == '\0')
+		{
+			return shellVars[i];
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Finds a shell variable by name, creating an empty scalar if
+ * 				it does not exist yet.
+ * Parameters: name/nameLen = the variable name
+ * Returns: The variable
+ ****************************************************************************/
+ShellVar* getOrCreateVar(const char *name, size_t nameLen)
+{
+	ShellVar *var = findVar(name, nameLen);
+	if (var)
+	{
+		return var;
+	}
+
+	if (shellVarCount == shellVarCap)
+	{
+		shellVarCap = shellVarCap ? shellVarCap * 2 : 16;
+		shellVars = realloc(shellVars, shellVarCap * sizeof(ShellVar *));
+	}
+	var = calloc(1, sizeof(ShellVar));
+	var->name = strndup(name, nameLen);
+	var->kind = VAR_SCALAR;
+	shellVars[shellVarCount++] = var;
+	return var;
+}
+
+/*****************************************************************************
+ * Description: Frees a variable's value and changes its kind
+ * Parameters: var = the variable
+ * 			   kind = the kind it will hold from now on
+ * Returns: None
+ ****************************************************************************/
+void resetVar(ShellVar *var, VarKind kind)
+{
+	strFree(&var->scalar);
+	indexedClear(&var->indexed);
+	assocClear(&var->assoc);
+	var->kind = kind;
+}
+
+/*****************************************************************************
+ * Description: Gets the value a variable has when used without a subscript.
+ * 				For arrays that is element 0, as in bash.
+ * Parameters: var = the variable, may be NULL
+ * Returns: The value, "" if unset
+ ****************************************************************************/
+const char* scalarValue(ShellVar *var)
+{
+	ShellStr *elem = NULL;
+	if (!var)
+	{
+		return "";
+	}
+	switch (var->kind)
+	{
+		case VAR_SCALAR: return strGet(&var->scalar);
+		case VAR_INDEXED: elem = indexedGet(&var->indexed, 0); break;
+		case VAR_ASSOC: elem = assocFind(&var->assoc, "0", 1); break;
+	}
+	return elem ? strGet(elem) : "";
+}
+
+/*****************************************************************************
+ * Description: Measures the identifier at the start of a string
+ * Parameters: str = the string
+ * Returns: The length of the leading name, 0 if it does not start with one
+ ****************************************************************************/
+size_t nameLength(const char *str)
+{
+	size_t len = 0;
+	if (!isalpha((unsigned char)str[0]) && str[0] != '_')
+	{
+		return 0;
+	}
+	while (isalnum((unsigned char)str[len]) || str[len] == '_')
+	{
+		len++;
+	}
+	return len;
+}
+
+/*****************************************************************************
+ * Description: Checks if a word has the form name=..., or name[sub]=...
+ * Parameters: word = the (already expanded) word
+ * Returns: true if the word is an assignment
+ ****************************************************************************/
+bool isAssignment(const char *word)
+{
+	size_t len = nameLength(word);
+	if (len == 0)
+	{
+		return false;
+	}
+	if (word[len] == '[')
+	{
+		const char *close = strchr(word + len, ']');
+		return close && close[1] == '=';
+	}
+	return word[len] == '=';
+}
+
+/*****************************************************************************
+ * Description: Sets one element of an array, or the variable itself when it
+ * 				is a scalar and there is no subscript.
+ * Parameters: var = the variable
+ * 			   sub/subLen = the subscript, NULL for none
+ * 			   val = the value
+ * Returns: 0 on success, 1 on a bad or too large subscript
+ ****************************************************************************/
+int setElement(ShellVar *var, const char *sub, size_t subLen, const char *val)
+{
+	if (var->kind == VAR_ASSOC)
+	{
+		if (!sub)
+		{
+			sub = "0";
+			subLen = 1;
+		}
+		assocSet(&var->assoc, sub, subLen, val, strlen(val));
+		return 0;
+	}
+
+	if (!sub)
+	{
+		if (var->kind == VAR_SCALAR)
+		{
+			strSet(&var->scalar, val, strlen(val));
+		}
+		else
+		{
+			indexedSet(&var->indexed, 0, val, strlen(val));
+		}
+		return 0;
+	}
+
+	char *end = NULL, subStr[32] = { 0 };
+	long idx = 0;
+	if (subLen >= sizeof(subStr))
+	{
+		subLen = sizeof(subStr) - 1;
+	}
+	memcpy(subStr, sub, subLen);
+	idx = strtol(subStr, &end, 10);
+
+	// a scalar becomes element 0 of the new array
+	if (var->kind == VAR_SCALAR)
+	{
+		char *old = strdup(strGet(&var->scalar));
+		bool wasSet = var->scalar.kind != STR_UNSET;
+		resetVar(var, VAR_INDEXED);
+		if (wasSet)
+		{
+			indexedSet(&var->indexed, 0, old, strlen(old));
+		}
+		free(old);
+	}
+	if (idx < 0)
+	{
+		idx += var->indexed.count;
+	}
+	if (*end != '\0' || end == subStr || idx < 0)
+	{
+		fprintf(stderr, "smallsh: %s[%s]: bad array subscript\n", var->name, subStr);
+		return 1;
+	}
+	if (!indexedSet(&var->indexed, idx, val, strlen(val)))
+	{
+		fprintf(stderr, "smallsh: %s[%s]: %s\n", var->name, subStr, idx >= MAX_ARRAY_SIZE ? "array subscript too large" : strerror(ENOMEM));
+		return 1;
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ * Description: Assigns a compound list, the words between ( and ), to an
+ * 				array. Elements of an associative array are [key]=value.
+ * Parameters: var = the variable, reset to an array
+ * 			   words/numWords = the list elements, parentheses removed
+ * Returns: 0 on success, 1 on error
+ ****************************************************************************/
+int assignList(ShellVar *var, char **words, int numWords)
+{
+	int i = 0,
+		result = 0;
+	size_t next = 0;
+
+	resetVar(var, var->kind == VAR_ASSOC ? VAR_ASSOC : VAR_INDEXED);
+	for (i = 0; i < numWords; i++)
+	{
+		const char *word = words[i];
+		const char *close = word[0] == '[' ? strchr(word, ']') : NULL;
+		if (close && close[1] == '=')
+		{
+			if (var->kind == VAR_ASSOC)
+			{
+				assocSet(&var->assoc, word + 1, close - word - 1, close + 2, strlen(close + 2));
+			}
+			else
+			{
+				result |= setElement(var, word + 1, close - word - 1, close + 2);
+				next = var->indexed.count;
+			}
+		}
+		else if (var->kind == VAR_ASSOC)
+		{
+			fprintf(stderr, "smallsh: %s: %s: must use subscript when assigning associative array\n", var->name, word);
+			result = 1;
+		}
+		else if (!indexedSet(&var->indexed, next++, word, strlen(word)))
+		{
+			fprintf(stderr, "smallsh: %s: %s\n", var->name, next > MAX_ARRAY_SIZE ? "array subscript too large" : strerror(ENOMEM));
+			return 1;
+		}
+	}
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Performs the assignments on a command line. Every word must
+ * 				be an assignment; name=( starts a compound list that ends at
+ * 				the first word ending in ).
+ * Parameters: args/argCount = the expanded command words
+ * Returns: 0 on success, 1 on error
+ ****************************************************************************/
+int assignVariables(char **args, int argCount)
+{
+	int i = 0,
+		result = 0;
+
+	while (i < argCount)
+	{
+		char *word = args[i];
+		if (!isAssignment(word))
+		{
+			fprintf(stderr, "smallsh: %s: assignments before a command are not supported\n", word);
+			return 1;
+		}
+
+		size_t nameLen = nameLength(word);
+		ShellVar *var = getOrCreateVar(word, nameLen);
+		const char *sub = NULL;
+		size_t subLen = 0;
+		char *value = strchr(word + nameLen, '=') + 1;
+		if (word[nameLen] == '[')
+		{
+			sub = word + nameLen + 1;
+			subLen = strchr(sub, ']') - sub;
+		}
+
+		if (!sub && value[0] == '(')
+		{
+			// gather the list words, stripping the parentheses
+			char *list[MAX_LINE_ARGS];
+			int numWords = 0,
+				j = i;
+			bool closed = false;
+			value++;
+			for (j = i; j < argCount && !closed; j++)
+			{
+				char *elem = (j == i) ? value : args[j];
+				size_t len = strlen(elem);
+				if (len > 0 && elem[len - 1] == ')')
+				{
+					elem[len - 1] = '\0';
+					closed = true;
+				}
+				// skip what is left of a bare ( or ) word
+				if (elem[0] != '\0' || (j != i && len > 1))
+				{
+					list[numWords++] = elem;
+				}
+			}
+			if (!closed)
+			{
+				fprintf(stderr, "smallsh: %s: missing ) in array assignment\n", var->name);
+				return 1;
+			}
+			result |= assignList(var, list, numWords);
+			i = j;
+		}
+		else
+		{
+			result |= setElement(var, sub, subLen, value);
+			i++;
+		}
+	}
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Prints a variable in a form that can be read back in
+ * Parameters: var = the variable
+ * Returns: None
+ ****************************************************************************/
+void printVar(ShellVar *var)
+{
+	size_t i = 0;
+	switch (var->kind)
+	{
+		case VAR_SCALAR:
+			printf("declare -- %s=", var->name);
+			printQuoted(strGet(&var->scalar));
+			printf("\n");
+			break;
+		case VAR_INDEXED:
+			printf("declare -a %s=(", var->name);
+			for (i = 0; i < var->indexed.count; i++)
+			{
+				if (var->indexed.elems[i].kind != STR_UNSET)
+				{
+					printf("[%zu]=", i);
+					printQuoted(strGet(&var->indexed.elems[i]));
+					printf(" ");
+				}
+			}
+			printf(")\n");
+			break;
+		case VAR_ASSOC:
+			printf("declare -A %s=(", var->name);
+			for (i = 0; i < var->assoc.cap; i++)
+			{
+				if (!(var->assoc.ctrl[i] & 0x80))
+				{
+					printf("[");
+					printQuoted(strGet(&var->assoc.slots[i].key));
+					printf("]=");
+					printQuoted(strGet(&var->assoc.slots[i].value));
+					printf(" ");
+				}
+			}
+			printf(")\n");
+			break;
+	}
+	fflush(stdout);
+}
+
+/*****************************************************************************
+ * Description: Prints a value in double quotes, escaping the characters that
+ * 				are special inside them so the value reads back unchanged
+ * Parameters: value = the value to print
+ * Returns: None
+ ****************************************************************************/
+void printQuoted(const char *value)
+{
+	putchar('"');
+	for (; *value; value++)
+	{
+		if (strchr("\"$`\\", *value))
+		{
+			putchar('\\');
+		}
+		putchar(*value);
+	}
+	putchar('"');
+}
+
+/*****************************************************************************
+ * Description: The declare builtin. declare [-a|-A|-p] [name[=value]...]
+ * 				-a makes indexed arrays, -A associative arrays, and -p (or
+ * 				no names at all) prints variables.
+ * Parameters: args/argCount = the command words
+ * Returns: The exit status
+ ****************************************************************************/
+int declareBuiltin(char **args, int argCount)
+{
+	VarKind kind = VAR_SCALAR;
+	bool setKind = false,
+		 print = false;
+	int i = 1,
+		result = 0;
+
+	for (i = 1; i < argCount && args[i][0] == '-'; i++)
+	{
+		if (!strcmp(args[i], "-a")) { kind = VAR_INDEXED; setKind = true; }
+		else if (!strcmp(args[i], "-A")) { kind = VAR_ASSOC; setKind = true; }
+		else if (!strcmp(args[i], "-p")) { print = true; }
+		else if (!strcmp(args[i], "--")) { i++; break; }
+		else
+		{
+			fprintf(stderr, "smallsh: declare: %s: invalid option\n", args[i]);
+			return 2;
+		}
+	}
+
+	if (i == argCount)
+	{
+		int v = 0;
+		for (v = 0; v < shellVarCount; v++)
+		{
+			printVar(shellVars[v]);
+		}
+		return 0;
+	}
+
+	for (; i < argCount; i++)
+	{
+		size_t nameLen = nameLength(args[i]);
+		if (nameLen == 0 || (args[i][nameLen] != '\0' && args[i][nameLen] != '='))
+		{
+			fprintf(stderr, "smallsh: declare: `%s': not a valid identifier\n", args[i]);
+			result = 1;
+			continue;
+		}
+
+		if (print)
+		{
+			ShellVar *var = findVar(args[i], nameLen);
+			if (var) { printVar(var); }
+			else { fprintf(stderr, "smallsh: declare: %s: not found\n", args[i]); result = 1; }
+			continue;
+		}
+
+		ShellVar *var = getOrCreateVar(args[i], nameLen);
+		if (setKind && var->kind != kind)
+		{
+			resetVar(var, kind);
+		}
+		if (args[i][nameLen] == '=')
+		{
+			// reuse assignment handling, which may span the following words
+			int j = i;
+			while (j < argCount && !strchr(args[j], ')') && args[i][nameLen + 1] == '(')
+			{
+				j++;
+			}
+			if (j == argCount)
+			{
+				j = i;
+			}
+			result |= assignVariables(args + i, j - i + 1);
+			i = j;
+		}
+	}
+	return result;
+}
+
+/*****************************************************************************
+ * Description: The unset builtin. unset name... or unset name[sub]...
+ * Parameters: args/argCount = the command words
+ * Returns: The exit status
+ ****************************************************************************/
+int unsetBuiltin(char **args, int argCount)
+{
+	int i = 1;
+	for (i = 1; i < argCount; i++)
+	{
+		size_t nameLen = nameLength(args[i]);
+		ShellVar *var = nameLen ? findVar(args[i], nameLen) : NULL;
+		if (!var)
+		{
+			continue;
+		}
+
+		if (args[i][nameLen] == '[')
+		{
+			const char *sub = args[i] + nameLen + 1;
+			const char *close = strchr(sub, ']');
+			if (!close)
+			{
+				continue;
+			}
+			if (var->kind == VAR_ASSOC)
+			{
+				assocErase(&var->assoc, sub, close - sub);
+			}
+			else if (var->kind == VAR_INDEXED)
+			{
+				long idx = strtol(sub, NULL, 10);
+				if (idx < 0)
+				{
+					idx += var->indexed.count;
+				}
+				if (idx >= 0)
+				{
+					indexedUnset(&var->indexed, idx);
+				}
+			}
+			continue;
+		}
+
+		// remove the whole variable, keeping the table compact
+		int v = 0;
+		resetVar(var, VAR_SCALAR);
+		for (v = 0; v < shellVarCount && shellVars[v] != var; v++);
+		shellVars[v] = shellVars[--shellVarCount];
+		free(var->name);
+		free(var);
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ * Description: Appends bytes to a growable buffer, keeping it NUL terminated
+ * Parameters: sb = the buffer
+ * 			   src/len = the bytes to append
+ * Returns: None
+ ****************************************************************************/
+void sbAppend(StrBuf *sb, const char *src, size_t len)
+{
+	if (sb->len + len + 1 > sb->cap)
+	{
+		size_t newCap = sb->cap ? sb->cap * 2 : 64;
+		while (newCap < sb->len + len + 1)
+		{
+			newCap *= 2;
+		}
+		sb->buf = realloc(sb->buf, newCap);
+		sb->cap = newCap;
+	}
+	memcpy(sb->buf + sb->len, src, len);
+	sb->len += len;
+	sb->buf[sb->len] = '\0';
+}
+
+void sbAppendChar(StrBuf *sb, char c)
+{
+	sbAppend(sb, &c, 1);
+}
+
+/*****************************************************************************
+ * Description: Ends the current field: copies the buffer into the field
+ * 				list and empties the buffer.
+ * Parameters: fl = the field list
+ * 			   sb = the buffer holding the field
+ * Returns: None
+ ****************************************************************************/
+void fieldsPush(FieldList *fl, StrBuf *sb)
+{
+	if (fl->count == fl->cap)
+	{
+		fl->cap = fl->cap ? fl->cap * 2 : 8;
+		fl->fields = realloc(fl->fields, fl->cap * sizeof(char *));
+	}
+	fl->fields[fl->count++] = strndup(sb->buf ? sb->buf : "", sb->len);
+	sb->len = 0;
+}
+
+void fieldsFree(FieldList *fl)
+{
+	int i = 0;
+	for (i = 0; i < fl->count; i++)
+	{
+		free(fl->fields[i]);
+	}
+	free(fl->fields);
+	memset(fl, 0, sizeof(FieldList));
+}
+
+/*****************************************************************************
+ * Description: Splits the next word off a command line. Words end at
+ * 				whitespace that is not inside quotes or ${...}. The word is
+ * 				NUL terminated in place, like strtok.
+ * Parameters: cursor = position in the line, advanced past the word
+ * Returns: The start of the word, or NULL at the end of the line
+ ****************************************************************************/
+char* nextRawWord(char **cursor)
+{
+	char *p = *cursor;
+	char quote = '\0';
+	int braces = 0;
+
+	while (*p == ' ' || *p == '\t')
+	{
+		p++;
+	}
+	if (*p == '\0')
+	{
+		*cursor = p;
+		return NULL;
+	}
+
+	char *start = p;
+	for (; *p; p++)
+	{
+		if (quote)
+		{
+			if (*p == '\\' && quote == '"' && p[1]) { p++; }
+			else if (*p == quote) { quote = '\0'; }
+		}
+		else if (*p == '\\' && p[1]) { p++; }
+		else if (*p == '\'' || *p == '"') { quote = *p; }
+		else if (*p == '$' && p[1] == '{') { braces++; p++; }
+		else if (*p == '}' && braces > 0) { braces--; }
+		else if ((*p == ' ' || *p == '\t') && braces == 0) { break; }
+	}
+
+	if (*p)
+	{
+		*p++ = '\0';
+	}
+	*cursor = p;
+	return start;
+}
+
+/*****************************************************************************
+ * Description: Expands a word: removes quotes and backslashes and performs
+ * 				$ expansions. A word can expand to no fields (an unquoted
+ * 				empty expansion) or several (${arr[@]}).
+ * Parameters: word = the raw word
+ * 			   out = receives the fields
+ * 			   keepEmpty = produce an empty field rather than none, as
+ * 			   			   inside [[ ]]
+ * Returns: None
+ ****************************************************************************/
+void expandWord(const char *word, FieldList *out, bool keepEmpty)
+{
+	StrBuf cur = { 0 };
+	bool started = false,
+		 inDouble = false;
+	const char *p = word;
+
+	while (*p)
+	{
+		if (*p == '\\' && !inDouble)
+		{
+			if (p[1]) { sbAppendChar(&cur, p[1]); p++; }
+			p++;
+			started = true;
+		}
+		else if (*p == '\\' && inDouble)
+		{
+			if (p[1] && strchr("$`\"\\", p[1])) { p++; }
+			sbAppendChar(&cur, *p);
+			p++;
+		}
+		else if (*p == '\'' && !inDouble)
+		{
+			const char *end = strchr(p + 1, '\'');
+			if (!end)
+			{
+				end = p + strlen(p);
+			}
+			sbAppend(&cur, p + 1, end - p - 1);
+			p = *end ? end + 1 : end;
+			started = true;
+		}
+		else if (*p == '"')
+		{
+			inDouble = !inDouble;
+			started = true;
+			p++;
+		}
+		else if (*p == '$')
+		{
+			p = expandDollar(p, &cur, out, &started);
+		}
+		else
+		{
+			sbAppendChar(&cur, *p);
+			started = true;
+			p++;
+		}
+	}
+
+	if (started || cur.len || (keepEmpty && out->count == 0))
+	{
+		fieldsPush(out, &cur);
+	}
+	free(cur.buf);
+}
+
+/*****************************************************************************
+ * Description: Expands a word to a single string, joining multiple fields
+ * 				with spaces. Used for redirect targets and subscripts.
+ * Parameters: word = the raw word
+ * Returns: A malloc'd string
+ ****************************************************************************/
+char* expandToString(const char *word)
+{
+	FieldList fields = { 0 };
+	StrBuf joined = { 0 };
+	int i = 0;
+
+	expandWord(word, &fields, false);
+	sbAppend(&joined, "", 0);
+	for (i = 0; i < fields.count; i++)
+	{
+		if (i > 0)
+		{
+			sbAppendChar(&joined, ' ');
+		}
+		sbAppend(&joined, fields.fields[i], strlen(fields.fields[i]));
+	}
+	fieldsFree(&fields);
+	return joined.buf;
+}
+
+/*****************************************************************************
+ * Description: Expands the $ form at 'p': $$, $?, $name or ${...}. A $ that
+ * 				does not start an expansion is kept as is.
+ * Parameters: p = points at the $
+ * 			   cur = the field being built
+ * 			   out = the finished fields
+ * 			   started = set once the current field has content
+ * Returns: The position just past the expansion
+ ****************************************************************************/
+const char* expandDollar(const char *p, StrBuf *cur, FieldList *out, bool *started)
+{
+	if (p[1] == '$' || p[1] == '?')
+	{
+		char numStr[16];
+		sprintf(numStr, "%d", p[1] == '$' ? (int)getpid() : exitCode(childExitMethod));
+		sbAppend(cur, numStr, strlen(numStr));
+		*started = true;
+		return p + 2;
+	}
+
+	if (p[1] == '{')
+	{
+		// find the matching close brace, allowing nested ${...}
+		const char *q = p + 2;
+		int depth = 1;
+		for (; *q; q++)
+		{
+			if (*q == '{') { depth++; }
+			else if (*q == '}' && --depth == 0) { break; }
+		}
+		if (*q == '}')
+		{
+			expandBraced(p + 2, q - p - 2, cur, out, started);
+			return q + 1;
+		}
+	}
+
+	size_t len = nameLength(p + 1);
+	if (len > 0)
+	{
+		const char *value = scalarValue(findVar(p + 1, len));
+		if (!findVar(p + 1, len))
+		{
+			char *name = strndup(p + 1, len);
+			value = getenv(name) ? getenv(name) : "";
+			free(name);
+		}
+		sbAppend(cur, value, strlen(value));
+		if (value[0])
+		{
+			*started = true;
+		}
+		return p + 1 + len;
+	}
+
+	sbAppendChar(cur, '$');
+	*started = true;
+	return p + 1;
+}
+
+/*****************************************************************************
+ * Description: Adds one value of a multi-valued expansion. The first value
+ * 				joins the current field; later ones start new fields, or are
+ * 				joined with spaces.
+ * Parameters: val/len = the value
+ * 			   op = string operator to apply to the value, may be NULL
+ * 			   first = true for the first value, cleared on return
+ * 			   join = true to join values into one field
+ * 			   cur/out = the field being built and the finished fields
+ * Returns: None
+ ****************************************************************************/
+void emitValue(const char *val, size_t len, StrOp *op, bool *first, bool join, StrBuf *cur, FieldList *out)
+{
+	if (!*first)
+	{
+		if (join) { sbAppendChar(cur, ' '); }
+		else { fieldsPush(out, cur); }
+	}
+	applyStrOp(op, val, len, cur);
+	*first = false;
+}
+
+/*****************************************************************************
+ * Description: Looks up one element of a variable by subscript
+ * Parameters: var = the variable
+ * 			   sub = the expanded subscript
+ * Returns: The element, or NULL if unset
+ ****************************************************************************/
+ShellStr* lookupElement(ShellVar *var, const char *sub)
+{
+	if (var->kind == VAR_ASSOC)
+	{
+		return assocFind(&var->assoc, sub, strlen(sub));
+	}
+
+	long idx = strtol(sub, NULL, 10);
+	if (var->kind == VAR_SCALAR)
+	{
+		return (idx == 0 && var->scalar.kind != STR_UNSET) ? &var->scalar : NULL;
+	}
+	if (idx < 0)
+	{
+		idx += var->indexed.count;
+	}
+	return idx < 0 ? NULL : indexedGet(&var->indexed, idx);
+}
+
+/*****************************************************************************
+ * Description: Expands the inside of ${...}: name, name[sub], name[@],
+ * 				name[*], #name, #name[@] and !name[@], optionally followed by
+ * 				a string operator (see parseStrOp) applied to each value,
+ * 				except :off:len, which slices name[@] and name[*].
+ * Parameters: expr/len = the text between the braces
+ * 			   cur/out/started = as for expandDollar
+ * Returns: None
+ ****************************************************************************/
+void expandBraced(const char *expr, size_t len, StrBuf *cur, FieldList *out, bool *started)
+{
+	char *text = strndup(expr, len);
+	char *p = text,
+		 *sub = NULL;
+	bool wantLength = false,
+		 wantKeys = false;
+	StrOp op = { 0 };
+
+	if (*p == '#' && p[1]) { wantLength = true; p++; }
+	else if (*p == '!' && p[1]) { wantKeys = true; p++; }
+
+	size_t nameLen = nameLength(p);
+	char *rest = p + nameLen;
+	if (nameLen > 0 && *rest == '[')
+	{
+		char *close = strchr(rest, ']');
+		if (close)
+		{
+			*close = '\0';
+			sub = rest + 1;
+			rest = close + 1;
+		}
+	}
+
+	if (nameLen == 0 || (*rest && (wantLength || wantKeys || !parseStrOp(rest, &op))))
+	{
+		fprintf(stderr, "smallsh: ${%.*s}: bad substitution\n", (int)len, expr);
+		freeStrOp(&op);
+		free(text);
+		return;
+	}
+	p[nameLen] = '\0';
+
+	ShellVar *var = findVar(p, nameLen);
+	bool all = sub && (!strcmp(sub, "@") || !strcmp(sub, "*")),
+		 join = sub && !strcmp(sub, "*");
+	char numStr[32];
+
+	if (all && (wantLength || wantKeys || var))
+	{
+		size_t count = 0,
+			   i = 0;
+		bool first = true;
+		/* ${a[@]:off:len} slices the array rather than each element: an
+		 * indexed array from index off, anything else from the off'th
+		 * value, taking len values (take is -1 for all of them) */
+		long from = 0,
+			 take = -1,
+			 n = 0;
+		if (op.kind == ':')
+		{
+			if (op.hasLength && op.length < 0)
+			{
+				fprintf(stderr, "smallsh: %ld: substring expression < 0\n", op.length);
+				freeStrOp(&op);
+				free(text);
+				return;
+			}
+			take = op.hasLength ? op.length : -1;
+			from = op.offset;
+			if (from < 0 && var)
+			{
+				from += var->kind == VAR_INDEXED ? (long)var->indexed.count :
+						var->kind == VAR_ASSOC ? (long)var->assoc.size : var->scalar.kind != STR_UNSET;
+				take = from < 0 ? 0 : take;
+			}
+			op.kind = 0;
+		}
+
+		if (var && var->kind == VAR_SCALAR)
+		{
+			count = var->scalar.kind != STR_UNSET;
+			if (count && !wantLength && from <= 0 && take != 0)
+			{
+				emitValue(wantKeys ? "0" : strGet(&var->scalar), wantKeys ? 1 : var->scalar.len, &op, &first, join, cur, out);
+			}
+		}
+		else if (var && var->kind == VAR_INDEXED)
+		{
+			count = var->indexed.numSet;
+			for (i = from > 0 ? (size_t)from : 0; i < var->indexed.count && !wantLength && take != 0; i++)
+			{
+				ShellStr *elem = &var->indexed.elems[i];
+				if (elem->kind == STR_UNSET)
+				{
+					continue;
+				}
+				take -= take > 0;
+				if (wantKeys)
+				{
+					sprintf(numStr, "%zu", i);
+					emitValue(numStr, strlen(numStr), &op, &first, join, cur, out);
+				}
+				else
+				{
+					emitValue(strGet(elem), elem->len, &op, &first, join, cur, out);
+				}
+			}
+		}
+		else if (var && var->kind == VAR_ASSOC)
+		{
+			count = var->assoc.size;
+			for (i = 0; i < var->assoc.cap && !wantLength && take != 0; i++)
+			{
+				if (!(var->assoc.ctrl[i] & 0x80) && n++ >= from)
+				{
+					take -= take > 0;
+					ShellStr *str = wantKeys ? &var->assoc.slots[i].key : &var->assoc.slots[i].value;
+					emitValue(strGet(str), str->len, &op, &first, join, cur, out);
+				}
+			}
+		}
+
+		if (wantLength)
+		{
+			sprintf(numStr, "%zu", count);
+			sbAppend(cur, numStr, strlen(numStr));
+		}
+		if (wantLength || !first)
+		{
+			*started = true;
+		}
+		freeStrOp(&op);
+		free(text);
+		return;
+	}
+
+	const char *value = "";
+	if (sub && var)
+	{
+		char *expandedSub = expandToString(sub);
+		ShellStr *elem = lookupElement(var, expandedSub);
+		value = elem ? strGet(elem) : "";
+		free(expandedSub);
+	}
+	else if (var)
+	{
+		value = scalarValue(var);
+	}
+	else if (!sub && getenv(p))
+	{
+		value = getenv(p);
+	}
+
+	if (wantLength)
+	{
+		sprintf(numStr, "%zu", strlen(value));
+		value = numStr;
+	}
+	else if (op.kind == '=' && value[0] == '\0')
+	{
+		// := assigns the default as well as expanding to it
+		setElement(getOrCreateVar(p, nameLen), sub, sub ? strlen(sub) : 0, op.word);
+	}
+
+	size_t before = cur->len;
+	applyStrOp(&op, value, strlen(value), cur);
+	if (cur->len > before)
+	{
+		*started = true;
+	}
+	freeStrOp(&op);
+	free(text);
+}
+
+/*****************************************************************************
+ * Description: Parses a bracket expression like [a-z] or [!0-9[:space:]]
+ * 				into a byte set.
+ * Parameters: p = points at the [
+ * 			   set = receives the membership bitmap
+ * Returns: The position just past the closing ], or NULL if there is none
+ * 			(the [ is then a literal character)
+ ****************************************************************************/
+const char* globParseClass(const char *p, unsigned char *set)
+{
+	const char *q = p + 1;
+	bool negate = false;
+	int c = 0;
+
+	memset(set, 0, 32);
+	if (*q == '!' || *q == '^')
+	{
+		negate = true;
+		q++;
+	}
+
+	// a ] right after the [ is a member, not the end
+	do
+	{
+		if (*q == '\0')
+		{
+			return NULL;
+		}
+		if (*q == '[' && q[1] == ':')
+		{
+			const char *end = strstr(q + 2, ":]");
+			if (!end)
+			{
+				return NULL;
+			}
+			int (*classFn)(int) = NULL;
+			size_t nameLen = end - q - 2;
+			if (!strncmp(q + 2, "alpha", nameLen)) { classFn = isalpha; }
+			else if (!strncmp(q + 2, "digit", nameLen)) { classFn = isdigit; }
+			else if (!strncmp(q + 2, "alnum", nameLen)) { classFn = isalnum; }
+			else if (!strncmp(q + 2, "space", nameLen)) { classFn = isspace; }
+			else if (!strncmp(q + 2, "upper", nameLen)) { classFn = isupper; }
+			else if (!strncmp(q + 2, "lower", nameLen)) { classFn = islower; }
+			else if (!strncmp(q + 2, "punct", nameLen)) { classFn = ispunct; }
+			else if (!strncmp(q + 2, "xdigit", nameLen)) { classFn = isxdigit; }
+			for (c = 0; classFn && c < 256; c++)
+			{
+				if (classFn(c)) { set[c >> 3] |= 1 << (c & 7); }
+			}
+			q = end + 2;
+			continue;
+		}
+
+		unsigned char low = *q,
+					  high = *q;
+		if (*q == '\\' && q[1])
+		{
+			low = high = *++q;
+		}
+		if (q[1] == '-' && q[2] && q[2] != ']')
+		{
+			high = q[2];
+			q += 2;
+		}
+		for (c = low; c <= high; c++)
+		{
+			set[c >> 3] |= 1 << (c & 7);
+		}
+		q++;
+	} while (*q != ']');
+
+	if (negate)
+	{
+		for (c = 0; c < 32; c++)
+		{
+			set[c] = ~set[c];
+		}
+	}
+	return q + 1;
+}
+
+/*****************************************************************************
+ * Description: Compiles a glob pattern (* ? [...] and \ escapes) into a
+ * 				token list. Adjacent literal characters share one token.
+ * Parameters: text = the pattern
+ * Returns: A malloc'd compiled pattern
+ ****************************************************************************/
+GlobPattern* globCompile(const char *text)
+{
+	GlobPattern *pat = calloc(1, sizeof(GlobPattern));
+	size_t textLen = strlen(text),
+		   litLen = 0;
+	const char *p = text;
+
+	pat->text = strdup(text);
+	pat->literals = malloc(textLen + 1);
+	pat->tokens = malloc((textLen + 1) * sizeof(GlobToken));
+
+	while (*p)
+	{
+		GlobToken *tok = &pat->tokens[pat->numTokens];
+		const char *next = NULL;
+
+		if (*p == '*')
+		{
+			while (*p == '*')
+			{
+				p++;
+			}
+			tok->kind = GLOB_STAR;
+			pat->hasStar = true;
+			pat->numTokens++;
+			continue;
+		}
+		if (*p == '?')
+		{
+			tok->kind = GLOB_ANY;
+			tok->len = 1;
+			pat->numTokens++;
+			pat->minLen++;
+			p++;
+			continue;
+		}
+		if (*p == '[' && (next = globParseClass(p, tok->set)))
+		{
+			tok->kind = GLOB_CLASS;
+			tok->len = 1;
+			pat->numTokens++;
+			pat->minLen++;
+			p = next;
+			continue;
+		}
+
+		if (*p == '\\' && p[1])
+		{
+			p++;
+		}
+		// extend the previous literal token, or start a new one
+		if (pat->numTokens > 0 && tok[-1].kind == GLOB_LITERAL)
+		{
+			tok[-1].len++;
+		}
+		else
+		{
+			tok->kind = GLOB_LITERAL;
+			tok->start = litLen;
+			tok->len = 1;
+			pat->numTokens++;
+		}
+		pat->literals[litLen++] = *p++;
+		pat->minLen++;
+	}
+	return pat;
+}
+
+/*****************************************************************************
+ * Description: Gets the compiled form of a glob pattern from the cache,
+ * 				compiling it on a miss. The cache is direct mapped by hash.
+ * Parameters: text = the pattern
+ * Returns: The compiled pattern, owned by the cache
+ ****************************************************************************/
+GlobPattern* globLookup(const char *text)
+{
+	size_t slot = hashBytes(text, strlen(text)) % GLOB_CACHE_SIZE;
+	GlobPattern *pat = globCache[slot];
+
+	if (pat && !strcmp(pat->text, text))
+	{
+		return pat;
+	}
+	if (pat)
+	{
+		free(pat->text);
+		free(pat->literals);
+		free(pat->tokens);
+		free(pat);
+	}
+	globCache[slot] = globCompile(text);
+	return globCache[slot];
+}
+
+/*****************************************************************************
+ * Description: Checks if a glob pattern matches a whole string. Stars are
+ * 				handled by backtracking to the most recent one, which is
+ * 				enough since every other token has a fixed width.
+ * Parameters: pat = the compiled pattern
+ * 			   str/len = the string, need not be NUL terminated
+ * Returns: true if the pattern matches
+ ****************************************************************************/
+bool globMatch(GlobPattern *pat, const char *str, size_t len)
+{
+	int tok = 0,
+		starTok = -1;
+	size_t pos = 0,
+		   starPos = 0;
+
+	if (len < pat->minLen || (!pat->hasStar && len != pat->minLen))
+	{
+		return false;
+	}
+
+	while (true)
+	{
+		if (tok < pat->numTokens)
+		{
+			GlobToken *t = &pat->tokens[tok];
+			bool matched = false;
+			unsigned char c = pos < len ? str[pos] : 0;
+
+			switch (t->kind)
+			{
+				case GLOB_STAR:
+					starTok = ++tok;
+					starPos = pos;
+					continue;
+				case GLOB_ANY:
+					matched = pos < len;
+					break;
+				case GLOB_CLASS:
+					matched = pos < len && (t->set[c >> 3] & (1 << (c & 7)));
+					break;
+				case GLOB_LITERAL:
+					matched = len - pos >= t->len && !memcmp(str + pos, pat->literals + t->start, t->len);
+					break;
+			}
+			if (matched)
+			{
+				pos += t->len;
+				tok++;
+				continue;
+			}
+		}
+		else if (pos == len)
+		{
+			return true;
+		}
+
+		// mismatch, let the last star swallow one more byte
+		if (starTok < 0 || starPos >= len)
+		{
+			return false;
+		}
+		tok = starTok;
+		pos = ++starPos;
+	}
+}
+
+/*****************************************************************************
+ * Description: Finds the longest match of a pattern starting at 'start'
+ * Parameters: pat = the compiled pattern
+ * 			   str/len = the string
+ * 			   start = where the match must begin
+ * 			   matchLen = receives the length of the match
+ * Returns: true if there is a match
+ ****************************************************************************/
+bool globMatchAt(GlobPattern *pat, const char *str, size_t len, size_t start, size_t *matchLen)
+{
+	size_t n = pat->hasStar ? len - start : pat->minLen;
+	if (start + pat->minLen > len)
+	{
+		return false;
+	}
+	for (;; n--)
+	{
+		if (globMatch(pat, str + start, n))
+		{
+			*matchLen = n;
+			return true;
+		}
+		if (n == pat->minLen || !pat->hasStar)
+		{
+			return false;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Appends text that must match literally to a pattern,
+ * 				escaping the characters the pattern compiler treats
+ * 				specially.
+ * Parameters: dst = the pattern being built
+ * 			   text/len = the literal text
+ * 			   special = GLOB_SPECIAL or REGEX_SPECIAL
+ * Returns: None
+ ****************************************************************************/
+void patternEscape(StrBuf *dst, const char *text, size_t len, const char *special)
+{
+	size_t i = 0;
+	for (i = 0; i < len; i++)
+	{
+		if (text[i] && strchr(special, text[i]))
+		{
+			sbAppendChar(dst, '\\');
+		}
+		sbAppendChar(dst, text[i]);
+	}
+}
+
+/*****************************************************************************
+ * Description: Expands a pattern word: the pattern of a ${...} operator or
+ * 				the right side of [[ == ]] and [[ =~ ]]. Quotes are removed
+ * 				and what they held is escaped, so it matches literally;
+ * 				unquoted text and expansions keep their pattern meaning.
+ * Parameters: text = the raw pattern
+ * 			   special = the characters to escape, GLOB_SPECIAL or
+ * 			   			 REGEX_SPECIAL
+ * Returns: A malloc'd pattern
+ ****************************************************************************/
+char* expandPatternText(const char *text, const char *special)
+{
+	StrBuf glob = { 0 },
+		   value = { 0 };
+	FieldList fields = { 0 };
+	bool inDouble = false,
+		 started = false;
+	const char *p = text;
+	int i = 0;
+
+	sbAppend(&glob, "", 0);
+	while (*p)
+	{
+		if (*p == '\\' && p[1] && (!inDouble || strchr("$`\"\\", p[1])))
+		{
+			patternEscape(&glob, p + 1, 1, special);
+			p += 2;
+		}
+		else if (*p == '\'' && !inDouble)
+		{
+			const char *end = strchr(p + 1, '\'');
+			if (!end)
+			{
+				end = p + strlen(p);
+			}
+			patternEscape(&glob, p + 1, end - p - 1, special);
+			p = *end ? end + 1 : end;
+		}
+		else if (*p == '"')
+		{
+			inDouble = !inDouble;
+			p++;
+		}
+		else if (*p == '$')
+		{
+			// multi-valued expansions are joined with spaces
+			value.len = 0;
+			p = expandDollar(p, &value, &fields, &started);
+			for (i = fields.count - 1; i >= 0; i--)
+			{
+				StrBuf joined = { 0 };
+				sbAppend(&joined, fields.fields[i], strlen(fields.fields[i]));
+				sbAppendChar(&joined, ' ');
+				sbAppend(&joined, value.buf, value.len);
+				free(value.buf);
+				value = joined;
+			}
+			fieldsFree(&fields);
+			if (inDouble)
+			{
+				patternEscape(&glob, value.buf, value.len, special);
+			}
+			else
+			{
+				sbAppend(&glob, value.buf, value.len);
+			}
+		}
+		else if (inDouble)
+		{
+			patternEscape(&glob, p++, 1, special);
+		}
+		else
+		{
+			sbAppendChar(&glob, *p++);
+		}
+	}
+
+	free(value.buf);
+	return glob.buf;
+}
+
+/*****************************************************************************
+ * Description: Expands and compiles the pattern part of an operator
+ * Parameters: text = the raw pattern
+ * Returns: The compiled pattern
+ ****************************************************************************/
+GlobPattern* expandPattern(const char *text)
+{
+	char *expanded = expandPatternText(text, GLOB_SPECIAL);
+	GlobPattern *pat = globLookup(expanded);
+	free(expanded);
+	return pat;
+}
+
+/*****************************************************************************
+ * Description: Parses the operator that follows the name in ${...}:
+ * 				#pat ##pat %pat %%pat /pat/rep //pat/rep /#pat/rep /%pat/rep
+ * 				:off :off:len :-word :+word :=word ^ ^^ , ,,
+ * Parameters: text = the operator text, modified in place
+ * 			   op = receives the parsed operator
+ * Returns: false if the operator is not recognized
+ ****************************************************************************/
+bool parseStrOp(char *text, StrOp *op)
+{
+	char *p = text + 1;
+	op->kind = text[0];
+
+	switch (op->kind)
+	{
+		case '#':
+		case '%':
+			if (*p == op->kind) { op->longest = true; p++; }
+			op->pat = expandPattern(p);
+			return true;
+		case '/':
+		{
+			if (*p == '/') { op->longest = true; p++; }
+			else if (*p == '#' || *p == '%') { op->anchor = *p++; }
+
+			// the pattern ends at the first unescaped, unquoted /
+			char *q = p,
+				 quote = '\0';
+			for (; *q && (quote || *q != '/'); q++)
+			{
+				if (*q == '\\' && q[1] && quote != '\'') { q++; }
+				else if (*q == quote) { quote = '\0'; }
+				else if (!quote && (*q == '\'' || *q == '"')) { quote = *q; }
+			}
+			op->word = expandToString(*q ? q + 1 : "");
+			*q = '\0';
+			op->pat = expandPattern(p);
+			return true;
+		}
+		case '^':
+		case ',':
+			if (*p == op->kind) { op->longest = true; p++; }
+			return *p == '\0';
+		case ':':
+		{
+			if (*p == '-' || *p == '+' || *p == '=')
+			{
+				op->kind = *p;
+				op->word = expandToString(p + 1);
+				return true;
+			}
+
+			char *lenPart = strchr(p, ':'),
+				 *expanded = NULL,
+				 *end = NULL;
+			if (lenPart)
+			{
+				*lenPart++ = '\0';
+				expanded = expandToString(lenPart);
+				op->length = strtol(expanded, &end, 10);
+				op->hasLength = true;
+				free(expanded);
+			}
+			expanded = expandToString(p);
+			op->offset = strtol(expanded, &end, 10);
+			free(expanded);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*****************************************************************************
+ * Description: Applies a string operator to a value, appending the result
+ * 				straight to the field being built.
+ * Parameters: op = the operator, NULL or kind 0 for none
+ * 			   val/len = the value
+ * 			   dst = where the result goes
+ * Returns: None
+ ****************************************************************************/
+void applyStrOp(StrOp *op, const char *val, size_t len, StrBuf *dst)
+{
+	size_t i = 0,
+		   n = 0;
+
+	switch (op ? op->kind : 0)
+	{
+		case '#': // strip the shortest or longest matching prefix
+			if (op->longest)
+			{
+				for (n = len + 1; n-- > 0 && !globMatch(op->pat, val, n););
+			}
+			else
+			{
+				for (n = 0; n <= len && !globMatch(op->pat, val, n); n++);
+			}
+			if (n > len) { n = 0; }
+			sbAppend(dst, val + n, len - n);
+			break;
+		case '%': // strip the shortest or longest matching suffix
+			if (op->longest)
+			{
+				for (i = 0; i <= len && !globMatch(op->pat, val + i, len - i); i++);
+			}
+			else
+			{
+				for (i = len + 1; i-- > 0 && !globMatch(op->pat, val + i, len - i););
+			}
+			if (i > len) { i = len; }
+			sbAppend(dst, val, i);
+			break;
+		case '/': // replace the first, every, leading or trailing match
+			if (op->anchor == '%')
+			{
+				for (i = 0; i <= len && !globMatch(op->pat, val + i, len - i); i++);
+				sbAppend(dst, val, i > len ? len : i);
+				if (i <= len) { sbAppend(dst, op->word, strlen(op->word)); }
+				break;
+			}
+			if (op->anchor == '#')
+			{
+				// an empty match at the start still counts, so /#/ prepends
+				if (globMatchAt(op->pat, val, len, 0, &n)) { sbAppend(dst, op->word, strlen(op->word)); }
+				else { n = 0; }
+				sbAppend(dst, val + n, len - n);
+				break;
+			}
+			for (i = 0; i < len; )
+			{
+				bool replaced = false;
+				if (op->pat->numTokens > 0 && globMatchAt(op->pat, val, len, i, &n) && n > 0)
+				{
+					sbAppend(dst, op->word, strlen(op->word));
+					i += n;
+					replaced = true;
+				}
+				if (replaced && !op->longest)
+				{
+					break;
+				}
+				if (!replaced)
+				{
+					sbAppendChar(dst, val[i++]);
+				}
+			}
+			sbAppend(dst, val + i, len - i);
+			break;
+		case '^': // upper case the first or every character
+		case ',': // lower case the first or every character
+			for (i = 0; i < len; i++)
+			{
+				char c = val[i];
+				if (i == 0 || op->longest)
+				{
+					c = op->kind == '^' ? toupper((unsigned char)c) : tolower((unsigned char)c);
+				}
+				sbAppendChar(dst, c);
+			}
+			break;
+		case ':': // substring, negative values count from the end
+		{
+			long start = op->offset < 0 ? (long)len + op->offset : op->offset,
+				 end = (long)len;
+			if (start < 0 || start > (long)len)
+			{
+				break;
+			}
+			if (op->hasLength)
+			{
+				end = op->length < 0 ? (long)len + op->length : start + op->length;
+				if (end > (long)len) { end = len; }
+			}
+			if (end > start)
+			{
+				sbAppend(dst, val + start, end - start);
+			}
+			break;
+		}
+		case '-': // use the word if the value is empty
+		case '=':
+			if (len) { sbAppend(dst, val, len); }
+			else { sbAppend(dst, op->word, strlen(op->word)); }
+			break;
+		case '+': // use the word if the value is not empty
+			if (len) { sbAppend(dst, op->word, strlen(op->word)); }
+			break;
+		default:
+			sbAppend(dst, val, len);
+	}
+}
+
+/*****************************************************************************
+ * Description: Frees what a parsed operator owns. Patterns belong to the
+ * 				glob cache and are not freed.
+ * Parameters: op = the operator
+ * Returns: None
+ ****************************************************************************/
+void freeStrOp(StrOp *op)
+{
+	free(op->word);
+	op->word = NULL;
+}
+
+/*****************************************************************************
+ * Description: Looks up a builtin in the builtin table
+ * Parameters: name = the command name
+ * Returns: The builtin, or NULL if the command is not one
+ ****************************************************************************/
+const Builtin* findBuiltin(const char *name)
+{
+	size_t i = 0;
+	for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+	{
+		if (!strcmp(builtins[i].name, name))
+		{
+			return &builtins[i];
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Runs a builtin in the shell process. Its redirects are applied
+ * 				to the shell's own stdin/stdout and undone afterwards; unlike
+ * 				in a child, a redirect that fails only fails the command.
+ * 				Output stdout could not take is dropped, not left for the
+ * 				next command, and a closed pipe gives the status SIGPIPE
+ * 				would have.
+ * Parameters: builtin = the builtin to run
+ * 			   args/argCount = the command words
+ * 			   newStdin/newStdout = the redirect filenames, may be NULL
+ * Returns: The builtin's exit status
+ ****************************************************************************/
+int runBuiltin(const Builtin *builtin, char **args, int argCount, char *newStdin, char *newStdout)
+{
+	RedirectFrame frame;
+	int result = 1,
+		err = 0;
+
+	if (!pushRedirects(newStdin, newStdout, &frame))
+	{
+		return 1;
+	}
+	result = builtin->fn(args, argCount);
+	err = fflush(stdout) == EOF ? errno : 0;
+	if (ferror(stdout))
+	{
+		__fpurge(stdout);
+		clearerr(stdout);
+		result = result ? result : (err == EPIPE ? 128 + SIGPIPE : 1);
+	}
+	popRedirects(&frame);
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Redirects the shell's own stdin/stdout for a builtin or group
+ * 				and makes the redirected fds the ones commands inside it are
+ * 				reset to.
+ * Parameters: newStdin/newStdout = the redirect filenames, may be NULL
+ * 			   frame = receives what popRedirects needs to undo it
+ * Returns: false (after printing why) if a file could not be opened, in
+ * 			which case nothing was redirected
+ ****************************************************************************/
+bool pushRedirects(char *newStdin, char *newStdout, RedirectFrame *frame)
+{
+	int inputFD = -1,
+		outputFD = -1;
+
+	frame->prevSavedStdin = frame->prevSavedStdout = -1;
+	if (newStdin && (inputFD = open(newStdin, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		perror("Input file could not be opened");
+		return false;
+	}
+	if (newStdout && (outputFD = open(newStdout, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+	{
+		perror("Output file could not be opened");
+		if (inputFD != -1) { close(inputFD); }
+		return false;
+	}
+
+	fflush(stdout);
+	if (inputFD != -1)
+	{
+		dup2(inputFD, STDIN_NUM);
+		frame->prevSavedStdin = savedStdin;
+		savedStdin = inputFD;
+	}
+	if (outputFD != -1)
+	{
+		dup2(outputFD, STDOUT_NUM);
+		frame->prevSavedStdout = savedStdout;
+		savedStdout = outputFD;
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Undoes pushRedirects, going back to the previous stdin/stdout
+ * Parameters: frame = filled in by pushRedirects
+ * Returns: None
+ ****************************************************************************/
+void popRedirects(RedirectFrame *frame)
+{
+	fflush(stdout);
+	if (frame->prevSavedStdin != -1)
+	{
+		close(savedStdin);
+		savedStdin = frame->prevSavedStdin;
+		redirectStdin(savedStdin);
+	}
+	if (frame->prevSavedStdout != -1)
+	{
+		close(savedStdout);
+		savedStdout = frame->prevSavedStdout;
+		redirectStdout(savedStdout);
+	}
+}
+
+/*****************************************************************************
+ * Description: Reads one delim terminated record from an fd, without
+ * 				consuming anything past the delimiter, so commands run later
+ * 				see the rest of the input.
+ * Parameters: fd = the fd to read
+ * 			   delim = the record terminator
+ * 			   out = the record is appended here, without the delimiter
+ * Returns: 1 if a full record was read, 0 if input ended after a partial
+ * 			record, -1 at end of input or on error
+ ****************************************************************************/
+int readRecord(int fd, char delim, StrBuf *out)
+{
+	struct stat info;
+	if (fstat(fd, &info) == -1)
+	{
+		return -1;
+	}
+
+	// regular files can be read ahead and seeked back
+	if (S_ISREG(info.st_mode) && lseek(fd, 0, SEEK_CUR) != -1)
+	{
+		return readSeekable(fd, delim, out);
+	}
+	// pipes can be peeked at with tee(2)
+	if (S_ISFIFO(info.st_mode))
+	{
+		return readPipe(fd, delim, out);
+	}
+
+	// a terminal in canonical mode never returns more than one line
+	bool lineAtATime = isatty(fd) && delim == '\n';
+	size_t before = out->len;
+	char buf[4096];
+	while (true)
+	{
+		ssize_t n = read(fd, buf, lineAtATime ? sizeof(buf) : 1);
+		if (n <= 0)
+		{
+			return out->len > before ? 0 : -1;
+		}
+		char *hit = memchr(buf, delim, n);
+		sbAppend(out, buf, hit ? (size_t)(hit - buf) : (size_t)n);
+		if (hit)
+		{
+			return 1;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: readRecord for regular files. Reads large blocks into the
+ * 				fd's FdReader and seeks the fd back to just past the record.
+ * 				The buffer is reused while the fd still refers to the same
+ * 				file at the offset it was left at, and the file's size and
+ * 				mtime show it hasn't been written since.
+ * Parameters: fd/delim/out = as for readRecord
+ * Returns: As for readRecord
+ ****************************************************************************/
+int readSeekable(int fd, char delim, StrBuf *out)
+{
+	static FdReader overflowReader;
+	FdReader *reader = fd < FD_READER_COUNT ? &fdReaders[fd] : &overflowReader;
+	struct stat info;
+	off_t pos = lseek(fd, 0, SEEK_CUR);
+	size_t before = out->len;
+
+	fstat(fd, &info);
+	if (!reader->valid || reader->dev != info.st_dev || reader->ino != info.st_ino || reader->pos != pos ||
+		reader->size != info.st_size || reader->mtime.tv_sec != info.st_mtim.tv_sec ||
+		reader->mtime.tv_nsec != info.st_mtim.tv_nsec)
+	{
+		reader->start = reader->end = 0;
+	}
+	if (!reader->buf)
+	{
+		reader->buf = malloc(FD_READER_BUFSIZE);
+	}
+	reader->valid = true;
+	reader->dev = info.st_dev;
+	reader->ino = info.st_ino;
+	reader->size = info.st_size;
+	reader->mtime = info.st_mtim;
+
+	while (true)
+	{
+		if (reader->start == reader->end)
+		{
+			ssize_t n = read(fd, reader->buf, FD_READER_BUFSIZE);
+			if (n <= 0)
+			{
+				reader->start = reader->end = 0;
+				reader->pos = lseek(fd, 0, SEEK_CUR);
+				return out->len > before ? 0 : -1;
+			}
+			reader->start = 0;
+			reader->end = n;
+		}
+
+		char *data = reader->buf + reader->start;
+		size_t avail = reader->end - reader->start;
+		char *hit = memchr(data, delim, avail);
+		size_t take = hit ? (size_t)(hit - data) : avail,
+			   used = hit ? take + 1 : avail;
+
+		sbAppend(out, data, take);
+		reader->start += used;
+		pos += used;
+		if (hit)
+		{
+			// leave the offset just past the record for whoever reads next
+			lseek(fd, pos, SEEK_SET);
+			reader->pos = pos;
+			return 1;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: readRecord for pipes. Copies the pending pipe data into a
+ * 				private pipe with tee(2), which does not consume it, looks
+ * 				for the delimiter there, and then reads exactly up to it from
+ * 				the real pipe. Falls back to single bytes if tee fails.
+ * Parameters: fd/delim/out = as for readRecord
+ * Returns: As for readRecord
+ ****************************************************************************/
+int readPipe(int fd, char delim, StrBuf *out)
+{
+	char buf[FD_READER_BUFSIZE];
+	size_t before = out->len;
+
+	if (peekPipe[0] == -1 && pipe2(peekPipe, O_CLOEXEC) == -1)
+	{
+		peekPipe[0] = peekPipe[1] = -1;
+	}
+
+	while (true)
+	{
+		ssize_t peeked = peekPipe[0] == -1 ? -1 : tee(fd, peekPipe[1], sizeof(buf), 0);
+		ssize_t want = 1;
+
+		if (peeked == 0)
+		{
+			return out->len > before ? 0 : -1;
+		}
+		if (peeked > 0)
+		{
+			// drain the copy; the private pipe never holds more than one tee
+			ssize_t got = 0, n = 0;
+			while (got < peeked && (n = read(peekPipe[0], buf + got, peeked - got)) > 0)
+			{
+				got += n;
+			}
+			char *hit = memchr(buf, delim, got);
+			want = hit ? hit - buf + 1 : got;
+		}
+
+		ssize_t n = read(fd, buf, want);
+		if (n <= 0)
+		{
+			return out->len > before ? 0 : -1;
+		}
+		if (buf[n - 1] == delim)
+		{
+			sbAppend(out, buf, n - 1);
+			return 1;
+		}
+		sbAppend(out, buf, n);
+	}
+}
+
+/*****************************************************************************
+ * Description: Checks if a character of a line read by read is a field
+ * 				separator
+ * Parameters: ifs = the separator characters
+ * 			   text/quoted = the line and which of its characters were quoted
+ * 			   idx = the character to check
+ * 			   spaceOnly = only count whitespace separators
+ * Returns: true if the character separates fields
+ ****************************************************************************/
+bool isIfs(const char *ifs, const char *text, const bool *quoted, size_t idx, bool spaceOnly)
+{
+	if (quoted[idx] || text[idx] == '\0' || !strchr(ifs, text[idx]))
+	{
+		return false;
+	}
+	return !spaceOnly || isspace((unsigned char)text[idx]);
+}
+
+/*****************************************************************************
+ * Description: The read builtin. read [-r] [-d delim] [-a array] [-p prompt]
+ * 				[-u fd] [name...]
+ * 				Reads one record and splits it on IFS into the named
+ * 				variables (REPLY if none), the last getting the remainder.
+ * 				Without -r, backslash quotes the next character and a
+ * 				backslash-newline continues the line.
+ * Parameters: args/argCount = the command words
+ * Returns: 0 on success, 1 at end of input (even after a partial record),
+ * 			2 on a usage error
+ ****************************************************************************/
+int readBuiltin(char **args, int argCount)
+{
+	bool raw = false;
+	char delim = '\n',
+		 *arrayName = NULL,
+		 *prompt = NULL;
+	int fd = STDIN_NUM,
+		i = 1;
+
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1]; i++)
+	{
+		if (!strcmp(args[i], "-r")) { raw = true; }
+		else if (!strcmp(args[i], "-d") && i + 1 < argCount) { delim = args[++i][0]; }
+		else if (!strcmp(args[i], "-a") && i + 1 < argCount) { arrayName = args[++i]; }
+		else if (!strcmp(args[i], "-p") && i + 1 < argCount) { prompt = args[++i]; }
+		else if (!strcmp(args[i], "-u") && i + 1 < argCount)
+		{
+			long value = 0;
+			if (!parseCount(args[++i], &value) || value > INT_MAX)
+			{
+				fprintf(stderr, "smallsh: read: -u: %s: invalid number\n", args[i]);
+				return 2;
+			}
+			fd = value;
+		}
+		else
+		{
+			fprintf(stderr, "smallsh: read: usage: read [-r] [-d delim] [-a array] [-p prompt] [-u fd] [name...]\n");
+			return 2;
+		}
+	}
+
+	if (prompt)
+	{
+		fprintf(stderr, "%s", prompt);
+	}
+
+	StrBuf line = { 0 };
+	int status = readRecord(fd, delim, &line);
+	sbAppend(&line, "", 0);
+
+	// a trailing unquoted backslash joins the next line
+	while (!raw && delim == '\n' && status == 1 && line.len > 0 && line.buf[line.len - 1] == '\\')
+	{
+		size_t slashes = 0;
+		while (slashes < line.len && line.buf[line.len - 1 - slashes] == '\\')
+		{
+			slashes++;
+		}
+		if (slashes % 2 == 0)
+		{
+			break;
+		}
+		line.len--;
+		status = readRecord(fd, delim, &line);
+		sbAppend(&line, "", 0);
+	}
+
+	/* remove backslash quoting, remembering which characters were quoted
+	 * so they are never treated as separators */
+	char *text = malloc(line.len + 1);
+	bool *quoted = calloc(line.len + 1, sizeof(bool));
+	size_t len = 0,
+		   pos = 0;
+	for (pos = 0; pos < line.len; pos++)
+	{
+		if (!raw && line.buf[pos] == '\\' && pos + 1 < line.len)
+		{
+			pos++;
+			quoted[len] = true;
+		}
+		text[len++] = line.buf[pos];
+	}
+	text[len] = '\0';
+	free(line.buf);
+
+	const char *ifs = findVar("IFS", 3) ? scalarValue(findVar("IFS", 3)) : " \t\n";
+
+	char *defaultName = "REPLY";
+	char **names = i < argCount ? args + i : &defaultName;
+	int numNames = i < argCount ? argCount - i : 1,
+		field = 0;
+	ShellVar *array = NULL;
+	if (arrayName)
+	{
+		array = getOrCreateVar(arrayName, strlen(arrayName));
+		resetVar(array, VAR_INDEXED);
+		numNames = -1;
+	}
+
+	// REPLY with no names keeps the whole line
+	bool splitting = i < argCount || arrayName;
+	pos = 0;
+	while (splitting && isIfs(ifs, text, quoted, pos, true)) { pos++; }
+
+	for (field = 0; numNames < 0 ? pos < len : field < numNames; field++)
+	{
+		size_t start = pos,
+			   end = len;
+		if (field != numNames - 1)
+		{
+			while (pos < len && !isIfs(ifs, text, quoted, pos, false)) { pos++; }
+			end = pos;
+			// skip one separator and the whitespace around it
+			while (isIfs(ifs, text, quoted, pos, true)) { pos++; }
+			if (pos < len && isIfs(ifs, text, quoted, pos, false)) { pos++; }
+			while (isIfs(ifs, text, quoted, pos, true)) { pos++; }
+		}
+		else if (splitting)
+		{
+			// the last name gets the rest, less trailing IFS whitespace
+			while (end > start && isIfs(ifs, text, quoted, end - 1, true)) { end--; }
+			pos = len;
+		}
+		else
+		{
+			pos = len;
+		}
+
+		if (array)
+		{
+			indexedSet(&array->indexed, field, text + start, end - start);
+		}
+		else
+		{
+			char saved = text[end];
+			text[end] = '\0';
+			setElement(getOrCreateVar(names[field], strlen(names[field])), NULL, 0, text + start);
+			text[end] = saved;
+		}
+	}
+
+	free(text);
+	free(quoted);
+	// like bash, a last record without its delimiter is assigned but still
+	// ends the input, so while read loops stop
+	return status == 1 ? 0 : 1;
+}
+
+/*****************************************************************************
+ * Description: The mapfile (readarray) builtin.
+ * 				mapfile [-t] [-d delim] [-n count] [-s skip] [-O origin]
+ * 				[-u fd] [array]
+ * 				Loads the records of an fd into an array (MAPFILE if none is
+ * 				named). Regular files are mmap'd and scanned with memchr;
+ * 				every record is copied once into a single buffer owned by
+ * 				the array and the elements point into it, so there is no
+ * 				allocation per element.
+ * Parameters: args/argCount = the command words
+ * Returns: 0 on success, 1 on error, 2 on a usage error
+ ****************************************************************************/
+int mapfileBuiltin(char **args, int argCount)
+{
+	bool trim = false;
+	char delim = '\n';
+	long count = 0,
+		 skip = 0,
+		 origin = 0;
+	bool hasOrigin = false;
+	int fd = STDIN_NUM,
+		i = 1;
+
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1]; i++)
+	{
+		if (!strcmp(args[i], "-t")) { trim = true; }
+		else if (!strcmp(args[i], "-d") && i + 1 < argCount) { delim = args[++i][0]; }
+		else if (strchr("nsOu", args[i][1]) && !args[i][2] && i + 1 < argCount)
+		{
+			long value = 0;
+			if (!parseCount(args[i + 1], &value) || (args[i][1] == 'u' && value > INT_MAX))
+			{
+				fprintf(stderr, "smallsh: %s: %s: %s: invalid number\n", args[0], args[i], args[i + 1]);
+				return 2;
+			}
+			switch (args[i++][1])
+			{
+				case 'n': count = value; break;
+				case 's': skip = value; break;
+				case 'O': origin = value; hasOrigin = true; break;
+				default: fd = value; break;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "smallsh: %s: usage: %s [-t] [-d delim] [-n count] [-s skip] [-O origin] [-u fd] [array]\n", args[0], args[0]);
+			return 2;
+		}
+	}
+
+	const char *name = i < argCount ? args[i] : "MAPFILE";
+	if (nameLength(name) != strlen(name))
+	{
+		fprintf(stderr, "smallsh: %s: `%s': not a valid identifier\n", args[0], name);
+		return 1;
+	}
+
+	/* get the input as one block of memory - the rest of a regular file is
+	 * mapped, anything else is read into a buffer */
+	struct stat info;
+	StrBuf readBuf = { 0 };
+	char *data = NULL,
+		 *map = MAP_FAILED;
+	size_t size = 0,
+		   mapLen = 0;
+	off_t pos = lseek(fd, 0, SEEK_CUR);
+
+	if (fstat(fd, &info) == -1)
+	{
+		perror("mapfile");
+		return 1;
+	}
+	if (S_ISREG(info.st_mode) && pos != -1 && info.st_size > pos)
+	{
+		off_t aligned = pos & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+		mapLen = info.st_size - aligned;
+		map = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, fd, aligned);
+		if (map != MAP_FAILED)
+		{
+			madvise(map, mapLen, MADV_SEQUENTIAL);
+			data = map + (pos - aligned);
+			size = info.st_size - pos;
+		}
+	}
+	if (map == MAP_FAILED && count > 0)
+	{
+		// only take as many records as asked for, leaving the rest unread
+		long n = 0;
+		int status = 0;
+		for (n = 0; n < skip + count && (status = readRecord(fd, delim, &readBuf)) != -1; n++)
+		{
+			if (status == 1)
+			{
+				sbAppendChar(&readBuf, delim);
+			}
+		}
+		data = readBuf.buf;
+		size = readBuf.len;
+	}
+	else if (map == MAP_FAILED)
+	{
+		char chunk[FD_READER_BUFSIZE];
+		ssize_t n = 0;
+		while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+		{
+			sbAppend(&readBuf, chunk, n);
+		}
+		data = readBuf.buf;
+		size = readBuf.len;
+	}
+
+	// first pass - find where the wanted records start and end
+	const char *p = data,
+			   *end = data + size,
+			   *first = NULL;
+	long records = 0,
+		 seen = 0;
+	while (p < end && (count == 0 || records < count))
+	{
+		const char *hit = memchr(p, delim, end - p);
+		const char *next = hit ? hit + 1 : end;
+		if (seen++ == skip)
+		{
+			first = p;
+		}
+		if (seen > skip)
+		{
+			records++;
+		}
+		p = next;
+	}
+	size_t consumed = p - data;
+
+	// a regular file is left positioned just past the records used
+	if (map != MAP_FAILED)
+	{
+		lseek(fd, pos + consumed, SEEK_SET);
+	}
+
+	ShellVar *var = getOrCreateVar(name, strlen(name));
+	if (!hasOrigin || var->kind != VAR_INDEXED)
+	{
+		resetVar(var, VAR_INDEXED);
+	}
+	IndexedArray *arr = &var->indexed;
+
+	// second pass - copy the records into one slab with room for the NULs
+	if (records > 0 && !indexedReserve(arr, origin + records))
+	{
+		fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], name, origin + records > MAX_ARRAY_SIZE ? "array subscript too large" : strerror(ENOMEM));
+		records = -1;
+	}
+	if (records > 0)
+	{
+		size_t slabLen = (p - first) + records;
+		char *slab = malloc(slabLen),
+			 *dst = slab;
+		arr->slabs = realloc(arr->slabs, (arr->numSlabs + 1) * sizeof(char *));
+		arr->slabs[arr->numSlabs++] = slab;
+
+		long n = 0;
+		for (p = first, n = 0; n < records; n++)
+		{
+			const char *hit = memchr(p, delim, end - p);
+			const char *next = hit ? hit + 1 : end;
+			size_t len = (hit && trim) ? (size_t)(hit - p) : (size_t)(next - p);
+			ShellStr *elem = &arr->elems[origin + n];
+
+			memcpy(dst, p, len);
+			dst[len] = '\0';
+			if (elem->kind == STR_UNSET)
+			{
+				arr->numSet++;
+			}
+			strFree(elem);
+			elem->kind = STR_SLAB;
+			elem->len = len;
+			elem->data.ptr = dst;
+			dst += len + 1;
+			p = next;
+		}
+		if ((size_t)(origin + records) > arr->count)
+		{
+			arr->count = origin + records;
+		}
+	}
+
+	if (map != MAP_FAILED)
+	{
+		munmap(map, mapLen);
+	}
+	free(readBuf.buf);
+	return records == -1 ? 1 : 0;
+}
+
+/*****************************************************************************
+ * Description: Processes backslash escapes for printf. In the format, \ooo
+ * 				is an octal byte; in a %b argument it is \0ooo and \c stops
+ * 				all further output.
+ * Parameters: src = the text to process
+ * 			   dst = receives the result, at least as long as src
+ * 			   isArg = true for a %b argument, false for the format
+ * 			   stop = set if \c was found, may be NULL
+ * Returns: The length of the result
+ ****************************************************************************/
+size_t processEscapes(const char *src, char *dst, bool isArg, bool *stop)
+{
+	size_t len = 0;
+	const char *p = src;
+
+	while (*p)
+	{
+		if (*p != '\\' || p[1] == '\0')
+		{
+			dst[len++] = *p++;
+			continue;
+		}
+
+		p++;
+		switch (*p)
+		{
+			case 'a': dst[len++] = '\a'; p++; break;
+			case 'b': dst[len++] = '\b'; p++; break;
+			case 'f': dst[len++] = '\f'; p++; break;
+			case 'n': dst[len++] = '\n'; p++; break;
+			case 'r': dst[len++] = '\r'; p++; break;
+			case 't': dst[len++] = '\t'; p++; break;
+			case 'v': dst[len++] = '\v'; p++; break;
+			case '\\': dst[len++] = '\\'; p++; break;
+			case 'c':
+				if (isArg)
+				{
+					if (stop) { *stop = true; }
+					return len;
+				}
+				dst[len++] = '\\';
+				break;
+			case 'x':
+			{
+				int value = 0, digits = 0;
+				for (p++; digits < 2 && isxdigit((unsigned char)*p); digits++, p++)
+				{
+					value = value * 16 + (isdigit((unsigned char)*p) ? *p - '0' : tolower((unsigned char)*p) - 'a' + 10);
+				}
+				if (digits == 0) { dst[len++] = '\\'; dst[len++] = 'x'; }
+				else { dst[len++] = value; }
+				break;
+			}
+			default:
+				if (*p >= '0' && *p <= '7')
+				{
+					// %b arguments spell octal \0ooo, formats \ooo
+					int value = 0, digits = 0;
+					if (isArg && *p == '0') { p++; }
+					for (; digits < 3 && *p >= '0' && *p <= '7'; digits++, p++)
+					{
+						value = value * 8 + (*p - '0');
+					}
+					dst[len++] = value;
+				}
+				else
+				{
+					dst[len++] = '\\';
+				}
+		}
+	}
+	return len;
+}
+
+/*****************************************************************************
+ * Description: Compiles a printf format into literal and conversion
+ * 				directives. Escapes are processed here, once.
+ * Parameters: format = the format string
+ * Returns: A malloc'd compiled format, or NULL if it is invalid
+ ****************************************************************************/
+PrintfFormat* printfCompile(const char *format)
+{
+	PrintfFormat *fmt = calloc(1, sizeof(PrintfFormat));
+	size_t formatLen = strlen(format),
+		   litLen = 0;
+	const char *p = format;
+
+	fmt->format = strdup(format);
+	fmt->literals = malloc(formatLen + 1);
+	fmt->dirs = malloc((formatLen + 1) * sizeof(PrintfDirective));
+
+	while (*p)
+	{
+		PrintfDirective *dir = &fmt->dirs[fmt->numDirs];
+		memset(dir, 0, sizeof(PrintfDirective));
+		dir->prec = -1;
+
+		if (*p != '%' || p[1] == '%')
+		{
+			// gather literal text up to the next conversion
+			const char *end = p;
+			if (*p == '%') { end = p + 2; }
+			while (*end && !(*end == '%' && end[1] != '%'))
+			{
+				end += (*end == '%') ? 2 : 1;
+			}
+
+			char *text = strndup(p, end - p),
+				 *src = text,
+				 *dst = text;
+			// collapse %% first, then escapes
+			for (; *src; src++)
+			{
+				*dst++ = *src;
+				if (*src == '%' && src[1] == '%') { src++; }
+			}
+			*dst = '\0';
+			dir->textStart = litLen;
+			dir->textLen = processEscapes(text, fmt->literals + litLen, false, NULL);
+			litLen += dir->textLen;
+			free(text);
+			fmt->numDirs++;
+			p = end;
+			continue;
+		}
+
+		// %[flags][width][.precision][length]conversion
+		char flags[8] = { 0 };
+		int numFlags = 0;
+		for (p++; *p && strchr("-+ #0", *p); p++)
+		{
+			if (numFlags < 5 && !strchr(flags, *p)) { flags[numFlags++] = *p; }
+		}
+		if (*p == '*') { dir->widthArg = true; p++; }
+		else { for (; isdigit((unsigned char)*p); p++) { dir->width = dir->width * 10 + (*p - '0'); } }
+		if (*p == '.')
+		{
+			p++;
+			dir->prec = 0;
+			if (*p == '*') { dir->precArg = true; p++; }
+			else { for (; isdigit((unsigned char)*p); p++) { dir->prec = dir->prec * 10 + (*p - '0'); } }
+		}
+		const char *modifier = NULL;
+		while (*p && strchr("hlLjzt", *p))
+		{
+			modifier = p++;
+		}
+
+		dir->conv = *p;
+		switch (*p)
+		{
+			case 'd': case 'i':
+				sprintf(dir->spec, "%%%s*.*ll%c", flags, *p);
+				break;
+			case 'o': case 'u': case 'x': case 'X':
+				sprintf(dir->spec, "%%%s*.*ll%c", flags, *p);
+				break;
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+				sprintf(dir->spec, "%%%s*.*L%c", flags, *p);
+				break;
+			case 'c':
+				sprintf(dir->spec, "%%%s*c", flags);
+				break;
+			case 's': case 'b':
+				sprintf(dir->spec, "%%%s*.*s", flags);
+				break;
+			default:
+				// in %z\n or %l the modifier is what was meant as the conversion
+				if (modifier && !isalpha((unsigned char)*p)) { p = modifier; }
+				if (*p) { fprintf(stderr, "smallsh: printf: `%c': invalid format character\n", *p); }
+				else { fprintf(stderr, "smallsh: printf: missing format character\n"); }
+				free(fmt->format);
+				free(fmt->literals);
+				free(fmt->dirs);
+				free(fmt);
+				return NULL;
+		}
+		fmt->usesArgs = true;
+		fmt->numDirs++;
+		p++;
+	}
+	return fmt;
+}
+
+/*****************************************************************************
+ * Description: Gets the compiled form of a printf format from the cache,
+ * 				compiling it on a miss.
+ * Parameters: format = the format string
+ * Returns: The compiled format, owned by the cache, or NULL if invalid
+ ****************************************************************************/
+PrintfFormat* printfLookup(const char *format)
+{
+	size_t slot = hashBytes(format, strlen(format)) % PRINTF_CACHE_SIZE;
+	PrintfFormat *fmt = printfCache[slot];
+
+	if (fmt && !strcmp(fmt->format, format))
+	{
+		return fmt;
+	}
+
+	PrintfFormat *compiled = printfCompile(format);
+	if (compiled && fmt)
+	{
+		free(fmt->format);
+		free(fmt->literals);
+		free(fmt->dirs);
+		free(fmt);
+	}
+	if (compiled)
+	{
+		printfCache[slot] = compiled;
+	}
+	return compiled;
+}
+
+/*****************************************************************************
+ * Description: Converts a printf numeric argument. Accepts C style decimal,
+ * 				octal and hex constants, and 'c or "c for a character code.
+ * Parameters: arg = the argument
+ * 			   out = receives the value, as much as could be converted
+ * Returns: false (after printing a message) if the argument is not a number
+ ****************************************************************************/
+bool parseNumArg(const char *arg, long long *out)
+{
+	char *end = NULL;
+
+	if (arg[0] == '\'' || arg[0] == '"')
+	{
+		*out = (unsigned char)arg[1];
+		return true;
+	}
+	*out = strtoll(arg, &end, 0);
+	if (*arg == '\0')
+	{
+		return true;
+	}
+	if (end == arg || *end != '\0')
+	{
+		fprintf(stderr, "smallsh: printf: %s: invalid number\n", arg);
+		return false;
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: The printf builtin. printf [-v var] format [arguments...]
+ * 				Follows the POSIX printf utility: the format is reused until
+ * 				the arguments run out, and missing arguments are 0 or "".
+ * 				Formats are compiled once and cached. -v stores the output
+ * 				in a variable instead of printing it.
+ * Parameters: args/argCount = the command words
+ * Returns: 0 on success, 1 if an argument was invalid, 2 on a usage error
+ ****************************************************************************/
+int printfBuiltin(char **args, int argCount)
+{
+	const char *varName = NULL;
+	int first = 1,
+		result = 0;
+
+	if (argCount > 2 && !strcmp(args[1], "-v"))
+	{
+		varName = args[2];
+		first = 3;
+	}
+	if (first < argCount && !strcmp(args[first], "--"))
+	{
+		first++;
+	}
+	if (first >= argCount)
+	{
+		fprintf(stderr, "smallsh: printf: usage: printf [-v var] format [arguments]\n");
+		return 2;
+	}
+
+	PrintfFormat *fmt = printfLookup(args[first]);
+	if (!fmt)
+	{
+		return 1;
+	}
+
+	char *memBuf = NULL;
+	size_t memLen = 0;
+	FILE *out = varName ? open_memstream(&memBuf, &memLen) : stdout;
+	int arg = first + 1,
+		d = 0;
+	bool stop = false;
+
+	do
+	{
+		for (d = 0; d < fmt->numDirs && !stop; d++)
+		{
+			PrintfDirective *dir = &fmt->dirs[d];
+			long long width = dir->width,
+					  prec = dir->prec,
+					  num = 0;
+			if (!dir->conv)
+			{
+				fwrite(fmt->literals + dir->textStart, 1, dir->textLen, out);
+				continue;
+			}
+			if (dir->widthArg && arg < argCount && !parseNumArg(args[arg++], &width)) { result = 1; }
+			if (dir->precArg && arg < argCount && !parseNumArg(args[arg++], &prec)) { result = 1; }
+
+			const char *value = arg < argCount ? args[arg++] : "";
+			switch (dir->conv)
+			{
+				case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+					if (!parseNumArg(value, &num)) { result = 1; }
+					fprintf(out, dir->spec, (int)width, (int)prec, num);
+					break;
+				case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+				{
+					char *end = NULL;
+					long double real = (value[0] == '\'' || value[0] == '"') ? (unsigned char)value[1] : strtold(value, &end);
+					if (end && *value && *end)
+					{
+						fprintf(stderr, "smallsh: printf: %s: invalid number\n", value);
+						result = 1;
+					}
+					fprintf(out, dir->spec, (int)width, (int)prec, real);
+					break;
+				}
+				case 'c':
+					if (value[0]) { fprintf(out, dir->spec, (int)width, value[0]); }
+					else if (width > 1) { fprintf(out, "%*s", (int)(dir->spec[1] == '-' ? -width : width), ""); }
+					break;
+				case 's':
+					fprintf(out, dir->spec, (int)width, (int)prec, value);
+					break;
+				case 'b':
+				{
+					char *expanded = malloc(strlen(value) + 1);
+					size_t len = processEscapes(value, expanded, true, &stop);
+					expanded[len] = '\0';
+					fprintf(out, dir->spec, (int)width, (int)prec, expanded);
+					free(expanded);
+					break;
+				}
+			}
+		}
+	} while (fmt->usesArgs && arg < argCount && !stop);
+
+	if (varName)
+	{
+		fclose(out);
+		ShellVar *var = getOrCreateVar(varName, strlen(varName));
+		setElement(var, NULL, 0, memBuf);
+		free(memBuf);
+	}
+	return result;
+}
+
+/*****************************************************************************
+ * Description: stat or lstat through the stat cache
+ * Parameters: path = the file to stat
+ * 			   follow = true for stat, false for lstat
+ * 			   info = receives the result
+ * Returns: 0 on success, -1 with errno set on failure
+ ****************************************************************************/
+int cachedStat(const char *path, bool follow, struct stat *info)
+{
+	int i = 0;
+	for (i = 0; i < statCacheCount; i++)
+	{
+		StatCacheEntry *entry = &statCache[i];
+		if (entry->follow == follow && !strcmp(entry->path, path))
+		{
+			*info = entry->info;
+			errno = entry->err;
+			return entry->err ? -1 : 0;
+		}
+	}
+
+	// take a free entry, or evict the oldest
+	StatCacheEntry *entry = NULL;
+	if (statCacheCount < STAT_CACHE_SIZE)
+	{
+		entry = &statCache[statCacheCount++];
+	}
+	else
+	{
+		entry = &statCache[statCacheNext];
+		statCacheNext = (statCacheNext + 1) % STAT_CACHE_SIZE;
+		free(entry->path);
+	}
+	memset(entry, 0, sizeof(StatCacheEntry));
+	entry->path = strdup(path);
+	entry->follow = follow;
+	entry->err = (follow ? stat(path, &entry->info) : lstat(path, &entry->info)) ? errno : 0;
+
+	*info = entry->info;
+	errno = entry->err;
+	return entry->err ? -1 : 0;
+}
+
+/*****************************************************************************
+ * Description: access(2) with the effective ids, through the stat cache.
+ * 				Permission checks are not derived from the mode bits, since
+ * 				ACLs, read-only mounts and root would make that wrong.
+ * Parameters: path = the file to check
+ * 			   mode = R_OK, W_OK or X_OK
+ * Returns: true if access is allowed
+ ****************************************************************************/
+bool cachedAccess(const char *path, int mode)
+{
+	struct stat info;
+	int i = 0;
+
+	// the entry is created by stat'ing the path if it is not cached yet
+	if (cachedStat(path, true, &info) == -1)
+	{
+		return false;
+	}
+	for (i = 0; i < statCacheCount; i++)
+	{
+		StatCacheEntry *entry = &statCache[i];
+		if (entry->follow && !strcmp(entry->path, path))
+		{
+			if (!(entry->accessChecked & mode))
+			{
+				entry->accessChecked |= mode;
+				if (!faccessat(AT_FDCWD, path, mode, AT_EACCESS))
+				{
+					entry->accessOk |= mode;
+				}
+			}
+			return entry->accessOk & mode;
+		}
+	}
+	return !faccessat(AT_FDCWD, path, mode, AT_EACCESS);
+}
+
+/*****************************************************************************
+ * Description: Forgets all cached stat results. Called whenever a command
+ * 				other than test runs, since it may change the file system.
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void clearStatCache()
+{
+	int i = 0;
+	for (i = 0; i < statCacheCount; i++)
+	{
+		free(statCache[i].path);
+	}
+	statCacheCount = 0;
+	statCacheNext = 0;
+}
+
+/*****************************************************************************
+ * Description: Gets a compiled extended regex from the cache, compiling it
+ * 				on a miss. The cache is direct mapped by hash.
+ * Parameters: pattern = the regex
+ * Returns: The compiled regex, owned by the cache, or NULL if invalid
+ ****************************************************************************/
+regex_t* regexLookup(const char *pattern)
+{
+	RegexCacheEntry *entry = &regexCache[hashBytes(pattern, strlen(pattern)) % REGEX_CACHE_SIZE];
+	regex_t compiled;
+
+	if (entry->pattern && !strcmp(entry->pattern, pattern))
+	{
+		return &entry->regex;
+	}
+	if (regcomp(&compiled, pattern, REG_EXTENDED))
+	{
+		return NULL;
+	}
+	if (entry->pattern)
+	{
+		free(entry->pattern);
+		regfree(&entry->regex);
+	}
+	entry->pattern = strdup(pattern);
+	entry->regex = compiled;
+	return &entry->regex;
+}
+
+/*****************************************************************************
+ * Description: Checks if a command is one of the test builtins
+ * Parameters: name = the command name
+ * Returns: true for test, [ and [[
+ ****************************************************************************/
+bool isTestCommand(const char *name)
+{
+	return !strcmp(name, "test") || !strcmp(name, "[") || !strcmp(name, "[[");
+}
+
+bool isUnaryTestOp(const char *op)
+{
+	return op[0] == '-' && op[1] && !op[2] && strchr("bcdefghLkprsStuwxOGNznv", op[1]);
+}
+
+bool isBinaryTestOp(const char *op, bool isDouble)
+{
+	static const char *ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+								 "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+	int i = 0;
+	for (i = 0; ops[i]; i++)
+	{
+		if (!strcmp(op, ops[i]))
+		{
+			return true;
+		}
+	}
+	return isDouble && !strcmp(op, "=~");
+}
+
+/*****************************************************************************
+ * Description: Evaluates a unary test such as -f file or -z string
+ * Parameters: tp = the parser, for reporting errors
+ * 			   op/arg = the operator and its operand
+ * Returns: The result of the test
+ ****************************************************************************/
+bool testUnary(TestParser *tp, const char *op, const char *arg)
+{
+	struct stat info;
+	char flag = op[1];
+
+	switch (flag)
+	{
+		case 'z': return arg[0] == '\0';
+		case 'n': return arg[0] != '\0';
+		case 'v': return findVar(arg, strlen(arg)) || getenv(arg);
+		case 't': return isatty(atoi(arg));
+		case 'r': return cachedAccess(arg, R_OK);
+		case 'w': return cachedAccess(arg, W_OK);
+		case 'x': return cachedAccess(arg, X_OK);
+		case 'h':
+		case 'L': return !cachedStat(arg, false, &info) && S_ISLNK(info.st_mode);
+	}
+
+	if (cachedStat(arg, true, &info) == -1)
+	{
+		return false;
+	}
+	switch (flag)
+	{
+		case 'e': return true;
+		case 'f': return S_ISREG(info.st_mode);
+		case 'd': return S_ISDIR(info.st_mode);
+		case 'b': return S_ISBLK(info.st_mode);
+		case 'c': return S_ISCHR(info.st_mode);
+		case 'p': return S_ISFIFO(info.st_mode);
+		case 'S': return S_ISSOCK(info.st_mode);
+		case 's': return info.st_size > 0;
+		case 'g': return info.st_mode & S_ISGID;
+		case 'u': return info.st_mode & S_ISUID;
+		case 'k': return info.st_mode & S_ISVTX;
+		case 'O': return info.st_uid == geteuid();
+		case 'G': return info.st_gid == getegid();
+		case 'N':
+			return info.st_mtim.tv_sec > info.st_atim.tv_sec ||
+				   (info.st_mtim.tv_sec == info.st_atim.tv_sec && info.st_mtim.tv_nsec > info.st_atim.tv_nsec);
+	}
+	tp->error = true;
+	return false;
+}
+
+/*****************************************************************************
+ * Description: Evaluates a binary test such as a = b or x -nt y. In [[ ]]
+ * 				== and != match glob patterns and =~ an extended regex,
+ * 				whose captures are stored in BASH_REMATCH.
+ * Parameters: tp = the parser, for reporting errors
+ * 			   left/op/right = the operands and operator
+ * Returns: The result of the test
+ ****************************************************************************/
+bool testBinary(TestParser *tp, const char *left, const char *op, const char *right)
+{
+	if (!strcmp(op, "=") || !strcmp(op, "==") || !strcmp(op, "!="))
+	{
+		bool equal = tp->isDouble ? globMatch(globLookup(right), left, strlen(left)) : !strcmp(left, right);
+		return (op[0] == '!') ? !equal : equal;
+	}
+	if (!strcmp(op, "<")) { return strcmp(left, right) < 0; }
+	if (!strcmp(op, ">")) { return strcmp(left, right) > 0; }
+
+	if (!strcmp(op, "=~"))
+	{
+		regex_t *regex = regexLookup(right);
+		regmatch_t matches[10];
+		if (!regex)
+		{
+			fprintf(stderr, "smallsh: [[: %s: invalid regular expression\n", right);
+			tp->error = true;
+			return false;
+		}
+		if (regexec(regex, left, 10, matches, 0))
+		{
+			return false;
+		}
+
+		ShellVar *rematch = getOrCreateVar("BASH_REMATCH", 12);
+		size_t i = 0;
+		resetVar(rematch, VAR_INDEXED);
+		for (i = 0; i <= regex->re_nsub && i < 10; i++)
+		{
+			if (matches[i].rm_so == -1)
+			{
+				indexedSet(&rematch->indexed, i, "", 0);
+			}
+			else
+			{
+				indexedSet(&rematch->indexed, i, left + matches[i].rm_so, matches[i].rm_eo - matches[i].rm_so);
+			}
+		}
+		return true;
+	}
+
+	if (!strcmp(op, "-nt") || !strcmp(op, "-ot") || !strcmp(op, "-ef"))
+	{
+		struct stat leftInfo, rightInfo;
+		bool leftOk = !cachedStat(left, true, &leftInfo),
+			 rightOk = !cachedStat(right, true, &rightInfo);
+		if (op[1] == 'e')
+		{
+			return leftOk && rightOk && leftInfo.st_dev == rightInfo.st_dev && leftInfo.st_ino == rightInfo.st_ino;
+		}
+		// a file that exists is newer than one that does not
+		if (!leftOk || !rightOk)
+		{
+			return op[1] == 'n' ? leftOk : rightOk;
+		}
+		struct timespec a = leftInfo.st_mtim,
+						b = rightInfo.st_mtim;
+		if (op[1] == 'o')
+		{
+			a = rightInfo.st_mtim;
+			b = leftInfo.st_mtim;
+		}
+		return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+	}
+
+	// the rest are integer comparisons
+	char *leftEnd = NULL,
+		 *rightEnd = NULL;
+	long long a = strtoll(left, &leftEnd, 10),
+			  b = strtoll(right, &rightEnd, 10);
+	while (isspace((unsigned char)*leftEnd)) { leftEnd++; }
+	while (isspace((unsigned char)*rightEnd)) { rightEnd++; }
+	if (leftEnd == left || *leftEnd || rightEnd == right || *rightEnd)
+	{
+		fprintf(stderr, "smallsh: %s: integer expression expected\n", (leftEnd == left || *leftEnd) ? left : right);
+		tp->error = true;
+		return false;
+	}
+	if (!strcmp(op, "-eq")) { return a == b; }
+	if (!strcmp(op, "-ne")) { return a != b; }
+	if (!strcmp(op, "-lt")) { return a < b; }
+	if (!strcmp(op, "-le")) { return a <= b; }
+	if (!strcmp(op, "-gt")) { return a > b; }
+	return a >= b;
+}
+
+/*****************************************************************************
+ * Description: Recursive descent over a test expression:
+ * 				or := and { -o | || and }
+ * 				and := not { -a | && not }
+ * 				not := ! not | primary
+ * 				primary := ( or ) | unary-op arg | arg binary-op arg | arg
+ * 				Evaluation happens while parsing.
+ * Parameters: tp = the parser
+ * Returns: The value of the expression
+ ****************************************************************************/
+bool testOr(TestParser *tp)
+{
+	bool result = testAnd(tp);
+	while (tp->pos < tp->end && !strcmp(tp->args[tp->pos], tp->isDouble ? "||" : "-o"))
+	{
+		tp->pos++;
+		// evaluate both sides so the parse position stays right
+		bool right = testAnd(tp);
+		result = result || right;
+	}
+	return result;
+}
+
+bool testAnd(TestParser *tp)
+{
+	bool result = testNot(tp);
+	while (tp->pos < tp->end && !strcmp(tp->args[tp->pos], tp->isDouble ? "&&" : "-a"))
+	{
+		tp->pos++;
+		bool right = testNot(tp);
+		result = result && right;
+	}
+	return result;
+}
+
+bool testNot(TestParser *tp)
+{
+	int remaining = tp->end - tp->pos;
+	// a lone ! is a string, and "! = x" compares the string !
+	if (remaining >= 2 && !strcmp(tp->args[tp->pos], "!") &&
+		!(remaining >= 3 && isBinaryTestOp(tp->args[tp->pos + 1], tp->isDouble)))
+	{
+		tp->pos++;
+		return !testNot(tp);
+	}
+	return testPrimary(tp);
+}
+
+bool testPrimary(TestParser *tp)
+{
+	int remaining = tp->end - tp->pos;
+	char **args = tp->args + tp->pos;
+
+	if (remaining <= 0)
+	{
+		fprintf(stderr, "smallsh: test: argument expected\n");
+		tp->error = true;
+		return false;
+	}
+
+	if (remaining >= 3 && isBinaryTestOp(args[1], tp->isDouble))
+	{
+		tp->pos += 3;
+		return testBinary(tp, args[0], args[1], args[2]);
+	}
+	if (remaining >= 2 && !strcmp(args[0], "("))
+	{
+		tp->pos++;
+		bool result = testOr(tp);
+		if (tp->pos >= tp->end || strcmp(tp->args[tp->pos], ")"))
+		{
+			fprintf(stderr, "smallsh: test: `)' expected\n");
+			tp->error = true;
+			return false;
+		}
+		tp->pos++;
+		return result;
+	}
+	if (remaining >= 2 && isUnaryTestOp(args[0]))
+	{
+		tp->pos += 2;
+		return testUnary(tp, args[0], args[1]);
+	}
+
+	// anything else is true if it is not empty
+	tp->pos++;
+	return args[0][0] != '\0';
+}
+
+/*****************************************************************************
+ * Description: The test, [ and [[ builtins. File tests go through a stat
+ * 				cache that lives until a command other than a test runs, so
+ * 				chained tests on the same file stat it once.
+ * Parameters: args/argCount = the command words
+ * Returns: 0 if the expression is true, 1 if false, 2 on error
+ ****************************************************************************/
+int testBuiltin(char **args, int argCount)
+{
+	TestParser tp = { 0 };
+	tp.args = args;
+	tp.pos = 1;
+	tp.end = argCount;
+	tp.isDouble = !strcmp(args[0], "[[");
+
+	// [ and [[ need their closing bracket
+	if (strcmp(args[0], "test"))
+	{
+		const char *close = tp.isDouble ? "]]" : "]";
+		if (argCount < 2 || strcmp(args[argCount - 1], close))
+		{
+			fprintf(stderr, "smallsh: %s: missing `%s'\n", args[0], close);
+			return 2;
+		}
+		tp.end--;
+	}
+
+	// no expression is false
+	if (tp.pos == tp.end)
+	{
+		return 1;
+	}
+
+	bool result = testOr(&tp);
+	if (!tp.error && tp.pos != tp.end)
+	{
+		fprintf(stderr, "smallsh: %s: %s: unexpected argument\n", args[0], args[tp.pos]);
+		tp.error = true;
+	}
+	return tp.error ? 2 : !result;
+}
+
+/*****************************************************************************
+ * Description: Duplicates an fd the shell keeps for itself, close on exec
+ * 				and at SHELL_FD_MIN or above
+ * Parameters: fd = the fd to duplicate
+ * Returns: The new fd, or -1 on failure
+ ****************************************************************************/
+int saveFd(int fd)
+{
+	return fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_MIN);
+}
+
+/*****************************************************************************
+ * Description: Marks every fd above stderr close on exec, just before exec.
+ * 				The shell's own fds are opened that way already; this also
+ * 				catches any the shell inherited, so a command starts with
+ * 				only 0, 1 and 2 open, plus the jobserver pipe if there is one.
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void markFdsCloexec()
+{
+	if (close_range(3, ~0U, CLOSE_RANGE_CLOEXEC) == 0)
+	{
+		shareJobserverFds();
+		return;
+	}
+
+	// kernels before 5.11 - walk the open fds instead
+	DIR *dir = opendir("/proc/self/fd");
+	struct dirent *entry = NULL;
+	if (!dir)
+	{
+		return;
+	}
+	while ((entry = readdir(dir)))
+	{
+		int fd = atoi(entry->d_name);
+		if (fd > 2 && fd != dirfd(dir))
+		{
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+	closedir(dir);
+	shareJobserverFds();
+}
+
+/*****************************************************************************
+ * Description: Leaves the jobserver pipe named in MAKEFLAGS open across exec,
+ * 				so make and other clients run by the shell can use it
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void shareJobserverFds()
+{
+	if (jobserverFds[0] != -1)
+	{
+		fcntl(jobserverFds[0], F_SETFD, 0);
+		fcntl(jobserverFds[1], F_SETFD, 0);
+	}
+}
+
+/*****************************************************************************
+ * Description: Names what the shell is using an open fd for
+ * Parameters: fd = the fd
+ * Returns: A short description, or NULL if the shell doesn't know the fd
+ ****************************************************************************/
+const char* fdPurpose(int fd)
+{
+	static const char *standard[] = { "stdin", "stdout", "stderr" };
+
+	if (fd >= 0 && fd <= 2)
+	{
+		return standard[fd];
+	}
+	if (fd == savedStdin)
+	{
+		return "saved stdin, restored after each command";
+	}
+	if (fd == savedStdout)
+	{
+		return "saved stdout, restored after each command";
+	}
+	if (fd == peekPipe[0] || fd == peekPipe[1])
+	{
+		return "read peek pipe";
+	}
+	if (fd == scriptFd)
+	{
+		return "script being run";
+	}
+	if (traceFile && fd == fileno(traceFile))
+	{
+		return "SMALLSH_TRACE log";
+	}
+	if (fd == memTriggerFd)
+	{
+		return "PSI memory trigger";
+	}
+	int r = 0;
+	for (r = 0; r < PSI_RESOURCES; r++)
+	{
+		if (fd == psiFds[r])
+		{
+			return "PSI trigger";
+		}
+	}
+	if (fd == jobserverRead || fd == jobserverWrite || fd == jobserverFds[0] || fd == jobserverFds[1])
+	{
+		return "make jobserver";
+	}
+	int i = 0;
+	for (i = 0; i < numPathDirs; i++)
+	{
+		if (fd == pathDirs[i].fd)
+		{
+			return "$PATH directory";
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: fds - lists the shell's open fds, whether each is close on
+ * 				exec, what it refers to and what the shell uses it for.
+ * 				Redirected stdin/stdout show the file they refer to.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, or 1 if the fds could not be listed
+ ****************************************************************************/
+int fdsBuiltin(char **args, int argCount)
+{
+	DIR *dir = opendir("/proc/self/fd");
+	struct dirent *entry = NULL;
+	int fds[1024],
+		numFds = 0,
+		i = 0;
+
+	(void)argCount;
+	if (!dir)
+	{
+		fprintf(stderr, "smallsh: %s: /proc/self/fd: %s\n", args[0], strerror(errno));
+		return 1;
+	}
+	while ((entry = readdir(dir)) && numFds < 1024)
+	{
+		if (isdigit((unsigned char)entry->d_name[0]) && atoi(entry->d_name) != dirfd(dir))
+		{
+			fds[numFds++] = atoi(entry->d_name);
+		}
+	}
+	closedir(dir);
+
+	// readdir order is not fd order
+	for (i = 1; i < numFds; i++)
+	{
+		int fd = fds[i],
+			j = i;
+		for (; j > 0 && fds[j - 1] > fd; j--)
+		{
+			fds[j] = fds[j - 1];
+		}
+		fds[j] = fd;
+	}
+
+	for (i = 0; i < numFds; i++)
+	{
+		char link[64],
+			 target[4096];
+		const char *purpose = fdPurpose(fds[i]);
+		int flags = fcntl(fds[i], F_GETFD);
+		ssize_t len = 0;
+
+		snprintf(link, sizeof(link), "/proc/self/fd/%d", fds[i]);
+		len = readlink(link, target, sizeof(target) - 1);
+		target[len > 0 ? len : 0] = '\0';
+
+		printf("%3d %-7s %s%s%s\n", fds[i], (flags != -1 && (flags & FD_CLOEXEC)) ? "cloexec" : "-",
+			   target, purpose ? "  # " : "", purpose ? purpose : "");
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ * Description: Finds the end of the field starting at pos - the next
+ * 				separator, or with no -t the end of the run of non blanks
+ * 				after the field's leading blanks.
+ * Parameters: opts = psort options
+ * 			   line/len = the line
+ * 			   pos = where the field starts
+ * Returns: the offset just past the field
+ ****************************************************************************/
+size_t sortSkipField(const SortOptions *opts, const char *line, size_t len, size_t pos)
+{
+	if (opts->sep)
+	{
+		const char *sep = memchr(line + pos, opts->sep, len - pos);
+		return sep ? (size_t)(sep - line) : len;
+	}
+	while (pos < len && isblank((unsigned char)line[pos]))
+	{
+		pos++;
+	}
+	while (pos < len && !isblank((unsigned char)line[pos]))
+	{
+		pos++;
+	}
+	return pos;
+}
+
+/*****************************************************************************
+ * Description: Finds a record's key and computes its prefix from it.
+ * Parameters: opts = psort options
+ * 			   rec = the record, with line and len set
+ * Returns: None
+ ****************************************************************************/
+void sortMakeRecord(const SortOptions *opts, SortRecord *rec)
+{
+	size_t start = 0,
+		   end = rec->len;
+	int field = 1;
+
+	if (opts->keyStart > 1 || opts->keyEnd)
+	{
+		for (field = 1; field < opts->keyStart && start < rec->len; field++)
+		{
+			start = sortSkipField(opts, rec->line, rec->len, start);
+			start += opts->sep && start < rec->len;
+		}
+		if (field < opts->keyStart || (opts->keyEnd && opts->keyEnd < opts->keyStart))
+		{
+			start = end = rec->len;
+		}
+		else if (opts->keyEnd)
+		{
+			end = start;
+			for (; field < opts->keyEnd && end < rec->len; field++)
+			{
+				end = sortSkipField(opts, rec->line, rec->len, end);
+				end += opts->sep && end < rec->len;
+			}
+			end = sortSkipField(opts, rec->line, rec->len, end);
+		}
+	}
+	rec->keyStart = start;
+	rec->keyLen = end - start;
+
+	const unsigned char *key = (const unsigned char *)rec->line + start;
+	uint64_t prefix = 0;
+	if (opts->numeric)
+	{
+		/* IEEE doubles order like sign-magnitude integers: flip negative
+		 * ones entirely and set the sign bit of the rest */
+		double value = sortParseNumber((const char *)key, rec->keyLen);
+		if (value == 0)
+		{
+			value = 0; // -0 sorts with 0
+		}
+		memcpy(&prefix, &value, sizeof(prefix));
+		prefix = (prefix >> 63) ? ~prefix : prefix | (1ULL << 63);
+	}
+	else
+	{
+		size_t i = 0;
+		for (i = 0; i < 8; i++)
+		{
+			prefix = (prefix << 8) | (i < rec->keyLen ? key[i] : 0);
+		}
+	}
+	rec->prefix = opts->reverse ? ~prefix : prefix;
+}
+
+/*****************************************************************************
+ * Description: Reads a number for psort -n: optional blanks and minus sign,
+ * 				digits and a decimal fraction. Anything else ends it, and no
+ * 				digits at all reads as 0, like sort -n.
+ * Parameters: text/len = the key
+ * Returns: its value
+ ****************************************************************************/
+double sortParseNumber(const char *text, size_t len)
+{
+	size_t i = 0;
+	double value = 0,
+		   scale = 1;
+	bool negative = false;
+
+	while (i < len && isblank((unsigned char)text[i]))
+	{
+		i++;
+	}
+	if (i < len && text[i] == '-')
+	{
+		negative = true;
+		i++;
+	}
+	for (; i < len && isdigit((unsigned char)text[i]); i++)
+	{
+		value = value * 10 + (text[i] - '0');
+	}
+	if (i < len && text[i] == '.')
+	{
+		for (i++; i < len && isdigit((unsigned char)text[i]); i++)
+		{
+			scale /= 10;
+			value += (text[i] - '0') * scale;
+		}
+	}
+	return negative ? -value : value;
+}
+
+/*****************************************************************************
+ * Description: Compares two records' keys, in the order psort outputs them.
+ * Parameters: a/b = the records
+ * 			   opts = psort options
+ * Returns: <0, 0 or >0 as a sorts before, with or after b
+ ****************************************************************************/
+int sortCompareKeys(const SortRecord *a, const SortRecord *b, const SortOptions *opts)
+{
+	if (a->prefix != b->prefix)
+	{
+		return a->prefix < b->prefix ? -1 : 1;
+	}
+	if (opts->numeric)
+	{
+		return 0;
+	}
+
+	// equal prefixes mean the first 8 bytes of both keys match
+	size_t common = a->keyLen < b->keyLen ? a->keyLen : b->keyLen;
+	int diff = common > 8 ? memcmp(a->line + a->keyStart + 8, b->line + b->keyStart + 8, common - 8) : 0;
+	if (!diff)
+	{
+		diff = (a->keyLen > b->keyLen) - (a->keyLen < b->keyLen);
+	}
+	return opts->reverse ? -diff : diff;
+}
+
+/*****************************************************************************
+ * Description: Compares two records. Records with equal keys are ordered
+ * 				by their whole lines as a last resort, like sort, except
+ * 				with -u where equal keys are duplicates.
+ * Parameters: a/b = the records
+ * 			   opts = psort options
+ * Returns: <0, 0 or >0 as a sorts before, with or after b
+ ****************************************************************************/
+int sortCompare(const SortRecord *a, const SortRecord *b, const SortOptions *opts)
+{
+	int diff = sortCompareKeys(a, b, opts);
+	if (diff || opts->unique)
+	{
+		return diff;
+	}
+
+	size_t common = a->len < b->len ? a->len : b->len;
+	diff = memcmp(a->line, b->line, common);
+	if (!diff)
+	{
+		diff = (a->len > b->len) - (a->len < b->len);
+	}
+	return opts->reverse ? -diff : diff;
+}
+
+/*****************************************************************************
+ * Description: qsort_r comparator for records of one run. Records with
+ * 				equal keys under -u keep their input order (their lines'
+ * 				order in the run's buffer), so the first one is kept.
+ * Parameters: a/b = the records
+ * 			   opts = psort options
+ * Returns: <0, 0 or >0 as a sorts before, with or after b
+ ****************************************************************************/
+int sortQsortCompare(const void *a, const void *b, void *opts)
+{
+	const SortRecord *left = a,
+					 *right = b;
+	int diff = sortCompare(left, right, opts);
+	if (!diff)
+	{
+		diff = (left->line > right->line) - (left->line < right->line);
+	}
+	return diff;
+}
+
+/*****************************************************************************
+ * Description: Sorts records with an MSD radix sort on their prefixes, a
+ * 				byte at a time. Small buckets are insertion sorted, and
+ * 				records whose prefixes are equal are compared in full.
+ * 				The sort is stable.
+ * Parameters: recs/count = the records
+ * 			   tmp = scratch space for count records
+ * 			   shift = the prefix byte to sort on, as a shift (56 first)
+ * 			   opts = psort options
+ * Returns: None
+ ****************************************************************************/
+void sortRadix(SortRecord *recs, SortRecord *tmp, size_t count, int shift, const SortOptions *opts)
+{
+	size_t counts[256] = { 0 },
+		   starts[256],
+		   i = 0,
+		   pos = 0;
+	int b = 0;
+
+	if (count <= PSORT_INSERTION_MAX)
+	{
+		for (i = 1; i < count; i++)
+		{
+			SortRecord rec = recs[i];
+			size_t j = i;
+			for (; j > 0 && sortCompare(&recs[j - 1], &rec, opts) > 0; j--)
+			{
+				recs[j] = recs[j - 1];
+			}
+			recs[j] = rec;
+		}
+		return;
+	}
+	if (shift < 0)
+	{
+		qsort_r(recs, count, sizeof(SortRecord), sortQsortCompare, (void *)opts);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		counts[(recs[i].prefix >> shift) & 0xff]++;
+	}
+	if (counts[(recs[0].prefix >> shift) & 0xff] == count)
+	{
+		// all in one bucket - nothing to move at this byte
+		sortRadix(recs, tmp, count, shift - 8, opts);
+		return;
+	}
+	for (b = 0; b < 256; b++)
+	{
+		starts[b] = pos;
+		pos += counts[b];
+	}
+	for (i = 0; i < count; i++)
+	{
+		tmp[starts[(recs[i].prefix >> shift) & 0xff]++] = recs[i];
+	}
+	memcpy(recs, tmp, count * sizeof(SortRecord));
+
+	for (b = 0, pos = 0; b < 256; pos += counts[b], b++)
+	{
+		if (counts[b] > 1)
+		{
+			sortRadix(recs + pos, tmp + pos, counts[b], shift - 8, opts);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Thread body for psort: makes the records of one chunk and
+ * 				sorts them.
+ * Parameters: arg = the chunk's SortTask
+ * Returns: NULL
+ ****************************************************************************/
+void* sortChunk(void *arg)
+{
+	SortTask *task = arg;
+	size_t i = 0;
+
+	for (i = 0; i < task->count; i++)
+	{
+		sortMakeRecord(task->opts, &task->recs[i]);
+	}
+	sortRadix(task->recs, task->tmp, task->count, 56, task->opts);
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Moves a merge source on to its next record.
+ * Parameters: src = the source
+ * 			   opts = psort options
+ * Returns: false (and marks it done) once it has no more records
+ ****************************************************************************/
+bool sortSourceNext(SortSource *src, const SortOptions *opts)
+{
+	if (src->file)
+	{
+		ssize_t len = getline(&src->lineBuf, &src->lineCap, src->file);
+		if (len <= 0)
+		{
+			src->done = true;
+			return false;
+		}
+		src->cur.line = src->lineBuf;
+		src->cur.len = len - (src->lineBuf[len - 1] == '\n');
+		sortMakeRecord(opts, &src->cur);
+		return true;
+	}
+	if (src->pos == src->end)
+	{
+		src->done = true;
+		return false;
+	}
+	src->cur = src->recs[src->pos++];
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Decides which of two merge sources' heads comes out first.
+ * 				-1 is the loser tree's placeholder and comes before all;
+ * 				exhausted sources come after all, and ties go to the earlier
+ * 				source so the merge is stable.
+ * Parameters: sources = the merge sources
+ * 			   a/b = indexes into sources, or -1
+ * 			   opts = psort options
+ * Returns: true if a comes out before b
+ ****************************************************************************/
+bool sortBeats(const SortSource *sources, int a, int b, const SortOptions *opts)
+{
+	if (a == -1 || b == -1)
+	{
+		return a == -1;
+	}
+	if (sources[a].done || sources[b].done)
+	{
+		return !sources[a].done;
+	}
+	int diff = sortCompare(&sources[a].cur, &sources[b].cur, opts);
+	return diff < 0 || (diff == 0 && a < b);
+}
+
+/*****************************************************************************
+ * Description: Replays a loser tree's matches from a leaf whose source has
+ * 				moved on to the root. Each node keeps the loser of its match
+ * 				and the overall winner ends up in tree[0].
+ * Parameters: tree = count nodes, internal nodes from 1
+ * 			   count = number of sources
+ * 			   sources = the merge sources
+ * 			   leaf = the source that changed
+ * 			   opts = psort options
+ * Returns: None
+ ****************************************************************************/
+void sortAdjust(int *tree, int count, const SortSource *sources, int leaf, const SortOptions *opts)
+{
+	int winner = leaf,
+		node = 0;
+
+	for (node = (leaf + count) / 2; node > 0; node /= 2)
+	{
+		if (sortBeats(sources, tree[node], winner, opts))
+		{
+			int loser = winner;
+			winner = tree[node];
+			tree[node] = loser;
+		}
+	}
+	tree[0] = winner;
+}
+
+/*****************************************************************************
+ * Description: Merges sorted sources with a loser tree, writing each line
+ * 				out. With -u only the first of the lines with equal keys is
+ * 				written.
+ * Parameters: sources/count = the sources, not yet started
+ * 			   out = where the lines go
+ * 			   opts = psort options
+ * Returns: None
+ ****************************************************************************/
+void sortMerge(SortSource *sources, int count, FILE *out, const SortOptions *opts)
+{
+	int *tree = malloc(count * sizeof(int)),
+		i = 0;
+	StrBuf last = { 0 };
+	SortRecord lastRec;
+	bool haveLast = false;
+
+	if (!count || !tree)
+	{
+		free(tree);
+		return;
+	}
+	for (i = 0; i < count; i++)
+	{
+		tree[i] = -1;
+		sortSourceNext(&sources[i], opts);
+	}
+	for (i = count - 1; i >= 0; i--)
+	{
+		sortAdjust(tree, count, sources, i, opts);
+	}
+
+	while (!sources[tree[0]].done)
+	{
+		SortSource *src = &sources[tree[0]];
+		if (!opts->unique || !haveLast || sortCompareKeys(&lastRec, &src->cur, opts))
+		{
+			fwrite(src->cur.line, 1, src->cur.len, out);
+			putc('\n', out);
+			if (opts->unique)
+			{
+				// keep a copy, file sources reuse their line buffer
+				last.len = 0;
+				sbAppend(&last, src->cur.line, src->cur.len);
+				lastRec = src->cur;
+				lastRec.line = last.buf;
+				haveLast = true;
+			}
+		}
+		sortSourceNext(src, opts);
+		sortAdjust(tree, count, sources, tree[0], opts);
+	}
+	free(last.buf);
+	free(tree);
+}
+
+/*****************************************************************************
+ * Description: Sorts one run's records on up to a thread per CPU, each
+ * 				sorting a chunk, and merges the chunks out.
+ * Parameters: recs/count = the records, with line and len set
+ * 			   out = where the sorted lines go
+ * 			   opts = psort options
+ * Returns: false if there was not enough memory
+ ****************************************************************************/
+bool sortEmitRun(SortRecord *recs, size_t count, FILE *out, const SortOptions *opts)
+{
+	SortTask tasks[PSORT_MAX_THREADS];
+	SortSource sources[PSORT_MAX_THREADS];
+	pthread_t threads[PSORT_MAX_THREADS];
+	bool started[PSORT_MAX_THREADS] = { false };
+	SortRecord *tmp = malloc((count ? count : 1) * sizeof(SortRecord));
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int numTasks = count / PSORT_MIN_PER_THREAD,
+		t = 0;
+
+	if (!tmp)
+	{
+		return false;
+	}
+	if (numTasks > cpus)
+	{
+		numTasks = cpus;
+	}
+	if (numTasks > PSORT_MAX_THREADS)
+	{
+		numTasks = PSORT_MAX_THREADS;
+	}
+	if (numTasks < 1)
+	{
+		numTasks = 1;
+	}
+
+	for (t = 0; t < numTasks; t++)
+	{
+		size_t start = count * t / numTasks,
+			   end = count * (t + 1) / numTasks;
+		tasks[t] = (SortTask){ recs + start, tmp + start, end - start, opts };
+	}
+	for (t = 1; t < numTasks; t++)
+	{
+		started[t] = !pthread_create(&threads[t], NULL, sortChunk, &tasks[t]);
+	}
+	for (t = 0; t < numTasks; t++)
+	{
+		if (!started[t])
+		{
+			sortChunk(&tasks[t]);
+		}
+	}
+	for (t = 1; t < numTasks; t++)
+	{
+		if (started[t])
+		{
+			pthread_join(threads[t], NULL);
+		}
+	}
+	free(tmp);
+
+	for (t = 0; t < numTasks; t++)
+	{
+		sources[t] = (SortSource){ .recs = tasks[t].recs, .end = tasks[t].count };
+	}
+	sortMerge(sources, numTasks, out, opts);
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Creates an unlinked temporary file for a psort run, in
+ * 				$TMPDIR or /tmp.
+ * Parameters: None
+ * Returns: the file open for writing and reading back, or NULL (after
+ * 			printing why)
+ ****************************************************************************/
+FILE* sortTempFile()
+{
+	const char *dir = getenv("TMPDIR");
+	char path[PATH_MAX];
+	FILE *file = NULL;
+	int fd = -1;
+
+	snprintf(path, sizeof(path), "%s/psort.XXXXXX", dir && *dir ? dir : "/tmp");
+	if ((fd = mkostemp(path, O_CLOEXEC)) == -1)
+	{
+		fprintf(stderr, "smallsh: psort: %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	unlink(path);
+	if (!(file = fdopen(fd, "w+")))
+	{
+		fprintf(stderr, "smallsh: psort: %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	setvbuf(file, NULL, _IOFBF, FD_READER_BUFSIZE);
+	return file;
+}
+
+/*****************************************************************************
+ * Description: Sorts a block of whole lines.
+ * Parameters: data/len = the lines, ending in a newline
+ * 			   recs/recCap = record array, grown as needed and reused
+ * 			   out = where the sorted lines go
+ * 			   opts = psort options
+ * Returns: false if there was not enough memory
+ ****************************************************************************/
+bool sortBlock(char *data, size_t len, SortRecord **recs, size_t *recCap, FILE *out, const SortOptions *opts)
+{
+	size_t count = 0,
+		   pos = 0;
+
+	while (pos < len)
+	{
+		char *nl = memchr(data + pos, '\n', len - pos);
+		if (count == *recCap)
+		{
+			size_t cap = *recCap ? *recCap * 2 : 1024;
+			SortRecord *grown = realloc(*recs, cap * sizeof(SortRecord));
+			if (!grown)
+			{
+				return false;
+			}
+			*recs = grown;
+			*recCap = cap;
+		}
+		(*recs)[count].line = data + pos;
+		(*recs)[count].len = nl - (data + pos);
+		count++;
+		pos = nl - data + 1;
+	}
+	return sortEmitRun(*recs, count, out, opts);
+}
+
+/*****************************************************************************
+ * Description: Sorts a block of whole lines into a new spilled run. Once
+ * 				PSORT_MAX_RUNS are open the existing ones are merged into
+ * 				one first.
+ * Parameters: runs/numRuns = the spilled runs, updated
+ * 			   data/len = the lines, ending in a newline
+ * 			   recs/recCap = record array, grown as needed and reused
+ * 			   opts = psort options
+ * Returns: false (after printing why) if the run could not be written
+ ****************************************************************************/
+bool sortSpill(FILE **runs, int *numRuns, char *data, size_t len, SortRecord **recs, size_t *recCap, const SortOptions *opts)
+{
+	FILE *run = NULL;
+
+	if (*numRuns == PSORT_MAX_RUNS)
+	{
+		if (!(run = sortTempFile()))
+		{
+			return false;
+		}
+		runs[0] = sortMergeRuns(runs, *numRuns, run, opts);
+		*numRuns = 1;
+	}
+	if (!(run = sortTempFile()))
+	{
+		return false;
+	}
+	if (!sortBlock(data, len, recs, recCap, run, opts))
+	{
+		fprintf(stderr, "smallsh: psort: %s\n", strerror(ENOMEM));
+		fclose(run);
+		return false;
+	}
+	if (fflush(run) || ferror(run))
+	{
+		fprintf(stderr, "smallsh: psort: temporary file: %s\n", strerror(errno));
+		fclose(run);
+		return false;
+	}
+	rewind(run);
+	runs[(*numRuns)++] = run;
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Merges spilled runs, and closes them.
+ * Parameters: runs/numRuns = the runs, rewound
+ * 			   out = where the merged lines go
+ * 			   opts = psort options
+ * Returns: out, rewound if it is a run itself
+ ****************************************************************************/
+FILE* sortMergeRuns(FILE **runs, int numRuns, FILE *out, const SortOptions *opts)
+{
+	SortSource *sources = calloc(numRuns, sizeof(SortSource));
+	int i = 0;
+
+	for (i = 0; i < numRuns; i++)
+	{
+		sources[i].file = runs[i];
+	}
+	sortMerge(sources, numRuns, out, opts);
+	for (i = 0; i < numRuns; i++)
+	{
+		free(sources[i].lineBuf);
+		fclose(runs[i]);
+	}
+	free(sources);
+	if (out != stdout)
+	{
+		fflush(out);
+		rewind(out);
+	}
+	return out;
+}
+
+/*****************************************************************************
+ * Description: Applies a psort option that takes a value: -k start[,end]
+ * 				(either may be followed by n or r), -t char, or -S size in
+ * 				kilobytes, or with a b, K, M or G suffix.
+ * Parameters: letter = the option
+ * 			   value = its value
+ * 			   opts/memory = updated
+ * Returns: false if the value is not valid
+ ****************************************************************************/
+bool sortOptionValue(char letter, const char *value, SortOptions *opts, size_t *memory)
+{
+	char *end = NULL;
+
+	if (letter == 't')
+	{
+		opts->sep = value[0];
+		return value[0] && !value[1];
+	}
+	if (letter == 'S')
+	{
+		unsigned long long size = 0;
+		if (!parseSize(value, 1, &size))
+		{
+			return false;
+		}
+		*memory = size;
+		return *memory > 0;
+	}
+
+	opts->keyStart = strtol(value, &end, 10);
+	opts->keyEnd = 0;
+	if (end == value || opts->keyStart < 1)
+	{
+		return false;
+	}
+	for (; *end == 'n' || *end == 'r'; end++)
+	{
+		*(*end == 'n' ? &opts->numeric : &opts->reverse) = true;
+	}
+	if (*end == ',')
+	{
+		value = end + 1;
+		opts->keyEnd = strtol(value, &end, 10);
+		if (end == value || opts->keyEnd < 1)
+		{
+			return false;
+		}
+		for (; *end == 'n' || *end == 'r'; end++)
+		{
+			*(*end == 'n' ? &opts->numeric : &opts->reverse) = true;
+		}
+	}
+	return !*end;
+}
+
+/*****************************************************************************
+ * Description: psort - sorts the lines of the named files, or stdin, in
+ * 				byte order. Input is read into memory up to -S bytes (with
+ * 				the records describing it) at a time; each such run is
+ * 				sorted in chunks on a thread per CPU, radix sorting the
+ * 				keys' leading bytes, and the chunks merged. Input larger than
+ * 				that is spilled to temporary files as sorted runs which are
+ * 				merged at the end.
+ * 				-k start[,end] sort on those fields, -t c fields are
+ * 				separated by c, -n compare keys as numbers, -r reverse,
+ * 				-u output only the first of lines with equal keys.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, or 2 on a usage, input or temporary file error
+ ****************************************************************************/
+int psortBuiltin(char **args, int argCount)
+{
+	SortOptions opts = { .keyStart = 1 };
+	size_t memory = PSORT_DEFAULT_MEMORY;
+	int i = 1;
+
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1]; i++)
+	{
+		const char *opt = args[i] + 1;
+		bool valid = true;
+		for (; *opt && valid; opt++)
+		{
+			if (*opt == 'n') { opts.numeric = true; }
+			else if (*opt == 'r') { opts.reverse = true; }
+			else if (*opt == 'u') { opts.unique = true; }
+			else if (strchr("ktS", *opt))
+			{
+				const char *value = opt[1] ? opt + 1 : (i + 1 < argCount ? args[++i] : NULL);
+				valid = value && sortOptionValue(*opt, value, &opts, &memory);
+				break;
+			}
+			else { valid = false; }
+		}
+		if (!valid)
+		{
+			fprintf(stderr, "smallsh: %s: usage: %s [-nru] [-k start[,end]] [-t char] [-S size] [file ...]\n", args[0], args[0]);
+			return 2;
+		}
+	}
+
+	char *arena = NULL;
+	size_t arenaLen = 0,
+		   arenaCap = 0,
+		   numLines = 0,
+		   recCap = 0;
+	SortRecord *recs = NULL;
+	FILE *runs[PSORT_MAX_RUNS];
+	int numRuns = 0,
+		result = 0,
+		first = i;
+
+	for (i = first; result == 0 && (i < argCount || i == first); i++)
+	{
+		bool isStdin = i == argCount || !strcmp(args[i], "-");
+		int fd = isStdin ? STDIN_NUM : open(args[i], O_RDONLY | O_CLOEXEC);
+		ssize_t n = 0;
+
+		if (fd == -1)
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], args[i], strerror(errno));
+			result = 2;
+			break;
+		}
+		do
+		{
+			// once the run and its records fill the budget, sort and spill its whole lines
+			char *lastLine = NULL;
+			if (arenaLen + 2 * numLines * sizeof(SortRecord) >= memory &&
+				(lastLine = memrchr(arena, '\n', arenaLen)))
+			{
+				size_t runLen = lastLine - arena + 1;
+				if (!sortSpill(runs, &numRuns, arena, runLen, &recs, &recCap, &opts))
+				{
+					result = 2;
+					break;
+				}
+				memmove(arena, arena + runLen, arenaLen - runLen);
+				arenaLen -= runLen;
+				numLines = 0;
+			}
+			if (arenaCap - arenaLen < PSORT_READ_SIZE)
+			{
+				size_t cap = arenaLen + PSORT_READ_SIZE;
+				char *grown = NULL;
+				if (cap < arenaCap * 2 && arenaCap * 2 <= memory)
+				{
+					cap = arenaCap * 2;
+				}
+				if (!(grown = realloc(arena, cap + 1)))
+				{
+					fprintf(stderr, "smallsh: %s: %s\n", args[0], strerror(ENOMEM));
+					result = 2;
+					break;
+				}
+				arena = grown;
+				arenaCap = cap;
+			}
+			n = read(fd, arena + arenaLen, PSORT_READ_SIZE);
+			if (n > 0)
+			{
+				char *p = arena + arenaLen,
+					 *end = p + n;
+				while ((p = memchr(p, '\n', end - p)))
+				{
+					numLines++;
+					p++;
+				}
+				arenaLen += n;
+			}
+		} while (n > 0 || (n == -1 && errno == EINTR));
+
+		if (n == -1 && result == 0)
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], isStdin ? "stdin" : args[i], strerror(errno));
+			result = 2;
+		}
+		if (arenaLen && arena[arenaLen - 1] != '\n')
+		{
+			arena[arenaLen++] = '\n'; // the arena always has a byte to spare
+			numLines++;
+		}
+		if (!isStdin)
+		{
+			close(fd);
+		}
+	}
+
+	if (result == 0 && numRuns == 0)
+	{
+		// it all fit: sort straight to stdout
+		if (!sortBlock(arena, arenaLen, &recs, &recCap, stdout, &opts))
+		{
+			fprintf(stderr, "smallsh: %s: %s\n", args[0], strerror(ENOMEM));
+			result = 2;
+		}
+	}
+	else if (result == 0 && (!arenaLen || sortSpill(runs, &numRuns, arena, arenaLen, &recs, &recCap, &opts)))
+	{
+		sortMergeRuns(runs, numRuns, stdout, &opts);
+		numRuns = 0;
+	}
+	else
+	{
+		result = 2;
+	}
+	for (i = 0; i < numRuns; i++)
+	{
+		fclose(runs[i]);
+	}
+	free(arena);
+	free(recs);
+
+	if (fflush(stdout) || ferror(stdout))
+	{
+		fprintf(stderr, "smallsh: %s: write error: %s\n", args[0], strerror(errno));
+		clearerr(stdout);
+		result = 2;
+	}
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Reads an fd to its end, handing its lines to fn in blocks:
+ * 				a regular file read from its start is mapped and handed over
+ * 				whole; anything else is read a buffer at a time and the whole
+ * 				lines in it handed over, with the rest carried over to the
+ * 				next read. A last line without a newline is handed over on
+ * 				its own at the end.
+ * Parameters: fd = the input
+ * 			   fn/ctx = called with each block
+ * Returns: 0, or the errno of a failed read
+ ****************************************************************************/
+int readLineBlocks(int fd, LineBlockFn fn, void *ctx)
+{
+	struct stat info;
+	char *buf = MAP_FAILED;
+	size_t cap = FD_READER_BUFSIZE,
+		   len = 0;
+	ssize_t n = 0;
+
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0 &&
+		(buf = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+	{
+		madvise(buf, info.st_size, MADV_SEQUENTIAL);
+		fn(ctx, buf, info.st_size);
+		munmap(buf, info.st_size);
+		lseek(fd, 0, SEEK_END);
+		return 0;
+	}
+
+	buf = malloc(cap);
+	while ((n = read(fd, buf + len, cap - len)) > 0 || (n == -1 && errno == EINTR))
+	{
+		char *lastNl = NULL;
+		len += n > 0 ? n : 0;
+		if ((lastNl = memrchr(buf, '\n', len)))
+		{
+			size_t whole = lastNl - buf + 1;
+			fn(ctx, buf, whole);
+			memmove(buf, buf + whole, len - whole);
+			len -= whole;
+		}
+		else if (len == cap)
+		{
+			buf = realloc(buf, cap *= 2);
+		}
+	}
+	int err = n == -1 ? errno : 0;
+	if (len)
+	{
+		fn(ctx, buf, len);
+	}
+	free(buf);
+	return err;
+}
+
+/*****************************************************************************
+ * Description: Doubles a countby table's capacity (or allocates its first
+ * 				one), moving the slots by their stored hashes.
+ * Parameters: table = the table
+ * Returns: None
+ ****************************************************************************/
+void countGrow(CountTable *table)
+{
+	unsigned char *oldCtrl = table->ctrl;
+	CountSlot *oldSlots = table->slots;
+	size_t oldCap = table->cap,
+		   newCap = oldCap ? oldCap * 2 : 1024,
+		   i = 0;
+
+	table->ctrl = malloc(newCap);
+	memset(table->ctrl, CTRL_EMPTY, newCap);
+	table->slots = malloc(newCap * sizeof(CountSlot));
+	table->cap = newCap;
+
+	for (i = 0; i < oldCap; i++)
+	{
+		if (!(oldCtrl[i] & 0x80))
+		{
+			size_t groupMask = newCap / GROUP_WIDTH - 1,
+				   group = (oldSlots[i].hash >> 7) & groupMask,
+				   step = 0;
+			uint64_t empty = 0;
+			while (!(empty = groupMatchEmpty(groupLoad(table->ctrl + group * GROUP_WIDTH))))
+			{
+				step++;
+				group = (group + step) & groupMask;
+			}
+			size_t idx = group * GROUP_WIDTH + (__builtin_ctzll(empty) >> 3);
+			table->ctrl[idx] = oldSlots[i].hash & 0x7F;
+			table->slots[idx] = oldSlots[i];
+		}
+	}
+	free(oldCtrl);
+	free(oldSlots);
+}
+
+/*****************************************************************************
+ * Description: Adds to a key's count in a countby table, interning the key
+ * 				if it is new.
+ * Parameters: table = the table
+ * 			   key/len = the key
+ * 			   hash = hashBytes of the key
+ * 			   count = how much to add
+ * Returns: None
+ ****************************************************************************/
+void countAdd(CountTable *table, const char *key, size_t len, uint64_t hash, uint64_t count)
+{
+	unsigned char tag = hash & 0x7F;
+	size_t groupMask = 0,
+		   group = 0,
+		   step = 0;
+
+	if ((table->size + 1) * 8 > table->cap * 7)
+	{
+		countGrow(table);
+	}
+	groupMask = table->cap / GROUP_WIDTH - 1;
+	group = (hash >> 7) & groupMask;
+
+	while (true)
+	{
+		uint64_t ctrl = groupLoad(table->ctrl + group * GROUP_WIDTH),
+				 matches = groupMatchTag(ctrl, tag),
+				 empty = 0;
+		for (; matches; matches &= matches - 1)
+		{
+			CountSlot *slot = &table->slots[group * GROUP_WIDTH + (__builtin_ctzll(matches) >> 3)];
+			if (slot->hash == hash && slot->len == len && !memcmp(slot->key, key, len))
+			{
+				slot->count += count;
+				return;
+			}
+		}
+		if ((empty = groupMatchEmpty(ctrl)))
+		{
+			size_t idx = group * GROUP_WIDTH + (__builtin_ctzll(empty) >> 3);
+			if (len > table->slabLeft)
+			{
+				size_t slabSize = len > COUNT_SLAB_SIZE ? len : COUNT_SLAB_SIZE;
+				table->slabs = realloc(table->slabs, (table->numSlabs + 1) * sizeof(char *));
+				table->slabPos = table->slabs[table->numSlabs++] = malloc(slabSize);
+				table->slabLeft = slabSize;
+			}
+			char *copy = table->slabPos;
+			memcpy(copy, key, len);
+			table->slabPos += len;
+			table->slabLeft -= len;
+			table->ctrl[idx] = tag;
+			table->slots[idx] = (CountSlot){ copy, len, hash, count };
+			table->size++;
+			return;
+		}
+		step++;
+		group = (group + step) & groupMask;
+	}
+}
+
+/*****************************************************************************
+ * Description: Finds the field countby counts a line by. Fields are
+ * 				separated by delim, or if it is 0 by runs of blanks, with
+ * 				leading blanks ignored like awk.
+ * Parameters: line/len = the line, without its newline
+ * 			   field = the field, from 1, or 0 for the whole line
+ * 			   delim = the separator
+ * 			   keyLen = receives the field's length
+ * Returns: the field, empty if the line has too few fields
+ ****************************************************************************/
+const char* countKey(const char *line, size_t len, int field, char delim, size_t *keyLen)
+{
+	const char *end = line + len,
+			   *start = line;
+	int f = 1;
+
+	if (field == 0)
+	{
+		*keyLen = len;
+		return line;
+	}
+	if (delim)
+	{
+		for (f = 1; f < field && start; f++)
+		{
+			start = memchr(start, delim, end - start);
+			start = start ? start + 1 : NULL;
+		}
+		if (!start)
+		{
+			*keyLen = 0;
+			return line;
+		}
+		const char *stop = memchr(start, delim, end - start);
+		*keyLen = (stop ? stop : end) - start;
+		return start;
+	}
+	for (f = 1; ; f++)
+	{
+		while (start < end && isblank((unsigned char)*start))
+		{
+			start++;
+		}
+		const char *stop = start;
+		while (stop < end && !isblank((unsigned char)*stop))
+		{
+			stop++;
+		}
+		if (f == field || stop == end)
+		{
+			*keyLen = f == field ? (size_t)(stop - start) : 0;
+			return start;
+		}
+		start = stop;
+	}
+}
+
+/*****************************************************************************
+ * Description: Counts the keys of a block of lines. A last line without a
+ * 				newline counts too.
+ * Parameters: table = the table counted into
+ * 			   data/len = the lines
+ * 			   field/delim = the key, see countKey
+ * Returns: None
+ ****************************************************************************/
+void countLines(CountTable *table, const char *data, size_t len, int field, char delim)
+{
+	const char *pos = data,
+			   *end = data + len;
+
+	while (pos < end)
+	{
+		const char *nl = memchr(pos, '\n', end - pos);
+		size_t keyLen = 0;
+		const char *key = countKey(pos, (nl ? nl : end) - pos, field, delim, &keyLen);
+
+		countAdd(table, key, keyLen, hashBytes(key, keyLen), 1);
+		pos = nl ? nl + 1 : end;
+	}
+}
+
+/*****************************************************************************
+ * Description: Thread body for countby: counts one chunk of a mapped file.
+ * Parameters: arg = the chunk's CountTask
+ * Returns: NULL
+ ****************************************************************************/
+void* countChunk(void *arg)
+{
+	CountTask *task = arg;
+	countBlock(task, task->data, task->len);
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: LineBlockFn for countby: counts a block of lines into the
+ * 				CountTask's table.
+ * Parameters: ctx = the CountTask
+ * 			   data/len = the lines
+ * Returns: None
+ ****************************************************************************/
+void countBlock(void *ctx, const char *data, size_t len)
+{
+	CountTask *task = ctx;
+	countLines(&task->table, data, len, task->field, task->delim);
+}
+
+/*****************************************************************************
+ * Description: Frees a countby table and its keys.
+ * Parameters: table = the table
+ * Returns: None
+ ****************************************************************************/
+void countFree(CountTable *table)
+{
+	size_t i = 0;
+	for (i = 0; i < table->numSlabs; i++)
+	{
+		free(table->slabs[i]);
+	}
+	free(table->slabs);
+	free(table->ctrl);
+	free(table->slots);
+	memset(table, 0, sizeof(CountTable));
+}
+
+/*****************************************************************************
+ * Description: qsort comparator putting countby's keys in output order:
+ * 				most frequent first, then by key in byte order.
+ * Parameters: a/b = the CountSlots
+ * Returns: <0, 0 or >0 as a goes before, with or after b
+ ****************************************************************************/
+int countCompare(const void *a, const void *b)
+{
+	const CountSlot *left = a,
+					*right = b;
+	size_t common = left->len < right->len ? left->len : right->len;
+	int diff = 0;
+
+	if (left->count != right->count)
+	{
+		return left->count > right->count ? -1 : 1;
+	}
+	if ((diff = memcmp(left->key, right->key, common)))
+	{
+		return diff;
+	}
+	return (left->len > right->len) - (left->len < right->len);
+}
+
+/*****************************************************************************
+ * Description: countby - counts how often each line, or each line's -f
+ * 				field, occurs in the named files or stdin, and prints the
+ * 				counts like uniq -c, most frequent first. Keys are counted
+ * 				in a hash table as they stream past, so the input is never
+ * 				sorted. Large regular files are mapped and split on line
+ * 				boundaries across a thread per CPU, each counting into its
+ * 				own table, and the tables are merged.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if an input could not be read, or 2 on a usage error
+ ****************************************************************************/
+int countbyBuiltin(char **args, int argCount)
+{
+	CountTable table = { 0 };
+	int field = 0,
+		result = 0,
+		first = 0,
+		i = 1;
+	char delim = 0;
+
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1]; i++)
+	{
+		if (!strcmp(args[i], "-f") && i + 1 < argCount) { field = atoi(args[++i]); }
+		else if (!strcmp(args[i], "-d") && i + 1 < argCount) { delim = args[++i][0]; }
+		else
+		{
+			fprintf(stderr, "smallsh: %s: usage: %s [-f field] [-d delim] [file...]\n", args[0], args[0]);
+			return 2;
+		}
+	}
+	if (field < 0)
+	{
+		fprintf(stderr, "smallsh: %s: invalid field\n", args[0]);
+		return 2;
+	}
+
+	for (first = i; i < argCount || i == first; i++)
+	{
+		bool isStdin = i == argCount || !strcmp(args[i], "-");
+		int fd = isStdin ? STDIN_NUM : open(args[i], O_RDONLY | O_CLOEXEC);
+		const char *name = isStdin ? "stdin" : args[i];
+		struct stat info;
+		char *map = MAP_FAILED;
+
+		if (fd == -1)
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], name, strerror(errno));
+			result = 1;
+			continue;
+		}
+		if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0)
+		{
+			map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		if (map != MAP_FAILED)
+		{
+			CountTask tasks[COUNT_MAX_THREADS];
+			pthread_t threads[COUNT_MAX_THREADS];
+			bool started[COUNT_MAX_THREADS] = { false };
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			size_t pos = 0;
+			int numTasks = info.st_size / COUNT_MIN_PER_THREAD,
+				t = 0;
+
+			numTasks = numTasks > cpus ? cpus : numTasks;
+			numTasks = numTasks > COUNT_MAX_THREADS ? COUNT_MAX_THREADS : numTasks;
+			numTasks = numTasks < 1 ? 1 : numTasks;
+			madvise(map, info.st_size, MADV_SEQUENTIAL);
+
+			// split on the first line end after each even share of the file
+			for (t = 0; t < numTasks; t++)
+			{
+				size_t end = (size_t)info.st_size * (t + 1) / numTasks;
+				const char *nl = NULL;
+				if (end < pos)
+				{
+					end = pos;
+				}
+				if (t < numTasks - 1 && end < (size_t)info.st_size &&
+					(nl = memchr(map + end, '\n', info.st_size - end)))
+				{
+					end = nl - map + 1;
+				}
+				else if (t < numTasks - 1 && end < (size_t)info.st_size)
+				{
+					end = info.st_size;
+				}
+				tasks[t] = (CountTask){ .data = map + pos, .len = end - pos, .field = field, .delim = delim };
+				pos = end;
+			}
+			for (t = 1; t < numTasks; t++)
+			{
+				started[t] = !pthread_create(&threads[t], NULL, countChunk, &tasks[t]);
+			}
+			countLines(&table, tasks[0].data, tasks[0].len, field, delim);
+			for (t = 1; t < numTasks; t++)
+			{
+				size_t s = 0;
+				if (started[t])
+				{
+					pthread_join(threads[t], NULL);
+				}
+				else
+				{
+					countChunk(&tasks[t]);
+				}
+				for (s = 0; s < tasks[t].table.cap; s++)
+				{
+					if (!(tasks[t].table.ctrl[s] & 0x80))
+					{
+						CountSlot *slot = &tasks[t].table.slots[s];
+						countAdd(&table, slot->key, slot->len, slot->hash, slot->count);
+					}
+				}
+				countFree(&tasks[t].table);
+			}
+			munmap(map, info.st_size);
+			lseek(fd, 0, SEEK_END);
+		}
+		else
+		{
+			CountTask task = { .table = table, .field = field, .delim = delim };
+			int err = readLineBlocks(fd, countBlock, &task);
+			table = task.table;
+			if (err)
+			{
+				fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], name, strerror(err));
+				result = 1;
+			}
+		}
+		if (!isStdin)
+		{
+			close(fd);
+		}
+	}
+
+	// the live slots, packed to the front and put in output order
+	size_t count = 0,
+		   s = 0;
+	for (s = 0; s < table.cap; s++)
+	{
+		if (!(table.ctrl[s] & 0x80))
+		{
+			table.slots[count++] = table.slots[s];
+		}
+	}
+	qsort(table.slots, count, sizeof(CountSlot), countCompare);
+	for (s = 0; s < count; s++)
+	{
+		printf("%7llu ", (unsigned long long)table.slots[s].count);
+		fwrite(table.slots[s].key, 1, table.slots[s].len, stdout);
+		putchar('\n');
+	}
+	countFree(&table);
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Finds the first of a set of bytes, 8 bytes at a time using
+ * 				the control byte group helpers: only the lowest match of
+ * 				groupMatchTag is exact, which is the only one used.
+ * Parameters: pos/end = the bytes to search
+ * 			   set = the bytes to look for, not including NUL
+ * Returns: the first one found, or end
+ ****************************************************************************/
+const char* scanBytes(const char *pos, const char *end, const char *set)
+{
+	size_t numSet = strlen(set),
+		   i = 0;
+
+	for (; end - pos >= GROUP_WIDTH; pos += GROUP_WIDTH)
+	{
+		uint64_t group = groupLoad((const unsigned char *)pos),
+				 found = 0;
+		for (i = 0; i < numSet; i++)
+		{
+			found |= groupMatchTag(group, set[i]);
+		}
+		if (found)
+		{
+			return pos + (__builtin_ctzll(found) >> 3);
+		}
+	}
+	for (; pos < end; pos++)
+	{
+		if (*pos && strchr(set, *pos))
+		{
+			return pos;
+		}
+	}
+	return end;
+}
+
+/*****************************************************************************
+ * Description: Skips JSON whitespace.
+ * Parameters: pos/end = the text
+ * Returns: the first byte that is not whitespace, or end
+ ****************************************************************************/
+const char* jsonSkipSpace(const char *pos, const char *end)
+{
+	while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n'))
+	{
+		pos++;
+	}
+	return pos;
+}
+
+/*****************************************************************************
+ * Description: Skips a JSON string without decoding it.
+ * Parameters: pos = the opening quote
+ * 			   end = the end of the text
+ * Returns: just past the closing quote, or NULL if there is none
+ ****************************************************************************/
+const char* jsonSkipString(const char *pos, const char *end)
+{
+	for (pos++; (pos = scanBytes(pos, end, "\"\\")) < end; pos += 2)
+	{
+		if (*pos == '"')
+		{
+			return pos + 1;
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Skips a JSON value without looking inside it beyond the
+ * 				bytes that give it structure: brackets, braces and quotes.
+ * Parameters: pos = the start of the value
+ * 			   end = the end of the text
+ * Returns: just past the value, or NULL if it is cut short
+ ****************************************************************************/
+const char* jsonSkipValue(const char *pos, const char *end)
+{
+	int depth = 0;
+
+	if (pos >= end)
+	{
+		return NULL;
+	}
+	if (*pos == '"')
+	{
+		return jsonSkipString(pos, end);
+	}
+	if (*pos != '{' && *pos != '[')
+	{
+		// a number, true, false or null
+		while (pos < end && !strchr(",}] \t\r\n", *pos))
+		{
+			pos++;
+		}
+		return pos;
+	}
+	while ((pos = scanBytes(pos, end, "\"{}[]")) < end)
+	{
+		if (*pos == '"')
+		{
+			if (!(pos = jsonSkipString(pos, end)))
+			{
+				return NULL;
+			}
+			continue;
+		}
+		depth += (*pos == '{' || *pos == '[') ? 1 : -1;
+		pos++;
+		if (depth == 0)
+		{
+			return pos;
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Decodes the escapes in the body of a JSON string, writing
+ * 				\u escapes (and surrogate pairs) as UTF-8.
+ * Parameters: pos/end = the string between its quotes
+ * 			   out = appended to
+ * Returns: None
+ ****************************************************************************/
+void jsonDecodeString(const char *pos, const char *end, StrBuf *out)
+{
+	while (pos < end)
+	{
+		const char *esc = memchr(pos, '\\', end - pos);
+		if (!esc)
+		{
+			sbAppend(out, pos, end - pos);
+			return;
+		}
+		sbAppend(out, pos, esc - pos);
+		pos = esc + 2;
+		if (pos > end)
+		{
+			return;
+		}
+		switch (esc[1])
+		{
+			case 'b': sbAppendChar(out, '\b'); break;
+			case 'f': sbAppendChar(out, '\f'); break;
+			case 'n': sbAppendChar(out, '\n'); break;
+			case 'r': sbAppendChar(out, '\r'); break;
+			case 't': sbAppendChar(out, '\t'); break;
+			case 'u':
+			{
+				char hex[5] = { 0 };
+				unsigned long code = 0;
+				if (end - pos < 4)
+				{
+					return;
+				}
+				memcpy(hex, pos, 4);
+				code = strtoul(hex, NULL, 16);
+				pos += 4;
+				if (code >= 0xD800 && code < 0xDC00 && end - pos >= 6 && pos[0] == '\\' && pos[1] == 'u')
+				{
+					memcpy(hex, pos + 2, 4);
+					unsigned long low = strtoul(hex, NULL, 16);
+					if (low >= 0xDC00 && low < 0xE000)
+					{
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+						pos += 6;
+					}
+				}
+				if (code < 0x80)
+				{
+					sbAppendChar(out, code);
+				}
+				else if (code < 0x800)
+				{
+					sbAppendChar(out, 0xC0 | (code >> 6));
+					sbAppendChar(out, 0x80 | (code & 0x3F));
+				}
+				else if (code < 0x10000)
+				{
+					sbAppendChar(out, 0xE0 | (code >> 12));
+					sbAppendChar(out, 0x80 | ((code >> 6) & 0x3F));
+					sbAppendChar(out, 0x80 | (code & 0x3F));
+				}
+				else
+				{
+					sbAppendChar(out, 0xF0 | (code >> 18));
+					sbAppendChar(out, 0x80 | ((code >> 12) & 0x3F));
+					sbAppendChar(out, 0x80 | ((code >> 6) & 0x3F));
+					sbAppendChar(out, 0x80 | (code & 0x3F));
+				}
+				break;
+			}
+			default: sbAppendChar(out, esc[1]); break; // \" \\ \/
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Checks an object member's key against a path step. Keys
+ * 				without escapes are compared as they are.
+ * Parameters: pos/end = the key between its quotes
+ * 			   step = the path step
+ * 			   scratch = used to unescape keys
+ * Returns: true if they are the same key
+ ****************************************************************************/
+bool jsonKeyMatches(const char *pos, const char *end, const JsonStep *step, StrBuf *scratch)
+{
+	StrBuf stepKey = { 0 };
+	bool matches = false;
+
+	if (!memchr(pos, '\\', end - pos) && !memchr(step->key, '\\', step->keyLen))
+	{
+		return (size_t)(end - pos) == step->keyLen && !memcmp(pos, step->key, step->keyLen);
+	}
+	scratch->len = 0;
+	jsonDecodeString(pos, end, scratch);
+	jsonDecodeString(step->key, step->key + step->keyLen, &stepKey);
+	matches = scratch->len == stepKey.len && !memcmp(scratch->buf, stepKey.buf, stepKey.len);
+	free(stepKey.buf);
+	return matches;
+}
+
+/*****************************************************************************
+ * Description: Follows a path into a JSON value, skipping over every member
+ * 				and element that is not on it without parsing it.
+ * Parameters: pos/end = the value's text
+ * 			   path = the path
+ * 			   scratch = used to unescape keys
+ * Returns: the start of the value the path leads to, or NULL if it does
+ * 			not lead anywhere
+ ****************************************************************************/
+const char* jsonFollow(const char *pos, const char *end, const JsonPath *path, StrBuf *scratch)
+{
+	int s = 0;
+
+	for (s = 0; s < path->numSteps; s++)
+	{
+		const JsonStep *step = &path->steps[s];
+		long i = 0;
+
+		pos = jsonSkipSpace(pos, end);
+		if (pos == end || *pos != (step->key ? '{' : '['))
+		{
+			return NULL;
+		}
+		pos = jsonSkipSpace(pos + 1, end);
+		if (pos < end && (*pos == '}' || *pos == ']'))
+		{
+			return NULL;
+		}
+
+		for (i = 0; ; i++)
+		{
+			if (step->key)
+			{
+				const char *keyEnd = pos < end && *pos == '"' ? jsonSkipString(pos, end) : NULL;
+				if (!keyEnd)
+				{
+					return NULL;
+				}
+				bool found = jsonKeyMatches(pos + 1, keyEnd - 1, step, scratch);
+				pos = jsonSkipSpace(keyEnd, end);
+				if (pos == end || *pos != ':')
+				{
+					return NULL;
+				}
+				pos = jsonSkipSpace(pos + 1, end);
+				if (found)
+				{
+					break;
+				}
+			}
+			else if (i == step->index)
+			{
+				break;
+			}
+
+			if (!(pos = jsonSkipValue(pos, end)))
+			{
+				return NULL;
+			}
+			pos = jsonSkipSpace(pos, end);
+			if (pos == end || *pos != ',')
+			{
+				return NULL;
+			}
+			pos = jsonSkipSpace(pos + 1, end);
+		}
+	}
+	return jsonSkipSpace(pos, end);
+}
+
+/*****************************************************************************
+ * Description: Parses a jget path: . for the whole value, then any of .key,
+ * 				."key", ["key"] and [index], e.g. .a.b[0]."c d"
+ * Parameters: text = the path
+ * 			   path = receives the steps, which point into text
+ * Returns: false if it is not a valid path
+ ****************************************************************************/
+bool jsonParsePath(const char *text, JsonPath *path)
+{
+	const char *pos = text;
+
+	path->steps = NULL;
+	path->numSteps = 0;
+	if (*pos != '.' && *pos != '[')
+	{
+		return false;
+	}
+	if (!strcmp(pos, "."))
+	{
+		return true;
+	}
+
+	while (*pos)
+	{
+		JsonStep step = { NULL, 0, 0 };
+		bool bracket = false;
+
+		if (*pos == '.' && pos[1] == '[')
+		{
+			pos++;
+		}
+		if (*pos == '[')
+		{
+			bracket = true;
+			pos++;
+		}
+		else if (*pos == '.')
+		{
+			pos++;
+		}
+		else
+		{
+			free(path->steps);
+			return false;
+		}
+
+		if (*pos == '"')
+		{
+			const char *close = jsonSkipString(pos, pos + strlen(pos));
+			if (!close)
+			{
+				free(path->steps);
+				return false;
+			}
+			step.key = pos + 1;
+			step.keyLen = close - 1 - step.key;
+			pos = close;
+		}
+		else if (bracket && isdigit((unsigned char)*pos))
+		{
+			char *after = NULL;
+			step.index = strtol(pos, &after, 10);
+			pos = after;
+		}
+		else if (!bracket)
+		{
+			step.key = pos;
+			while (*pos && *pos != '.' && *pos != '[')
+			{
+				pos++;
+			}
+			step.keyLen = pos - step.key;
+		}
+		else
+		{
+			free(path->steps);
+			return false;
+		}
+		if ((bracket && *pos++ != ']') || (step.key && step.keyLen == 0 && pos[-1] != '"'))
+		{
+			free(path->steps);
+			return false;
+		}
+
+		path->steps = realloc(path->steps, (path->numSteps + 1) * sizeof(JsonStep));
+		path->steps[path->numSteps++] = step;
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: LineBlockFn for jget: prints the query's values from each
+ * 				line, tab separated. Strings are printed unescaped, but with
+ * 				tabs, newlines and backslashes escaped as \t, \n and \\ so
+ * 				the output stays one row per line; other values are printed
+ * 				as they appear, and paths that lead nowhere as null. Blank
+ * 				lines are skipped, and lines that are not JSON are reported
+ * 				on stderr instead of printed.
+ * Parameters: ctx = the JsonQuery
+ * 			   data/len = the lines
+ * Returns: None
+ ****************************************************************************/
+void jgetBlock(void *ctx, const char *data, size_t len)
+{
+	JsonQuery *query = ctx;
+	const char *pos = data,
+			   *end = data + len;
+
+	while (pos < end)
+	{
+		const char *nl = memchr(pos, '\n', end - pos),
+				   *lineEnd = nl ? nl : end;
+		int p = 0;
+
+		query->lineNum++;
+		if (jsonSkipSpace(pos, lineEnd) == lineEnd)
+		{
+			pos = lineEnd + 1;
+			continue;
+		}
+		if (!jsonLineValid(pos, lineEnd))
+		{
+			fflush(stdout);
+			fprintf(stderr, "smallsh: %s: %s:%ld: invalid JSON\n", query->command, query->source, query->lineNum);
+			query->invalid = true;
+			pos = lineEnd + 1;
+			continue;
+		}
+		for (p = 0; p < query->numPaths; p++)
+		{
+			const char *value = jsonFollow(pos, lineEnd, &query->paths[p], &query->scratch),
+					   *valueEnd = value ? jsonSkipValue(value, lineEnd) : NULL;
+
+			if (p > 0)
+			{
+				putchar('\t');
+			}
+			if (!valueEnd)
+			{
+				fputs("null", stdout);
+			}
+			else if (*value == '"')
+			{
+				query->scratch.len = 0;
+				jsonDecodeString(value + 1, valueEnd - 1, &query->scratch);
+				printTsvField(query->scratch.buf, query->scratch.len);
+			}
+			else
+			{
+				fwrite(value, 1, valueEnd - value, stdout);
+			}
+		}
+		putchar('\n');
+		pos = lineEnd + 1;
+	}
+}
+
+/*****************************************************************************
+ * Description: jget - pulls values out of newline delimited JSON. Each line
+ * 				of the named files (or stdin) prints one line with the value
+ * 				at each path, tab separated, e.g. jget .a.b[0] .c < log.json
+ * 				Lines are never parsed in full: only the members and
+ * 				elements on the way to each value are looked at, and the rest
+ * 				skipped over by scanning for quotes and brackets.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if an input could not be read or had a line that is not
+ * 			JSON, or 2 on a usage error
+ ****************************************************************************/
+int jgetBuiltin(char **args, int argCount)
+{
+	JsonQuery query = { 0 };
+	int result = 0,
+		first = 0,
+		i = 1;
+
+	query.paths = malloc(argCount * sizeof(JsonPath));
+	query.command = args[0];
+	for (i = 1; i < argCount && (args[i][0] == '.' || args[i][0] == '['); i++)
+	{
+		if (!jsonParsePath(args[i], &query.paths[query.numPaths]))
+		{
+			fprintf(stderr, "smallsh: %s: %s: invalid path\n", args[0], args[i]);
+			result = 2;
+			break;
+		}
+		query.numPaths++;
+	}
+	if (result == 0 && query.numPaths == 0)
+	{
+		fprintf(stderr, "smallsh: %s: usage: %s path... [file...]\n", args[0], args[0]);
+		result = 2;
+	}
+
+	for (first = i; result != 2 && (i < argCount || i == first); i++)
+	{
+		bool isStdin = i == argCount || !strcmp(args[i], "-");
+		int fd = isStdin ? STDIN_NUM : open(args[i], O_RDONLY | O_CLOEXEC),
+			err = 0;
+
+		query.source = isStdin ? "stdin" : args[i];
+		query.lineNum = 0;
+		if (fd == -1 || (err = readLineBlocks(fd, jgetBlock, &query)))
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], isStdin ? "stdin" : args[i], strerror(fd == -1 ? errno : err));
+			result = 1;
+		}
+		if (!isStdin && fd != -1)
+		{
+			close(fd);
+		}
+	}
+
+	for (i = 0; i < query.numPaths; i++)
+	{
+		free(query.paths[i].steps);
+	}
+	free(query.paths);
+	free(query.scratch.buf);
+	return result == 0 && query.invalid ? 1 : result;
+}
+
+/*****************************************************************************
+ * Description: Splits one RFC 4180 record into fields. Quoted fields may
+ * 				hold the delimiter, newlines and "" for a quote; a record
+ * 				ends at a newline (or CRLF) outside quotes. A quoted field
+ * 				the input ends inside runs to the end, and is flagged.
+ * Parameters: pos/end = the text the record starts
+ * 			   final = there is no more text after end, so a record ending
+ * 			   		   there without a newline is complete
+ * 			   delim = the field delimiter
+ * 			   fields = receives the fields
+ * Returns: the start of the next record, or NULL if the record is not
+ * 			complete (or there is none)
+ ****************************************************************************/
+const char* colsRecord(const char *pos, const char *end, bool final, char delim, ColsFields *fields)
+{
+	char unquoted[3] = { delim, '\n', '\0' };
+
+	fields->count = 0;
+	if (pos >= end)
+	{
+		return NULL;
+	}
+	while (true)
+	{
+		const char *start = pos;
+		if (pos < end && *pos == '"')
+		{
+			// the closing quote is one not followed by another
+			for (pos++; (pos = memchr(pos, '"', end - pos)) && pos + 1 < end && pos[1] == '"'; pos += 2)
+			{
+			}
+			if (!pos && final)
+			{
+				// run to the end, leaving out a last newline
+				fields->unterminated = true;
+				pos = end[-1] == '\n' ? end - 2 : end - 1;
+			}
+			if (!pos || (pos + 1 == end && !final))
+			{
+				return NULL;
+			}
+			pos++;
+		}
+		pos = scanBytes(pos, end, unquoted);
+
+		if (fields->count == fields->cap)
+		{
+			fields->cap = fields->cap ? fields->cap * 2 : 16;
+			fields->starts = realloc(fields->starts, fields->cap * sizeof(char *));
+			fields->lens = realloc(fields->lens, fields->cap * sizeof(size_t));
+		}
+		fields->starts[fields->count] = start;
+		fields->lens[fields->count] = pos - start;
+		fields->count++;
+
+		if (pos == end)
+		{
+			if (!final)
+			{
+				return NULL;
+			}
+			break;
+		}
+		if (*pos++ == '\n')
+		{
+			break;
+		}
+	}
+	// drop the CR of a CRLF
+	int last = fields->count - 1;
+	if (fields->lens[last] && fields->starts[last][fields->lens[last] - 1] == '\r')
+	{
+		fields->lens[last]--;
+	}
+	return pos;
+}
+
+/*****************************************************************************
+ * Description: Gets a CSV field's value: without its quotes, and with ""
+ * 				inside them as one quote.
+ * Parameters: field/len = the field as it appears in the record
+ * 			   out = replaced with the value, NUL terminated
+ * Returns: None
+ ****************************************************************************/
+void colsUnquote(const char *field, size_t len, StrBuf *out)
+{
+	size_t i = 0;
+
+	out->len = 0;
+	if (len >= 2 && field[0] == '"' && field[len - 1] == '"')
+	{
+		for (i = 1; i < len - 1; i++)
+		{
+			sbAppendChar(out, field[i]);
+			i += field[i] == '"' && field[i + 1] == '"';
+		}
+	}
+	else
+	{
+		sbAppend(out, field, len);
+	}
+	if (!out->buf)
+	{
+		sbAppend(out, "", 0);
+	}
+	out->buf[out->len] = '\0';
+}
+
+/*****************************************************************************
+ * Description: Finds a column by its 1 based number or, given a header, by
+ * 				its name.
+ * Parameters: name = the number or name
+ * 			   header = the header record's fields, or NULL
+ * 			   scratch = used to unquote header fields
+ * Returns: the 0 based column, or -1 if there is none by that name
+ ****************************************************************************/
+int colsFind(const char *name, const ColsFields *header, StrBuf *scratch)
+{
+	char *after = NULL;
+	long number = strtol(name, &after, 10);
+	int i = 0;
+
+	if (*name && !*after)
+	{
+		return number >= 1 && number <= INT_MAX ? (int)number - 1 : -1;
+	}
+	for (i = 0; header && i < header->count; i++)
+	{
+		colsUnquote(header->starts[i], header->lens[i], scratch);
+		if (!strcmp(scratch->buf, name))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*****************************************************************************
+ * Description: Checks a record against the cols filters. A field that is
+ * 				missing is empty; one that is not a number fails the -eq
+ * 				style ops.
+ * Parameters: query = the cols query
+ * 			   fields = the record
+ * 			   scratch = used to unquote fields
+ * Returns: true if the record passes them all
+ ****************************************************************************/
+bool colsPasses(const ColsQuery *query, const ColsFields *fields, StrBuf *scratch)
+{
+	int f = 0;
+
+	for (f = 0; f < query->numFilters; f++)
+	{
+		const ColsFilter *filter = &query->filters[f];
+		const char *op = filter->op;
+		bool inRecord = filter->column < fields->count,
+			 passes = false;
+
+		colsUnquote(inRecord ? fields->starts[filter->column] : "", inRecord ? fields->lens[filter->column] : 0, scratch);
+		if (op[0] != '-')
+		{
+			int diff = strcmp(scratch->buf, filter->value);
+			passes = op[0] == '!' ? diff != 0 : diff == 0;
+		}
+		else
+		{
+			char *after = NULL;
+			double value = strtod(scratch->buf, &after);
+			if (after == scratch->buf || *after)
+			{
+				return false;
+			}
+			if (!strcmp(op, "-eq")) { passes = value == filter->number; }
+			else if (!strcmp(op, "-ne")) { passes = value != filter->number; }
+			else if (!strcmp(op, "-lt")) { passes = value < filter->number; }
+			else if (!strcmp(op, "-le")) { passes = value <= filter->number; }
+			else if (!strcmp(op, "-gt")) { passes = value > filter->number; }
+			else { passes = value >= filter->number; }
+		}
+		if (!passes)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Prints a record's selected columns, or all of it, as they
+ * 				appear in it so quoting is kept.
+ * Parameters: query = the cols query
+ * 			   fields = the record's fields
+ * 			   record = the record's text
+ * 			   out = appended to
+ * Returns: None
+ ****************************************************************************/
+void colsOutput(const ColsQuery *query, const ColsFields *fields, const char *record, StrBuf *out)
+{
+	int c = 0;
+
+	if (query->numColumns == 0)
+	{
+		int last = fields->count - 1;
+		sbAppend(out, record, fields->starts[last] + fields->lens[last] - record);
+		sbAppendChar(out, '\n');
+		return;
+	}
+	for (c = 0; c < query->numColumns; c++)
+	{
+		int column = query->columns[c];
+		if (c > 0)
+		{
+			sbAppendChar(out, query->delim);
+		}
+		if (column < fields->count)
+		{
+			sbAppend(out, fields->starts[column], fields->lens[column]);
+		}
+	}
+	sbAppendChar(out, '\n');
+}
+
+/*****************************************************************************
+ * Description: Checks for a cols -w op.
+ * Parameters: op = the word
+ * Returns: true if it is one
+ ****************************************************************************/
+bool colsIsOp(const char *op)
+{
+	static const char *ops[] = { "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+	size_t i = 0;
+
+	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+	{
+		if (!strcmp(op, ops[i]))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/*****************************************************************************
+ * Description: Runs the cols query over the complete records in a block.
+ * Parameters: query = the cols query
+ * 			   data/len = the records
+ * 			   final = nothing follows the block
+ * 			   out = what is printed is appended to it
+ * 			   unterminated = set if the block ends inside a quoted field
+ * Returns: the number of bytes used - the rest is a record cut short
+ ****************************************************************************/
+size_t colsProcess(const ColsQuery *query, const char *data, size_t len, bool final, StrBuf *out, bool *unterminated)
+{
+	ColsFields fields = { 0 };
+	StrBuf scratch = { 0 };
+	const char *pos = data,
+			   *next = NULL;
+
+	while ((next = colsRecord(pos, data + len, final, query->delim, &fields)))
+	{
+		if (colsPasses(query, &fields, &scratch))
+		{
+			colsOutput(query, &fields, pos, out);
+		}
+		pos = next;
+	}
+	*unterminated = *unterminated || fields.unterminated;
+	free(fields.starts);
+	free(fields.lens);
+	free(scratch.buf);
+	return pos - data;
+}
+
+/*****************************************************************************
+ * Description: Thread body for cols: processes one chunk of a mapped file.
+ * Parameters: arg = the chunk's ColsTask
+ * Returns: NULL
+ ****************************************************************************/
+void* colsChunk(void *arg)
+{
+	ColsTask *task = arg;
+	colsProcess(task->query, task->data, task->len, true, &task->out, &task->unterminated);
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Finds where the first record after a point in a CSV file
+ * 				starts, without splitting the records before it: whether the
+ * 				point is inside quotes follows from the number of quotes
+ * 				since a known record start.
+ * Parameters: from = a record start
+ * 			   target = the point
+ * 			   end = the end of the file
+ * Returns: the start of the record after the newline that ends the one
+ * 			target is in, or end
+ ****************************************************************************/
+const char* colsRecordStart(const char *from, const char *target, const char *end)
+{
+	bool inQuotes = false;
+
+	for (; (from = memchr(from, '"', target - from)); from++)
+	{
+		inQuotes = !inQuotes;
+	}
+	while ((target = scanBytes(target, end, "\"\n")) < end)
+	{
+		if (*target++ == '"')
+		{
+			inQuotes = !inQuotes;
+		}
+		else if (!inQuotes)
+		{
+			return target;
+		}
+	}
+	return end;
+}
+
+/*****************************************************************************
+ * Description: Resolves the columns of the -f list and the filters to
+ * 				column numbers.
+ * Parameters: query = the cols query, its filters named but not resolved
+ * 			   list = the -f list, comma separated, or NULL
+ * 			   header = the header record, or NULL without -h
+ * Returns: false (after printing why) if a column is not found
+ ****************************************************************************/
+bool colsSetup(ColsQuery *query, const char *list, const ColsFields *header)
+{
+	StrBuf scratch = { 0 };
+	char *names = list ? strdup(list) : NULL,
+		 *save = NULL,
+		 *name = NULL;
+	bool found = true;
+	int f = 0;
+
+	for (name = names ? strtok_r(names, ",", &save) : NULL; name && found; name = strtok_r(NULL, ",", &save))
+	{
+		query->columns = realloc(query->columns, (query->numColumns + 1) * sizeof(int));
+		if ((query->columns[query->numColumns++] = colsFind(name, header, &scratch)) == -1)
+		{
+			fprintf(stderr, "smallsh: cols: %s: no such column\n", name);
+			found = false;
+		}
+	}
+	for (f = 0; f < query->numFilters && found; f++)
+	{
+		if ((query->filters[f].column = colsFind(query->filters[f].columnName, header, &scratch)) == -1)
+		{
+			fprintf(stderr, "smallsh: cols: %s: no such column\n", query->filters[f].columnName);
+			found = false;
+		}
+	}
+	free(names);
+	free(scratch.buf);
+	return found;
+}
+
+/*****************************************************************************
+ * Description: cols - selects, reorders and filters the columns of CSV
+ * 				(RFC 4180, quoted fields and all) or with -t TSV, from a
+ * 				file or stdin.
+ * 				-d c fields are separated by c, -t by tabs
+ * 				-h the first record is a header naming the columns; it is
+ * 				   printed, and the names can be used for columns
+ * 				-f list the columns to print, in order, by number or name
+ * 				-w column op value only print records that pass: op is
+ * 				   = or != to compare strings, or -eq -ne -lt -le -gt -ge
+ * 				   to compare numbers. Several -w must all pass.
+ * 				Fields are printed as they appear, still quoted. Large
+ * 				regular files are mapped and split at record ends across a
+ * 				thread per CPU.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if the input could not be read, or 2 on a usage error
+ ****************************************************************************/
+int colsBuiltin(char **args, int argCount)
+{
+	ColsQuery query = { .delim = ',' };
+	ColsFields header = { 0 };
+	StrBuf out = { 0 };
+	const char *list = NULL;
+	bool hasHeader = false,
+		 unterminated = false;
+	int result = 0,
+		fd = STDIN_NUM,
+		i = 1;
+
+	query.filters = malloc(argCount * sizeof(ColsFilter));
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1]; i++)
+	{
+		if (!strcmp(args[i], "-d") && i + 1 < argCount && args[i + 1][0]) { query.delim = args[++i][0]; }
+		else if (!strcmp(args[i], "-t")) { query.delim = '\t'; }
+		else if (!strcmp(args[i], "-h")) { hasHeader = true; }
+		else if (!strcmp(args[i], "-f") && i + 1 < argCount) { list = args[++i]; }
+		else if (!strcmp(args[i], "-w") && i + 3 < argCount && colsIsOp(args[i + 2]))
+		{
+			ColsFilter *filter = &query.filters[query.numFilters++];
+			filter->columnName = args[i + 1];
+			filter->op = args[i + 2];
+			filter->value = args[i + 3];
+			filter->number = strtod(filter->value, NULL);
+			i += 3;
+		}
+		else
+		{
+			fprintf(stderr, "smallsh: %s: usage: %s [-t | -d delim] [-h] [-f columns] [-w column op value]... [file]\n", args[0], args[0]);
+			free(query.filters);
+			return 2;
+		}
+	}
+	if (i < argCount && strcmp(args[i], "-") && (fd = open(args[i], O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], args[i], strerror(errno));
+		free(query.filters);
+		return 1;
+	}
+
+	struct stat info;
+	char *map = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0)
+	{
+		map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	if (map != MAP_FAILED)
+	{
+		const char *end = map + info.st_size,
+				   *body = hasHeader ? colsRecord(map, end, true, query.delim, &header) : NULL;
+		if (!colsSetup(&query, list, body ? &header : NULL))
+		{
+			result = 2;
+		}
+		else if (body)
+		{
+			colsOutput(&query, &header, map, &out);
+		}
+		body = body ? body : map;
+
+		if (result == 0)
+		{
+			ColsTask tasks[COLS_MAX_THREADS];
+			pthread_t threads[COLS_MAX_THREADS];
+			bool started[COLS_MAX_THREADS] = { false };
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			int numTasks = (end - body) / COLS_MIN_PER_THREAD,
+				t = 0;
+			const char *start = body;
+
+			numTasks = numTasks > cpus ? cpus : numTasks;
+			numTasks = numTasks > COLS_MAX_THREADS ? COLS_MAX_THREADS : numTasks;
+			numTasks = numTasks < 1 ? 1 : numTasks;
+			madvise(map, info.st_size, MADV_SEQUENTIAL);
+
+			for (t = 0; t < numTasks; t++)
+			{
+				const char *target = body + (end - body) * (t + 1) / numTasks,
+						   *stop = end;
+				if (t < numTasks - 1)
+				{
+					stop = colsRecordStart(start, target > start ? target : start, end);
+				}
+				tasks[t] = (ColsTask){ .query = &query, .data = start, .len = stop - start };
+				start = stop;
+			}
+			for (t = 1; t < numTasks; t++)
+			{
+				started[t] = !pthread_create(&threads[t], NULL, colsChunk, &tasks[t]);
+			}
+			fwrite(out.buf, 1, out.len, stdout);
+			for (t = 0; t < numTasks; t++)
+			{
+				if (started[t])
+				{
+					pthread_join(threads[t], NULL);
+				}
+				else
+				{
+					colsChunk(&tasks[t]);
+				}
+				fwrite(tasks[t].out.buf, 1, tasks[t].out.len, stdout);
+				free(tasks[t].out.buf);
+				unterminated = unterminated || tasks[t].unterminated;
+			}
+		}
+		munmap(map, info.st_size);
+		lseek(fd, 0, SEEK_END);
+	}
+	else
+	{
+		// stream: process the complete records of each read, carrying the rest over
+		char *buf = malloc(FD_READER_BUFSIZE);
+		size_t cap = FD_READER_BUFSIZE,
+			   len = 0;
+		ssize_t n = 0;
+		bool eof = false,
+			 ready = false;
+
+		while (!eof && result == 0)
+		{
+			size_t used = 0;
+			if (len == cap)
+			{
+				buf = realloc(buf, cap *= 2);
+			}
+			if ((n = read(fd, buf + len, cap - len)) == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (n == -1)
+			{
+				fprintf(stderr, "smallsh: %s: %s\n", args[0], strerror(errno));
+				result = 1;
+			}
+			eof = n <= 0;
+			len += n > 0 ? n : 0;
+
+			if (!ready)
+			{
+				const char *body = hasHeader ? colsRecord(buf, buf + len, eof, query.delim, &header) : buf;
+				if (!body)
+				{
+					continue; // the header is not all here yet, or there is no input
+				}
+				if (!colsSetup(&query, list, hasHeader ? &header : NULL))
+				{
+					result = 2;
+					break;
+				}
+				if (hasHeader)
+				{
+					colsOutput(&query, &header, buf, &out);
+				}
+				used = body - buf;
+				ready = true;
+			}
+			used += colsProcess(&query, buf + used, len - used, eof, &out, &unterminated);
+			fwrite(out.buf, 1, out.len, stdout);
+			out.len = 0;
+			memmove(buf, buf + used, len - used);
+			len -= used;
+		}
+		free(buf);
+	}
+
+	// the input ended inside quotes; what followed the quote was printed
+	if (unterminated || header.unterminated)
+	{
+		fflush(stdout);
+		fprintf(stderr, "smallsh: %s: unterminated quote at end of input\n", args[0]);
+		result = result ? result : 1;
+	}
+	if (fd != STDIN_NUM)
+	{
+		close(fd);
+	}
+	free(header.starts);
+	free(header.lens);
+	free(out.buf);
+	free(query.columns);
+	free(query.filters);
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Builds the CRC-32C table and picks the checksum kernels for
+ * 				this CPU: the SSE4.2 crc32 instruction, the SHA extensions
+ * 				and AVX2 for XXH3's accumulators. Must run before hash
+ * 				threads start.
+ * Parameters: None
+ * Returns: None
+ ****************************************************************************/
+void hashSelectKernels()
+{
+	uint32_t i = 0;
+	int bit = 0;
+
+	if (crc32cTable[1])
+	{
+		return;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		uint32_t crc = i;
+		for (bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (crc & 1 ? 0x82F63B78 : 0);
+		}
+		crc32cTable[i] = crc;
+	}
+#ifdef __x86_64__
+	if (__builtin_cpu_supports("sse4.2"))
+	{
+		crc32cUpdate = crc32cHw;
+	}
+	if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+	{
+		sha256Blocks = sha256BlocksNi;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		xxh3Stripes = xxh3StripesAvx2;
+		xxh3Scramble = xxh3ScrambleAvx2;
+	}
+#endif
+}
+
+/*****************************************************************************
+ * Description: Updates a CRC-32C a byte at a time from a table.
+ * Parameters: crc = the CRC so far, not inverted
+ * 			   data/len = the bytes
+ * Returns: the updated CRC
+ ****************************************************************************/
+uint32_t crc32cSoft(uint32_t crc, const unsigned char *data, size_t len)
+{
+	size_t i = 0;
+	for (i = 0; i < len; i++)
+	{
+		crc = (crc >> 8) ^ crc32cTable[(crc ^ data[i]) & 0xFF];
+	}
+	return crc;
+}
+
+#ifdef __x86_64__
+/*****************************************************************************
+ * Description: Updates a CRC-32C with the SSE4.2 crc32 instruction, 8 bytes
+ * 				at a time.
+ * Parameters: crc = the CRC so far, not inverted
+ * 			   data/len = the bytes
+ * Returns: the updated CRC
+ ****************************************************************************/
+__attribute__((target("sse4.2")))
+uint32_t crc32cHw(uint32_t crc, const unsigned char *data, size_t len)
+{
+	uint64_t crc64 = crc;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = crc64;
+	for (; i < len; i++)
+	{
+		crc = _mm_crc32_u8(crc, data[i]);
+	}
+	return crc;
+}
+#endif
+
+/*****************************************************************************
+ * Description: HashFn for CRC-32C (Castagnoli).
+ * Parameters: data/len = the input
+ * 			   digest = receives the CRC, big endian
+ * Returns: None
+ ****************************************************************************/
+void crc32cDigest(const unsigned char *data, size_t len, unsigned char *digest)
+{
+	uint32_t crc = ~crc32cUpdate(~0U, data, len);
+	int i = 0;
+
+	for (i = 0; i < 4; i++)
+	{
+		digest[i] = crc >> (24 - 8 * i);
+	}
+}
+
+/*****************************************************************************
+ * Description: Runs SHA-256 compression over whole 64 byte blocks.
+ * Parameters: state = the 8 word hash state
+ * 			   data/blocks = the blocks
+ * Returns: None
+ ****************************************************************************/
+void sha256BlocksSoft(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+	uint32_t w[64],
+			 v[8];
+	size_t b = 0;
+	int i = 0;
+
+	for (b = 0; b < blocks; b++, data += 64)
+	{
+		for (i = 0; i < 16; i++)
+		{
+			w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 | (uint32_t)data[4 * i + 2] << 8 | data[4 * i + 3];
+		}
+		for (i = 16; i < 64; i++)
+		{
+			uint32_t s0 = (w[i - 15] >> 7 | w[i - 15] << 25) ^ (w[i - 15] >> 18 | w[i - 15] << 14) ^ (w[i - 15] >> 3),
+					 s1 = (w[i - 2] >> 17 | w[i - 2] << 15) ^ (w[i - 2] >> 19 | w[i - 2] << 13) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		memcpy(v, state, sizeof(v));
+		for (i = 0; i < 64; i++)
+		{
+			uint32_t s1 = (v[4] >> 6 | v[4] << 26) ^ (v[4] >> 11 | v[4] << 21) ^ (v[4] >> 25 | v[4] << 7),
+					 t1 = v[7] + s1 + ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256K[i] + w[i],
+					 s0 = (v[0] >> 2 | v[0] << 30) ^ (v[0] >> 13 | v[0] << 19) ^ (v[0] >> 22 | v[0] << 10),
+					 t2 = s0 + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+			memmove(v + 1, v, 7 * sizeof(uint32_t));
+			v[4] += t1;
+			v[0] = t1 + t2;
+		}
+		for (i = 0; i < 8; i++)
+		{
+			state[i] += v[i];
+		}
+	}
+}
+
+#ifdef __x86_64__
+/*****************************************************************************
+ * Description: Runs SHA-256 compression over whole 64 byte blocks with the
+ * 				SHA extensions. The state is kept in the ABEF/CDGH word order
+ * 				sha256rnds2 works on, and the message schedule in a ring of
+ * 				four vectors of four words.
+ * Parameters: state = the 8 word hash state
+ * 			   data/blocks = the blocks
+ * Returns: None
+ ****************************************************************************/
+__attribute__((target("sha,sse4.1")))
+void sha256BlocksNi(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+	const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i abef = _mm_loadu_si128((const __m128i *)state),
+			cdgh = _mm_loadu_si128((const __m128i *)(state + 4)),
+			tmp = _mm_shuffle_epi32(abef, 0xB1), // CDAB
+			msgs[4];
+	size_t b = 0;
+	int r = 0;
+
+	cdgh = _mm_shuffle_epi32(cdgh, 0x1B); // EFGH
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+	for (b = 0; b < blocks; b++, data += 64)
+	{
+		__m128i savedAbef = abef,
+				savedCdgh = cdgh;
+		for (r = 0; r < 16; r++)
+		{
+			__m128i *quad = &msgs[r % 4],
+					msg;
+			if (r < 4)
+			{
+				*quad = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * r)), byteSwap);
+			}
+			else
+			{
+				// W[t-16] + s0(W[t-15]), + W[t-7], + s1(W[t-2])
+				msg = _mm_sha256msg1_epu32(*quad, msgs[(r + 1) % 4]);
+				msg = _mm_add_epi32(msg, _mm_alignr_epi8(msgs[(r + 3) % 4], msgs[(r + 2) % 4], 4));
+				*quad = _mm_sha256msg2_epu32(msg, msgs[(r + 3) % 4]);
+			}
+			msg = _mm_add_epi32(*quad, _mm_loadu_si128((const __m128i *)(sha256K + 4 * r)));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E));
+		}
+		abef = _mm_add_epi32(abef, savedAbef);
+		cdgh = _mm_add_epi32(cdgh, savedCdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(abef, 0x1B); // FEBA
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1); // DCHG
+	_mm_storeu_si128((__m128i *)state, _mm_blend_epi16(tmp, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#endif
+
+/*****************************************************************************
+ * Description: HashFn for SHA-256.
+ * Parameters: data/len = the input
+ * 			   digest = receives the 32 byte hash
+ * Returns: None
+ ****************************************************************************/
+void sha256Digest(const unsigned char *data, size_t len, unsigned char *digest)
+{
+	uint32_t state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	unsigned char tail[128] = { 0 };
+	size_t whole = len / 64,
+		   rest = len % 64,
+		   tailLen = rest < 56 ? 64 : 128;
+	uint64_t bits = (uint64_t)len * 8;
+	int i = 0;
+
+	sha256Blocks(state, data, whole);
+	memcpy(tail, data + whole * 64, rest);
+	tail[rest] = 0x80;
+	for (i = 0; i < 8; i++)
+	{
+		tail[tailLen - 1 - i] = bits >> (8 * i);
+	}
+	sha256Blocks(state, tail, tailLen / 64);
+	for (i = 0; i < 32; i++)
+	{
+		digest[i] = state[i / 4] >> (24 - 8 * (i % 4));
+	}
+}
+
+/*****************************************************************************
+ * Description: XXH3 helpers: the 128 bit product of two words folded to 64
+ * 				bits, the final avalanche, and the mix of 16 input bytes with
+ * 				16 secret bytes the short inputs are hashed with.
+ ****************************************************************************/
+uint64_t xxh3Mul128Fold(uint64_t a, uint64_t b)
+{
+	unsigned __int128 product = (unsigned __int128)a * b;
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+uint64_t xxh3Avalanche(uint64_t hash)
+{
+	hash ^= hash >> 37;
+	hash *= XXH_PRIME_MX1;
+	return hash ^ (hash >> 32);
+}
+
+uint64_t xxh3Mix16(const unsigned char *data, const unsigned char *secret)
+{
+	uint64_t lo, hi, keyLo, keyHi;
+	memcpy(&lo, data, 8);
+	memcpy(&hi, data + 8, 8);
+	memcpy(&keyLo, secret, 8);
+	memcpy(&keyHi, secret + 8, 8);
+	return xxh3Mul128Fold(lo ^ keyLo, hi ^ keyHi);
+}
+
+/*****************************************************************************
+ * Description: Feeds 64 byte stripes into XXH3's 8 accumulators, moving 8
+ * 				bytes along the secret for each stripe.
+ * Parameters: acc = the accumulators
+ * 			   data/stripes = the stripes
+ * 			   secret = the secret for the first stripe
+ * Returns: None
+ ****************************************************************************/
+void xxh3StripesSoft(uint64_t *acc, const unsigned char *data, size_t stripes, const unsigned char *secret)
+{
+	size_t n = 0;
+	int i = 0;
+
+	for (n = 0; n < stripes; n++)
+	{
+		for (i = 0; i < 8; i++)
+		{
+			uint64_t value, key;
+			memcpy(&value, data + n * 64 + 8 * i, 8);
+			memcpy(&key, secret + n * 8 + 8 * i, 8);
+			key ^= value;
+			acc[i ^ 1] += value;
+			acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Scrambles XXH3's accumulators at the end of each block.
+ * Parameters: acc = the accumulators
+ * 			   secret = the secret's last 64 bytes
+ * Returns: None
+ ****************************************************************************/
+void xxh3ScrambleSoft(uint64_t *acc, const unsigned char *secret)
+{
+	int i = 0;
+	for (i = 0; i < 8; i++)
+	{
+		uint64_t key;
+		memcpy(&key, secret + 8 * i, 8);
+		acc[i] = (acc[i] ^ (acc[i] >> 47) ^ key) * XXH_PRIME32_1;
+	}
+}
+
+#ifdef __x86_64__
+/*****************************************************************************
+ * Description: xxh3StripesSoft with AVX2, four accumulators per vector.
+ * Parameters: acc = the accumulators
+ * 			   data/stripes = the stripes
+ * 			   secret = the secret for the first stripe
+ * Returns: None
+ ****************************************************************************/
+__attribute__((target("avx2")))
+void xxh3StripesAvx2(uint64_t *acc, const unsigned char *data, size_t stripes, const unsigned char *secret)
+{
+	__m256i accs[2] = { _mm256_loadu_si256((const __m256i *)acc), _mm256_loadu_si256((const __m256i *)(acc + 4)) };
+	size_t n = 0;
+	int half = 0;
+
+	for (n = 0; n < stripes; n++)
+	{
+		for (half = 0; half < 2; half++)
+		{
+			__m256i value = _mm256_loadu_si256((const __m256i *)(data + n * 64 + 32 * half)),
+					key = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i *)(secret + n * 8 + 32 * half))),
+					product = _mm256_mul_epu32(key, _mm256_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1))),
+					swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+			accs[half] = _mm256_add_epi64(accs[half], _mm256_add_epi64(product, swapped));
+		}
+	}
+	_mm256_storeu_si256((__m256i *)acc, accs[0]);
+	_mm256_storeu_si256((__m256i *)(acc + 4), accs[1]);
+}
+
+/*****************************************************************************
+ * Description: xxh3ScrambleSoft with AVX2; the 64 by 32 bit multiply is
+ * 				done as two 32 bit halves.
+ * Parameters: acc = the accumulators
+ * 			   secret = the secret's last 64 bytes
+ * Returns: None
+ ****************************************************************************/
+__attribute__((target("avx2")))
+void xxh3ScrambleAvx2(uint64_t *acc, const unsigned char *secret)
+{
+	const __m256i prime = _mm256_set1_epi32(XXH_PRIME32_1);
+	int half = 0;
+
+	for (half = 0; half < 2; half++)
+	{
+		__m256i value = _mm256_loadu_si256((const __m256i *)(acc + 4 * half)),
+				key = _mm256_loadu_si256((const __m256i *)(secret + 32 * half));
+		value = _mm256_xor_si256(_mm256_xor_si256(value, _mm256_srli_epi64(value, 47)), key);
+		__m256i low = _mm256_mul_epu32(value, prime),
+				high = _mm256_mul_epu32(_mm256_shuffle_epi32(value, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+		_mm256_storeu_si256((__m256i *)(acc + 4 * half), _mm256_add_epi64(low, _mm256_slli_epi64(high, 32)));
+	}
+}
+#endif
+
+/*****************************************************************************
+ * Description: HashFn for XXH3 (64 bit, seed 0, default secret). Inputs up
+ * 				to 240 bytes are mixed directly; longer ones go through the
+ * 				accumulators a 1 KiB block at a time.
+ * Parameters: data/len = the input
+ * 			   digest = receives the hash, big endian
+ * Returns: None
+ ****************************************************************************/
+void xxh3Digest(const unsigned char *data, size_t len, unsigned char *digest)
+{
+	const unsigned char *secret = xxh3Secret;
+	uint64_t hash = 0,
+			 lo = 0,
+			 hi = 0;
+	size_t i = 0;
+
+	if (len == 0)
+	{
+		memcpy(&lo, secret + 56, 8);
+		memcpy(&hi, secret + 64, 8);
+		hash = lo ^ hi;
+		hash ^= hash >> 33;
+		hash *= XXH_PRIME64_2;
+		hash ^= hash >> 29;
+		hash *= XXH_PRIME64_3;
+		hash ^= hash >> 32;
+	}
+	else if (len <= 3)
+	{
+		uint32_t combined = (uint32_t)data[0] << 16 | (uint32_t)data[len >> 1] << 24 | data[len - 1] | (uint32_t)len << 8,
+				 key0, key1;
+		memcpy(&key0, secret, 4);
+		memcpy(&key1, secret + 4, 4);
+		hash = combined ^ (uint64_t)(key0 ^ key1);
+		hash ^= hash >> 33;
+		hash *= XXH_PRIME64_2;
+		hash ^= hash >> 29;
+		hash *= XXH_PRIME64_3;
+		hash ^= hash >> 32;
+	}
+	else if (len <= 8)
+	{
+		uint32_t first, last;
+		memcpy(&first, data, 4);
+		memcpy(&last, data + len - 4, 4);
+		memcpy(&lo, secret + 8, 8);
+		memcpy(&hi, secret + 16, 8);
+		hash = ((uint64_t)last + ((uint64_t)first << 32)) ^ (lo ^ hi);
+		hash ^= (hash << 49 | hash >> 15) ^ (hash << 24 | hash >> 40);
+		hash *= XXH_PRIME_MX2;
+		hash ^= (hash >> 35) + len;
+		hash *= XXH_PRIME_MX2;
+		hash ^= hash >> 28;
+	}
+	else if (len <= 16)
+	{
+		uint64_t keys[4], first, last;
+		memcpy(keys, secret + 24, sizeof(keys));
+		memcpy(&first, data, 8);
+		memcpy(&last, data + len - 8, 8);
+		lo = first ^ (keys[0] ^ keys[1]);
+		hi = last ^ (keys[2] ^ keys[3]);
+		hash = xxh3Avalanche(len + __builtin_bswap64(lo) + hi + xxh3Mul128Fold(lo, hi));
+	}
+	else if (len <= 128)
+	{
+		// pairs from each end, working inwards
+		hash = len * XXH_PRIME64_1;
+		for (i = 0; i <= (len - 1) / 32; i++)
+		{
+			hash += xxh3Mix16(data + 16 * i, secret + 32 * i);
+			hash += xxh3Mix16(data + len - 16 * (i + 1), secret + 32 * i + 16);
+		}
+		hash = xxh3Avalanche(hash);
+	}
+	else if (len <= 240)
+	{
+		hash = len * XXH_PRIME64_1;
+		for (i = 0; i < 8; i++)
+		{
+			hash += xxh3Mix16(data + 16 * i, secret + 16 * i);
+		}
+		hash = xxh3Avalanche(hash);
+		for (i = 8; i < len / 16; i++)
+		{
+			hash += xxh3Mix16(data + 16 * i, secret + 16 * (i - 8) + 3);
+		}
+		hash += xxh3Mix16(data + len - 16, secret + 136 - 17);
+		hash = xxh3Avalanche(hash);
+	}
+	else
+	{
+		uint64_t acc[8] = { XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+							XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1 };
+		size_t blockLen = 1024, // 16 stripes, a secret's worth
+			   blocks = (len - 1) / blockLen;
+
+		for (i = 0; i < blocks; i++)
+		{
+			xxh3Stripes(acc, data + i * blockLen, 16, secret);
+			xxh3Scramble(acc, secret + sizeof(xxh3Secret) - 64);
+		}
+		xxh3Stripes(acc, data + blocks * blockLen, (len - 1 - blocks * blockLen) / 64, secret);
+		xxh3Stripes(acc, data + len - 64, 1, secret + sizeof(xxh3Secret) - 64 - 7);
+
+		hash = len * XXH_PRIME64_1;
+		for (i = 0; i < 4; i++)
+		{
+			memcpy(&lo, secret + 11 + 16 * i, 8);
+			memcpy(&hi, secret + 11 + 16 * i + 8, 8);
+			hash += xxh3Mul128Fold(acc[2 * i] ^ lo, acc[2 * i + 1] ^ hi);
+		}
+		hash = xxh3Avalanche(hash);
+	}
+
+	for (i = 0; i < 8; i++)
+	{
+		digest[i] = hash >> (56 - 8 * i);
+	}
+}
+
+/*****************************************************************************
+ * Description: Hashes one input: a regular file is mapped, anything else
+ * 				read in full.
+ * Parameters: job = the input, receives the digest or errno
+ * Returns: None
+ ****************************************************************************/
+void hashRunJob(HashJob *job)
+{
+	bool isStdin = !strcmp(job->path, "-");
+	int fd = isStdin ? STDIN_NUM : open(job->path, O_RDONLY | O_CLOEXEC);
+	struct stat info;
+	StrBuf data = { 0 };
+	char *map = MAP_FAILED;
+
+	job->err = 0;
+	if (fd == -1 || fstat(fd, &info) == -1)
+	{
+		job->err = errno;
+		return;
+	}
+	if (S_ISDIR(info.st_mode))
+	{
+		job->err = EISDIR;
+	}
+	else if (S_ISREG(info.st_mode) && info.st_size > 0 && !isStdin &&
+			 (map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+	{
+		madvise(map, info.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+		job->algo->fn((const unsigned char *)map, info.st_size, job->digest);
+		munmap(map, info.st_size);
+	}
+	else
+	{
+		char chunk[FD_READER_BUFSIZE];
+		ssize_t n = 0;
+		while ((n = read(fd, chunk, sizeof(chunk))) > 0 || (n == -1 && errno == EINTR))
+		{
+			sbAppend(&data, chunk, n > 0 ? n : 0);
+		}
+		if (n == -1)
+		{
+			job->err = errno;
+		}
+		else
+		{
+			job->algo->fn((const unsigned char *)(data.buf ? data.buf : ""), data.len, job->digest);
+		}
+		free(data.buf);
+	}
+	if (!isStdin)
+	{
+		close(fd);
+	}
+}
+
+/*****************************************************************************
+ * Description: Thread body for the hash builtins: hashes inputs from the
+ * 				pool until there are none left.
+ * Parameters: arg = the HashPool
+ * Returns: NULL
+ ****************************************************************************/
+void* hashWorker(void *arg)
+{
+	HashPool *pool = arg;
+	int next = 0;
+
+	while ((next = atomic_fetch_add(&pool->next, 1)) < pool->numJobs)
+	{
+		hashRunJob(&pool->jobs[next]);
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Hashes inputs on a thread per CPU (the shell's own thread
+ * 				being one of them), each taking the next input in turn.
+ * Parameters: jobs/numJobs = the inputs
+ * Returns: None
+ ****************************************************************************/
+void hashJobs(HashJob *jobs, int numJobs)
+{
+	HashPool pool = { jobs, numJobs, 0 };
+	pthread_t threads[HASH_MAX_THREADS];
+	bool started[HASH_MAX_THREADS] = { false };
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int numThreads = numJobs,
+		t = 0;
+
+	numThreads = numThreads > cpus ? cpus : numThreads;
+	numThreads = numThreads > HASH_MAX_THREADS ? HASH_MAX_THREADS : numThreads;
+	hashSelectKernels();
+	for (t = 1; t < numThreads; t++)
+	{
+		started[t] = !pthread_create(&threads[t], NULL, hashWorker, &pool);
+	}
+	hashWorker(&pool);
+	for (t = 1; t < numThreads; t++)
+	{
+		if (started[t])
+		{
+			pthread_join(threads[t], NULL);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Finds a checksum by its name or its builtin's name.
+ * Parameters: name = the name
+ * Returns: the checksum, or NULL if there is none by that name
+ ****************************************************************************/
+const HashAlgo* hashAlgoFor(const char *name)
+{
+	size_t i = 0;
+	for (i = 0; i < sizeof(hashAlgos) / sizeof(hashAlgos[0]); i++)
+	{
+		if (!strcmp(name, hashAlgos[i].name) || !strcmp(name, hashAlgos[i].command))
+		{
+			return &hashAlgos[i];
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Checks the files listed in a sha256sum style checksum list,
+ * 				"digest  name" per line (or "digest *name"), printing OK or
+ * 				FAILED for each.
+ * Parameters: algo = the checksum
+ * 			   listPath = the list, - for stdin
+ * 			   command = the builtin's name, for messages
+ * Returns: 0 if every file matched, else 1
+ ****************************************************************************/
+int hashCheck(const HashAlgo *algo, const char *listPath, const char *command)
+{
+	StrBuf list = { 0 };
+	HashJob *jobs = NULL;
+	char **expected = NULL,
+		 *line = NULL,
+		 *save = NULL;
+	int numJobs = 0,
+		mismatched = 0,
+		unreadable = 0,
+		i = 0;
+	int fd = strcmp(listPath, "-") ? open(listPath, O_RDONLY | O_CLOEXEC) : STDIN_NUM;
+	char chunk[FD_READER_BUFSIZE];
+	ssize_t n = 0;
+
+	if (fd == -1)
+	{
+		fprintf(stderr, "smallsh: %s: %s: %s\n", command, listPath, strerror(errno));
+		return 1;
+	}
+	while ((n = read(fd, chunk, sizeof(chunk))) > 0 || (n == -1 && errno == EINTR))
+	{
+		sbAppend(&list, chunk, n > 0 ? n : 0);
+	}
+	if (fd != STDIN_NUM)
+	{
+		close(fd);
+	}
+
+	for (line = list.buf ? strtok_r(list.buf, "\n", &save) : NULL; line; line = strtok_r(NULL, "\n", &save))
+	{
+		size_t hexLen = strspn(line, "0123456789abcdefABCDEF");
+		if (hexLen != algo->digestLen * 2 || line[hexLen] != ' ' || (line[hexLen + 1] != ' ' && line[hexLen + 1] != '*'))
+		{
+			continue;
+		}
+		line[hexLen] = '\0';
+		jobs = realloc(jobs, (numJobs + 1) * sizeof(HashJob));
+		expected = realloc(expected, (numJobs + 1) * sizeof(char *));
+		jobs[numJobs] = (HashJob){ .path = line + hexLen + 2, .algo = algo };
+		expected[numJobs++] = line;
+	}
+	if (numJobs == 0)
+	{
+		fprintf(stderr, "smallsh: %s: %s: no properly formatted checksum lines found\n", command, listPath);
+		free(list.buf);
+		return 1;
+	}
+
+	hashJobs(jobs, numJobs);
+	for (i = 0; i < numJobs; i++)
+	{
+		char hex[65];
+		size_t b = 0;
+		for (b = 0; b < algo->digestLen; b++)
+		{
+			snprintf(hex + 2 * b, 3, "%02x", jobs[i].digest[b]);
+		}
+		if (jobs[i].err)
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", command, jobs[i].path, strerror(jobs[i].err));
+			printf("%s: FAILED open or read\n", jobs[i].path);
+			unreadable++;
+		}
+		else if (strcasecmp(hex, expected[i]))
+		{
+			printf("%s: FAILED\n", jobs[i].path);
+			mismatched++;
+		}
+		else
+		{
+			printf("%s: OK\n", jobs[i].path);
+		}
+	}
+	fflush(stdout);
+	if (unreadable)
+	{
+		fprintf(stderr, "smallsh: %s: WARNING: %d listed file%s could not be read\n", command, unreadable, unreadable == 1 ? "" : "s");
+	}
+	if (mismatched)
+	{
+		fprintf(stderr, "smallsh: %s: WARNING: %d computed checksum%s did NOT match\n", command, mismatched, mismatched == 1 ? "" : "s");
+	}
+	free(jobs);
+	free(expected);
+	free(list.buf);
+	return unreadable || mismatched ? 1 : 0;
+}
+
+/*****************************************************************************
+ * Description: hash [-a crc32c|xxh3|sha256] [-c] [file...], and crc32c,
+ * 				xxh3sum and sha256sum - prints the checksum of each file (or
+ * 				stdin) in sha256sum's format, or with -c checks the files
+ * 				listed in that format. Files are mapped and hashed on a
+ * 				thread per CPU, with kernels for the CPU's CRC, SHA and AVX2
+ * 				instructions where it has them. hash defaults to sha256.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if a file could not be read or did not match, or 2 on a
+ * 			usage error
+ ****************************************************************************/
+int hashBuiltin(char **args, int argCount)
+{
+	const HashAlgo *algo = hashAlgoFor(strcmp(args[0], "hash") ? args[0] : "sha256");
+	HashJob *jobs = NULL;
+	bool check = false;
+	int numJobs = 0,
+		result = 0,
+		i = 1;
+
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1]; i++)
+	{
+		if (!strcmp(args[i], "-a") && i + 1 < argCount && !strcmp(args[0], "hash") && hashAlgoFor(args[i + 1])) { algo = hashAlgoFor(args[++i]); }
+		else if (!strcmp(args[i], "-c")) { check = true; }
+		else if (!strcmp(args[i], "--")) { i++; break; }
+		else
+		{
+			fprintf(stderr, "smallsh: %s: usage: %s%s [-c] [file...]\n", args[0], args[0], strcmp(args[0], "hash") ? "" : " [-a crc32c|xxh3|sha256]");
+			return 2;
+		}
+	}
+
+	if (check)
+	{
+		for (; i < argCount || numJobs == 0; i++, numJobs++)
+		{
+			result |= hashCheck(algo, i < argCount ? args[i] : "-", args[0]);
+		}
+		return result;
+	}
+
+	numJobs = i < argCount ? argCount - i : 1;
+	jobs = malloc(numJobs * sizeof(HashJob));
+	for (numJobs = 0; i < argCount || numJobs == 0; i++)
+	{
+		jobs[numJobs++] = (HashJob){ .path = i < argCount ? args[i] : "-", .algo = algo };
+	}
+	hashJobs(jobs, numJobs);
+
+	for (i = 0; i < numJobs; i++)
+	{
+		size_t b = 0;
+		if (jobs[i].err)
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], jobs[i].path, strerror(jobs[i].err));
+			result = 1;
+			continue;
+		}
+		for (b = 0; b < algo->digestLen; b++)
+		{
+			printf("%02x", jobs[i].digest[b]);
+		}
+		printf("  %s\n", jobs[i].path);
+	}
+	free(jobs);
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Sets up the codecs for a command's <z and >z redirects. Each
+ * 				opens the file, and starts a thread that gzips what the
+ * 				command writes into it, or gunzips it for the command to
+ * 				read, through a pipe. The redirect's filename is replaced
+ * 				with the command's end of the pipe, so it is applied like
+ * 				any other redirect.
+ * Parameters: input/output = the redirect filenames, may point to NULL
+ * 			   compressed = [0] and [1] set for <z and >z
+ * 			   codecs = filled in with the two streams, NULL where none
+ * Returns: false (after printing why) if a codec could not be started, in
+ * 			which case none were
+ ****************************************************************************/
+bool startCodecs(char **input, char **output, const bool *compressed, CodecStream **codecs)
+{
+	char **names[2] = { input, output };
+	int i = 0;
+
+	codecs[0] = codecs[1] = NULL;
+	for (i = 0; i < 2; i++)
+	{
+		if (!compressed[i] || !*names[i])
+		{
+			continue;
+		}
+#ifndef HAVE_ZLIB
+		fprintf(stderr, "smallsh: %s: compressed redirects need zlib\n", *names[i]);
+		return false;
+#else
+		CodecStream *stream = calloc(1, sizeof(CodecStream));
+		int fds[2] = { -1, -1 },
+			result = 0;
+		sigset_t all,
+				 prev;
+
+		stream->compress = i == 1;
+		stream->pipeFd = stream->cmdFd = -1;
+		stream->fileFd = stream->compress ? open(*names[i], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+										  : open(*names[i], O_RDONLY | O_CLOEXEC);
+		if (stream->fileFd == -1)
+		{
+			perror(stream->compress ? "Output file could not be opened" : "Input file could not be opened");
+			free(stream);
+			finishCodecs(codecs, 0);
+			return false;
+		}
+		if (pipe2(fds, O_CLOEXEC) == -1)
+		{
+			perror("smallsh: pipe");
+			close(stream->fileFd);
+			free(stream);
+			finishCodecs(codecs, 0);
+			return false;
+		}
+		stream->pipeFd = fds[stream->compress ? 0 : 1];
+		stream->cmdFd = fds[stream->compress ? 1 : 0];
+		stream->path = *names[i];
+
+		/* with every signal blocked the thread gets EPIPE rather than SIGPIPE
+		 * if the command stops reading, and signals go to the shell as before */
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &prev);
+		result = pthread_create(&stream->thread, NULL, codecThread, stream);
+		pthread_sigmask(SIG_SETMASK, &prev, NULL);
+		if (result)
+		{
+			fprintf(stderr, "smallsh: %s: %s\n", stream->path, strerror(result));
+			close(stream->fileFd);
+			close(fds[0]);
+			close(fds[1]);
+			free(stream);
+			finishCodecs(codecs, 0);
+			return false;
+		}
+
+		// the command opens its end of the pipe in place of the file
+		*names[i] = malloc(32);
+		snprintf(*names[i], 32, "/proc/self/fd/%d", stream->cmdFd);
+		codecs[i] = stream;
+#endif
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Hands a command's codecs over once it has its end of their
+ * 				pipes: closes the shell's copy, so the codec sees EOF when
+ * 				the command is done, and either waits for them or leaves
+ * 				them for reapCodecs.
+ * Parameters: codecs = from startCodecs, set to NULL on return
+ * 			   job = the background job they belong to, or 0 to join them
+ * 			   		 now
+ * Returns: false if a codec that was joined failed
+ ****************************************************************************/
+bool finishCodecs(CodecStream **codecs, pid_t job)
+{
+	bool ok = true;
+	int i = 0;
+
+	for (i = 0; i < 2; i++)
+	{
+		CodecStream *stream = codecs[i];
+		if (!stream)
+		{
+			continue;
+		}
+		codecs[i] = NULL;
+		close(stream->cmdFd);
+		stream->cmdFd = -1;
+		if (!job)
+		{
+			ok = joinCodec(stream) && ok;
+		}
+		else
+		{
+			stream->job = job;
+			stream->next = bgCodecs;
+			bgCodecs = stream;
+		}
+	}
+	return ok;
+}
+
+/*****************************************************************************
+ * Description: Closes the codec fds a forked child inherited. The threads
+ * 				stay in the shell, and a copy of a <z pipe's write end
+ * 				would keep its reader from ever seeing EOF.
+ * Parameters: codecs = the child's own codecs, after it has applied them
+ * Returns: None
+ ****************************************************************************/
+void dropCodecs(CodecStream **codecs)
+{
+	CodecStream *stream = NULL;
+	int i = 0;
+
+	for (i = 0; i < 2; i++)
+	{
+		if (codecs[i])
+		{
+			close(codecs[i]->cmdFd);
+			close(codecs[i]->pipeFd);
+			close(codecs[i]->fileFd);
+			codecs[i] = NULL;
+		}
+	}
+	for (stream = bgCodecs; stream; stream = stream->next)
+	{
+		if (stream->pipeFd != -1)
+		{
+			close(stream->pipeFd);
+		}
+		close(stream->fileFd);
+	}
+	bgCodecs = NULL;
+}
+
+/*****************************************************************************
+ * Description: Waits for a codec thread, reports if it failed, and frees it
+ * Parameters: stream = the codec, its command's end already closed
+ * Returns: false if it failed
+ ****************************************************************************/
+bool joinCodec(CodecStream *stream)
+{
+	bool ok = false;
+
+	pthread_join(stream->thread, NULL);
+	ok = !stream->err;
+	if (stream->err == EBADMSG)
+	{
+		fprintf(stderr, "smallsh: %s: not in gzip format\n", stream->path);
+	}
+	else if (stream->err)
+	{
+		fprintf(stderr, "smallsh: %s: %s\n", stream->path, strerror(stream->err));
+	}
+	close(stream->fileFd);
+	free(stream->path);
+	free(stream);
+	return ok;
+}
+
+/*****************************************************************************
+ * Description: Joins the codecs of background jobs
+ * Parameters: wait = true to wait for all of them, false for only those
+ * 					  that are done
+ * Returns: None
+ ****************************************************************************/
+void reapCodecs(bool wait)
+{
+	CodecStream **link = &bgCodecs;
+
+	while (*link)
+	{
+		CodecStream *stream = *link;
+		if (wait || atomic_load(&stream->done))
+		{
+			*link = stream->next;
+			joinCodec(stream);
+		}
+		else
+		{
+			link = &stream->next;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Waits for the codecs of a background job that has finished,
+ * 				so its >z files are complete
+ * Parameters: job = the job's pid
+ * Returns: None
+ ****************************************************************************/
+void joinJobCodecs(pid_t job)
+{
+	CodecStream **link = &bgCodecs;
+
+	while (*link)
+	{
+		CodecStream *stream = *link;
+		if (stream->job == job)
+		{
+			*link = stream->next;
+			joinCodec(stream);
+		}
+		else
+		{
+			link = &stream->next;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Description: Writes all of a buffer to an fd
+ * Parameters: fd = the fd
+ * 			   data/len = the bytes to write
+ * Returns: 0, or the errno of the write that failed
+ ****************************************************************************/
+int writeAll(int fd, const void *data, size_t len)
+{
+	const char *pos = data;
+
+	while (len > 0)
+	{
+		ssize_t wrote = write(fd, pos, len);
+		if (wrote == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return errno;
+		}
+		pos += wrote;
+		len -= wrote;
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ * Description: Reads until a buffer is full or the input ends
+ * Parameters: fd = the fd
+ * 			   buf/len = where to read to
+ * 			   err = set to the errno of a read that failed
+ * Returns: The number of bytes read, short only at EOF or on error
+ ****************************************************************************/
+size_t readFull(int fd, void *buf, size_t len, int *err)
+{
+	size_t got = 0;
+
+	while (got < len)
+	{
+		ssize_t result = read(fd, (char *)buf + got, len - got);
+		if (result == 0)
+		{
+			break;
+		}
+		if (result == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			*err = errno;
+			break;
+		}
+		got += result;
+	}
+	return got;
+}
+
+#ifdef HAVE_ZLIB
+/*****************************************************************************
+ * Description: Runs a <z or >z codec, then closes its end of the pipe so the
+ * 				command sees EOF, or EPIPE if the file could not be written
+ * Parameters: arg = the CodecStream
+ * Returns: NULL
+ ****************************************************************************/
+void* codecThread(void *arg)
+{
+	CodecStream *stream = arg;
+	int fd = -1;
+
+	stream->err = stream->compress ? gzipStream(stream) : gunzipStream(stream);
+	// a command that stops reading a <z file early is not an error
+	if (!stream->compress && stream->err == EPIPE)
+	{
+		stream->err = 0;
+	}
+	fd = stream->pipeFd;
+	stream->pipeFd = -1;
+	close(fd);
+	atomic_store(&stream->done, 1);
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Deflates one block of a >z stream as raw deflate ending in a
+ * 				sync flush, so the blocks can be written one after another,
+ * 				and takes its crc
+ * Parameters: arg = the CodecBlock, its out buffer grown as needed
+ * Returns: NULL
+ ****************************************************************************/
+void* deflateBlock(void *arg)
+{
+	CodecBlock *block = arg;
+	z_stream strm;
+	size_t need = 0;
+
+	memset(&strm, 0, sizeof(strm));
+	block->ok = false;
+	block->crc = crc32(0, block->in, block->inLen);
+	if (deflateInit2(&strm, CODEC_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		return NULL;
+	}
+	// room for the sync flush's empty block too
+	need = deflateBound(&strm, block->inLen) + 16;
+	if (need > block->outCap)
+	{
+		unsigned char *out = realloc(block->out, need);
+		if (!out)
+		{
+			deflateEnd(&strm);
+			return NULL;
+		}
+		block->out = out;
+		block->outCap = need;
+	}
+	if (block->dictLen)
+	{
+		deflateSetDictionary(&strm, block->dict, block->dictLen);
+	}
+	strm.next_in = (Bytef *)block->in;
+	strm.avail_in = block->inLen;
+	strm.next_out = block->out;
+	strm.avail_out = block->outCap;
+	block->ok = deflate(&strm, Z_SYNC_FLUSH) == Z_OK && strm.avail_in == 0 && strm.avail_out > 0;
+	block->outLen = block->outCap - strm.avail_out;
+	deflateEnd(&strm);
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Gzips everything the command writes into the file, the way
+ * 				pigz does: the input is cut into CODEC_BLOCK_SIZE blocks,
+ * 				a batch of which are deflated at once, each primed with the
+ * 				32K before it, and written in order as one gzip member
+ * Parameters: stream = the >z codec
+ * Returns: 0, or an errno
+ ****************************************************************************/
+int gzipStream(CodecStream *stream)
+{
+	static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+	// a final, empty fixed block, which ends the deflate stream
+	static const unsigned char last[2] = { 0x03, 0x00 };
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int numThreads = cpus < 1 ? 1 : (cpus > CODEC_MAX_THREADS ? CODEC_MAX_THREADS : cpus),
+		numBlocks = 0,
+		err = 0,
+		t = 0;
+	size_t batchSize = (size_t)numThreads * CODEC_BLOCK_SIZE,
+		   got = batchSize,
+		   dictLen = 0;
+	unsigned char *in = malloc(batchSize),
+				  dict[CODEC_DICT_SIZE],
+				  trailer[8];
+	CodecBlock blocks[CODEC_MAX_THREADS];
+	pthread_t threads[CODEC_MAX_THREADS];
+	bool started[CODEC_MAX_THREADS];
+	unsigned long crc = crc32(0, NULL, 0);
+	uint64_t total = 0;
+
+	memset(blocks, 0, sizeof(blocks));
+	err = in ? writeAll(stream->fileFd, header, sizeof(header)) : ENOMEM;
+	// a short batch means the input has ended
+	while (!err && got == batchSize)
+	{
+		got = readFull(stream->pipeFd, in, batchSize, &err);
+		numBlocks = (got + CODEC_BLOCK_SIZE - 1) / CODEC_BLOCK_SIZE;
+		for (t = 0; t < numBlocks; t++)
+		{
+			blocks[t].in = in + (size_t)t * CODEC_BLOCK_SIZE;
+			blocks[t].inLen = got - (size_t)t * CODEC_BLOCK_SIZE < CODEC_BLOCK_SIZE ? got - (size_t)t * CODEC_BLOCK_SIZE : CODEC_BLOCK_SIZE;
+			blocks[t].dict = t ? blocks[t].in - CODEC_DICT_SIZE : dict;
+			blocks[t].dictLen = t ? CODEC_DICT_SIZE : dictLen;
+		}
+
+		for (t = 1; t < numBlocks; t++)
+		{
+			started[t] = !pthread_create(&threads[t], NULL, deflateBlock, &blocks[t]);
+		}
+		if (numBlocks > 0)
+		{
+			deflateBlock(&blocks[0]);
+		}
+		for (t = 1; t < numBlocks; t++)
+		{
+			if (started[t])
+			{
+				pthread_join(threads[t], NULL);
+			}
+			else
+			{
+				deflateBlock(&blocks[t]);
+			}
+		}
+
+		for (t = 0; t < numBlocks && !err; t++)
+		{
+			err = blocks[t].ok ? writeAll(stream->fileFd, blocks[t].out, blocks[t].outLen) : ENOMEM;
+			crc = crc32_combine(crc, blocks[t].crc, blocks[t].inLen);
+			total += blocks[t].inLen;
+		}
+		// every block of a full batch is full, so the next batch's window is the end of the last
+		if (got == batchSize)
+		{
+			memcpy(dict, in + batchSize - CODEC_DICT_SIZE, CODEC_DICT_SIZE);
+			dictLen = CODEC_DICT_SIZE;
+		}
+	}
+
+	if (!err)
+	{
+		for (t = 0; t < 4; t++)
+		{
+			trailer[t] = crc >> (8 * t);
+			trailer[4 + t] = total >> (8 * t);
+		}
+		err = writeAll(stream->fileFd, last, sizeof(last));
+	}
+	if (!err)
+	{
+		err = writeAll(stream->fileFd, trailer, sizeof(trailer));
+	}
+	for (t = 0; t < CODEC_MAX_THREADS; t++)
+	{
+		free(blocks[t].out);
+	}
+	free(in);
+	return err;
+}
+
+/*****************************************************************************
+ * Description: Gunzips the file for the command to read. Members one after
+ * 				another, as cat a.gz b.gz makes, are read as one stream.
+ * Parameters: stream = the <z codec
+ * Returns: 0, EBADMSG if the file is not gzip or is cut short, or an errno
+ ****************************************************************************/
+int gunzipStream(CodecStream *stream)
+{
+	unsigned char *in = malloc(CODEC_BLOCK_SIZE),
+				  *out = malloc(CODEC_BLOCK_SIZE);
+	z_stream strm;
+	int err = 0,
+		ret = Z_OK;
+	ssize_t got = 0;
+
+	memset(&strm, 0, sizeof(strm));
+	// 15 + 32 takes the gzip header rather than a raw or zlib stream
+	if (!in || !out || inflateInit2(&strm, 15 + 32) != Z_OK)
+	{
+		free(in);
+		free(out);
+		return ENOMEM;
+	}
+	while (!err && (got = read(stream->fileFd, in, CODEC_BLOCK_SIZE)) != 0)
+	{
+		if (got == -1)
+		{
+			if (errno != EINTR)
+			{
+				err = errno;
+			}
+			continue;
+		}
+		strm.next_in = in;
+		strm.avail_in = got;
+		do
+		{
+			if (ret == Z_STREAM_END)
+			{
+				inflateReset(&strm);
+			}
+			strm.next_out = out;
+			strm.avail_out = CODEC_BLOCK_SIZE;
+			ret = inflate(&strm, Z_NO_FLUSH);
+			if (ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR)
+			{
+				err = writeAll(stream->pipeFd, out, CODEC_BLOCK_SIZE - strm.avail_out);
+			}
+			else
+			{
+				err = EBADMSG;
+			}
+		} while (!err && (strm.avail_in > 0 || (strm.avail_out == 0 && ret != Z_STREAM_END)));
+	}
+	if (!err && ret != Z_STREAM_END)
+	{
+		err = EBADMSG;
+	}
+	inflateEnd(&strm);
+	free(in);
+	free(out);
+	return err;
+}
+#endif
+
+/*****************************************************************************
+ * Description: tee - copies stdin to stdout and each named file without
+ * 				copying it through the shell where it can help: each chunk
+ * 				of input is spliced into a private pipe, duplicated with
+ * 				tee(2) into a second one for each file, pipe or socket
+ * 				sink and spliced out to it, the last taking the chunk
+ * 				itself. Sinks that can't be spliced to (terminals, devices,
+ * 				files opened with -a) are written from a ring of chunks by
+ * 				a thread each. The next chunk is only read once the spliced
+ * 				sinks have taken this one and the ring has room, so input
+ * 				goes at the pace of the slowest sink.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if a file could not be opened or written, or 2 on a usage
+ * 			error
+ ****************************************************************************/
+int teeBuiltin(char **args, int argCount)
+{
+	TeeSink *sinks = calloc(argCount, sizeof(TeeSink));
+	TeeRing ring = { 0 };
+	bool append = false,
+		 useRing = false,
+		 running = true;
+	int chunk[2] = { -1, -1 },
+		spare[2] = { -1, -1 },
+		numSinks = 0,
+		result = 0,
+		i = 1,
+		s = 0;
+	size_t chunkSize = FD_READER_BUFSIZE;
+	char *scratch = malloc(FD_READER_BUFSIZE);
+
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1]; i++)
+	{
+		if (!strcmp(args[i], "-a")) { append = true; }
+		else
+		{
+			fprintf(stderr, "smallsh: %s: usage: %s [-a] [file...]\n", args[0], args[0]);
+			free(sinks);
+			free(scratch);
+			return 2;
+		}
+	}
+
+	sinks[numSinks++] = (TeeSink){ .fd = STDOUT_NUM, .name = "stdout" };
+	for (; i < argCount; i++)
+	{
+		int fd = open(args[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+		if (fd == -1)
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", args[0], args[i], strerror(errno));
+			result = 1;
+			continue;
+		}
+		sinks[numSinks++] = (TeeSink){ .fd = fd, .name = args[i] };
+	}
+	// splice(2) writes to files, pipes and sockets, but not in append mode
+	for (s = 0; s < numSinks; s++)
+	{
+		struct stat info;
+		int flags = fcntl(sinks[s].fd, F_GETFL);
+		sinks[s].copy = fstat(sinks[s].fd, &info) == -1 || (flags != -1 && (flags & O_APPEND)) ||
+						!(S_ISREG(info.st_mode) || S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode));
+		useRing = useRing || sinks[s].copy;
+	}
+
+	fflush(stdout);
+	if (pipe2(chunk, O_CLOEXEC) == -1 || pipe2(spare, O_CLOEXEC) == -1 || !scratch)
+	{
+		fprintf(stderr, "smallsh: %s: %s\n", args[0], strerror(errno));
+		result = 1;
+		running = false;
+	}
+	else
+	{
+		// tee(2) duplicates whole chunks only if both pipes can hold one
+		fcntl(chunk[1], F_SETPIPE_SZ, TEE_PIPE_SIZE);
+		fcntl(spare[1], F_SETPIPE_SZ, TEE_PIPE_SIZE);
+		int chunkPipe = fcntl(chunk[1], F_GETPIPE_SZ),
+			sparePipe = fcntl(spare[1], F_GETPIPE_SZ);
+		chunkSize = chunkPipe > 0 ? chunkPipe : chunkSize;
+		chunkSize = sparePipe > 0 && (size_t)sparePipe < chunkSize ? sparePipe : chunkSize;
+	}
+
+	if (useRing && running)
+	{
+		ring.buf = malloc(TEE_RING_SLOTS * chunkSize);
+		ring.lens = calloc(TEE_RING_SLOTS, sizeof(size_t));
+		ring.slotSize = chunkSize;
+		ring.sinks = sinks;
+		ring.numSinks = numSinks;
+		pthread_mutex_init(&ring.lock, NULL);
+		pthread_cond_init(&ring.cond, NULL);
+		for (s = 0; s < numSinks; s++)
+		{
+			sinks[s].ring = &ring;
+			// one that can't have a thread is written to before the next chunk
+			if (sinks[s].copy && ring.buf && ring.lens)
+			{
+				sinks[s].threaded = !pthread_create(&sinks[s].thread, NULL, teeConsumer, &sinks[s]);
+			}
+		}
+		if (!ring.buf || !ring.lens)
+		{
+			fprintf(stderr, "smallsh: %s: %s\n", args[0], strerror(ENOMEM));
+			result = 1;
+			running = false;
+		}
+	}
+
+	while (running)
+	{
+		ssize_t len = teeFill(chunk[1], chunkSize, scratch);
+		int last = -1;
+
+		if (len <= 0)
+		{
+			if (len == -1)
+			{
+				fprintf(stderr, "smallsh: %s: stdin: %s\n", args[0], strerror(errno));
+				result = 1;
+			}
+			break;
+		}
+
+		// the last spliced sink takes the chunk itself, unless the ring needs it
+		for (s = 0; s < numSinks && !useRing; s++)
+		{
+			last = !sinks[s].copy && !sinks[s].failed ? s : last;
+		}
+		for (s = 0; s < numSinks; s++)
+		{
+			if (sinks[s].copy || sinks[s].failed)
+			{
+				continue;
+			}
+			if (s == last)
+			{
+				teeSplice(chunk[0], &sinks[s], len, args[0]);
+				continue;
+			}
+			ssize_t copied = tee(chunk[0], spare[1], len, 0);
+			if (copied != len)
+			{
+				fprintf(stderr, "smallsh: %s: %s\n", args[0], strerror(copied == -1 ? errno : EIO));
+				teeDrain(spare[0], copied > 0 ? copied : 0);
+				sinks[s].failed = true;
+				continue;
+			}
+			teeSplice(spare[0], &sinks[s], len, args[0]);
+		}
+		if (useRing)
+		{
+			teePublish(&ring, chunk[0], len, args[0]);
+		}
+		else if (last == -1)
+		{
+			// every sink has failed, but the input is still read to the end
+			teeDrain(chunk[0], len);
+		}
+	}
+
+	if (ring.sinks)
+	{
+		pthread_mutex_lock(&ring.lock);
+		ring.done = true;
+		pthread_cond_broadcast(&ring.cond);
+		pthread_mutex_unlock(&ring.lock);
+	}
+	for (s = 0; s < numSinks; s++)
+	{
+		if (sinks[s].threaded)
+		{
+			pthread_join(sinks[s].thread, NULL);
+		}
+		result = sinks[s].failed ? 1 : result;
+		if (sinks[s].fd != STDOUT_NUM)
+		{
+			close(sinks[s].fd);
+		}
+	}
+	if (ring.sinks)
+	{
+		pthread_mutex_destroy(&ring.lock);
+		pthread_cond_destroy(&ring.cond);
+	}
+	for (i = 0; i < 2; i++)
+	{
+		if (chunk[i] != -1) { close(chunk[i]); }
+		if (spare[i] != -1) { close(spare[i]); }
+	}
+	free(ring.buf);
+	free(ring.lens);
+	free(sinks);
+	free(scratch);
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Moves the next chunk of stdin into a pipe. Input that can't
+ * 				be spliced from, like a terminal, is read and written in.
+ * Parameters: pipeFd = the write end of the empty pipe
+ * 			   len = the most to move, no more than the pipe holds
+ * 			   scratch = a FD_READER_BUFSIZE buffer
+ * Returns: The bytes moved, 0 at EOF, or -1 with errno set
+ ****************************************************************************/
+ssize_t teeFill(int pipeFd, size_t len, char *scratch)
+{
+	ssize_t got = -1;
+	int err = 0;
+
+	do
+	{
+		got = splice(STDIN_NUM, NULL, pipeFd, NULL, len, SPLICE_F_MOVE);
+	} while (got == -1 && errno == EINTR);
+	if (got != -1 || errno != EINVAL)
+	{
+		return got;
+	}
+
+	do
+	{
+		got = read(STDIN_NUM, scratch, len < FD_READER_BUFSIZE ? len : FD_READER_BUFSIZE);
+	} while (got == -1 && errno == EINTR);
+	if (got > 0 && (err = writeAll(pipeFd, scratch, got)) != 0)
+	{
+		errno = err;
+		return -1;
+	}
+	return got;
+}
+
+/*****************************************************************************
+ * Description: Splices all of a chunk from a pipe to a sink. If the sink
+ * 				fails it is marked so, and what is left of the chunk is
+ * 				drained so the pipe is empty for the next one.
+ * Parameters: from = the read end of the pipe holding the chunk
+ * 			   sink = where it goes
+ * 			   len = the size of the chunk
+ * 			   command = the name to report errors under
+ * Returns: None
+ ****************************************************************************/
+void teeSplice(int from, TeeSink *sink, size_t len, const char *command)
+{
+	while (len > 0)
+	{
+		ssize_t moved = splice(from, NULL, sink->fd, NULL, len, SPLICE_F_MOVE);
+		if (moved == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (moved <= 0)
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", command, sink->name, strerror(moved ? errno : EIO));
+			sink->failed = true;
+			teeDrain(from, len);
+			return;
+		}
+		len -= moved;
+	}
+}
+
+/*****************************************************************************
+ * Description: Reads and discards bytes from a pipe
+ * Parameters: fd = the read end
+ * 			   len = how many
+ * Returns: None
+ ****************************************************************************/
+void teeDrain(int fd, size_t len)
+{
+	char buf[4096];
+	int err = 0;
+
+	while (len > 0 && !err)
+	{
+		size_t got = readFull(fd, buf, len < sizeof(buf) ? len : sizeof(buf), &err);
+		if (got == 0)
+		{
+			break;
+		}
+		len -= got;
+	}
+}
+
+/*****************************************************************************
+ * Description: Reads a chunk out of a pipe into the next slot of the ring,
+ * 				once the slowest sink has written what was there, and wakes
+ * 				the sink threads. Sinks without a thread are written to here.
+ * Parameters: ring = the ring
+ * 			   from = the read end of the pipe holding the chunk
+ * 			   len = the size of the chunk
+ * 			   command = the name to report errors under
+ * Returns: None
+ ****************************************************************************/
+void teePublish(TeeRing *ring, int from, size_t len, const char *command)
+{
+	unsigned char *slot = NULL;
+	size_t got = 0;
+	int err = 0,
+		s = 0;
+
+	pthread_mutex_lock(&ring->lock);
+	while (ring->head - teeSlowest(ring) >= TEE_RING_SLOTS)
+	{
+		pthread_cond_wait(&ring->cond, &ring->lock);
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	// the slot is no sink's until head moves past it
+	slot = ring->buf + (ring->head % TEE_RING_SLOTS) * ring->slotSize;
+	got = readFull(from, slot, len, &err);
+
+	pthread_mutex_lock(&ring->lock);
+	ring->lens[ring->head % TEE_RING_SLOTS] = got;
+	ring->head++;
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+
+	for (s = 0; s < ring->numSinks; s++)
+	{
+		TeeSink *sink = &ring->sinks[s];
+		if (!sink->copy || sink->threaded || sink->failed)
+		{
+			continue;
+		}
+		if ((err = writeAll(sink->fd, slot, got)) != 0)
+		{
+			fprintf(stderr, "smallsh: %s: %s: %s\n", command, sink->name, strerror(err));
+			sink->failed = true;
+		}
+		sink->tail = ring->head;
+	}
+}
+
+/*****************************************************************************
+ * Description: Finds how far the slowest sink of the ring has got. Called
+ * 				with the ring locked.
+ * Parameters: ring = the ring
+ * Returns: The fewest chunks any sink still writing from it has written, or
+ * 			head if there are none
+ ****************************************************************************/
+uint64_t teeSlowest(TeeRing *ring)
+{
+	uint64_t slowest = ring->head;
+	int s = 0;
+
+	for (s = 0; s < ring->numSinks; s++)
+	{
+		if (ring->sinks[s].copy && !ring->sinks[s].failed && ring->sinks[s].tail < slowest)
+		{
+			slowest = ring->sinks[s].tail;
+		}
+	}
+	return slowest;
+}
+
+/*****************************************************************************
+ * Description: Writes the ring's chunks to one sink as they are put in,
+ * 				until the input ends or the sink fails
+ * Parameters: arg = the TeeSink
+ * Returns: NULL
+ ****************************************************************************/
+void* teeConsumer(void *arg)
+{
+	TeeSink *sink = arg;
+	TeeRing *ring = sink->ring;
+	int err = 0;
+
+	pthread_mutex_lock(&ring->lock);
+	while (true)
+	{
+		while (sink->tail == ring->head && !ring->done)
+		{
+			pthread_cond_wait(&ring->cond, &ring->lock);
+		}
+		if (sink->tail == ring->head)
+		{
+			break;
+		}
+		size_t slot = sink->tail % TEE_RING_SLOTS;
+		pthread_mutex_unlock(&ring->lock);
+
+		err = writeAll(sink->fd, ring->buf + slot * ring->slotSize, ring->lens[slot]);
+
+		pthread_mutex_lock(&ring->lock);
+		if (err)
+		{
+			fprintf(stderr, "smallsh: tee: %s: %s\n", sink->name, strerror(err));
+			sink->failed = true;
+		}
+		else
+		{
+			sink->tail++;
+		}
+		pthread_cond_broadcast(&ring->cond);
+		if (err)
+		{
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ring->lock);
+	return NULL;
+}
+
+/*****************************************************************************
+ * Description: Converts a size, a number that may be followed by a b, K, M
+ * 				or G suffix
+ * Parameters: value = the text
+ * 			   defaultUnit = the unit without a suffix, from 0 for bytes to
+ * 			   				 3 for G
+ * 			   size = receives the size in bytes
+ * Returns: false if the value is not a size
+ ****************************************************************************/
+bool parseSize(const char *value, int defaultUnit, unsigned long long *size)
+{
+	char *end = NULL;
+	unsigned long long count = strtoull(value, &end, 10);
+	const char *units = "bKMG",
+			   *unit = *end ? strchr(units, toupper((unsigned char)*end) == 'B' ? 'b' : toupper((unsigned char)*end)) : units + defaultUnit;
+
+	if (end == value || value[0] == '-' || !unit || !*unit || (*end && end[1]))
+	{
+		return false;
+	}
+	*size = count << (10 * (unit - units));
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Notes a SIGINT for a running builtin
+ * Parameters: signo = the signal
+ * Returns: None
+ ****************************************************************************/
+void catchBuiltinSIGINT(int signo)
+{
+	builtinInterrupted = 1;
+}
+
+/*****************************************************************************
+ * Description: Catches SIGINT, which the shell ignores, for a builtin that
+ * 				may block for long, so the user can stop it. There is no
+ * 				SA_RESTART, so a blocked write or poll returns to see it.
+ * Parameters: prev = receives the action to put back afterwards
+ * Returns: None
+ ****************************************************************************/
+void catchInterrupts(struct sigaction *prev)
+{
+	struct sigaction interrupt = {{ 0 }};
+
+	builtinInterrupted = 0;
+	interrupt.sa_handler = catchBuiltinSIGINT;
+	sigemptyset(&interrupt.sa_mask);
+	sigaction(SIGINT, &interrupt, prev);
+}
+
+/*****************************************************************************
+ * Description: Gets stdout ready for a generator builtin. The pipe it may be
+ * 				is grown to hold a whole block, and SIGINT, which the shell
+ * 				ignores, is caught so the user can stop a generator that
+ * 				has no end.
+ * Parameters: out = filled in
+ * 			   limit = the most bytes to write, 0 for no limit
+ * Returns: None
  ****************************************************************************/
-char* getUserCmd()
+void genStart(GenOutput *out, unsigned long long limit)
 {
-	char *lineEntered = NULL;
-	size_t bufferSize = 0;
-	int numCharsEntered = 0;
+	struct stat info;
 
-	while (true)
+	fflush(stdout);
+	out->fd = STDOUT_NUM;
+	out->isPipe = fstat(out->fd, &info) == 0 && S_ISFIFO(info.st_mode);
+	out->limit = limit;
+	out->written = 0;
+	out->err = 0;
+	if (out->isPipe)
 	{
-		// get line from user
-		numCharsEntered = getline(&lineEntered, &bufferSize, stdin);
-		if (numCharsEntered == -1)
-			clearerr(stdin);
+		fcntl(out->fd, F_SETPIPE_SZ, GEN_BLOCK_SIZE);
+	}
+	catchInterrupts(&out->prevInt);
+}
+
+/*****************************************************************************
+ * Description: Writes a block of a generator's output, cut short at its
+ * 				limit. A constant block, one that is never changed or freed
+ * 				while the pipe may still hold it, is vmspliced into a pipe
+ * 				so the pipe refers to its pages rather than a copy.
+ * Parameters: out = from genStart
+ * 			   data/len = the block
+ * 			   constant = true if the block stays as it is
+ * Returns: false once the generator should stop: the limit was reached,
+ * 			a write failed or the user hit ^C
+ ****************************************************************************/
+bool genEmit(GenOutput *out, const char *data, size_t len, bool constant)
+{
+	if (out->limit && len > out->limit - out->written)
+	{
+		len = out->limit - out->written;
+	}
+	while (len > 0 && !builtinInterrupted)
+	{
+		ssize_t wrote = -1;
+		if (constant && out->isPipe)
+		{
+			struct iovec iov = { (void *)data, len };
+			wrote = vmsplice(out->fd, &iov, 1, 0);
+			if (wrote == -1 && errno == EINVAL)
+			{
+				out->isPipe = false;
+				continue;
+			}
+		}
 		else
-			break;  // loop control - exits when we have input
+		{
+			wrote = write(out->fd, data, len);
+		}
+		if (wrote == -1)
+		{
+			if (errno != EINTR)
+			{
+				out->err = errno;
+				return false;
+			}
+			continue;
+		}
+		data += wrote;
+		len -= wrote;
+		out->written += wrote;
+	}
+	return !builtinInterrupted && (!out->limit || out->written < out->limit);
+}
+
+/*****************************************************************************
+ * Description: Puts SIGINT back after a generator builtin and reports why
+ * 				it stopped
+ * Parameters: out = from genStart
+ * 			   command = the name to report errors under
+ * Returns: 0, 1 if a write failed, 141 if the reader went away, or 130 if
+ * 			it was interrupted
+ ****************************************************************************/
+int genFinish(GenOutput *out, const char *command)
+{
+	sigaction(SIGINT, &out->prevInt, NULL);
+	// the reader went away: stop quietly, as SIGPIPE would have
+	if (out->err == EPIPE)
+	{
+		return 128 + SIGPIPE;
+	}
+	if (out->err)
+	{
+		fprintf(stderr, "smallsh: %s: %s\n", command, strerror(out->err));
+		return 1;
+	}
+	return builtinInterrupted ? 128 + SIGINT : 0;
+}
+
+/*****************************************************************************
+ * Description: Parses the options the generator builtins share
+ * Parameters: args/argCount = the command words
+ * 			   next = set to the first word after the options
+ * 			   limit = set by --size
+ * 			   seed = set by --seed, or NULL if the command takes none
+ * Returns: false on a usage error
+ ****************************************************************************/
+bool genOptions(char **args, int argCount, int *next, unsigned long long *limit, uint64_t *seed)
+{
+	int i = 1;
+
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1]; i++)
+	{
+		if (!strcmp(args[i], "--size") && i + 1 < argCount && parseSize(args[i + 1], 0, limit) && *limit > 0) { i++; }
+		else if (seed && !strcmp(args[i], "--seed") && i + 1 < argCount) { *seed = strtoull(args[++i], NULL, 0); }
+		else if (!strcmp(args[i], "--")) { i++; break; }
+		else { return false; }
+	}
+	*next = i;
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Steps the xoshiro256** generator
+ * Parameters: state = its four words
+ * Returns: The next 64 random bits
+ ****************************************************************************/
+uint64_t genNext(uint64_t *state)
+{
+	uint64_t mixed = state[1] * 5,
+			 result = ((mixed << 7) | (mixed >> 57)) * 9,
+			 shifted = state[1] << 17;
+
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+	state[2] ^= shifted;
+	state[3] = (state[3] << 45) | (state[3] >> 19);
+	return result;
+}
+
+/*****************************************************************************
+ * Description: seq - prints the integers from first to last, by incr, one
+ * 				per line or separated by -s. Numbers are formatted straight
+ * 				into a large block, which is written whole.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if a write failed, 130 if interrupted, or 2 on a usage
+ * 			error
+ ****************************************************************************/
+int seqBuiltin(char **args, int argCount)
+{
+	const char *sep = "\n";
+	long long values[3] = { 1, 1, 0 }; // first, incr, last
+	int numValues = 0,
+		i = 1,
+		v = 0;
+	GenOutput out;
+	char *block = NULL;
+	size_t used = 0,
+		   sepLen = 0;
+	bool first = true,
+		 more = true;
+
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1] && !isdigit((unsigned char)args[i][1]); i++)
+	{
+		if (!strcmp(args[i], "-s") && i + 1 < argCount) { sep = args[++i]; }
+		else
+		{
+			fprintf(stderr, "smallsh: %s: usage: %s [-s sep] [first [incr]] last\n", args[0], args[0]);
+			return 2;
+		}
+	}
+	numValues = argCount - i;
+	if (numValues < 1 || numValues > 3)
+	{
+		fprintf(stderr, "smallsh: %s: usage: %s [-s sep] [first [incr]] last\n", args[0], args[0]);
+		return 2;
+	}
+	for (v = 0; v < numValues; v++)
+	{
+		char *end = NULL;
+		// one value is last, two are first and last
+		int slot = numValues == 1 ? 2 : (numValues == 2 ? v * 2 : v);
+		errno = 0;
+		values[slot] = strtoll(args[i + v], &end, 10);
+		if (end == args[i + v] || *end || errno)
+		{
+			fprintf(stderr, "smallsh: %s: invalid integer: %s\n", args[0], args[i + v]);
+			return 2;
+		}
+	}
+	if (values[1] == 0)
+	{
+		fprintf(stderr, "smallsh: %s: invalid zero increment\n", args[0]);
+		return 2;
+	}
+
+	block = malloc(GEN_BLOCK_SIZE);
+	sepLen = strlen(sep);
+	genStart(&out, 0);
+	long long value = values[0];
+	char digits[24],
+		 *pos = NULL,
+		 *end = digits + sizeof(digits);
+	// counting up by one from 0 or more, the digits are carried in place
+	bool carry = value >= 0 && values[1] == 1;
+
+	while (more && (values[1] > 0 ? value <= values[2] : value >= values[2]))
+	{
+		if (!pos || !carry)
+		{
+			unsigned long long magnitude = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+			pos = end;
+			do
+			{
+				*--pos = '0' + magnitude % 10;
+				magnitude /= 10;
+			} while (magnitude);
+			if (value < 0)
+			{
+				*--pos = '-';
+			}
+		}
+
+		if (used + sepLen + (end - pos) + 1 > GEN_BLOCK_SIZE)
+		{
+			more = genEmit(&out, block, used, false);
+			used = 0;
+		}
+		// the separator goes between numbers, and a newline after the last
+		if (!first)
+		{
+			memcpy(block + used, sep, sepLen);
+			used += sepLen;
+		}
+		memcpy(block + used, pos, end - pos);
+		used += end - pos;
+		first = false;
+		if (__builtin_add_overflow(value, values[1], &value))
+		{
+			break;
+		}
+		if (carry)
+		{
+			char *digit = end - 1;
+			for (; digit >= pos && *digit == '9'; digit--)
+			{
+				*digit = '0';
+			}
+			if (digit < pos)
+			{
+				*--pos = '1';
+			}
+			else
+			{
+				(*digit)++;
+			}
+		}
+	}
+	if (more && !first)
+	{
+		block[used++] = '\n';
+		genEmit(&out, block, used, false);
+	}
+	free(block);
+	return genFinish(&out, args[0]);
+}
+
+/*****************************************************************************
+ * Description: yes - prints its arguments, or y, over and over until ^C, a
+ * 				failed write, or --size bytes. The line is repeated into a
+ * 				block once, and since the block never changes it is
+ * 				vmspliced when stdout is a pipe.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if a write failed, 130 if interrupted, or 2 on a usage
+ * 			error
+ ****************************************************************************/
+int yesBuiltin(char **args, int argCount)
+{
+	StrBuf line = { 0 };
+	unsigned long long limit = 0;
+	GenOutput out;
+	char *block = MAP_FAILED;
+	size_t size = 0,
+		   pos = 0;
+	int i = 1,
+		result = 0;
+
+	if (!genOptions(args, argCount, &i, &limit, NULL))
+	{
+		fprintf(stderr, "smallsh: %s: usage: %s [--size size] [string...]\n", args[0], args[0]);
+		return 2;
+	}
+	for (int first = i; i < argCount; i++)
+	{
+		if (i > first)
+		{
+			sbAppendChar(&line, ' ');
+		}
+		sbAppend(&line, args[i], strlen(args[i]));
+	}
+	if (!line.buf)
+	{
+		sbAppendChar(&line, 'y');
+	}
+	sbAppendChar(&line, '\n');
+
+	/* the pipe may still hold the block's pages after this returns, so it is
+	 * mapped rather than malloc'd: unmapping it leaves the pages to the pipe,
+	 * where freeing it would let them be reused */
+	size = line.len < GEN_BLOCK_SIZE ? GEN_BLOCK_SIZE / line.len * line.len : line.len;
+	block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (block == MAP_FAILED)
+	{
+		fprintf(stderr, "smallsh: %s: %s\n", args[0], strerror(errno));
+		free(line.buf);
+		return 1;
+	}
+	for (pos = 0; pos < size; pos += line.len)
+	{
+		memcpy(block + pos, line.buf, line.len);
+	}
+
+	genStart(&out, limit);
+	while (genEmit(&out, block, size, true))
+	{
+	}
+	result = genFinish(&out, args[0]);
+	munmap(block, size);
+	free(line.buf);
+	return result;
+}
+
+/*****************************************************************************
+ * Description: randbytes - writes random bytes; randlines - writes lines of
+ * 				1 to GEN_LINE_MAX letters, digits, _ and -, each cut from a
+ * 				random place in a block of random characters. Either runs
+ * 				until ^C, a failed write, or --size bytes, where the last
+ * 				line is cut short to end there. The output is from
+ * 				xoshiro256**, seeded by --seed or getrandom(2), so a seed
+ * 				gives the same output every time.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if a write failed, 130 if interrupted, or 2 on a usage
+ * 			error
+ ****************************************************************************/
+int randBuiltin(char **args, int argCount)
+{
+	static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-";
+	bool lines = !strcmp(args[0], "randlines");
+	unsigned long long limit = 0;
+	uint64_t seed = 0,
+			 state[4];
+	GenOutput out;
+	char *block = NULL,
+		 *pool = NULL;
+	size_t len = 0,
+		   k = 0;
+	int i = 1;
+
+	if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed))
+	{
+		seed = (uint64_t)time(NULL) ^ getpid();
+	}
+	if (!genOptions(args, argCount, &i, &limit, &seed) || i < argCount)
+	{
+		fprintf(stderr, "smallsh: %s: usage: %s [--size size] [--seed n]\n", args[0], args[0]);
+		return 2;
+	}
+	// splitmix64 spreads the seed over the state
+	for (i = 0; i < 4; i++)
+	{
+		uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		state[i] = z ^ (z >> 31);
+	}
+
+	block = malloc(GEN_BLOCK_SIZE);
+	// lines are cut from random places in a block of random characters made once
+	if (lines)
+	{
+		pool = malloc(GEN_BLOCK_SIZE + GEN_LINE_MAX);
+		for (len = 0; len < GEN_BLOCK_SIZE + GEN_LINE_MAX; len += sizeof(uint64_t))
+		{
+			uint64_t bits = genNext(state);
+			for (k = 0; k < sizeof(uint64_t); k++, bits >>= 8)
+			{
+				pool[len + k] = alphabet[bits & 63];
+			}
+		}
+	}
+	genStart(&out, limit);
+	do
+	{
+		len = 0;
+		if (!lines)
+		{
+			for (len = 0; len < GEN_BLOCK_SIZE; len += sizeof(uint64_t))
+			{
+				uint64_t bits = genNext(state);
+				memcpy(block + len, &bits, sizeof(bits));
+			}
+		}
+		else
+		{
+			while (len + GEN_LINE_MAX + 1 <= GEN_BLOCK_SIZE && (!limit || out.written + len < limit))
+			{
+				uint64_t bits = genNext(state);
+				size_t lineLen = 1 + (bits >> 32) % GEN_LINE_MAX;
+				if (limit && limit - out.written - len <= lineLen)
+				{
+					lineLen = limit - out.written - len - 1;
+				}
+				memcpy(block + len, pool + (uint32_t)bits % GEN_BLOCK_SIZE, lineLen);
+				len += lineLen;
+				block[len++] = '\n';
+			}
+		}
+	} while (genEmit(&out, block, len, false));
+	free(block);
+	free(pool);
+	return genFinish(&out, args[0]);
+}
+
+/*****************************************************************************
+ * Description: The event loop of the wait and sleep builtins. It polls a
+ * 				pidfd for each job waited on, the memory trigger and a
+ * 				timer, so jobs are reaped as they finish and stopped or
+ * 				resumed under memory pressure while the builtin blocks,
+ * 				rather than it sleeping in waitpid or nanosleep.
+ * Parameters: timerFd = a timerfd whose expiry ends the wait, or -1
+ * 			   pids/numPids = the jobs to poll, or NULL for all of them
+ * 			   step = reaps what is waited on, called on every wake up
+ * 			   ctx = passed to step
+ * Returns: true once step or the timer ends the wait, false on ^C
+ ****************************************************************************/
+bool waitEvents(int timerFd, const pid_t *pids, int numPids, WaitStepFn step, void *ctx)
+{
+	struct pollfd pfds[MAX_JOBS + 2];
+	int numFds = 0,
+		memIdx = -1,
+		firstPidfd = 0,
+		timeout = -1,
+		ready = 0,
+		i = 0;
+
+	while (!step(ctx))
+	{
+		numFds = 0;
+		memIdx = -1;
+		timeout = countStoppedJobs() ? MEM_RESUME_INTERVAL * 1000 : -1;
+		if (timerFd != -1)
+		{
+			pfds[numFds++] = (struct pollfd){ timerFd, POLLIN, 0 };
+		}
+		if (memTriggerFd != -1 && numJobs > 0)
+		{
+			memIdx = numFds;
+			pfds[numFds++] = (struct pollfd){ memTriggerFd, POLLPRI, 0 };
+		}
+		firstPidfd = numFds;
+		for (i = 0; i < (pids ? numPids : numJobs) && numFds < MAX_JOBS + 2; i++)
+		{
+			// jobs already reaped are done with
+			if (pids && !findJob(pids[i]))
+			{
+				continue;
+			}
+			int pidfd = syscall(SYS_pidfd_open, pids ? pids[i] : jobs[i].pid, 0);
+			if (pidfd != -1)
+			{
+				pfds[numFds++] = (struct pollfd){ pidfd, POLLIN, 0 };
+			}
+			// without pidfds, look again soon
+			else
+			{
+				timeout = 100;
+			}
+		}
+
+		ready = poll(pfds, numFds, timeout);
+		for (i = firstPidfd; i < numFds; i++)
+		{
+			close(pfds[i].fd);
+		}
+		if (builtinInterrupted)
+		{
+			return false;
+		}
+		if (ready > 0 && timerFd != -1 && (pfds[0].revents & POLLIN))
+		{
+			return true;
+		}
+		handleMemoryPressure(ready > 0 && memIdx != -1 && (pfds[memIdx].revents & POLLPRI));
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Converts a job id: %n for the nth job that jobs lists, %%
+ * 				or %+ for the newest, %- for the one before it, or a pid
+ * Parameters: command = the name to report errors under
+ * 			   id = the id
+ * 			   pid = receives the pid, which may be negative for a process
+ * 			   		 group
+ * Returns: false (after printing why) if it is not a job or pid
+ ****************************************************************************/
+bool jobIdPid(const char *command, const char *id, pid_t *pid)
+{
+	char *end = NULL;
+	long value = 0;
+	int idx = -1;
+
+	if (id[0] == '%')
+	{
+		if (!strcmp(id, "%") || !strcmp(id, "%%") || !strcmp(id, "%+")) { idx = numJobs - 1; }
+		else if (!strcmp(id, "%-")) { idx = numJobs - 2; }
+		else
+		{
+			value = strtol(id + 1, &end, 10);
+			idx = end != id + 1 && !*end ? value - 1 : -1;
+		}
+		if (idx < 0 || idx >= numJobs)
+		{
+			fprintf(stderr, "smallsh: %s: %s: no such job\n", command, id);
+			return false;
+		}
+		*pid = jobs[idx].pid;
+		return true;
+	}
+
+	value = strtol(id, &end, 10);
+	if (end == id || *end || value == 0)
+	{
+		fprintf(stderr, "smallsh: %s: %s: not a pid or valid job spec\n", command, id);
+		return false;
+	}
+	*pid = value;
+	return true;
+}
+
+/*****************************************************************************
+ * Description: Looks up a signal by number or name, with or without SIG
+ * Parameters: name = the number or name, any case
+ * Returns: The signal number, or -1 if there is no such signal
+ ****************************************************************************/
+int signalNumber(const char *name)
+{
+	char *end = NULL;
+	long value = strtol(name, &end, 10);
+	int sig = 0;
+
+	if (end != name && !*end)
+	{
+		return value >= 0 && value < NSIG ? value : -1;
+	}
+	if (!strncasecmp(name, "SIG", 3))
+	{
+		name += 3;
+	}
+	for (sig = 1; sig < NSIG; sig++)
+	{
+		const char *abbrev = sigabbrev_np(sig);
+		if (abbrev && !strcasecmp(name, abbrev))
+		{
+			return sig;
+		}
+	}
+	return -1;
+}
+
+/*****************************************************************************
+ * Description: kill [-s sig | -n num | -sig] id... - sends a signal
+ * 				(SIGTERM by default) to jobs and processes, or kill -l lists
+ * 				the signals. A process is signalled through a pidfd, so the
+ * 				signal can only reach the process the pid named when it was
+ * 				opened. A %job is signalled as its process group. A job sent
+ * 				SIGCONT is no longer counted as stopped for memory pressure.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if a process could not be signalled, or 2 on a usage error
+ ****************************************************************************/
+int killBuiltin(char **args, int argCount)
+{
+	int sig = SIGTERM,
+		result = 0,
+		i = 1;
+
+	if (argCount > 1 && !strcmp(args[1], "-l"))
+	{
+		for (sig = 1; sig < NSIG; sig++)
+		{
+			if (sigabbrev_np(sig))
+			{
+				printf("%2d) SIG%s\n", sig, sigabbrev_np(sig));
+			}
+		}
+		return 0;
+	}
+	if (i < argCount && args[i][0] == '-' && args[i][1])
+	{
+		if ((!strcmp(args[i], "-s") || !strcmp(args[i], "-n")) && i + 1 < argCount) { sig = signalNumber(args[++i]); }
+		else if (strcmp(args[i], "--")) { sig = signalNumber(args[i] + 1); }
+		i++;
+	}
+	if (sig == -1 || i == argCount)
+	{
+		fprintf(stderr, sig == -1 ? "smallsh: %s: invalid signal\n" : "smallsh: %s: usage: %s [-s sig | -n num | -sig] id...\n",
+				args[0], args[0]);
+		return 2;
+	}
+
+	for (; i < argCount; i++)
+	{
+		pid_t pid = 0;
+		int pidfd = -1,
+			sent = -1;
+		Job *job = NULL;
+
+		if (!jobIdPid(args[0], args[i], &pid))
+		{
+			result = 1;
+			continue;
+		}
+		// a job is signalled as its process group
+		if (args[i][0] == '%')
+		{
+			pid = -pid;
+		}
+		// process groups have no pidfd
+		if (pid > 0 && (pidfd = syscall(SYS_pidfd_open, pid, 0)) != -1)
+		{
+			sent = syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+			close(pidfd);
+		}
+		else if (pid < 0 || errno == ENOSYS)
+		{
+			sent = kill(pid, sig);
+		}
+		if (sent == -1)
+		{
+			fprintf(stderr, "smallsh: %s: (%d) - %s\n", args[0], (int)pid, strerror(errno));
+			result = 1;
+		}
+		else if (sig == SIGCONT && (job = findJob(pid < 0 ? -pid : pid)))
+		{
+			job->stopped = false;
+		}
+	}
+	return result;
+}
+
+/*****************************************************************************
+ * Description: Reaps the jobs a wait builtin is waiting for that have
+ * 				finished, and waits for their >z codecs
+ * Parameters: ctx = the WaitTargets
+ * Returns: true once all of them (or with -n, one) have finished
+ ****************************************************************************/
+bool waitStep(void *ctx)
+{
+	WaitTargets *targets = ctx;
+	int status = 0,
+		i = 0;
+
+	for (i = 0; i < targets->numPids; i++)
+	{
+		Job *job = findJob(targets->pids[i]);
+		pid_t reaped = 0;
+
+		if (targets->codes[i] != -1 || !job || (reaped = waitpid(job->pid, &status, WNOHANG)) == 0)
+		{
+			continue;
+		}
+		finishJob(job - jobs, reaped, status);
+		joinJobCodecs(targets->pids[i]);
+		targets->codes[i] = reaped > 0 ? exitCode(status) : 127;
+		targets->remaining--;
+		targets->last = i;
+		if (targets->any)
+		{
+			return true;
+		}
 	}
-	// get rid of newline at end
-	lineEntered[numCharsEntered - 1] = '\0';
-	return lineEntered;
+	return targets->remaining == 0;
 }
 
 /*****************************************************************************
- * Description: Prints a line and flushes afterward
- * Parameters: line = the line to print
- * Returns: None
+ * Description: wait [-n] [id...] - waits for the jobs given, or every job,
+ * 				and reaps them. With -n it returns as soon as one of them
+ * 				finishes. The jobs' pidfds are polled in the same loop as
+ * 				the memory trigger, so the jobs left running are still
+ * 				managed, and ^C stops the wait.
+ * Parameters: args/argCount = the command words
+ * Returns: The exit code of the last id given, or with -n of the job that
+ * 			finished; 0 with no ids; 127 if an id is not a job of this
+ * 			shell, or -n has no jobs to wait for; 130 if interrupted; 2 on a
+ * 			usage error
  ****************************************************************************/
-void printAndFlush(char *line)
+int waitBuiltin(char **args, int argCount)
 {
-	printf("%s", line);
-	fflush(stdout);
-}
+	WaitTargets targets = { 0 };
+	struct sigaction prevInt;
+	int result = 0,
+		i = 1,
+		first = 0;
+	bool finished = false;
 
-void parseUserCmd(char *userline, char **args, int *argCount, char **input, char **output, bool *backgroundFlag)
-{
-	char *saveptr;
-	char* piece = strtok_r(userline, " ", &saveptr);
-	int idx = 0;
-	int parentPid = getpid();
-	/* capture the command the user typed in and advance the token
-	 * do this out of the while loop b/c a command should always be a single string
-	 * and is not optional */
-	if (piece != NULL)
+	for (i = 1; i < argCount && args[i][0] == '-' && args[i][1] && args[i][1] != '-'; i++)
+	{
+		if (!strcmp(args[i], "-n")) { targets.any = true; }
+		else
+		{
+			fprintf(stderr, "smallsh: %s: usage: %s [-n] [id...]\n", args[0], args[0]);
+			return 2;
+		}
+	}
+	if (i < argCount && !strcmp(args[i], "--"))
 	{
-		strcpy(args[0], piece);
-		piece = strtok_r(NULL, " ", &saveptr);
-		idx++;
+		i++;
 	}
 
-	// the while loop captures all the optional items
-	while (piece)
+	first = i;
+	targets.pids = malloc((i < argCount ? argCount - i : numJobs + 1) * sizeof(pid_t));
+	targets.codes = malloc((i < argCount ? argCount - i : numJobs + 1) * sizeof(int));
+	if (i == argCount)
 	{
-		if (!strcmp(piece, "<")) // there is an input redirect
+		for (targets.numPids = 0; targets.numPids < numJobs; targets.numPids++)
 		{
-			piece = strtok_r(NULL, " ", &saveptr);
-			char *tempStr = malloc(512);
-			strcpy(tempStr, piece);
-			*input = tempStr;
+			targets.pids[targets.numPids] = jobs[targets.numPids].pid;
+			targets.codes[targets.numPids] = -1;
 		}
-		else if (!strcmp(piece, ">")) // there is an output redirect
-		{
-			piece = strtok_r(NULL, " ", &saveptr);
-			char *tempStr = malloc(512);
-			strcpy(tempStr, piece);
-			*output = tempStr;
-		}
-		else if (!strcmp(piece, "&")) // this piece is our background flag
+		targets.remaining = numJobs;
+	}
+	for (; i < argCount; i++)
+	{
+		pid_t pid = 0;
+		bool isJob = jobIdPid(args[0], args[i], &pid) && findJob(pid);
+
+		if (!isJob && pid != 0)
 		{
-			*backgroundFlag = true;
+			fprintf(stderr, "smallsh: %s: pid %d is not a child of this shell\n", args[0], (int)pid);
 		}
-		else // this piece is an argument
-		{
-			char *expanded = NULL;
+		targets.pids[targets.numPids] = pid;
+		// one that can't be waited for is already done, with 127
+		targets.codes[targets.numPids] = isJob ? -1 : 127;
+		targets.remaining += isJob;
+		targets.numPids++;
+	}
+	targets.last = -1;
 
-			int i = 0;
-			for (i = 0; i < strlen(piece); i++)
-			{
-				if (piece[i] == '$')
-				{
-					if ( (i + 1) < strlen(piece) && piece[i + 1] == '$')
-					{
-						// expand pid
-						piece[i] = '\0';
-						expanded = malloc(MAX_LINE_LENGTH);
-						sprintf(expanded, "%s%d", piece, parentPid);			
-						break;
-					}
-				}
-			}
-			if (expanded)
-			{
-				strcpy(args[idx], expanded);
-			}
-			else
-			{
-				strcpy(args[idx], piece);
-			}
-			idx++;
-		}
-	
-		// advance the token
-		piece = strtok_r(NULL, " ", &saveptr);
+	finished = true;
+	if (targets.remaining > 0)
+	{
+		fflush(stdout);
+		catchInterrupts(&prevInt);
+		finished = waitEvents(-1, targets.pids, targets.numPids, waitStep, &targets);
+		sigaction(SIGINT, &prevInt, NULL);
 	}
-	*argCount = idx;
-	/* free and set the next available slot to NULL so we can pass the 
-	 * arg array to execvp */
-	free(args[idx]);
-	args[idx] = NULL;
-}
 
-/*****************************************************************************
- * Description: Changes the CWD to the directory specified by filepath.
- * Parameters: filepath = the location of the directory to switch to
- * Returns: None
- ****************************************************************************/
-void changeDirectory(char *filepath)
-{
-	int failure = 0;
-	// check for empty argument
-	if (!filepath)
+	if (!finished)
 	{
-		failure = chdir(getenv("HOME"));
-	}			
-	// relative filepath
+		result = 128 + SIGINT;
+	}
+	else if (targets.any)
+	{
+		result = targets.last != -1 ? targets.codes[targets.last] : 127;
+	}
 	else
 	{
-		failure = chdir(filepath);
+		result = first < argCount ? targets.codes[targets.numPids - 1] : 0;
 	}
-
-	if (failure)
+	// every job is done, so all the background codecs will finish
+	if (finished && first == argCount && !targets.any)
 	{
-		printf("Error with chdir: %d\n", failure);
-		fflush(stdout);
+		reapCodecs(true);
 	}
+	free(targets.pids);
+	free(targets.codes);
+	return result;
+}
 
+/*****************************************************************************
+ * Description: Reaps and reports any background jobs that finished while a
+ * 				sleep builtin waits
+ * Parameters: ctx = unused
+ * Returns: false, since only the timer ends a sleep
+ ****************************************************************************/
+bool sleepStep(void *ctx)
+{
+	(void)ctx;
+	reapJobs();
+	return false;
 }
 
 /*****************************************************************************
- * Description: Terminates the parent process and all child processes
- * Parameters: None
- * Returns: None
+ * Description: sleep number[smhd]... - waits for the total of its arguments,
+ * 				which may have fractions, on a timerfd polled along with the
+ * 				background jobs' pidfds and the memory trigger: jobs are
+ * 				reaped as they finish, memory pressure is still handled, and
+ * 				^C ends the sleep. Scripts that poll in a loop don't start a
+ * 				process each time round.
+ * Parameters: args/argCount = the command words
+ * Returns: 0, 1 if the timer could not be set, 130 if interrupted, or 2 on
+ * 			a usage error
  ****************************************************************************/
-void terminatePidGroup(int bgProcs[], int numBgProcs)
+int sleepBuiltin(char **args, int argCount)
 {
-	int exitMethod = -5;
+	struct itimerspec timer = {{ 0 }};
+	struct sigaction prevInt;
+	double seconds = 0;
+	int timerFd = -1,
+		i = 0;
+	bool finished = false;
 
-	int i = 0;
-	for (i = 0; i < numBgProcs; i++)
+	if (argCount < 2)
 	{
-		kill(bgProcs[i], SIGTERM);
-		waitpid(bgProcs[i], &exitMethod, 0);
+		fprintf(stderr, "smallsh: %s: usage: %s number[smhd]...\n", args[0], args[0]);
+		return 2;
 	}
+	for (i = 1; i < argCount; i++)
+	{
+		char *end = NULL;
+		double value = strtod(args[i], &end);
+		const char *units = "smhd",
+				   *unit = *end ? strchr(units, *end) : units;
+		static const double scale[] = { 1, 60, 3600, 86400 };
 
-	exit(0);
-}
+		if (end == args[i] || !unit || !*unit || (*end && end[1]) || value < 0 || value != value)
+		{
+			fprintf(stderr, "smallsh: %s: invalid time interval `%s'\n", args[0], args[i]);
+			return 2;
+		}
+		seconds += value * scale[unit - units];
+	}
+	if (seconds <= 0)
+	{
+		return 0;
+	}
+	// beyond what a timer can hold (as sleep inf asks), 68 years will do
+	if (seconds > (double)INT_MAX)
+	{
+		seconds = (double)INT_MAX;
+	}
 
-/*****************************************************************************
- * Description: Prints exit status to CLI. If exited normally, prints the 
- * 				exit status code. If signaled, prints the signal code
- * Parameters: the int status code to interpret
- * Returns: None
- ****************************************************************************/
-void reportExitStatus(int exitMethod)
-{
-	if (WIFEXITED(exitMethod))
+	timer.it_value.tv_sec = (time_t)seconds;
+	timer.it_value.tv_nsec = (long)((seconds - (double)timer.it_value.tv_sec) * 1e9);
+	if (timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0)
 	{
-		int exitStatus = WEXITSTATUS(exitMethod);
-		printf("Exit Status: %d\n", exitStatus);
-		fflush(stdout);
+		timer.it_value.tv_nsec = 1;
 	}
-	else if (WIFSIGNALED(exitMethod))
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timerFd == -1 || timerfd_settime(timerFd, 0, &timer, NULL) == -1)
 	{
-		int termSignal = WTERMSIG(exitMethod);
-		if (termSignal != 123)
+		fprintf(stderr, "smallsh: %s: %s\n", args[0], strerror(errno));
+		if (timerFd != -1)
 		{
-			printf("Terminating Signal: %d\n", termSignal);
-			fflush(stdout);
+			close(timerFd);
 		}
+		return 1;
 	}
+
+	fflush(stdout);
+	catchInterrupts(&prevInt);
+	finished = waitEvents(timerFd, NULL, 0, sleepStep, NULL);
+	sigaction(SIGINT, &prevInt, NULL);
+	close(timerFd);
+	return finished ? 0 : 128 + SIGINT;
 }
 
 /*****************************************************************************
- * Description: Executes a command, searching PATH for command. 
- * 				Source: Class Lecture
- * Parameters: An array of arguments/the command to execute
+ * Description: Runs a builtin given with & in a forked child, which is
+ * 				admitted and tracked as a background job, like a command.
+ * 				What the builtin changes stays in the child, as with a
+ * 				backgrounded subshell.
+ * Parameters: builtin = the builtin to run
+ * 			   args/argCount = the command words
+ * 			   newStdin/newStdout = the redirect filenames, may be NULL;
+ * 			   						<z and >z replace them with the codec's
+ * 			   compressed = which redirects were <z and >z
  * Returns: None
  ****************************************************************************/
-void execute(char **args)
+void runBuiltinJob(const Builtin *builtin, char **args, int argCount, char **newStdin, char **newStdout, bool *compressed)
 {
-	if (execvp(args[CMD_NAME], args))
+	CodecStream *codecs[2] = { NULL, NULL };
+	Job job = { .token = JOB_TOKEN_NONE, .slot = -1, .policy = POLICY_NONE };
+
+	if (jobTableFull())
 	{
-		perror("Exec Failure!!!\n");
-		exit(1);
+		childExitMethod = W_EXITCODE(1, 0);
+		return;
+	}
+	job = admitJob();
+	if (!startCodecs(newStdin, newStdout, compressed, codecs))
+	{
+		retireJob(&job);
+		childExitMethod = W_EXITCODE(1, 0);
+		return;
 	}
-}
-
-/*****************************************************************************
- * Description: Opens a file to have stdin redirected to it. Opens as read-only
- * 				Source: Class Lecture
- * Parameters: inpfile = the filename to be opened
- * Returns: int representing the open file descriptor
- ****************************************************************************/
-int openInpFile(char *inpfile)
-{
-	// create file descriptor to redirect stdin
-	int inputFD = open(inpfile, O_RDONLY);
-	if (inputFD == -1) { perror("Input file could not be opened"); exit(1); }
 
-	return inputFD;
+	fflush(stdout);
+	pid_t forkPid = fork();
+	switch (forkPid)
+	{
+		case -1: { perror("Fork failure, get a spoon.\n"); exit(-2); break; }
+		case 0:
+		{
+			redirectStdIO(*newStdin, *newStdout, true);
+			dropCodecs(codecs);
+			setpgid(0, 0);
+			sigaction(SIGTSTP, &ignore_action, NULL);
+			savedStdin = saveFd(STDIN_NUM);
+			savedStdout = saveFd(STDOUT_NUM);
+			// the parent's jobs are not the builtin's to wait on or kill
+			numJobs = 0;
+			jobsOwner = getpid();
+			exitShell(builtin->fn(args, argCount));
+		}
+		default:
+		{
+			trackBackground(forkPid, &job);
+			// the codecs are joined when reapJobs sees the job finish
+			finishCodecs(codecs, forkPid);
+		}
+	}
 }
 
 /*****************************************************************************
- * Description: Redirects stdin to a provided file descriptor number. Exits
- * 				if redirection fails.
- * 				Source: Class Lecture
- * Parameters: FDNum = the file descriptor to be redirected to
- * Returns: None
+ * Description: Ends the shell, or a forked child of it that ran shell code
+ * 				rather than an exec. exit() would seek the script's fd, which
+ * 				a child shares with its parent, back to where the child's
+ * 				copy of the stream had read to, so the parent would run those
+ * 				lines again. This does what the shell's exit needs -
+ * 				abandonJobs and flushing stdout - and leaves with _exit.
+ * Parameters: code = the exit status
+ * Returns: Does not return
  ****************************************************************************/
-void redirectStdin(int FDNum)
+void exitShell(int code)
 {
-	int inResult = 0;
-	// redirect stdin
-	inResult = dup2(FDNum, STDIN_NUM);
-	if (inResult == -1) { perror("Input redirection failed.\n"); exit(1); }
+	abandonJobs();
+	fflush(stdout);
+	_exit(code);
 }
 
 /*****************************************************************************
- * Description: Opens a file to have stdout redirected to it. Opens for writing,
- * 				for truncating, and creating. Exits if file open fails
- * 				Source: Class Lecture
- * Parameters: outfile = the filename to be opened
- * Returns: int representing the open file descriptor
+ * Description: Sends a signal to every process in a job's process group.
+ * 				The lead pid alone is signalled if the group is not there,
+ * 				for a child that exited before joining it.
+ * Parameters: job = the job
+ * 			   sig = the signal
+ * Returns: 0 on success, or -1 with errno set
  ****************************************************************************/
-int openOutFile(char *outfile)
+int signalJob(const Job *job, int sig)
 {
-	// create file descriptor to redirect stdin
-	int outputFD = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (outputFD == -1) { perror("Output file could not be opened"); exit(1); }
-
-	return outputFD;
+	if (kill(-job->pid, sig) == 0)
+	{
+		return 0;
+	}
+	return errno == ESRCH ? kill(job->pid, sig) : -1;
 }
 
 /*****************************************************************************
- * Description: Redirects stdout to a provided file descriptor number. Exits
- * 				if redirection fails.
- * 				Source: Class Lecture
- * Parameters: FDNum = the file descriptor to be redirected to
- * Returns: None
+ * Description: Looks through the options of a printf command for -v. An
+ * 				option word that is quoted or expanded can't be known
+ * 				before it runs, so it counts as -v.
+ * Parameters: p = the text after the word printf
+ * Returns: true if the printf may assign a variable
  ****************************************************************************/
-void redirectStdout(int FDNum)
+bool printfSetsVar(const char *p)
 {
-	// redirect stdout
-	int outResult = 0;
-		
-	// redirect stdout
-	outResult = dup2(FDNum, STDOUT_NUM);
-	if (outResult == -1) { perror("Output redirection failed.\n"); exit(1); }
+	while (true)
+	{
+		while (*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+		size_t len = strcspn(p, " \t;&|(){}");
+		if (len == 0)
+		{
+			return false;
+		}
+		if (strchr("\"'$`\\", *p))
+		{
+			return true;
+		}
+		// options end at the first word that isn't one, or after --
+		if (*p != '-' || len == 1 || (len == 2 && p[1] == '-'))
+		{
+			return false;
+		}
+		if (p[1] == 'v')
+		{
+			return true;
+		}
+		p += len;
+	}
 }
 
 /*****************************************************************************
- * Description: Toggle global variable
- *
- * Parameters: signo = the parameter for passing which signal caused the 
- * 					   handler to start
- * Returns: None
+ * Description: Checks a JSON value that is not a string, object or array:
+ * 				true, false, null or a number
+ * Parameters: pos/end = the value's text
+ * Returns: true if it is one of those
  ****************************************************************************/
-void catchSIGTSTP(int signo)
+bool jsonScalarValid(const char *pos, const char *end)
 {
-	int exitMeth = -5;
-	//if (fgPidForSignal != -5)
+	size_t len = end - pos;
+	const char *digits = NULL;
+
+	if ((len == 4 && (!memcmp(pos, "true", 4) || !memcmp(pos, "null", 4))) || (len == 5 && !memcmp(pos, "false", 5)))
 	{
-		waitpid(fgPidForSignal, &exitMeth, 0);
+		return true;
 	}
-	if (!foregroundOnly)
+	// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+	if (pos < end && *pos == '-')
 	{
-		foregroundOnly = true;
-		char *msg = "\nEntering foreground only mode. (& is now ignored)\n:";
-		if (fgPidForSignal != -5)
+		pos++;
+	}
+	if (pos < end && *pos == '0')
+	{
+		pos++;
+	}
+	else
+	{
+		for (digits = pos; pos < end && isdigit((unsigned char)*pos); pos++) { }
+		if (pos == digits)
 		{
-			write(STDOUT_FILENO, msg, 51);
+			return false;
 		}
-		else
+	}
+	if (pos < end && *pos == '.')
+	{
+		for (digits = ++pos; pos < end && isdigit((unsigned char)*pos); pos++) { }
+		if (pos == digits)
 		{
-			write(STDOUT_FILENO, msg, 52);
+			return false;
 		}
-						
 	}
-	else
+	if (pos < end && (*pos == 'e' || *pos == 'E'))
 	{
-		foregroundOnly = false;
-		char *msg = "\nExiting foreground only mode.\n:";
-		if (fgPidForSignal != -5)
+		pos++;
+		if (pos < end && (*pos == '+' || *pos == '-'))
 		{
-			write(STDOUT_FILENO, msg, 31);
+			pos++;
 		}
-		else
+		for (digits = pos; pos < end && isdigit((unsigned char)*pos); pos++) { }
+		if (pos == digits)
 		{
-			write(STDOUT_FILENO, msg, 32);
+			return false;
 		}
 	}
-
+	return pos == end;
 }
 
 /*****************************************************************************
- * Description: Handles redirection of stdin and stdout based on the status of
- * 				'newStdin', 'newStdout', and bgFlag. Redirects stdin and stdout
- * 				to 'newStdin' and 'newStdout', respectively. If the process is
- * 				a background process, redirects to dev/null if 'newStdin' and
- * 				'newStdout' are NULL. 
- * Parameters: newStdin = the filename of the file to redirect stdin to
- * 			   newStdout = the filename of the file to redirect stdout to
- * 			   bgFlag = a boolean flag - 1 = backgroung process 0 = foreground
- * Returns: None
+ * Description: Checks that a line holds one JSON value and nothing else.
+ * 				Like the rest of jget this looks at structure only: a
+ * 				string, or brackets and braces that balance, or a valid
+ * 				scalar, followed by nothing but whitespace.
+ * Parameters: pos/end = the line
+ * Returns: true if the line is a JSON value
  ****************************************************************************/
-void redirectStdIO(char *newStdin, char *newStdout, bool bgFlag)
+bool jsonLineValid(const char *pos, const char *end)
 {
-	// redirect stdin
-	if (newStdin != NULL)
+	const char *start = jsonSkipSpace(pos, end),
+			   *valueEnd = jsonSkipValue(start, end);
+
+	if (!valueEnd || valueEnd == start)
 	{
-		// create file descriptor to redirect stdin
-		int inputFD = openInpFile(newStdin);
-		// redirect stdin
-		redirectStdin(inputFD);
+		return false;
 	}
-	else if (bgFlag)
+	if (*start != '"' && *start != '{' && *start != '[' && !jsonScalarValid(start, valueEnd))
 	{
-		// redirect to dev null
-		int devNull = open("/dev/null", O_RDONLY);
-		redirectStdin(devNull);
+		return false;
 	}
+	return jsonSkipSpace(valueEnd, end) == end;
+}
 
-	// redirect stdout
-	if (newStdout != NULL)
+/*****************************************************************************
+ * Description: Prints a field of tab separated output, escaping tabs,
+ * 				newlines, carriage returns and backslashes with a backslash
+ * Parameters: text/len = the field
+ * Returns: None
+ ****************************************************************************/
+void printTsvField(const char *text, size_t len)
+{
+	size_t i = 0,
+		   start = 0;
+
+	for (i = 0; i < len; i++)
 	{
-		// create file descriptor to redirect stdin
-		int outputFD = openOutFile(newStdout);
-		// redirect stdout
-		redirectStdout(outputFD);
+		const char *escaped = text[i] == '\t' ? "\\t" : text[i] == '\n' ? "\\n" :
+							  text[i] == '\r' ? "\\r" : text[i] == '\\' ? "\\\\" : NULL;
+		if (escaped)
+		{
+			fwrite(text + start, 1, i - start, stdout);
+			fputs(escaped, stdout);
+			start = i + 1;
+		}
 	}
-	else if (bgFlag)
+	fwrite(text + start, 1, len - start, stdout);
+}
+
+/*****************************************************************************
+ * Description: Parses an option's count, fd or index: a whole number of
+ * 				decimal digits, with nothing after it
+ * Parameters: text = the option's value
+ * 			   value = receives the number
+ * Returns: false if it is not a number or does not fit in a long
+ ****************************************************************************/
+bool parseCount(const char *text, long *value)
+{
+	char *end = NULL;
+
+	if (!isdigit((unsigned char)text[0]))
 	{
-		// redirect to dev null
-		int devNull = open("/dev/null", O_WRONLY);
-		redirectStdout(devNull);
+		return false;
 	}
+	errno = 0;
+	*value = strtol(text, &end, 10);
+	return !*end && errno != ERANGE;
 }
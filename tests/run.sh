@@ -0,0 +1,398 @@
+#!/bin/sh
+# Runs each case through ./smallsh, with -c or from a script file, and
+# compares its output with what is expected. Usage: tests/run.sh [path to smallsh]
+
+SMALLSH=${1:-./smallsh}
+failed=0
+total=0
+T=$(mktemp -d)
+export T
+trap 'rm -rf "$T"' EXIT
+
+# compare name script expected actual
+compare()
+{
+	total=$((total + 1))
+	if [ "$4" != "$3" ]; then
+		failed=$((failed + 1))
+		printf 'FAIL: %s\n  script:   %s\n  expected: %s\n  actual:   %s\n' "$1" "$2" "$3" "$4"
+	fi
+}
+
+# check name script expected
+check()
+{
+	compare "$1" "$2" "$3" "$("$SMALLSH" -c "$2" 2>&1)"
+}
+
+# checkScript name script expected - the same, run from a script file
+checkScript()
+{
+	printf '%s\n' "$2" > "$T/script"
+	compare "$1" "$2" "$3" "$("$SMALLSH" "$T/script" 2>&1)"
+}
+
+# quoted parts of ${v#pat} ${v%pat} ${v/pat/rep} patterns match literally
+check 'quoted suffix' 'v=abc; echo ${v%"c"} ${v%'"'c'"'}' 'ab ab'
+check 'quoted star prefix' 'v="a*bc"; echo ${v#"a*"} ${v#a*}' 'bc *bc'
+check 'partly quoted prefix' 'v="a*bc"; echo ${v#'"'a'"'*} [${v##"a"*}]' '*bc []'
+check 'quoted replace' 'v="a*bc"; echo ${v/"*b"/X} ${v/*b/X}' 'aXc Xc'
+check 'quoted slash' 'v=a/b; echo ${v/"a/"/X} ${v/'"'/'"'/-}' 'Xb a-b'
+check 'quoted expansion' 's="*"; v="a*bc"; echo ${v#$s} ${v#"$s"} ${v#a"$s"}' 'a*bc a*bc bc'
+
+# empty patterns anchored with # or % match at the start or the end
+check 'empty leading pattern' 'v=abc; echo ${v/#/X} ${v/#a/X} ${v/#b/X}' 'Xabc Xbc abc'
+check 'empty trailing pattern' 'v=abc; echo ${v/%/X} ${v/%c/X}' 'abcX abX'
+check 'empty anchored array' 'a=(one two); echo ${a[@]/#/pre-} ${a[@]/%/-post}' 'pre-one pre-two one-post two-post'
+check 'empty anchored empty value' 'e=; echo [${e/#/X}] [${e/%/X}] [${e//}]' '[X] [X] []'
+
+# subshells that wait on, signal or re-prioritize jobs fork
+check 'subshell wait forks' '{ /bin/sleep 5 & } > /dev/null; ( wait ); kill %1 && echo still running' 'still running'
+check 'subshell bgpolicy forks' '( bgpolicy idle ); bgpolicy' 'default batch, jobs not demoted'
+
+# read notices a file rewritten since its last read
+printf '1\nY\n' > "$T/f"
+check 'read after rewrite' '{ read a; /bin/sh -c "printf \"1\nZ\n\" > $T/f"; read b; echo $a $b; } < $T/f' '1 Z'
+
+# cols reports input that ends inside a quoted field, and still prints it
+printf 'a,b\n1,"x\n2,y\n' > "$T/open.csv"
+check 'cols unterminated quote' 'cols -f 2 $T/open.csv; echo $?' 'b
+"x
+2,y
+smallsh: cols: unterminated quote at end of input
+1'
+check 'cols unterminated quote on stdin' 'cols -h -f b < $T/open.csv; echo $?' 'b
+"x
+2,y
+smallsh: cols: unterminated quote at end of input
+1'
+
+# quoted parts of [[ == ]] and [[ =~ ]] patterns match literally
+check '[[ == ]] quoted pattern' '[[ abc == "a*" ]]; echo $?; [[ "a*" == "a*" ]]; echo $?' '1
+0'
+check '[[ == ]] unquoted pattern' '[[ abc == a* ]]; echo $?; [[ abc == '"'a'"'* ]]; echo $?; [[ abc == a\* ]]; echo $?' '0
+0
+1'
+check '[[ == ]] quoted expansion' 'p="a*"; [[ abc == $p ]]; echo $?; [[ abc == "$p" ]]; echo $?' '0
+1'
+check '[[ =~ ]] quoted regex' '[[ abc =~ "a.c" ]]; echo $?; [[ a.c =~ "a.c" ]]; echo $?' '1
+0'
+check '[[ =~ ]] partly quoted regex' '[[ abc =~ ^"a"(b)c$ ]]; echo $? ${BASH_REMATCH[1]}' '0 b'
+
+# a builtin whose reader goes away ends with 141, and the shell carries on
+mkfifo "$T/fifo"
+check 'generator reader exits' '{ head -c 10 $T/fifo > /dev/null & } > /dev/null; yes > $T/fifo; echo $?; echo after' '141
+after'
+check 'printf reader exits' '{ head -c 10 $T/fifo > /dev/null & } > /dev/null; printf "%0900000d\n" 1 > $T/fifo; echo $?' '141'
+
+# builtins given & run as background jobs instead of blocking the shell
+check 'background builtin' '{ sleep 5 & } > /dev/null; kill %1 && echo not blocked' 'not blocked'
+check 'background builtin output' '{ seq 1 3 > $T/seq & } > /dev/null; wait > /dev/null; /bin/cat $T/seq' '1
+2
+3'
+check 'background builtin state' '{ x=1; read x < /dev/null & } > /dev/null; wait > /dev/null; echo $x' '1'
+
+# children that run shell code leave the script's offset alone
+checkScript 'subshell exit in a script' '( exit 3 )
+echo $?
+echo end' '3
+end'
+checkScript 'background subshell in a script' '{ ( cd / ) & } > /dev/null
+wait > /dev/null
+echo end' 'end'
+
+# array subscripts are bounded rather than allocated
+check 'huge subscript' 'a[99999999999]=1; echo $?; a[2]=x; echo ${a[2]} ${#a[@]}' 'smallsh: a[99999999999]: array subscript too large
+1
+x 1'
+check 'huge mapfile origin' 'mapfile -O 99999999999 m < /dev/null; echo $?; seq 1 2 > $T/m; mapfile -O 99999999999 m < $T/m; echo $?' '0
+smallsh: mapfile: m: array subscript too large
+1'
+
+# a word or argument list over the limits fails the command, not cuts it
+check 'argument too long' 'printf -v v "%02047d" 1; echo ${#v} $v > /dev/null; echo $?; printf -v v "%02048d" 1; echo $v; echo $?' '0
+smallsh: 00000000000000000000...: argument too long (over 2047 bytes)
+1'
+check 'too many arguments' 'seq 1 510 > $T/args; mapfile -t a < $T/args; echo ${a[@]} > /dev/null; echo $?; a[510]=511; echo ${a[@]}; echo $?' '0
+smallsh: echo: too many arguments (over 511)
+1'
+
+# an assignment value takes ${a[@]} joined, and declare -p reads back in
+check 'array joined in assignment' 'a=(x y z); v="${a[@]}"; w=${a[@]}; echo "[$v] [$w]"' '[x y z] [x y z]'
+check 'declare -p quoting' 'b=('"'"'q"t'"'"' '"'"'d$x'"'"' '"'"'b\k'"'"'); declare -p b' 'declare -a b=([0]="q\"t" [1]="d\$x" [2]="b\\k" )'
+check 'declare -p round trip' 'declare -a b=('"'"'q"t'"'"' '"'"'d$x'"'"' '"'"'b\k'"'"' "s p" '"'"'c`d'"'"'); declare -A m=(["k y"]=1 [z]='"'"'a"b'"'"'); s='"'"'a"$`\b'"'"'; declare -p b m s > $T/declared; echo ${m[k y]}' '1'
+{ cat "$T/declared"; echo 'declare -p b m s'; } > "$T/readback"
+compare 'declare -p read back' "$(cat "$T/declared")" "$(cat "$T/declared")" "$("$SMALLSH" "$T/readback" 2>&1)"
+
+# a $PATH directory made after the shell started, or made again, is searched
+late='latecmd; mkdir $T/late; printf "#!/bin/sh\necho late\n" > $T/late/latecmd; chmod +x $T/late/latecmd; latecmd; rm -r $T/late; latecmd; mkdir $T/late; printf "#!/bin/sh\necho again\n" > $T/late/latecmd; chmod +x $T/late/latecmd; latecmd'
+compare 'late $PATH directory' "$late" 'smallsh: latecmd: command not found
+late
+smallsh: latecmd: command not found
+again' "$(PATH="$T/late:$PATH" "$SMALLSH" -c "$late" 2>&1)"
+
+# a background job is its own process group, signalled as a whole
+check 'job process group' '{ ( /bin/sleep 37; echo x ) & } > /dev/null; /bin/sleep 0.2; kill %1; wait > /dev/null; pgrep -fx "/bin/sleep 37" > /dev/null || echo gone' 'gone'
+# the memory pressure trigger waits for the first background job
+check 'memory trigger is lazy' '/bin/ls -l /proc/$$/fd > $T/fds; grep -c pressure/memory $T/fds' '0'
+
+# read assigns a last record without its delimiter but reports end of input
+check 'read partial record' 'printf "a b" > $T/partial; read x y < $T/partial; echo $? $x $y; printf "a\n" > $T/full; read x < $T/full; echo $? $x' '1 a b
+0 a'
+
+# printf -v and jobs in a subshell are run in a child
+check 'subshell printf -v' '( printf  -v x hi ); ( printf	-v x hi ); echo [$x]; ( printf -- -v ); echo' '[]
+-v'
+check 'subshell jobs' '{ sleep 1 & } > /dev/null; ( jobs ); echo end' 'end'
+
+# jget escapes tabs and newlines, and reports lines that are not JSON
+printf '%s\n' '{"a":"x\ty\\z","b":[1,2.5e3]}' 'not json' '{"a":1' '"s\nt"' > "$T/j.json"
+check 'jget' 'jget .a .b[1] $T/j.json; echo $?' 'x\ty\\z	2.5e3
+smallsh: jget: '"$T"'/j.json:2: invalid JSON
+smallsh: jget: '"$T"'/j.json:3: invalid JSON
+null	null
+1'
+check 'jget root' 'jget . < $T/j.json' '{"a":"x\ty\\z","b":[1,2.5e3]}
+smallsh: jget: stdin:2: invalid JSON
+smallsh: jget: stdin:3: invalid JSON
+s\nt'
+
+# ${a[@]:off:len} slices the array, other operators apply per element
+check 'array slice' 'a=(a b c d e); echo ${a[@]:1:2}; echo "${a[*]:2}"; echo ${a[@]: -2}; a[9]=j; echo ${a[@]:5} / ${a[@]:4:2}; echo ${a[@]/d/D} ${#a[@]}' 'b c
+c d e
+d e
+j / e j
+a b c D e j 6'
+
+# exit rejects a code that is not a number
+check 'exit non-numeric' 'exit abc' 'smallsh: exit: abc: numeric argument required'
+compare 'exit non-numeric status' 'exit abc' '2' "$("$SMALLSH" -c 'exit abc' 2> /dev/null; echo $?)"
+compare 'exit status' 'exit 3' '3' "$("$SMALLSH" -c 'exit 3'; echo $?)"
+
+# printf names the conversion that is invalid, not what follows a modifier
+check 'printf invalid conversion' 'printf "%z\n" 1; echo $?; printf "%ly" 1; printf "%ld|%zu\n" 3 4' 'smallsh: printf: `z'"'"': invalid format character
+1
+smallsh: printf: `y'"'"': invalid format character
+3|4'
+
+# mapfile and read reject counts and fds that are not numbers
+check 'mapfile bad number' 'mapfile -n x m < /dev/null; echo $?; mapfile -s -1 m < /dev/null; echo $?; read -u q x; echo $?; seq 1 5 > $T/s; mapfile -t -n 2 -s 1 m < $T/s; echo $? ${m[@]}' 'smallsh: mapfile: -n: x: invalid number
+2
+smallsh: mapfile: -s: -1: invalid number
+2
+smallsh: read: -u: q: invalid number
+2
+0 2 3'
+
+# feature checks, one group for each builtin or mode
+
+# arrays: indexed with gaps and negative subscripts, and associative
+check 'indexed array' 'a=(x y z); a[5]=w; echo ${a[1]} ${#a[@]} ${!a[@]} ${a[-1]}; unset a[1]; echo ${a[@]} ${#a[@]}' 'y 4 0 1 2 5 w
+x z w 3'
+check 'associative array' 'declare -A m; m[k]=v; m["a b"]=u; echo ${m[k]} ${m[a b]} ${#m[@]}; unset m[k]; echo ${!m[@]}' 'v u 2
+a b'
+
+# string operators
+check 'string operators' 'v=/usr/lib/file.tar.gz; echo ${#v} ${v##*/} ${v%%.*} ${v#*/} ${v%.*}; echo ${v//l/L} ${v:5:3} ${v: -2} ${v^^}' '20 file.tar.gz /usr/lib/file usr/lib/file.tar.gz /usr/lib/file.tar
+/usr/Lib/fiLe.tar.gz lib gz /USR/LIB/FILE.TAR.GZ'
+check 'case and defaults' 'w=Hello; echo ${w,,} ${w,} ${w^} ${u:-def} [${u:+set}] ${w:+set} ${z:=zz} $z' 'hello hello Hello def [] set zz zz'
+
+# read splits on IFS, honours -r, -a and -d, and defaults to REPLY
+printf 'a b  c d\n x\\ y z\nq:w:e\n' > "$T/in"
+check 'read fields' 'read one rest < $T/in; echo "[$one][$rest]"; read -a arr < $T/in; echo ${#arr[@]} ${arr[3]}; read < $T/in; echo "[$REPLY]"' '[a][b  c d]
+4 d
+[a b  c d]'
+check 'read -r and -d' '{ read l1; read l2 l3; } < $T/in; echo "[$l2][$l3]"; { read l1; read -r l2 l3; } < $T/in; echo "[$l2][$l3]"; IFS=:; read -d e a b c < $T/in; echo "[$b][$c]"' '[x y][z]
+[x\][y z]
+[w][]'
+
+# mapfile loads records, with -t -n -s -O -d
+printf 'l1\nl2\nl3\nl4\n' > "$T/lines"
+check 'mapfile' 'mapfile < $T/lines; echo "${MAPFILE[3]}|"; readarray -t a < $T/lines; echo ${a[@]} ${#a[@]}; mapfile -t -n 2 -s 1 -O 3 a < $T/lines; echo ${a[@]}; mapfile -t -d 3 b < $T/lines; echo ${#b[@]}' 'l4
+|
+l1 l2 l3 l4 4
+l1 l2 l3 l2 l3
+2'
+
+# printf reuses its format for the remaining arguments
+check 'printf' 'printf "%s-%d|" a 1 b 2 c; echo; printf "%5.2f|%-4s|%x|%o|%c|%05d|%+d\n" 3.14159 ab 255 8 xyz 42 7; printf "%b\n" "a\tb"; printf -v out "%03d" 5; echo $out; printf "%d %d\n" 0x1f "'"'"'A"' 'a-1|b-2|c-0|
+ 3.14|ab  |ff|10|x|00042|+7
+a	b
+005
+31 65'
+
+# test, [ and [[
+check 'test and [[' 'echo x > $T/f; [ -f $T/f ] && echo f; test -d $T && echo d; [ -e $T/none ] || echo none; [ 3 -lt 10 ] && echo lt; [ -n "" ] || echo empty; [[ -f $T/f && ( 1 -eq 2 || b > a ) ]] && echo compound; [[ ab12 =~ ^([a-z]+)([0-9]+)$ ]] && echo ${BASH_REMATCH[1]} ${BASH_REMATCH[2]}; [ $T/f -nt $T/none ] && echo newer' 'f
+d
+none
+lt
+empty
+compound
+ab 12
+newer'
+
+# the last command of -c is exec'd in place, other commands are forked
+compare 'exec in place' 'echo $$; /bin/sh -c "echo \$\$"' 'same' \
+	"$("$SMALLSH" -c 'echo $$; /bin/sh -c "echo \$\$"' | { read a; read b; [ "$a" = "$b" ] && echo same; })"
+compare 'fork before the end' 'echo $$; /bin/sh -c "echo \$\$"; echo' 'different' \
+	"$("$SMALLSH" -c 'echo $$; /bin/sh -c "echo \$\$"; echo' | { read a; read b; [ "$a" != "$b" ] && echo different; })"
+
+# subshells keep their changes, groups don't
+check 'subshells and groups' 'x=1; cd $T; ( x=2; cd /; echo $x; /bin/pwd ); echo $x; /bin/pwd; { x=3; cd /; }; echo $x; /bin/pwd; ( echo a; echo b ) > $T/g; /bin/cat $T/g; true && { echo and; } || echo no; false || ( echo or )' "2
+/
+1
+$T
+3
+/
+a
+b
+and
+or"
+
+# exec errors come back from the child as 126 and 127
+printf 'echo hi\n' > "$T/noexec"
+check 'exec errors' '$T/noexec; echo $?; /nonexistent/cmd; echo $?; nosuchcmd_xyz; echo $?' "smallsh: $T/noexec: Permission denied
+126
+smallsh: /nonexistent/cmd: No such file or directory
+127
+smallsh: nosuchcmd_xyz: command not found
+127"
+
+# commands start with only stdin, stdout and stderr, even if the shell had more
+compare 'close on exec' 'ls /proc/$$/fd' '0 1 2 0 1 2' \
+	"$("$SMALLSH" -c '/bin/sh -c "ls /proc/\$\$/fd"; /bin/sh -c "ls /proc/\$\$/fd"' 3< /dev/null | tr '\n' ' ' | sed 's/ $//')"
+
+# a shell run with -j N is the jobserver: the second job waits for the first's token
+compare 'jobserver' 'smallsh -j 1' '[1] PID Running, batch, jobserver token
+exported' \
+	"$("$SMALLSH" -j 1 -c '{ /bin/sleep 0.2 & } > /dev/null; { /bin/sleep 0.2 & } > /dev/null; jobs; [[ $MAKEFLAGS == *--jobserver-auth=* ]] && echo exported' 2>&1 | sed 's/ [0-9]* / PID /')"
+
+# host-wide slots are held by jobs and shown by slots
+compare 'job slots' 'SMALLSH_SLOTS=4 ... slots' '1' \
+	"$(SMALLSH_SLOTS=4 "$SMALLSH" -c '{ /bin/sleep 0.2 & } > /dev/null; slots' 2>&1 | grep -c '(this shell), job')"
+
+# -A traces its adaptive limit
+compare 'adaptive limit' 'smallsh -A' '1' \
+	"$(SMALLSH_TRACE="$T/trace" "$SMALLSH" -A -c '{ /bin/sleep 0.1 & } > /dev/null; wait > /dev/null' 2>&1; grep -c 'adaptive: limit' "$T/trace")"
+
+# bgpolicy sets the policy of new jobs, which jobs shows
+check 'bgpolicy' 'bgpolicy; bgpolicy idle; { /bin/sleep 0.2 & } > /dev/null; bgpolicy > $T/policy; /bin/sed "s/^[0-9]* /PID /" $T/policy; bgpolicy bogus; echo $?' 'default batch, jobs not demoted
+default idle, jobs not demoted
+PID idle
+smallsh: bgpolicy: bogus: expected batch, idle, nice or none
+2'
+
+# psort matches LC_ALL=C sort, including when it spills runs to disk
+printf 'b 3\na 10\nc 2\na 1\nB 7\n' > "$T/sortme"
+check 'psort' 'psort $T/sortme; psort -k 2 -n $T/sortme; psort -r -u -k 1,1 < $T/sortme' 'B 7
+a 1
+a 10
+b 3
+c 2
+a 1
+c 2
+b 3
+B 7
+a 10
+c 2
+b 3
+a 10
+B 7'
+"$SMALLSH" -c "randlines --size 2M --seed 7 > $T/big; psort -S 100K $T/big > $T/sorted"
+compare 'psort spill' 'psort -S 100K' 'same' "$(LC_ALL=C sort "$T/big" | cmp - "$T/sorted" && echo same)"
+
+# countby counts lines or fields like sort | uniq -c | sort -rn
+check 'countby' 'countby -f 1 $T/sortme; countby -d " " -f 2 < $T/sortme > $T/counts; /usr/bin/wc -l < $T/counts' '      2 a
+      1 B
+      1 b
+      1 c
+5'
+
+# jget follows keys, quoted keys and indexes
+printf '%s\n' '{"a":{"b c":[10,{"d":true}]},"e":"f"}' > "$T/nested.json"
+check 'jget paths' 'jget ".a.\"b c\"[1].d" ".a[\"b c\"][0]" .e .x $T/nested.json' 'true	10	f	null'
+
+# cols selects and filters CSV columns, by number or header name
+printf 'name,age,city\nann,31,"New York, NY"\nbob,25,Paris\n"c ""q""",40,Rome\n' > "$T/p.csv"
+check 'cols' 'cols -f 3,1 $T/p.csv; cols -h -f city,name -w age -gt 30 $T/p.csv' 'city,name
+"New York, NY",ann
+Paris,bob
+Rome,"c ""q"""
+city,name
+"New York, NY",ann
+Rome,"c ""q"""'
+printf 'a\tb\n1\t2\n' > "$T/p.tsv"
+check 'cols tsv' 'cols -t -h -w a = 1 -f b $T/p.tsv' 'b
+2'
+
+# the hash builtins agree with coreutils and the reference implementations
+printf '123456789' > "$T/check"
+: > "$T/empty"
+head -c 300000 "$T/big" > "$T/mid"
+compare 'sha256sum' 'sha256sum files' "$(cd "$T" && sha256sum check empty mid big)" "$("$SMALLSH" -c "cd $T; sha256sum check empty mid big")"
+check 'sha256sum -c' 'sha256sum $T/check $T/mid > $T/sums; sha256sum -c $T/sums; echo $?; hash -c $T/sums > /dev/null; echo $?' "$T/check: OK
+$T/mid: OK
+0
+0"
+check 'crc32c' 'crc32c $T/check; hash -a crc32c < $T/check' "e3069283  $T/check
+e3069283  -"
+check 'xxh3' 'xxh3sum $T/empty $T/check' "2d06800538d394c2  $T/empty
+72dcb18b67a17dff  $T/check"
+if python3 -c 'import xxhash' 2> /dev/null; then
+	compare 'xxh3 reference' 'xxh3sum mid big' \
+		"$(cd "$T" && python3 -c 'import sys, xxhash
+for f in sys.argv[1:]: print(xxhash.xxh3_64_hexdigest(open(f, "rb").read()) + "  " + f)' mid big)" \
+		"$("$SMALLSH" -c "cd $T; xxh3sum mid big")"
+fi
+if command -v python3 > /dev/null; then
+	compare 'crc32c reference' 'crc32c mid' \
+		"$(cd "$T" && python3 -c 'import sys
+table = []
+for n in range(256):
+    c = n
+    for k in range(8): c = (c >> 1) ^ 0x82F63B78 if c & 1 else c >> 1
+    table.append(c)
+c = 0xFFFFFFFF
+for b in open(sys.argv[1], "rb").read(): c = table[(c ^ b) & 0xFF] ^ (c >> 8)
+print("%08x  %s" % (c ^ 0xFFFFFFFF, sys.argv[1]))' mid)" \
+		"$("$SMALLSH" -c "cd $T; crc32c mid")"
+fi
+
+# >z and <z gzip and gunzip in the shell, compatible with gzip
+check 'gzip redirects' 'seq 1 5000 >z $T/s.gz; /bin/cat <z $T/s.gz > $T/s.txt; /usr/bin/wc -l < $T/s.txt; read a <z $T/s.gz; echo $a' '5000
+1'
+compare 'gzip compatible' '>z then gzip -dc' "$(seq 1 5000)" "$(gzip -dc "$T/s.gz")"
+seq 3 | gzip > "$T/t.gz"
+check 'gunzip compatible' 'mapfile -t m <z $T/t.gz; echo ${m[@]}' '1 2 3'
+
+# tee copies stdin to stdout and every file
+check 'tee' 'seq 1 3 > $T/in3; tee $T/t1 $T/t2 < $T/in3 > $T/t3; /bin/cat $T/t1 $T/t2 $T/t3 > $T/all; /usr/bin/wc -l < $T/all; tee -a $T/t1 < $T/in3 > /dev/null; /usr/bin/wc -l < $T/t1' '9
+6'
+
+# generators
+check 'seq and yes' 'seq 3; seq 2 3 9; seq -s , 5 -2 1; yes --size 9 ab' '1
+2
+3
+2
+5
+8
+5,3,1
+ab
+ab
+ab'
+check 'random generators' 'randbytes --size 1000 > $T/rb; /usr/bin/stat -c %s $T/rb; randlines --size 1K --seed 3 > $T/rl1; randlines --size 1K --seed 3 > $T/rl2; /usr/bin/cmp $T/rl1 $T/rl2 && echo same; /bin/grep -vc "^[A-Za-z0-9_-]*$" $T/rl1' '1000
+same
+0'
+
+# kill, wait and sleep
+check 'wait -n' 'sleep 0.1; echo $?; { /bin/sh -c "sleep 0.3; exit 3" & } > /dev/null; { /bin/sleep 5 & } > /dev/null; wait -n > /dev/null; echo $?; kill %1; wait > /dev/null; echo $?' '0
+3
+0'
+check 'kill errors' 'kill -l > $T/sigs; /bin/grep -c SIGTERM $T/sigs; kill -s BOGUS 1; echo $?; kill %9; echo $?' '1
+smallsh: kill: invalid signal
+2
+smallsh: kill: %9: no such job
+1'
+
+echo "$((total - failed))/$total passed"
+[ "$failed" -eq 0 ]